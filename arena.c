@@ -0,0 +1,104 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "util.h"
+
+#define ARENA_DEFAULT_CHUNK_SIZE (64 * 1024)
+#define ARENA_MAX_CHUNK_SIZE (16 * 1024 * 1024)
+#define ARENA_ALIGNMENT 16
+
+typedef struct ArenaChunk ArenaChunk;
+
+struct ArenaChunk {
+    ArenaChunk* next;
+    size_t size;
+    // keeps data aligned to ARENA_ALIGNMENT
+    _Alignas(ARENA_ALIGNMENT) unsigned char data[];
+};
+
+struct Arena {
+    ArenaChunk* chunks;
+    unsigned char* top;
+    unsigned char* end;
+
+    // size of the next chunk. doubles with every chunk up to
+    // ARENA_MAX_CHUNK_SIZE so that big programs need few chunks
+    size_t next_chunk_size;
+    size_t bytes_allocated;
+};
+
+Arena* arena_create(size_t chunk_size) {
+    Arena* a = checked_malloc(sizeof(*a));
+
+    a->chunks = NULL;
+    a->top = NULL;
+    a->end = NULL;
+    a->next_chunk_size = chunk_size ? chunk_size : ARENA_DEFAULT_CHUNK_SIZE;
+    a->bytes_allocated = 0;
+    return a;
+}
+
+void arena_delete(Arena* a) {
+    if (!a) return;
+
+    ArenaChunk* chunk = a->chunks;
+    while (chunk != NULL) {
+        ArenaChunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    free(a);
+}
+
+static void arena_grow(Arena* a, size_t size) {
+    size_t chunk_size = a->next_chunk_size;
+    if (chunk_size < size) {
+        chunk_size = size;
+    }
+
+    // calloc so that arena memory starts out zeroed like the fields of
+    // freshly created nodes
+    ArenaChunk* chunk = checked_calloc(1, sizeof(ArenaChunk) + chunk_size);
+    chunk->size = chunk_size;
+    chunk->next = a->chunks;
+    a->chunks = chunk;
+
+    a->top = chunk->data;
+    a->end = chunk->data + chunk_size;
+
+    if (a->next_chunk_size < ARENA_MAX_CHUNK_SIZE) {
+        a->next_chunk_size *= 2;
+    }
+}
+
+void* arena_alloc(Arena* a, size_t size) {
+    size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+
+    if ((size_t)(a->end - a->top) < size) {
+        arena_grow(a, size);
+    }
+
+    void* p = a->top;
+    a->top += size;
+    a->bytes_allocated += size;
+    return p;
+}
+
+char* arena_strndup(Arena* a, const char* s, size_t length) {
+    char* copy = arena_alloc(a, length + 1);
+    memcpy(copy, s, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+char* arena_strdup(Arena* a, const char* s) {
+    return arena_strndup(a, s, strlen(s));
+}
+
+size_t arena_bytes_allocated(Arena* a) {
+    return a->bytes_allocated;
+}
@@ -0,0 +1,33 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/*
+A bump allocator. Memory is handed out from large chunks and is only ever
+released all at once by arena_delete, so individual allocations are never
+freed. Every AST node, Type, Symbol and ParamList of a compilation lives in
+one arena, which makes tearing down the whole program a matter of freeing
+a handful of chunks.
+*/
+
+typedef struct Arena Arena;
+
+// expr_create, stmt_create, decl_create, type_create, param_list_create and
+// symbol_create allocate from the ast_arena of the current CompilerContext
+
+// chunk_size is the size of the first chunk. If zero, a default is used.
+Arena* arena_create(size_t chunk_size);
+
+void arena_delete(Arena* a);
+
+// returns zero-initialized memory aligned for any type
+void* arena_alloc(Arena* a, size_t size);
+
+char* arena_strdup(Arena* a, const char* s);
+
+char* arena_strndup(Arena* a, const char* s, size_t length);
+
+size_t arena_bytes_allocated(Arena* a);
+
+#endif
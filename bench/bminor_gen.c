@@ -0,0 +1,266 @@
+// Generates large, valid B-minor programs for benchmarking the compiler.
+//
+// Each shape scales up one of the constructs from examples/*.txt:
+//
+//   functions N    N small functions (examples/function.txt), each calling
+//                  the previous one, plus a main that calls the last
+//   nesting N      blocks nested N deep, each declaring a local that reads
+//                  the one declared in the enclosing block
+//   statements N   a main whose body is N statements mixing declarations,
+//                  assignments, if/else, for loops and prints
+//                  (examples/stmt.txt, examples/codegen.txt)
+//   expression N   a single expression with N operands (examples/expr.txt)
+//   print N        a single print statement with N arguments
+//   mixed N        globals, functions and statements in proportion to N
+//
+// The output only depends on the shape, the size and the seed, so the same
+// command line always produces the same program.
+//
+// Usage: bminor_gen <shape> <size> [seed] > program.bminor
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static unsigned long long rng_state = 1;
+
+static unsigned rng_next() {
+    // 64-bit LCG (Knuth MMIX constants), upper bits only
+    rng_state = rng_state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (unsigned)(rng_state >> 33);
+}
+
+static int rng_range(int n) {
+    return (int)(rng_next() % (unsigned)n);
+}
+
+// deep nesting would otherwise make the output quadratic in size
+#define MAX_INDENT 16
+
+static void indent(int level) {
+    if (level > MAX_INDENT) {
+        level = MAX_INDENT;
+    }
+    for (int i = 0; i < level; i++) {
+        fputs("    ", stdout);
+    }
+}
+
+// prints an integer expression of roughly 'terms' operands over the given
+// integer variables. the tree is left-deep, like the parser builds it.
+static void integer_expr(int terms, const char** vars, int var_count) {
+    static const char* ops[] = { " + ", " - ", " * ", " + ", " - " };
+
+    for (int i = 0; i < terms; i++) {
+        if (i > 0) {
+            fputs(ops[rng_range(5)], stdout);
+        }
+        if (var_count > 0 && rng_range(2)) {
+            fputs(vars[rng_range(var_count)], stdout);
+        } else {
+            printf("%d", 1 + rng_range(100));
+        }
+    }
+}
+
+static void gen_function(int i, int indent_level) {
+    indent(indent_level);
+    printf("f_%d: function integer (a: integer, b: integer) = {\n", i);
+    indent(indent_level + 1);
+    printf("x: integer = a * %d + b;\n", 1 + i % 17);
+    indent(indent_level + 1);
+    printf("if (x > %d) {\n", 100 + i % 100);
+    indent(indent_level + 2);
+    printf("x = x - %d;\n", 1 + i % 50);
+    indent(indent_level + 1);
+    printf("}\n");
+    if (i > 0) {
+        indent(indent_level + 1);
+        printf("return f_%d(x, b) + 1;\n", i - 1);
+    } else {
+        indent(indent_level + 1);
+        printf("return x;\n");
+    }
+    indent(indent_level);
+    printf("}\n\n");
+}
+
+static void gen_functions(int n) {
+    for (int i = 0; i < n; i++) {
+        gen_function(i, 0);
+    }
+
+    printf("main: function integer () = {\n");
+    if (n > 0) {
+        printf("    print f_%d(1, 2), \"\\n\";\n", n - 1);
+    }
+    printf("    return 0;\n");
+    printf("}\n");
+}
+
+static void gen_nesting(int depth) {
+    printf("main: function integer () = {\n");
+    printf("    v_0: integer = 1;\n");
+    for (int i = 1; i <= depth; i++) {
+        indent(i);
+        printf("{\n");
+        indent(i + 1);
+        printf("v_%d: integer = v_%d + %d;\n", i, i - 1, i % 10);
+    }
+    indent(depth + 1);
+    printf("print v_%d, \"\\n\";\n", depth);
+    for (int i = depth; i >= 1; i--) {
+        indent(i);
+        printf("}\n");
+    }
+    printf("    return 0;\n");
+    printf("}\n");
+}
+
+static void gen_statements(int n) {
+    const char* vars[] = { "a", "b", "c", "d" };
+
+    printf("g: integer = 7;\n\n");
+    printf("main: function integer () = {\n");
+    printf("    a: integer = 1;\n");
+    printf("    b: integer = 2;\n");
+    printf("    c: integer = 3;\n");
+    printf("    d: integer = 4;\n");
+    printf("    i: integer;\n");
+    printf("    flag: boolean = true;\n");
+
+    int locals = 0;
+    for (int i = 0; i < n; i++) {
+        switch (rng_range(8)) {
+            case 0:
+                printf("    l_%d: integer = ", locals++);
+                integer_expr(3, vars, 4);
+                printf(";\n");
+                break;
+            case 1:
+            case 2:
+                printf("    %s = ", vars[rng_range(4)]);
+                integer_expr(3, vars, 4);
+                printf(";\n");
+                break;
+            case 3:
+                printf("    if (%s < %s) {\n", vars[rng_range(4)], vars[rng_range(4)]);
+                printf("        %s = %s + 1;\n", vars[rng_range(4)], vars[rng_range(4)]);
+                printf("    } else {\n");
+                printf("        g = g - 1;\n");
+                printf("    }\n");
+                break;
+            case 4:
+                printf("    for (i = 0; i < %d; i++) {\n", 1 + rng_range(10));
+                printf("        %s = %s + i;\n", vars[rng_range(4)], vars[rng_range(4)]);
+                printf("    }\n");
+                break;
+            case 5:
+                printf("    print \"%s is \", %s, \"\\n\";\n", vars[i % 4], vars[i % 4]);
+                break;
+            case 6:
+                printf("    flag = !flag && %s >= %s;\n", vars[rng_range(4)], vars[rng_range(4)]);
+                break;
+            default:
+                printf("    g++;\n");
+                break;
+        }
+    }
+
+    printf("    return 0;\n");
+    printf("}\n");
+}
+
+static void gen_expression(int n) {
+    const char* vars[] = { "a", "b", "c" };
+
+    printf("main: function integer () = {\n");
+    printf("    a: integer = 3;\n");
+    printf("    b: integer = 5;\n");
+    printf("    c: integer = 7;\n");
+    printf("    x: integer = ");
+    integer_expr(n, vars, 3);
+    printf(";\n");
+    printf("    print x, \"\\n\";\n");
+    printf("    return 0;\n");
+    printf("}\n");
+}
+
+static void gen_print(int n) {
+    printf("main: function integer () = {\n");
+    printf("    n: integer = 42;\n");
+    printf("    flag: boolean = false;\n");
+    printf("    print ");
+    for (int i = 0; i < n; i++) {
+        if (i > 0) {
+            printf(", ");
+        }
+        switch (rng_range(5)) {
+            case 0: printf("n"); break;
+            case 1: printf("%d", rng_range(1000)); break;
+            case 2: printf("flag"); break;
+            case 3: printf("'%c'", 'a' + rng_range(26)); break;
+            default: printf("\"s%d\"", i); break;
+        }
+    }
+    printf(";\n");
+    printf("    return 0;\n");
+    printf("}\n");
+}
+
+static void gen_mixed(int n) {
+    int globals = n / 10 + 1;
+    int functions = n / 10 + 1;
+
+    for (int i = 0; i < globals; i++) {
+        switch (i % 4) {
+            case 0: printf("gi_%d: integer = %d;\n", i, rng_range(100000)); break;
+            case 1: printf("gb_%d: boolean = %s;\n", i, rng_range(2) ? "true" : "false"); break;
+            case 2: printf("gc_%d: char = '%c';\n", i, 'a' + rng_range(26)); break;
+            default: printf("gs_%d: string = \"global %d\";\n", i, i); break;
+        }
+    }
+    printf("ga: array [%d] integer = {1, 2, 3};\n\n", 16);
+
+    for (int i = 0; i < functions; i++) {
+        gen_function(i, 0);
+    }
+
+    // the remaining statements go into main
+    gen_statements(n - globals - functions > 0 ? n - globals - functions : 1);
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3 || argc > 4) {
+        fprintf(stderr, "Usage: bminor_gen <shape> <size> [seed]\n");
+        fprintf(stderr, "  shapes: functions nesting statements expression print mixed\n");
+        return EXIT_FAILURE;
+    }
+
+    const char* shape = argv[1];
+    int size = atoi(argv[2]);
+    if (size < 1) {
+        fprintf(stderr, "Size must be a positive integer, got '%s'.\n", argv[2]);
+        return EXIT_FAILURE;
+    }
+    rng_state = argc == 4 ? strtoull(argv[3], NULL, 10) : 1;
+
+    if (strcmp(shape, "functions") == 0) {
+        gen_functions(size);
+    } else if (strcmp(shape, "nesting") == 0) {
+        gen_nesting(size);
+    } else if (strcmp(shape, "statements") == 0) {
+        gen_statements(size);
+    } else if (strcmp(shape, "expression") == 0) {
+        gen_expression(size);
+    } else if (strcmp(shape, "print") == 0) {
+        gen_print(size);
+    } else if (strcmp(shape, "mixed") == 0) {
+        gen_mixed(size);
+    } else {
+        fprintf(stderr, "Unknown shape '%s'.\n", shape);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
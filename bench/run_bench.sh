@@ -0,0 +1,124 @@
+#!/bin/sh
+# Compiler throughput benchmark.
+#
+# Generates programs of increasing size with bminor_gen, compiles each one
+# with 'bminor --time-report' and reports lines/sec and bytes/sec for every
+# compiler phase. Sizes and seeds are fixed, so runs before and after a
+# change are directly comparable.
+#
+# Usage: bench/run_bench.sh [path/to/bminor] [shape ...]
+#
+# Environment:
+#   BMINOR_GEN   generator binary (built from bench/bminor_gen.c if unset)
+#   REPEAT       runs per program, the fastest run is reported (default 3)
+#   QUICK=1      only the two smallest sizes of each shape
+#   KEEP=dir     keep generated programs and logs in dir
+
+set -u
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+BMINOR=$(cd "$(dirname "${1:-./bminor}")" && pwd)/$(basename "${1:-./bminor}")
+[ $# -gt 0 ] && shift
+SHAPES=${*:-"functions nesting statements expression print mixed"}
+REPEAT=${REPEAT:-3}
+QUICK=${QUICK:-0}
+
+if [ ! -x "$BMINOR" ]; then
+    echo "bminor binary '$BMINOR' not found. Pass its path as the first argument." >&2
+    exit 1
+fi
+
+WORK=${KEEP:-$(mktemp -d)}
+mkdir -p "$WORK"
+
+if [ -z "${BMINOR_GEN:-}" ]; then
+    BMINOR_GEN="$WORK/bminor_gen"
+    ${CC:-cc} -O2 -o "$BMINOR_GEN" "$BENCH_DIR/bminor_gen.c" || exit 1
+fi
+
+sizes_for() {
+    case "$1" in
+        functions)  echo "1000 10000 100000" ;;
+        nesting)    echo "100 1000 10000" ;;
+        statements) echo "10000 100000 1000000" ;;
+        expression) echo "100 1000 10000" ;;
+        print)      echo "10 100 1000 5000" ;;
+        mixed)      echo "1000 10000 100000" ;;
+    esac
+}
+
+printf "%-11s %9s %10s %11s  %-10s %10s %14s %12s %12s\n" \
+    shape size lines bytes phase "wall ms" "lines/s" "MB/s" "peak RSS KB"
+
+for shape in $SHAPES; do
+    sizes=$(sizes_for "$shape")
+    if [ -z "$sizes" ]; then
+        echo "Unknown shape '$shape'." >&2
+        continue
+    fi
+    if [ "$QUICK" = 1 ]; then
+        sizes=$(echo $sizes | cut -d' ' -f1-2)
+    fi
+
+    for size in $sizes; do
+        program="$WORK/$shape-$size.bminor"
+        "$BMINOR_GEN" "$shape" "$size" 1 > "$program"
+        lines=$(wc -l < "$program" | tr -d ' ')
+        bytes=$(wc -c < "$program" | tr -d ' ')
+
+        best="$WORK/$shape-$size.best"
+        rm -f "$best"
+        status=0
+        run=0
+        while [ $run -lt "$REPEAT" ]; do
+            run=$((run + 1))
+            log="$WORK/$shape-$size.log"
+            (cd "$WORK" && "$BMINOR" --time-report "$program" > "$log" 2>&1)
+            status=$?
+            if [ $status -ne 0 ]; then
+                break
+            fi
+            # keep the top-level phase rows of the report (no indentation)
+            sed -n '/^Phase /,$p' "$log" | awk 'NR > 1 && /^[a-z]/ { print $1, $2, $4 }' > "$WORK/run.txt"
+            if [ ! -f "$best" ]; then
+                cp "$WORK/run.txt" "$best"
+            else
+                # per phase minimum over the runs
+                awk 'NR == FNR { t[$1] = $2; r[$1] = $3; next }
+                     { if ($2 < t[$1]) { t[$1] = $2; r[$1] = $3 } }
+                     END { for (p in t) print p, t[p], r[p] }' \
+                    "$best" "$WORK/run.txt" > "$best.new"
+                # keep the phase order of the report
+                awk 'NR == FNR { t[$1] = $0; next } { print t[$1] }' \
+                    "$best.new" "$WORK/run.txt" > "$best"
+                rm -f "$best.new"
+            fi
+        done
+
+        if [ $status -ne 0 ]; then
+            printf "%-11s %9s %10s %11s  %-10s %s\n" \
+                "$shape" "$size" "$lines" "$bytes" "FAILED" \
+                "exit status $status, see $WORK/$shape-$size.log"
+            continue
+        fi
+
+        awk -v shape="$shape" -v size="$size" -v lines="$lines" -v bytes="$bytes" '
+            {
+                wall = $2; total += wall
+                lps = wall > 0 ? lines / (wall / 1000) : 0
+                mbs = wall > 0 ? bytes / (wall / 1000) / 1e6 : 0
+                printf "%-11s %9s %10s %11s  %-10s %10.3f %14.0f %12.2f %12s\n",
+                    shape, size, lines, bytes, $1, wall, lps, mbs, $3
+            }
+            END {
+                lps = total > 0 ? lines / (total / 1000) : 0
+                mbs = total > 0 ? bytes / (total / 1000) / 1e6 : 0
+                printf "%-11s %9s %10s %11s  %-10s %10.3f %14.0f %12.2f\n",
+                    shape, size, lines, bytes, "total", total, lps, mbs
+            }' "$best"
+    done
+done
+
+if [ -z "${KEEP:-}" ]; then
+    rm -rf "$WORK"
+fi
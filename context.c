@@ -0,0 +1,50 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "context.h"
+#include "arena.h"
+#include "intern.h"
+#include "timing.h"
+#include "util.h"
+
+_Thread_local CompilerContext* current_context = NULL;
+
+CompilerContext* context_create(const char* filename) {
+    CompilerContext* c = checked_calloc(1, sizeof(*c));
+
+    c->filename = filename;
+    c->messages = stdout;
+    c->unroll_factor = 4;
+    c->inline_threshold = 25;
+    c->ast_arena = arena_create(0);
+    c->atoms = intern_table_create();
+    return c;
+}
+
+void context_free_program(CompilerContext* c) {
+    arena_delete(c->ast_arena);
+    c->ast_arena = NULL;
+    intern_table_delete(c->atoms);
+    c->atoms = NULL;
+    c->program = NULL;
+}
+
+void context_delete(CompilerContext* c) {
+    if (!c) return;
+
+    context_free_program(c);
+    timing_delete(c->timing);
+    free(c->peephole_counts);
+    if (c->input) {
+        fclose(c->input);
+    }
+
+    if (current_context == c) {
+        current_context = NULL;
+    }
+    free(c);
+}
+
+void context_make_current(CompilerContext* c) {
+    current_context = c;
+}
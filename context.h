@@ -0,0 +1,85 @@
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+#include <stdio.h>
+
+/*
+The state of one compilation. The scanner, the parser and every later phase
+keep what they need between calls here instead of in globals, so any number
+of compilations can run in the same process, each on its own thread.
+
+The scanner and parser are handed their context explicitly. The other
+phases find it through current_context, which is per thread: a thread makes
+a context current with context_make_current before running phases on it.
+*/
+
+// the instruction set extensions code may use, from -march
+typedef enum {
+    MARCH_SSE2,     // every x86-64
+    MARCH_SSE4_2,   // x86-64-v2
+    MARCH_AVX2,     // x86-64-v3
+} March_t;
+
+typedef struct CompilerContext CompilerContext;
+typedef struct Decl Decl;
+typedef struct Arena Arena;
+typedef struct InternTable InternTable;
+typedef struct ScopeState ScopeState;
+typedef struct Timing Timing;
+typedef struct Emitter Emitter;
+typedef struct MachineFunction MachineFunction;
+
+struct CompilerContext {
+    const char* filename;
+    FILE* input;
+
+    // where the AST printout and all diagnostics go. stdout unless the
+    // driver collects them per file.
+    FILE* messages;
+
+    // every node of the program is allocated from this arena and released
+    // in one go by context_delete
+    Arena* ast_arena;
+    InternTable* atoms;
+
+    // set by the parser
+    Decl* program;
+
+    // symbol table, only while resolving
+    ScopeState* scope;
+    int scope_error;
+    int type_error;
+
+    // code generation
+    Emitter* emitter;
+    MachineFunction* function;  // body of the function being generated
+    int current_label_num;
+    int return_label;           // epilogue of the function being generated
+    int dump_ir;                // print the IR of every function to messages
+    long* peephole_counts;      // times each peephole rule fired, allocated
+                                // by the first function optimized
+    int unroll_factor;          // copies of the body per iteration of a
+                                // partially unrolled loop, 4 by default
+    int inline_threshold;       // how much bigger than the call it replaces
+                                // an inlined body may be, 0 turns inlining off
+    March_t march;
+
+    // spans recorded by timing_begin/timing_end
+    Timing* timing;
+};
+
+extern _Thread_local CompilerContext* current_context;
+
+CompilerContext* context_create(const char* filename);
+
+// frees the context and everything allocated for it, including the AST
+// and all atoms. closes the input file if it was opened.
+void context_delete(CompilerContext* c);
+
+// frees the AST and all atoms but keeps the rest of the context, such as
+// the timing spans
+void context_free_program(CompilerContext* c);
+
+void context_make_current(CompilerContext* c);
+
+#endif
@@ -5,15 +5,19 @@
 #include "expr.h"
 #include "type.h"
 #include "stmt.h"
+#include "arena.h"
+#include "context.h"
+
+static void decl_print_single(Decl* d);
 
 Decl* decl_create(
-    char* name,
+    const char* name,
     Type* type,
     Expr* value,
     Stmt* code,
     Decl* next
 ) {
-    Decl* d = malloc(sizeof(*d));
+    Decl* d = arena_alloc(current_context->ast_arena, sizeof(*d));
     d->name = name;
     d->type = type;
     d->value = value;
@@ -24,38 +28,29 @@ Decl* decl_create(
     return d;
 }
 
-void decl_delete(Decl* d) {
-    if (!d) return;
-
-    free((void*)d->name);
-    type_delete(d->type);
-    expr_delete(d->value);
-    stmt_delete(d->code);
-    decl_delete(d->next);
-
-    free(d);
-}
-
 void decl_print(Decl* d) {
-    if (!d) return;
+    for (; d != NULL; d = d->next) {
+        decl_print_single(d);
+    }
+}
 
-    printf("%s: ", d->name);
+static void decl_print_single(Decl* d) {
+    fprintf(current_context->messages, "%s: ", d->name);
     type_print(d->type);
     if (d->value) {
-        printf(" = ");
+        fprintf(current_context->messages, " = ");
         expr_print(d->value);
     }
 
     if (d->code) {
-        printf(" = ");
+        fprintf(current_context->messages, " = ");
         stmt_print(d->code);
         if (d->code->kind != STMT_BLOCK) {
-            printf(";");
+            fprintf(current_context->messages, ";");
         }
     } else {
-        printf(";");
+        fprintf(current_context->messages, ";");
     }
 
-    printf("\n");
-    decl_print(d->next);
+    fprintf(current_context->messages, "\n");
 }
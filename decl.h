@@ -6,7 +6,8 @@
 #include "stmt.h"
 
 typedef struct Decl {
-    char* name;
+    // interned, see intern.h
+    const char* name;
     Type* type;
     Expr* value;
     Stmt* code;
@@ -17,15 +18,13 @@ typedef struct Decl {
 } Decl;
 
 Decl* decl_create(
-    char* name,
+    const char* name,
     Type* type,
     Expr* value,
     Stmt* code,
     Decl* next
 );
 
-void decl_delete(Decl* d);
-
 void decl_print(Decl* d);
 
 #endif
@@ -3,9 +3,11 @@
 
 #include "expr.h"
 #include "type.h"
+#include "arena.h"
+#include "context.h"
 
 Expr* expr_create(Expr_t kind, Expr* left, Expr* right) {
-    Expr* e = malloc(sizeof(Expr));
+    Expr* e = arena_alloc(current_context->ast_arena, sizeof(Expr));
     e->kind = kind;
     e->left = left;
     e->right = right;
@@ -15,20 +17,11 @@ Expr* expr_create(Expr_t kind, Expr* left, Expr* right) {
     e->symbol = NULL;
     e->reg = -1;
     e->type = NULL;
+    e->registers_needed = 0;
+    e->has_side_effects = 0;
     return e;
 }
 
-void expr_delete(Expr* e) {
-    if (!e) return;
-
-    expr_delete(e->left);
-    expr_delete(e->right);
-    free((void*)e->string_literal);
-    type_delete(e->type);
-
-    free(e);
-}
-
 Expr* expr_create_name(const char* name) {
     Expr* e = expr_create(EXPR_NAME, 0, 0);
     e->name = name;
@@ -93,101 +86,101 @@ void expr_print(Expr* e) {
     int print_right = 1;
     switch (e->kind) {
         case EXPR_ADD:
-            printf(" + ");
+            fprintf(current_context->messages, " + ");
             break;
         case EXPR_SUB:
-            printf(" - ");
+            fprintf(current_context->messages, " - ");
             break;
         case EXPR_MUL:
-            printf(" * ");
+            fprintf(current_context->messages, " * ");
             break;
         case EXPR_DIV:
-            printf(" / ");
+            fprintf(current_context->messages, " / ");
             break;
         case EXPR_EXPONENT:
-            printf(" ^ ");
+            fprintf(current_context->messages, " ^ ");
             break;
         case EXPR_MODULO:
-            printf(" %% ");
+            fprintf(current_context->messages, " %% ");
             break;
         case EXPR_ASSIGN:
-            printf(" = ");
+            fprintf(current_context->messages, " = ");
             break;
         case EXPR_NEGATE:
-            printf("-");
+            fprintf(current_context->messages, "-");
             expr_print(e->left);
             break;
         case EXPR_LOGICAL_OR:
-            printf(" || ");
+            fprintf(current_context->messages, " || ");
             break;
         case EXPR_LOGICAL_AND:
-            printf(" && ");
+            fprintf(current_context->messages, " && ");
             break;
         case EXPR_LOGICAL_NOT:
-            printf("!");
+            fprintf(current_context->messages, "!");
             expr_print(e->left);
             break;
         case EXPR_CMP_EQUAL:
-            printf(" == ");
+            fprintf(current_context->messages, " == ");
             break;
         case EXPR_CMP_NOT_EQUAL:
-            printf(" != ");
+            fprintf(current_context->messages, " != ");
             break;
         case EXPR_CMP_GT:
-            printf(" > ");
+            fprintf(current_context->messages, " > ");
             break;
         case EXPR_CMP_GT_EQUAL:
-            printf(" >= ");
+            fprintf(current_context->messages, " >= ");
             break;
         case EXPR_CMP_LT:
-            printf(" < ");
+            fprintf(current_context->messages, " < ");
             break;
         case EXPR_CMP_LT_EQUAL:
-            printf(" <= ");
+            fprintf(current_context->messages, " <= ");
             break;
         case EXPR_INCREMENT:
-            printf("++");
+            fprintf(current_context->messages, "++");
             break;
         case EXPR_DECREMENT:
-            printf("--");
+            fprintf(current_context->messages, "--");
             break;
         case EXPR_NAME:
-            printf("%s", e->name);
+            fprintf(current_context->messages, "%s", e->name);
             break;
         case EXPR_CHAR_LITERAL:
-            printf("'%c'", e->integer_value);
+            fprintf(current_context->messages, "'%c'", (int)e->integer_value);
             break;
         case EXPR_STRING_LITERAL:
-            printf("\"%s\"", e->string_literal);
+            fprintf(current_context->messages, "\"%s\"", e->string_literal);
             break;
         case EXPR_INTEGER_LITERAL:
-            printf("%d", e->integer_value);
+            fprintf(current_context->messages, "%ld", e->integer_value);
             break;
         case EXPR_BOOLEAN_LITERAL:
-            printf("%s", e->integer_value ? "true" : "false");
+            fprintf(current_context->messages, "%s", e->integer_value ? "true" : "false");
             break;
         case EXPR_CALL:
             print_right = 0;
-            printf("(");
+            fprintf(current_context->messages, "(");
             expr_print(e->right);
-            printf(")");
+            fprintf(current_context->messages, ")");
             break;
         case EXPR_INIT_LIST:
             print_right = 0;
-            printf("{");
+            fprintf(current_context->messages, "{");
             expr_print(e->right);
-            printf("}");
+            fprintf(current_context->messages, "}");
             break;
         case EXPR_ARG:
             if (e->right) {
-                printf(", ");
+                fprintf(current_context->messages, ", ");
             }
             break;
         case EXPR_SUBSCRIPT:
             print_right = 0;
-            printf("[");
+            fprintf(current_context->messages, "[");
             expr_print(e->right);
-            printf("]");
+            fprintf(current_context->messages, "]");
             break;
     }
 
@@ -51,19 +51,24 @@ struct Expr {
     Expr* left;
     Expr* right;
 
+    // interned, see intern.h
     const char* name;
-    int integer_value;
+    long integer_value;
     const char* string_literal;
 
     Symbol* symbol;
     Type* type;
     int reg;
+
+    // filled in by code generation: the number of registers needed to
+    // evaluate the expression (0 until computed), and whether evaluating it
+    // can change a variable or call a function
+    int registers_needed;
+    int has_side_effects;
 };
 
 Expr* expr_create(Expr_t kind, Expr* left, Expr* right);
 
-void expr_delete(Expr* e);
-
 Expr* expr_create_name(const char* name);
 
 Expr* expr_create_integer_literal(int i);
@@ -0,0 +1,413 @@
+#include <stdlib.h>
+#include <limits.h>
+
+#include "fold.h"
+#include "symbol.h"
+#include "type.h"
+#include "expr.h"
+#include "decl.h"
+#include "stmt.h"
+#include "context.h"
+
+static void decl_fold_single(Decl* d);
+static void stmt_fold_single(Stmt* s);
+
+//
+// assignments
+//
+
+static void expr_count_assignments(Expr* e) {
+    if (!e) return;
+
+    switch (e->kind) {
+        case EXPR_ASSIGN:
+        case EXPR_INCREMENT:
+        case EXPR_DECREMENT:
+            if (e->left->symbol) {
+                e->left->symbol->assignment_count++;
+            }
+            break;
+        default:
+            break;
+    }
+    expr_count_assignments(e->left);
+    expr_count_assignments(e->right);
+}
+
+static void stmt_count_assignments(Stmt* s) {
+    for (; s != NULL; s = s->next) {
+        for (Decl* d = s->decl; d != NULL; d = d->next) {
+            expr_count_assignments(d->value);
+        }
+        expr_count_assignments(s->init_expr);
+        expr_count_assignments(s->expr);
+        expr_count_assignments(s->next_expr);
+        stmt_count_assignments(s->body);
+        stmt_count_assignments(s->else_body);
+    }
+}
+
+//
+// expressions
+//
+
+static int is_literal(Expr* e) {
+    return e != NULL && (
+        e->kind == EXPR_INTEGER_LITERAL ||
+        e->kind == EXPR_CHAR_LITERAL ||
+        e->kind == EXPR_BOOLEAN_LITERAL
+    );
+}
+
+// whether evaluating e does more than produce a value: changes a
+// variable, calls a function or divides, which may trap
+static int has_side_effects(Expr* e) {
+    if (!e) return 0;
+
+    switch (e->kind) {
+        case EXPR_CALL:
+        case EXPR_ASSIGN:
+        case EXPR_INCREMENT:
+        case EXPR_DECREMENT:
+        case EXPR_DIV:
+        case EXPR_MODULO:
+            return 1;
+        default:
+            return has_side_effects(e->left) || has_side_effects(e->right);
+    }
+}
+
+static void make_literal(Expr* e, Expr_t kind, long value) {
+    e->kind = kind;
+    e->integer_value = value;
+    e->left = NULL;
+    e->right = NULL;
+}
+
+// replaces e by its operand o
+static void replace(Expr* e, Expr* o) {
+    *e = *o;
+}
+
+// a to the power of b by squaring, wrapping around like multiplication. b
+// <= 0 gives 1: integer powers have no negative exponents, and the
+// generated code stops squaring once the exponent is not positive.
+static long power(long a, long b) {
+    unsigned long result = 1;
+    unsigned long base = a;
+    for (; b > 0; b /= 2) {
+        if (b % 2) {
+            result *= base;
+        }
+        base *= base;
+    }
+    return (long)result;
+}
+
+// the value of a op b, as the generated code computes it. returns 0 for
+// divisions that trap, which are left to run time.
+static int evaluate(Expr_t op, long a, long b, long* result) {
+    // unsigned arithmetic wraps around like the machine does
+    unsigned long ua = a;
+    unsigned long ub = b;
+
+    switch (op) {
+        case EXPR_ADD:
+            *result = (long)(ua + ub);
+            return 1;
+        case EXPR_SUB:
+            *result = (long)(ua - ub);
+            return 1;
+        case EXPR_MUL:
+            *result = (long)(ua * ub);
+            return 1;
+        case EXPR_EXPONENT:
+            *result = power(a, b);
+            return 1;
+        case EXPR_DIV:
+        case EXPR_MODULO:
+            if (b == 0 || (a == LONG_MIN && b == -1)) {
+                return 0;
+            }
+            *result = op == EXPR_DIV ? a / b : a % b;
+            return 1;
+        case EXPR_CMP_EQUAL:
+            *result = a == b;
+            return 1;
+        case EXPR_CMP_NOT_EQUAL:
+            *result = a != b;
+            return 1;
+        case EXPR_CMP_GT:
+            *result = a > b;
+            return 1;
+        case EXPR_CMP_GT_EQUAL:
+            *result = a >= b;
+            return 1;
+        case EXPR_CMP_LT:
+            *result = a < b;
+            return 1;
+        case EXPR_CMP_LT_EQUAL:
+            *result = a <= b;
+            return 1;
+        case EXPR_LOGICAL_AND:
+            *result = a && b;
+            return 1;
+        case EXPR_LOGICAL_OR:
+            *result = a || b;
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// identities of operators with one literal operand, such as x + 0 and
+// true && x. operands are only dropped when they have no side effects.
+static void simplify(Expr* e) {
+    Expr* l = e->left;
+    Expr* r = e->right;
+
+    switch (e->kind) {
+        case EXPR_LOGICAL_AND:
+            if (is_literal(l)) {
+                if (l->integer_value) {
+                    replace(e, r);
+                } else {
+                    make_literal(e, EXPR_BOOLEAN_LITERAL, 0);
+                }
+            } else if (is_literal(r)) {
+                if (r->integer_value) {
+                    replace(e, l);
+                } else if (!has_side_effects(l)) {
+                    make_literal(e, EXPR_BOOLEAN_LITERAL, 0);
+                }
+            }
+            break;
+        case EXPR_LOGICAL_OR:
+            if (is_literal(l)) {
+                if (l->integer_value) {
+                    make_literal(e, EXPR_BOOLEAN_LITERAL, 1);
+                } else {
+                    replace(e, r);
+                }
+            } else if (is_literal(r)) {
+                if (!r->integer_value) {
+                    replace(e, l);
+                } else if (!has_side_effects(l)) {
+                    make_literal(e, EXPR_BOOLEAN_LITERAL, 1);
+                }
+            }
+            break;
+        case EXPR_ADD:
+            if (is_literal(l) && l->integer_value == 0) {
+                replace(e, r);
+            } else if (is_literal(r) && r->integer_value == 0) {
+                replace(e, l);
+            }
+            break;
+        case EXPR_SUB:
+            if (is_literal(r) && r->integer_value == 0) {
+                replace(e, l);
+            }
+            break;
+        case EXPR_MUL:
+            if (is_literal(l) && l->integer_value == 1) {
+                replace(e, r);
+            } else if (is_literal(r) && r->integer_value == 1) {
+                replace(e, l);
+            } else if ((is_literal(l) && l->integer_value == 0 && !has_side_effects(r)) ||
+                       (is_literal(r) && r->integer_value == 0 && !has_side_effects(l))) {
+                make_literal(e, EXPR_INTEGER_LITERAL, 0);
+            }
+            break;
+        case EXPR_DIV:
+            if (is_literal(r) && r->integer_value == 1) {
+                replace(e, l);
+            }
+            break;
+        case EXPR_EXPONENT:
+            if (is_literal(r) && r->integer_value == 1) {
+                replace(e, l);
+            } else if ((is_literal(r) && r->integer_value <= 0 && !has_side_effects(l)) ||
+                       (is_literal(l) && l->integer_value == 1 && !has_side_effects(r))) {
+                make_literal(e, EXPR_INTEGER_LITERAL, 1);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+void expr_fold(Expr* e) {
+    if (!e) return;
+
+    switch (e->kind) {
+        case EXPR_NAME:
+            // a variable that always holds the same literal
+            if (e->symbol && e->symbol->constant_value) {
+                e->kind = e->symbol->constant_value->kind;
+                e->integer_value = e->symbol->constant_value->integer_value;
+            }
+            return;
+        // the names of assigned variables, arrays and functions stay
+        case EXPR_ASSIGN:
+        case EXPR_CALL:
+        case EXPR_SUBSCRIPT:
+            expr_fold(e->right);
+            return;
+        case EXPR_INCREMENT:
+        case EXPR_DECREMENT:
+            return;
+        default:
+            break;
+    }
+
+    expr_fold(e->left);
+    expr_fold(e->right);
+
+    switch (e->kind) {
+        case EXPR_NEGATE:
+            if (is_literal(e->left)) {
+                make_literal(e, EXPR_INTEGER_LITERAL, (long)-(unsigned long)e->left->integer_value);
+            }
+            break;
+        case EXPR_LOGICAL_NOT:
+            if (is_literal(e->left)) {
+                make_literal(e, EXPR_BOOLEAN_LITERAL, !e->left->integer_value);
+            }
+            break;
+        case EXPR_ADD:
+        case EXPR_SUB:
+        case EXPR_MUL:
+        case EXPR_DIV:
+        case EXPR_MODULO:
+        case EXPR_EXPONENT:
+        case EXPR_CMP_EQUAL:
+        case EXPR_CMP_NOT_EQUAL:
+        case EXPR_CMP_GT:
+        case EXPR_CMP_GT_EQUAL:
+        case EXPR_CMP_LT:
+        case EXPR_CMP_LT_EQUAL:
+        case EXPR_LOGICAL_AND:
+        case EXPR_LOGICAL_OR: {
+            long value;
+            if (is_literal(e->left) && is_literal(e->right)
+                && evaluate(e->kind, e->left->integer_value, e->right->integer_value, &value)
+            ) {
+                int arithmetic = e->kind == EXPR_ADD || e->kind == EXPR_SUB || e->kind == EXPR_MUL
+                              || e->kind == EXPR_DIV || e->kind == EXPR_MODULO || e->kind == EXPR_EXPONENT;
+                make_literal(e, arithmetic ? EXPR_INTEGER_LITERAL : EXPR_BOOLEAN_LITERAL, value);
+            } else {
+                simplify(e);
+            }
+        } break;
+        default:
+            break;
+    }
+}
+
+//
+// statements and declarations
+//
+
+void stmt_fold(Stmt* s) {
+    for (; s != NULL; s = s->next) {
+        stmt_fold_single(s);
+    }
+}
+
+static void stmt_fold_single(Stmt* s) {
+    switch (s->kind) {
+        case STMT_DECL:
+            decl_fold(s->decl);
+            break;
+        case STMT_EXPR:
+        case STMT_PRINT:
+        case STMT_RETURN:
+            expr_fold(s->expr);
+            break;
+        case STMT_IF_ELSE:
+            expr_fold(s->expr);
+            stmt_fold(s->body);
+            stmt_fold(s->else_body);
+
+            // keep only the branch that is taken
+            if (s->expr->kind == EXPR_BOOLEAN_LITERAL) {
+                s->kind = STMT_BLOCK;
+                s->body = s->expr->integer_value ? s->body : s->else_body;
+                s->else_body = NULL;
+                s->expr = NULL;
+            }
+            break;
+        case STMT_FOR:
+            expr_fold(s->init_expr);
+            expr_fold(s->expr);
+            expr_fold(s->next_expr);
+            stmt_fold(s->body);
+
+            if (s->expr && s->expr->kind == EXPR_BOOLEAN_LITERAL) {
+                if (s->expr->integer_value) {
+                    // a loop that is only left by returning
+                    s->expr = NULL;
+                } else if (s->init_expr) {
+                    s->kind = STMT_EXPR;
+                    s->expr = s->init_expr;
+                    s->init_expr = NULL;
+                    s->next_expr = NULL;
+                    s->body = NULL;
+                } else {
+                    s->kind = STMT_BLOCK;
+                    s->expr = NULL;
+                    s->next_expr = NULL;
+                    s->body = NULL;
+                }
+            }
+            break;
+        case STMT_BLOCK:
+            stmt_fold(s->body);
+            break;
+    }
+}
+
+void decl_fold(Decl* d) {
+    for (; d != NULL; d = d->next) {
+        decl_fold_single(d);
+    }
+}
+
+static void decl_fold_single(Decl* d) {
+    if (d->type->kind == TYPE_FUNCTION) {
+        // assignments are counted before anything is replaced, so that a
+        // variable assigned after its first use is not mistaken for a
+        // constant
+        stmt_count_assignments(d->code);
+        stmt_fold(d->code);
+        return;
+    }
+
+    expr_fold(d->value);
+
+    int scalar = d->type->kind == TYPE_INTEGER
+              || d->type->kind == TYPE_BOOLEAN
+              || d->type->kind == TYPE_CHAR;
+    if (!scalar || d->symbol->kind != SYMBOL_LOCAL || d->symbol->assignment_count != 0) {
+        return;
+    }
+
+    // locals without an initializer start out as zero
+    if (!d->value) {
+        switch (d->type->kind) {
+            case TYPE_BOOLEAN:
+                d->value = expr_create_boolean_literal(0);
+                break;
+            case TYPE_CHAR:
+                d->value = expr_create_char_literal(0);
+                break;
+            default:
+                d->value = expr_create_integer_literal(0);
+                break;
+        }
+    }
+    if (is_literal(d->value)) {
+        d->symbol->constant_value = d->value;
+    }
+}
@@ -0,0 +1,26 @@
+#ifndef FOLD_H
+#define FOLD_H
+
+#include "expr.h"
+#include "decl.h"
+#include "stmt.h"
+
+/*
+Constant folding, run after type checking. Operators whose operands are
+literals are replaced by their value, computed as the generated code would
+compute it: 64-bit integers that wrap around, division that truncates.
+Divisions that would trap at run time are left alone.
+
+Local variables that are never assigned to after their declaration are
+replaced by their initial value wherever they are read, if that is a
+literal after folding. If and for statements whose condition folds to a
+constant lose the branch that can not be taken.
+*/
+
+void expr_fold(Expr* e);
+
+void decl_fold(Decl* d);
+
+void stmt_fold(Stmt* s);
+
+#endif
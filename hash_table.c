@@ -2,27 +2,160 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 
-#define DEFAULT_SIZE 127
-#define DEFAULT_LOAD 0.75
-#define DEFAULT_FUNC hash_string
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
-struct entry {
-	char *key;
+/*
+The table uses open addressing.  Slots are grouped by sixteen, and every
+slot has a one byte control value next to the others of its group:
+
+	CTRL_EMPTY    the slot has never been used since the last rehash
+	CTRL_DELETED  the slot held an entry that has been removed
+	0x00 - 0x7f   the slot is full; the value is seven bits of its hash
+
+A lookup hashes the key once, then compares the sixteen control bytes of a
+group against those seven bits with a single SSE2 compare, and only looks
+at the slots that match.  Probing moves to the next group in a triangular
+sequence and stops at the first group that still has an empty slot.
+
+Entries need no allocation of their own.  Keys are copied into large
+chunks owned by the table, and growing the table only moves the slots:
+stored hashes and key copies are reused.  A table keyed by pointer stores
+the key itself and compares keys with == instead of strcmp.
+*/
+
+#define GROUP_SIZE 16
+#define DEFAULT_SIZE 16
+#define KEY_CHUNK_SIZE 4096
+
+#define CTRL_EMPTY   ((signed char) -128)
+#define CTRL_DELETED ((signed char) -2)
+
+struct slot {
+	const char *key;
 	void *value;
 	unsigned hash;
-	struct entry *next;
+};
+
+struct key_chunk {
+	struct key_chunk *next;
+	size_t used;
+	size_t size;
+	char data[];
 };
 
 struct hash_table {
 	hash_func_t hash_func;
-	int bucket_count;
+	int bucket_count;	/* number of slots, a multiple of GROUP_SIZE */
 	int size;
-	struct entry **buckets;
-	int ibucket;
-	struct entry *ientry;
+	int deleted;
+	signed char *ctrl;
+	struct slot *slots;
+	struct key_chunk *keys;
+	int by_pointer;		/* keys are stored as given and compared by address */
+	int islot;
 };
 
+/* The hash function may be weak (or a caller-supplied one), so its
+   result is mixed before the bits are split between group index and
+   control byte.  This is the MurmurHash3 finalizer. */
+static inline unsigned mix32(unsigned h)
+{
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+static inline signed char h2(unsigned mixed)
+{
+	return (signed char) (mixed >> 25);
+}
+
+/* Bit i of the result is set if control byte i of the group equals c. */
+static inline unsigned group_match(const signed char *group, signed char c)
+{
+#if defined(__SSE2__)
+	__m128i ctrl = _mm_load_si128((const __m128i *) group);
+	return (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(c)));
+#else
+	unsigned mask = 0;
+	int i;
+	for(i = 0; i < GROUP_SIZE; i++)
+		if(group[i] == c)
+			mask |= 1u << i;
+	return mask;
+#endif
+}
+
+/* Bit i of the result is set if slot i of the group is empty or deleted,
+   both of which have the sign bit set. */
+static inline unsigned group_match_free(const signed char *group)
+{
+#if defined(__SSE2__)
+	__m128i ctrl = _mm_load_si128((const __m128i *) group);
+	return (unsigned) _mm_movemask_epi8(ctrl);
+#else
+	unsigned mask = 0;
+	int i;
+	for(i = 0; i < GROUP_SIZE; i++)
+		if(group[i] < 0)
+			mask |= 1u << i;
+	return mask;
+#endif
+}
+
+static inline int lowest_bit(unsigned mask)
+{
+	return __builtin_ctz(mask);
+}
+
+static signed char *ctrl_alloc(int bucket_count)
+{
+	/* aligned so that groups can be loaded with _mm_load_si128 */
+	signed char *ctrl = aligned_alloc(GROUP_SIZE, bucket_count);
+	if(ctrl)
+		memset(ctrl, CTRL_EMPTY, bucket_count);
+	return ctrl;
+}
+
+static const char *key_copy(struct hash_table *h, const char *key)
+{
+	size_t length = strlen(key) + 1;
+	struct key_chunk *c = h->keys;
+
+	if(!c || c->size - c->used < length) {
+		size_t size = length > KEY_CHUNK_SIZE ? length : KEY_CHUNK_SIZE;
+		c = (struct key_chunk *) malloc(sizeof(struct key_chunk) + size);
+		if(!c)
+			return 0;
+		c->used = 0;
+		c->size = size;
+		c->next = h->keys;
+		h->keys = c;
+	}
+
+	char *copy = c->data + c->used;
+	memcpy(copy, key, length);
+	c->used += length;
+	return copy;
+}
+
+static void keys_free(struct hash_table *h)
+{
+	struct key_chunk *c, *next;
+	for(c = h->keys; c; c = next) {
+		next = c->next;
+		free(c);
+	}
+	h->keys = 0;
+}
+
 struct hash_table *hash_table_create(int bucket_count, hash_func_t func)
 {
 	struct hash_table *h;
@@ -34,13 +167,26 @@ struct hash_table *hash_table_create(int bucket_count, hash_func_t func)
 	if(bucket_count < 1)
 		bucket_count = DEFAULT_SIZE;
 	if(!func)
-		func = DEFAULT_FUNC;
+		func = hash_string;
+
+	/* round up to a power of two number of groups */
+	int groups = 1;
+	while(groups * GROUP_SIZE < bucket_count)
+		groups *= 2;
+	bucket_count = groups * GROUP_SIZE;
 
 	h->size = 0;
+	h->deleted = 0;
 	h->hash_func = func;
 	h->bucket_count = bucket_count;
-	h->buckets = (struct entry **) calloc(bucket_count, sizeof(struct entry *));
-	if(!h->buckets) {
+	h->keys = 0;
+	h->by_pointer = 0;
+	h->islot = 0;
+	h->ctrl = ctrl_alloc(bucket_count);
+	h->slots = (struct slot *) malloc(bucket_count * sizeof(struct slot));
+	if(!h->ctrl || !h->slots) {
+		free(h->ctrl);
+		free(h->slots);
 		free(h);
 		return 0;
 	}
@@ -48,51 +194,83 @@ struct hash_table *hash_table_create(int bucket_count, hash_func_t func)
 	return h;
 }
 
-void hash_table_clear(struct hash_table *h)
+struct hash_table *hash_table_create_by_pointer(int bucket_count, hash_func_t func)
 {
-	struct entry *e, *f;
-	int i;
-
-	for(i = 0; i < h->bucket_count; i++) {
-		e = h->buckets[i];
-		while(e) {
-			f = e->next;
-			free(e->key);
-			free(e);
-			e = f;
-		}
-	}
-
-	for(i = 0; i < h->bucket_count; i++) {
-		h->buckets[i] = 0;
-	}
+	struct hash_table *h = hash_table_create(bucket_count, func);
+	if(h)
+		h->by_pointer = 1;
+	return h;
 }
 
+void hash_table_clear(struct hash_table *h)
+{
+	memset(h->ctrl, CTRL_EMPTY, h->bucket_count);
+	keys_free(h);
+	h->size = 0;
+	h->deleted = 0;
+}
 
 void hash_table_delete(struct hash_table *h)
 {
-	hash_table_clear(h);
-	free(h->buckets);
+	keys_free(h);
+	free(h->ctrl);
+	free(h->slots);
 	free(h);
 }
 
-void *hash_table_lookup(struct hash_table *h, const char *key)
+/* Returns the slot holding key, or -1. */
+static int find_slot(struct hash_table *h, const char *key, unsigned hash)
 {
-	struct entry *e;
-	unsigned hash, index;
+	unsigned mixed = mix32(hash);
+	signed char tag = h2(mixed);
+	unsigned group_mask = h->bucket_count / GROUP_SIZE - 1;
+	unsigned group = mixed & group_mask;
+	unsigned step = 0;
+
+	while(1) {
+		const signed char *ctrl = h->ctrl + group * GROUP_SIZE;
+		unsigned match = group_match(ctrl, tag);
+
+		while(match) {
+			int i = group * GROUP_SIZE + lowest_bit(match);
+			struct slot *s = &h->slots[i];
+			if(s->hash == hash && (h->by_pointer ? s->key == key : !strcmp(s->key, key)))
+				return i;
+			match &= match - 1;
+		}
 
-	hash = h->hash_func(key);
-	index = hash % h->bucket_count;
-	e = h->buckets[index];
+		if(group_match(ctrl, CTRL_EMPTY))
+			return -1;
 
-	while(e) {
-		if(hash == e->hash && !strcmp(key, e->key)) {
-			return e->value;
-		}
-		e = e->next;
+		/* triangular probing visits every group once */
+		step++;
+		group = (group + step) & group_mask;
 	}
+}
 
-	return 0;
+/* Returns a free slot on the probe sequence of hash.  The table must not
+   be full. */
+static int find_free_slot(struct hash_table *h, unsigned hash)
+{
+	unsigned mixed = mix32(hash);
+	unsigned group_mask = h->bucket_count / GROUP_SIZE - 1;
+	unsigned group = mixed & group_mask;
+	unsigned step = 0;
+
+	while(1) {
+		unsigned match = group_match_free(h->ctrl + group * GROUP_SIZE);
+		if(match)
+			return group * GROUP_SIZE + lowest_bit(match);
+
+		step++;
+		group = (group + step) & group_mask;
+	}
+}
+
+void *hash_table_lookup(struct hash_table *h, const char *key)
+{
+	int i = find_slot(h, key, h->hash_func(key));
+	return i < 0 ? 0 : h->slots[i].value;
 }
 
 int hash_table_size(struct hash_table *h)
@@ -100,81 +278,69 @@ int hash_table_size(struct hash_table *h)
 	return h->size;
 }
 
-static int hash_table_double_buckets(struct hash_table *h)
+/* Moves every entry into a table of new_count slots.  Stored hashes and
+   key copies are reused, nothing is rehashed or duplicated. */
+static int hash_table_resize(struct hash_table *h, int new_count)
 {
-	struct hash_table *hn = hash_table_create(2 * h->bucket_count, h->hash_func);
-
-	if(!hn)
+	signed char *old_ctrl = h->ctrl;
+	struct slot *old_slots = h->slots;
+	int old_count = h->bucket_count;
+
+	signed char *ctrl = ctrl_alloc(new_count);
+	struct slot *slots = (struct slot *) malloc(new_count * sizeof(struct slot));
+	if(!ctrl || !slots) {
+		free(ctrl);
+		free(slots);
 		return 0;
+	}
 
-	/* Move pairs to new hash */
-	char *key;
-	void *value;
-	hash_table_firstkey(h);
-	while(hash_table_nextkey(h, &key, &value))
-		if(!hash_table_insert(hn, key, value))
-		{
-			hash_table_delete(hn);
-			return 0;
-		}
+	h->ctrl = ctrl;
+	h->slots = slots;
+	h->bucket_count = new_count;
+	h->deleted = 0;
 
-	/* Delete all old pairs */
-	struct entry *e, *f;
 	int i;
-	for(i = 0; i < h->bucket_count; i++) {
-		e = h->buckets[i];
-		while(e) {
-			f = e->next;
-			free(e->key);
-			free(e);
-			e = f;
-		}
+	for(i = 0; i < old_count; i++) {
+		if(old_ctrl[i] < 0)
+			continue;
+		int j = find_free_slot(h, old_slots[i].hash);
+		h->ctrl[j] = old_ctrl[i];
+		h->slots[j] = old_slots[i];
 	}
 
-	/* Make the old point to the new */
-	free(h->buckets);
-	h->buckets      = hn->buckets;
-	h->bucket_count = hn->bucket_count;
-	h->size         = hn->size;
-
-	/* Delete reference to new, so old is safe */
-	free(hn);
-
+	free(old_ctrl);
+	free(old_slots);
 	return 1;
 }
 
 int hash_table_insert(struct hash_table *h, const char *key, const void *value)
 {
-	struct entry *e;
-	unsigned hash, index;
-
-	if( ((float) h->size / h->bucket_count) > DEFAULT_LOAD )
-		hash_table_double_buckets(h);
+	unsigned hash = h->hash_func(key);
 
-	hash = h->hash_func(key);
-	index = hash % h->bucket_count;
-	e = h->buckets[index];
+	if(find_slot(h, key, hash) >= 0)
+		return 0;
 
-	while(e) {
-		if(hash == e->hash && !strcmp(key, e->key))
+	/* keep at most 7/8 of the slots in use, counting removed ones.  If
+	   most of those are removed entries, rehashing at the same size is
+	   enough to clean them out. */
+	if((h->size + h->deleted + 1) * 8 > h->bucket_count * 7) {
+		int new_count = h->size * 2 >= h->bucket_count ? h->bucket_count * 2 : h->bucket_count;
+		if(!hash_table_resize(h, new_count))
 			return 0;
-		e = e->next;
 	}
 
-	e = (struct entry *) malloc(sizeof(struct entry));
-	if(!e)
+	const char *copy = h->by_pointer ? key : key_copy(h, key);
+	if(!copy)
 		return 0;
 
-	e->key = strdup(key);
-	if(!e->key) {
-		free(e);
-		return 0;
-	}
+	int i = find_free_slot(h, hash);
+	if(h->ctrl[i] == CTRL_DELETED)
+		h->deleted--;
 
-	e->value = (void *) value;
-	e->hash = hash;
-	e->next = h->buckets[index];
-	h->buckets[index] = e;
+	h->ctrl[i] = h2(mix32(hash));
+	h->slots[i].key = copy;
+	h->slots[i].value = (void *) value;
+	h->slots[i].hash = hash;
 	h->size++;
 
 	return 1;
@@ -182,183 +348,94 @@ int hash_table_insert(struct hash_table *h, const char *key, const void *value)
 
 void *hash_table_remove(struct hash_table *h, const char *key)
 {
-	struct entry *e, *f;
-	void *value;
-	unsigned hash, index;
-
-	hash = h->hash_func(key);
-	index = hash % h->bucket_count;
-	e = h->buckets[index];
-	f = 0;
-
-	while(e) {
-		if(hash == e->hash && !strcmp(key, e->key)) {
-			if(f) {
-				f->next = e->next;
-			} else {
-				h->buckets[index] = e->next;
-			}
-			value = e->value;
-			free(e->key);
-			free(e);
-			h->size--;
-			return value;
-		}
-		f = e;
-		e = e->next;
+	int i = find_slot(h, key, h->hash_func(key));
+	if(i < 0)
+		return 0;
+
+	/* A group that still has an empty slot has never been full since the
+	   last rehash, so no probe sequence continues past it and the slot
+	   can become empty again.  Otherwise it must stay a tombstone.  The
+	   key copy is reclaimed when the table is cleared or deleted. */
+	const signed char *group = h->ctrl + (i / GROUP_SIZE) * GROUP_SIZE;
+	if(group_match(group, CTRL_EMPTY)) {
+		h->ctrl[i] = CTRL_EMPTY;
+	} else {
+		h->ctrl[i] = CTRL_DELETED;
+		h->deleted++;
 	}
+	h->size--;
 
-	return 0;
+	return h->slots[i].value;
 }
 
 void hash_table_firstkey(struct hash_table *h)
 {
-	h->ientry = 0;
-	for(h->ibucket = 0; h->ibucket < h->bucket_count; h->ibucket++) {
-		h->ientry = h->buckets[h->ibucket];
-		if(h->ientry)
-			break;
-	}
+	h->islot = 0;
 }
 
 int hash_table_nextkey(struct hash_table *h, char **key, void **value)
 {
-	if(h->ientry) {
-		*key = h->ientry->key;
-		*value = h->ientry->value;
-
-		h->ientry = h->ientry->next;
-		if(!h->ientry) {
-			h->ibucket++;
-			for(; h->ibucket < h->bucket_count; h->ibucket++) {
-				h->ientry = h->buckets[h->ibucket];
-				if(h->ientry)
-					break;
-			}
+	for(; h->islot < h->bucket_count; h->islot++) {
+		if(h->ctrl[h->islot] >= 0) {
+			*key = (char *) h->slots[h->islot].key;
+			*value = h->slots[h->islot].value;
+			h->islot++;
+			return 1;
 		}
-		return 1;
-	} else {
-		return 0;
 	}
+	return 0;
 }
 
-typedef unsigned long int ub4;	/* unsigned 4-byte quantities */
-typedef unsigned char ub1;	/* unsigned 1-byte quantities */
-
-#define hashsize(n) ((ub4)1<<(n))
-#define hashmask(n) (hashsize(n)-1)
-
 /*
 --------------------------------------------------------------------
-mix -- mix 3 32-bit values reversibly.
-For every delta with one or two bits set, and the deltas of all three
-  high bits or all three low bits, whether the original value of a,b,c
-  is almost all zero or is uniformly distributed,
-* If mix() is run forward or backward, at least 32 bits in a,b,c
-  have at least 1/4 probability of changing.
-* If mix() is run forward, every bit of c will change between 1/3 and
-  2/3 of the time.  (Well, 22/100 and 78/100 for some 2-bit deltas.)
-mix() was built out of 36 single-cycle latency instructions in a
-  structure that could supported 2x parallelism, like so:
-	  a -= b;
-	  a -= c; x = (c>>13);
-	  b -= c; a ^= x;
-	  b -= a; x = (a<<8);
-	  c -= a; b ^= x;
-	  c -= b; x = (b>>13);
-	  ...
-  Unfortunately, superscalar Pentiums and Sparcs can't take advantage
-  of that parallelism.  They've also turned some of those single-cycle
-  latency instructions into multi-cycle latency instructions.  Still,
-  this is the fastest good hash I could find.  There were about 2^^68
-  to choose from.  I only looked at a billion or so.
+hash_string is a multiply-mix hash in the style of wyhash: the key is
+consumed eight bytes at a time, each word is folded in with a 64x64->128
+bit multiply, and the result is finalized with the MurmurHash3 64-bit
+finalizer.  It is much faster than a byte-at-a-time hash on identifiers
+and passes the usual avalanche tests.  Do NOT use for cryptographic
+purposes.
 --------------------------------------------------------------------
 */
 
-#define mix(a,b,c) \
-{ \
-  a -= b; a -= c; a ^= (c>>13); \
-  b -= c; b -= a; b ^= (a<<8); \
-  c -= a; c -= b; c ^= (b>>13); \
-  a -= b; a -= c; a ^= (c>>12);  \
-  b -= c; b -= a; b ^= (a<<16); \
-  c -= a; c -= b; c ^= (b>>5); \
-  a -= b; a -= c; a ^= (c>>3);  \
-  b -= c; b -= a; b ^= (a<<10); \
-  c -= a; c -= b; c ^= (b>>15); \
-}
+#define HASH_SEED  0xa0761d6478bd642fULL
+#define HASH_PRIME 0xe7037ed1a0b428dbULL
 
-/*
---------------------------------------------------------------------
-hash() -- hash a variable-length key into a 32-bit value
-  k       : the key (the unaligned variable-length array of bytes)
-  len     : the length of the key, counting by bytes
-  initval : can be any 4-byte value
-Returns a 32-bit value.  Every bit of the key affects every bit of
-the return value.  Every 1-bit and 2-bit delta achieves avalanche.
-About 6*len+35 instructions. The best hash table sizes are powers of 2.  There is no need to do
-mod a prime (mod is sooo slow!).  If you need less than 32 bits,
-use a bitmask.  For example, if you need only 10 bits, do
-  h = (h & hashmask(10));
-In which case, the hash table should have hashsize(10) elements. If you are hashing n strings (ub1 **)k, do it like this:
-  for (i=0, h=0; i<n; ++i) h = hash( k[i], len[i], h);
-By Bob Jenkins, 1996.  bob_jenkins@burtleburtle.net.  You may use this code any way you wish, private, educational, or commercial.  It's free. See http://burtleburtle.net/bob/hash/evahash.html
-Use for hash table lookup, or anything where one collision in 2^^32 is
-acceptable.  Do NOT use for cryptographic purposes.
---------------------------------------------------------------------
-*/
+static inline uint64_t hash_fold(uint64_t a, uint64_t b)
+{
+	__uint128_t r = (__uint128_t) a * b;
+	return (uint64_t) r ^ (uint64_t) (r >> 64);
+}
 
-static ub4 jenkins_hash(k, length, initval)
-	 register const ub1 *k;	/* the key */
-	 register ub4 length;	/* the length of the key */
-	 register ub4 initval;	/* the previous hash, or an arbitrary value */
+static inline uint64_t hash_read64(const unsigned char *p)
 {
-	register ub4 a, b, c, len;	/* Set up the internal state */
-	len = length;
-	a = b = 0x9e3779b9;	/* the golden ratio; an arbitrary value */
-	c = initval;					 /* the previous hash value *//*---------------------------------------- handle most of the key */
-	while(len >= 12) {
-		a += (k[0] + ((ub4) k[1] << 8) + ((ub4) k[2] << 16) + ((ub4) k[3] << 24));
-		b += (k[4] + ((ub4) k[5] << 8) + ((ub4) k[6] << 16) + ((ub4) k[7] << 24));
-		c += (k[8] + ((ub4) k[9] << 8) + ((ub4) k[10] << 16) + ((ub4) k[11] << 24));
-		mix(a, b, c);
-		k += 12;
-		len -= 12;
-	}
-	/*------------------------------------- handle the last 11 bytes */
-	c += length;
-	switch (len) {		/* all the case statements fall through */
-	case 11:
-		c += ((ub4) k[10] << 24);
-	case 10:
-		c += ((ub4) k[9] << 16);
-	case 9:
-		c += ((ub4) k[8] << 8);
-		/* the first byte of c is reserved for the length */
-	case 8:
-		b += ((ub4) k[7] << 24);
-	case 7:
-		b += ((ub4) k[6] << 16);
-	case 6:
-		b += ((ub4) k[5] << 8);
-	case 5:
-		b += k[4];
-	case 4:
-		a += ((ub4) k[3] << 24);
-	case 3:
-		a += ((ub4) k[2] << 16);
-	case 2:
-		a += ((ub4) k[1] << 8);
-	case 1:
-		a += k[0];
-		/* case 0: nothing left to add */
-	}
-	mix(a, b, c);
-   /*-------------------------------------------- report the result */
-	return c;
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
 }
 
 unsigned hash_string(const char *s)
 {
-	return jenkins_hash((const ub1 *) s, strlen(s), 0);
+	const unsigned char *p = (const unsigned char *) s;
+	size_t length = strlen(s);
+	uint64_t h = HASH_SEED ^ length;
+
+	while(length >= 8) {
+		h = hash_fold(h ^ hash_read64(p), HASH_PRIME);
+		p += 8;
+		length -= 8;
+	}
+
+	if(length > 0) {
+		uint64_t tail = 0;
+		memcpy(&tail, p, length);
+		h = hash_fold(h ^ tail, HASH_PRIME);
+	}
+
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+
+	return (unsigned) h;
 }
@@ -3,6 +3,8 @@
 
 /** @file hash_table.h A general purpose hash table.
 This hash table module maps C strings to arbitrary objects (void pointers).
+It is a flat open-addressing table: entries and key copies need no
+allocation of their own, and lookups probe sixteen slots at a time.
 For example, to store a file object using the pathname as a key:
 <pre>
 struct hash_table *h;
@@ -27,13 +29,25 @@ while(hash_table_nextkey(h,&key,&value)) {
 typedef unsigned (*hash_func_t) (const char *key);
 
 /** Create a new hash table.
-@param buckets The number of buckets in the table.  If zero, a default value will be used.
+@param buckets The initial number of slots in the table, rounded up to a power of two multiple of sixteen.  If zero, a default value will be used.
 @param func The default hash function to be used.  If zero, @ref hash_string will be used.
 @return A pointer to a new hash table.
 */
 
 struct hash_table *hash_table_create(int buckets, hash_func_t func);
 
+/** Create a new hash table keyed by pointer.
+Keys are stored as given rather than copied, and two keys are the same only if they are the same pointer.
+This suits strings that are stored once per distinct value, such as interned identifiers.
+Keys must outlive the table.
+A key is only read by @ref hash_string, so with a hash function of the address itself the keys may point to any object.
+@param buckets The initial number of slots in the table, as for @ref hash_table_create.
+@param func The hash function to be used, which must give equal pointers equal hashes.  If zero, @ref hash_string will be used.
+@return A pointer to a new hash table.
+*/
+
+struct hash_table *hash_table_create_by_pointer(int buckets, hash_func_t func);
+
 /** Remove all entries from an hash table.
 Note that this function will not delete all of the objects contained within the hash table.
 @param h The hash table to delete.
@@ -61,7 +75,7 @@ This call will fail if the table already contains the same key.
 You must call @ref hash_table_remove to remove it.
 Also note that you cannot insert a null value into the table.
 @param h A pointer to a hash table.
-@param key A pointer to a string key which will be hashed and duplicated.
+@param key A pointer to a string key which will be hashed and duplicated, unless the table is keyed by pointer.
 @param value A pointer to store with the key.
 @return One if the insert succeeded, failure otherwise
 */
@@ -104,6 +118,7 @@ This function returns the next key and value in the iteration.
 int hash_table_nextkey(struct hash_table *h, char **key, void **value);
 
 /** A default hash function.
+It hashes eight bytes at a time with a multiply-mix and has good avalanche.
 @param s A string to hash.
 @return An integer hash of the string.
 */
@@ -0,0 +1,109 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "intern.h"
+#include "arena.h"
+#include "context.h"
+#include "hash_table.h"
+#include "util.h"
+
+#define INTERN_DEFAULT_CAPACITY 1024
+
+typedef struct Atom Atom;
+
+struct Atom {
+    unsigned hash;
+    unsigned length;
+    char text[];
+};
+
+struct InternTable {
+    // open addressing with linear probing. capacity is a power of two and
+    // the table is kept at most half full.
+    Atom** atoms;
+    int capacity;
+    int count;
+
+    // atom storage. atoms are never freed individually.
+    Arena* arena;
+};
+
+static Atom* atom_of(const char* name) {
+    return (Atom*)(name - offsetof(Atom, text));
+}
+
+InternTable* intern_table_create() {
+    InternTable* t = checked_calloc(1, sizeof(*t));
+    t->arena = arena_create(0);
+    return t;
+}
+
+void intern_table_delete(InternTable* t) {
+    if (!t) return;
+
+    free(t->atoms);
+    arena_delete(t->arena);
+    free(t);
+}
+
+static void intern_grow(InternTable* t) {
+    int new_capacity = t->capacity ? t->capacity * 2 : INTERN_DEFAULT_CAPACITY;
+    Atom** new_atoms = checked_calloc(new_capacity, sizeof(Atom*));
+
+    unsigned mask = new_capacity - 1;
+    for (int i = 0; i < t->capacity; i++) {
+        Atom* atom = t->atoms[i];
+        if (atom == NULL) continue;
+
+        unsigned index = atom->hash & mask;
+        while (new_atoms[index] != NULL) {
+            index = (index + 1) & mask;
+        }
+        new_atoms[index] = atom;
+    }
+
+    free(t->atoms);
+    t->atoms = new_atoms;
+    t->capacity = new_capacity;
+}
+
+const char* intern(const char* text) {
+    InternTable* t = current_context->atoms;
+    if (2 * (t->count + 1) > t->capacity) {
+        intern_grow(t);
+    }
+
+    unsigned hash = hash_string(text);
+    size_t length = strlen(text);
+    unsigned mask = t->capacity - 1;
+    unsigned index = hash & mask;
+
+    Atom* atom;
+    while ((atom = t->atoms[index]) != NULL) {
+        if (atom->hash == hash && atom->length == length
+            && memcmp(atom->text, text, length) == 0
+        ) {
+            return atom->text;
+        }
+        index = (index + 1) & mask;
+    }
+
+    atom = arena_alloc(t->arena, sizeof(Atom) + length + 1);
+    atom->hash = hash;
+    atom->length = length;
+    memcpy(atom->text, text, length + 1);
+
+    t->atoms[index] = atom;
+    t->count++;
+    return atom->text;
+}
+
+unsigned intern_hash(const char* name) {
+    return atom_of(name)->hash;
+}
+
+int intern_count() {
+    return current_context->atoms->count;
+}
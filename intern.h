@@ -0,0 +1,35 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+/*
+The identifier intern table. Every distinct identifier is stored exactly
+once; intern returns that canonical copy (an "atom"). Two atoms name the
+same identifier if and only if they are the same pointer, so names coming
+out of the parser can be compared with == instead of strcmp.
+
+Each atom also carries its hash, computed once when the atom is created.
+intern_hash returns it without touching the characters, and has the
+signature of a hash_func_t so that tables keyed by atoms never rehash.
+
+Every compilation has its own table (see CompilerContext); intern and
+intern_count use the one of the current context.
+*/
+
+typedef struct InternTable InternTable;
+
+InternTable* intern_table_create();
+
+// frees every atom of the table. atoms handed out from it become invalid.
+void intern_table_delete(InternTable* t);
+
+// returns the atom for text, creating it on first use
+const char* intern(const char* text);
+
+// returns the precomputed hash of an atom. name must have been returned by
+// intern; passing any other string is undefined.
+unsigned intern_hash(const char* name);
+
+// number of distinct identifiers interned so far
+int intern_count();
+
+#endif
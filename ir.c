@@ -0,0 +1,755 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "ir.h"
+#include "arena.h"
+#include "context.h"
+#include "util.h"
+
+// the first chunk of a function's arena. most functions are small, and
+// the chunks of the big ones double from there.
+#define IR_ARENA_CHUNK_SIZE 2048
+
+//
+// construction
+//
+
+static IrFunction* function_create(Arena* arena, const char* name, int param_count, int variable_count) {
+    IrFunction* f = arena_alloc(arena, sizeof(IrFunction));
+    f->name = name;
+    f->defined = 1;
+    f->param_count = param_count;
+    f->variable_count = variable_count;
+    f->temp_count = variable_count;
+    f->blocks = NULL;
+    f->block_count = 0;
+    f->block_capacity = 0;
+    f->next_block_id = 0;
+    f->arena = arena;
+    return f;
+}
+
+IrFunction* ir_function_create(const char* name, int param_count, int variable_count) {
+    return function_create(arena_create(IR_ARENA_CHUNK_SIZE), name, param_count, variable_count);
+}
+
+void ir_function_delete(IrFunction* f) {
+    // the function itself lives in its arena
+    arena_delete(f->arena);
+}
+
+// room for an allocation in an arena, which aligns each to 16 bytes
+static size_t arena_room(size_t size) {
+    return size + 16;
+}
+
+IrFunction* ir_function_compact(IrFunction* f) {
+    // everything that is copied, so that it fits a single chunk
+    size_t bytes = arena_room(sizeof(IrFunction)) + arena_room(sizeof(IrBlock*) * f->block_count)
+        + arena_room(sizeof(IrBlock*) * f->next_block_id);
+    for (int i = 0; i < f->block_count; i++) {
+        IrBlock* b = f->blocks[i];
+        bytes += arena_room(sizeof(IrBlock)) + arena_room(sizeof(IrBlock*) * b->pred_count);
+        for (IrInstr* in = b->first; in != NULL; in = in->next) {
+            bytes += arena_room(sizeof(IrInstr));
+            if (in->arg_count > 0) {
+                bytes += arena_room(sizeof(IrOperand) * in->arg_count);
+            }
+            if (in->phi_blocks) {
+                bytes += arena_room(sizeof(IrBlock*) * in->arg_count);
+            }
+            if (in->string) {
+                bytes += arena_room(strlen(in->string) + 1);
+            }
+            if (in->vector) {
+                bytes += arena_room(sizeof(IrVector)) + arena_room(sizeof(IrVectorStep) * in->vector->step_count);
+            }
+        }
+    }
+
+    Arena* arena = arena_create(bytes);
+    IrFunction* c = function_create(arena, f->name, f->param_count, f->variable_count);
+    c->defined = f->defined;
+    c->temp_count = f->temp_count;
+    c->next_block_id = f->next_block_id;
+    c->block_count = f->block_count;
+    c->block_capacity = f->block_count;
+    c->blocks = arena_alloc(arena, sizeof(IrBlock*) * f->block_count);
+
+    // blocks keep their ids, by which the copies are found
+    IrBlock** copies = arena_alloc(arena, sizeof(IrBlock*) * f->next_block_id);
+    for (int i = 0; i < f->block_count; i++) {
+        IrBlock* b = f->blocks[i];
+        IrBlock* copy = arena_alloc(arena, sizeof(IrBlock));
+        *copy = *b;
+        copy->first = NULL;
+        copy->last = NULL;
+        copies[b->id] = copy;
+        c->blocks[i] = copy;
+    }
+    for (int i = 0; i < f->block_count; i++) {
+        IrBlock* b = f->blocks[i];
+        IrBlock* copy = c->blocks[i];
+        copy->idom = b->idom ? copies[b->idom->id] : NULL;
+        copy->pred_capacity = b->pred_count;
+        copy->preds = b->pred_count ? arena_alloc(arena, sizeof(IrBlock*) * b->pred_count) : NULL;
+        for (int k = 0; k < b->pred_count; k++) {
+            copy->preds[k] = copies[b->preds[k]->id];
+        }
+
+        for (IrInstr* in = b->first; in != NULL; in = in->next) {
+            IrInstr* n = arena_alloc(arena, sizeof(IrInstr));
+            *n = *in;
+            if (in->arg_count > 0) {
+                n->args = arena_alloc(arena, sizeof(IrOperand) * in->arg_count);
+                memcpy(n->args, in->args, sizeof(IrOperand) * in->arg_count);
+            }
+            if (in->phi_blocks) {
+                n->phi_blocks = arena_alloc(arena, sizeof(IrBlock*) * in->arg_count);
+                for (int k = 0; k < in->arg_count; k++) {
+                    n->phi_blocks[k] = copies[in->phi_blocks[k]->id];
+                }
+            }
+            // the formats of prints are made in the arena
+            if (in->string) {
+                n->string = arena_strdup(arena, in->string);
+            }
+            if (in->vector) {
+                n->vector = arena_alloc(arena, sizeof(IrVector));
+                *n->vector = *in->vector;
+                n->vector->steps = arena_alloc(arena, sizeof(IrVectorStep) * in->vector->step_count);
+                memcpy(n->vector->steps, in->vector->steps, sizeof(IrVectorStep) * in->vector->step_count);
+            }
+            for (int k = 0; k < 2; k++) {
+                n->targets[k] = in->targets[k] ? copies[in->targets[k]->id] : NULL;
+            }
+            ir_append(copy, n);
+        }
+    }
+
+    ir_function_delete(f);
+    return c;
+}
+
+IrBlock* ir_block_create(IrFunction* f) {
+    IrBlock* b = arena_alloc(f->arena, sizeof(IrBlock));
+    b->id = f->next_block_id++;
+    b->first = NULL;
+    b->last = NULL;
+    b->preds = NULL;
+    b->pred_count = 0;
+    b->pred_capacity = 0;
+    b->idom = NULL;
+    b->rpo = -1;
+    b->label = -1;
+    return b;
+}
+
+void ir_block_place(IrFunction* f, IrBlock* b, IrBlock* after) {
+    if (f->block_count == f->block_capacity) {
+        // arena memory is never freed, the old array is simply left behind
+        int capacity = f->block_capacity ? 2 * f->block_capacity : 16;
+        IrBlock** blocks = arena_alloc(f->arena, sizeof(IrBlock*) * capacity);
+        if (f->block_count > 0) {
+            memcpy(blocks, f->blocks, sizeof(IrBlock*) * f->block_count);
+        }
+        f->blocks = blocks;
+        f->block_capacity = capacity;
+    }
+
+    int at = f->block_count;
+    if (after) {
+        for (at = 0; at < f->block_count && f->blocks[at] != after; at++);
+        at++;
+    }
+    memmove(&f->blocks[at+1], &f->blocks[at], sizeof(IrBlock*) * (f->block_count - at));
+    f->blocks[at] = b;
+    f->block_count++;
+}
+
+int ir_temp_create(IrFunction* f) {
+    return f->temp_count++;
+}
+
+IrOperand ir_temp(int t) {
+    IrOperand o;
+    o.kind = IR_OPERAND_TEMP;
+    o.value = t;
+    return o;
+}
+
+IrOperand ir_constant(long value) {
+    IrOperand o;
+    o.kind = IR_OPERAND_CONSTANT;
+    o.value = value;
+    return o;
+}
+
+IrOperand ir_none() {
+    IrOperand o;
+    o.kind = IR_OPERAND_NONE;
+    o.value = 0;
+    return o;
+}
+
+int ir_is_temp(IrOperand o, int t) {
+    return o.kind == IR_OPERAND_TEMP && o.value == t;
+}
+
+IrInstr* ir_instr_create(IrFunction* f, IrOpcode_t op, int dst, IrOperand a, IrOperand b) {
+    IrInstr* in = arena_alloc(f->arena, sizeof(IrInstr));
+    in->op = op;
+    in->dst = dst;
+    in->a = a;
+    in->b = b;
+    in->c = ir_none();
+    in->name = NULL;
+    in->string = NULL;
+    in->args = NULL;
+    in->arg_count = 0;
+    in->phi_blocks = NULL;
+    in->vector = NULL;
+    in->targets[0] = NULL;
+    in->targets[1] = NULL;
+    in->block = NULL;
+    in->prev = NULL;
+    in->next = NULL;
+    return in;
+}
+
+IrInstr* ir_phi_create(IrFunction* f, IrBlock* b, int dst) {
+    IrInstr* phi = ir_instr_create(f, IR_PHI, dst, ir_none(), ir_none());
+    phi->arg_count = b->pred_count;
+    phi->args = arena_alloc(f->arena, sizeof(IrOperand) * (b->pred_count + 1));
+    phi->phi_blocks = arena_alloc(f->arena, sizeof(IrBlock*) * (b->pred_count + 1));
+    for (int k = 0; k < b->pred_count; k++) {
+        phi->args[k] = ir_none();
+        phi->phi_blocks[k] = b->preds[k];
+    }
+    return phi;
+}
+
+void ir_append(IrBlock* b, IrInstr* in) {
+    in->block = b;
+    in->prev = b->last;
+    in->next = NULL;
+    if (b->last) {
+        b->last->next = in;
+    } else {
+        b->first = in;
+    }
+    b->last = in;
+}
+
+void ir_insert_before(IrInstr* at, IrInstr* in) {
+    IrBlock* b = at->block;
+    in->block = b;
+    in->prev = at->prev;
+    in->next = at;
+    if (at->prev) {
+        at->prev->next = in;
+    } else {
+        b->first = in;
+    }
+    at->prev = in;
+}
+
+void ir_remove(IrInstr* in) {
+    IrBlock* b = in->block;
+    if (in->prev) {
+        in->prev->next = in->next;
+    } else {
+        b->first = in->next;
+    }
+    if (in->next) {
+        in->next->prev = in->prev;
+    } else {
+        b->last = in->prev;
+    }
+    in->block = NULL;
+    in->prev = NULL;
+    in->next = NULL;
+}
+
+//
+// control flow
+//
+
+int ir_is_terminator(IrOpcode_t op) {
+    return op == IR_JUMP || op == IR_BRANCH || op == IR_RETURN;
+}
+
+int ir_successors(IrBlock* b, IrBlock* out[2]) {
+    IrInstr* last = b->last;
+    if (!last) {
+        return 0;
+    }
+    switch (last->op) {
+        case IR_JUMP:
+            out[0] = last->targets[0];
+            return 1;
+        case IR_BRANCH:
+            out[0] = last->targets[0];
+            if (last->targets[1] == last->targets[0]) {
+                return 1;
+            }
+            out[1] = last->targets[1];
+            return 2;
+        default:
+            return 0;
+    }
+}
+
+static void add_predecessor(IrFunction* f, IrBlock* b, IrBlock* pred) {
+    if (b->pred_count == b->pred_capacity) {
+        int capacity = b->pred_capacity ? 2 * b->pred_capacity : 4;
+        IrBlock** preds = arena_alloc(f->arena, sizeof(IrBlock*) * capacity);
+        if (b->pred_count > 0) {
+            memcpy(preds, b->preds, sizeof(IrBlock*) * b->pred_count);
+        }
+        b->preds = preds;
+        b->pred_capacity = capacity;
+    }
+    b->preds[b->pred_count++] = pred;
+}
+
+void ir_compute_predecessors(IrFunction* f) {
+    for (int i = 0; i < f->block_count; i++) {
+        f->blocks[i]->pred_count = 0;
+    }
+    for (int i = 0; i < f->block_count; i++) {
+        IrBlock* succs[2];
+        int succ_count = ir_successors(f->blocks[i], succs);
+        for (int k = 0; k < succ_count; k++) {
+            add_predecessor(f, succs[k], f->blocks[i]);
+        }
+    }
+}
+
+// the reachable blocks in reverse postorder, returning how many there are
+static int reverse_postorder(IrFunction* f, IrBlock** order) {
+    char* visited = checked_calloc(f->next_block_id, 1);
+    // each entry is a block and how many of its successors were visited
+    IrBlock** stack = checked_malloc(sizeof(IrBlock*) * f->block_count);
+    int* next_succ = checked_malloc(sizeof(int) * f->block_count);
+
+    int count = 0;
+    int depth = 0;
+    stack[depth] = f->blocks[0];
+    next_succ[depth] = 0;
+    depth++;
+    visited[f->blocks[0]->id] = 1;
+    while (depth > 0) {
+        IrBlock* b = stack[depth-1];
+        IrBlock* succs[2];
+        int succ_count = ir_successors(b, succs);
+        if (next_succ[depth-1] < succ_count) {
+            IrBlock* s = succs[next_succ[depth-1]++];
+            if (!visited[s->id]) {
+                visited[s->id] = 1;
+                stack[depth] = s;
+                next_succ[depth] = 0;
+                depth++;
+            }
+        } else {
+            // postorder, filled from the back
+            order[f->block_count - 1 - count++] = b;
+            depth--;
+        }
+    }
+    memmove(order, order + f->block_count - count, sizeof(IrBlock*) * count);
+
+    free(next_succ);
+    free(stack);
+    free(visited);
+    return count;
+}
+
+void ir_remove_unreachable_blocks(IrFunction* f) {
+    IrBlock** order = checked_malloc(sizeof(IrBlock*) * f->block_count);
+    int count = reverse_postorder(f, order);
+    for (int i = 0; i < f->block_count; i++) {
+        f->blocks[i]->rpo = -1;
+    }
+    for (int i = 0; i < count; i++) {
+        order[i]->rpo = i;
+    }
+
+    // keep the layout of the blocks that stay
+    int kept = 0;
+    for (int i = 0; i < f->block_count; i++) {
+        if (f->blocks[i]->rpo >= 0) {
+            f->blocks[kept++] = f->blocks[i];
+        }
+    }
+    f->block_count = kept;
+
+    ir_compute_predecessors(f);
+
+    // phis keep the arguments of the edges that are left
+    int* is_pred = checked_malloc(sizeof(int) * f->next_block_id);
+    for (int i = 0; i < f->next_block_id; i++) {
+        is_pred[i] = -1;
+    }
+    for (int i = 0; i < f->block_count; i++) {
+        IrBlock* b = f->blocks[i];
+        if (!b->first || b->first->op != IR_PHI) continue;
+        for (int k = 0; k < b->pred_count; k++) {
+            is_pred[b->preds[k]->id] = b->id;
+        }
+        for (IrInstr* in = b->first; in != NULL && in->op == IR_PHI; in = in->next) {
+            int k = 0;
+            for (int j = 0; j < in->arg_count; j++) {
+                if (is_pred[in->phi_blocks[j]->id] == b->id) {
+                    in->args[k] = in->args[j];
+                    in->phi_blocks[k] = in->phi_blocks[j];
+                    k++;
+                }
+            }
+            in->arg_count = k;
+        }
+    }
+    free(is_pred);
+    free(order);
+}
+
+// the dominator tree after "A Simple, Fast Dominance Algorithm" by Cooper,
+// Harvey and Kennedy: the immediate dominator of a block is the nearest
+// common dominator of its predecessors, iterated in reverse postorder
+// until nothing changes
+static IrBlock* common_dominator(IrBlock* a, IrBlock* b) {
+    while (a != b) {
+        while (a->rpo > b->rpo) a = a->idom;
+        while (b->rpo > a->rpo) b = b->idom;
+    }
+    return a;
+}
+
+void ir_compute_dominators(IrFunction* f) {
+    IrBlock** order = checked_malloc(sizeof(IrBlock*) * f->block_count);
+    int count = reverse_postorder(f, order);
+    if (count != f->block_count) {
+        fprintf(current_context->messages, "Error: dominators of %s with unreachable blocks.\n", f->name);
+        assert(0);
+    }
+    for (int i = 0; i < count; i++) {
+        order[i]->rpo = i;
+        order[i]->idom = NULL;
+    }
+
+    IrBlock* entry = order[0];
+    // the entry is its own dominator while iterating
+    entry->idom = entry;
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int i = 1; i < count; i++) {
+            IrBlock* b = order[i];
+            IrBlock* idom = NULL;
+            for (int k = 0; k < b->pred_count; k++) {
+                IrBlock* p = b->preds[k];
+                if (!p->idom) continue;
+                idom = idom ? common_dominator(p, idom) : p;
+            }
+            if (idom != b->idom) {
+                b->idom = idom;
+                changed = 1;
+            }
+        }
+    }
+    entry->idom = NULL;
+    free(order);
+}
+
+int ir_dominates(IrBlock* a, IrBlock* b) {
+    while (b && b->rpo > a->rpo) {
+        b = b->idom;
+    }
+    return b == a;
+}
+
+void ir_walk_dominator_tree(IrFunction* f, IrBlockVisit enter, IrBlockVisit leave, void* data) {
+    int count = f->block_count;
+    IrBlock** order = checked_malloc(sizeof(IrBlock*) * count);
+    int* first_child = checked_malloc(sizeof(int) * count);
+    int* next_sibling = checked_malloc(sizeof(int) * count);
+    for (int i = 0; i < count; i++) {
+        order[f->blocks[i]->rpo] = f->blocks[i];
+        first_child[i] = -1;
+    }
+    // children are linked last to first, so that they come off the stack
+    // below first to last
+    for (int i = 1; i < count; i++) {
+        int parent = order[i]->idom->rpo;
+        next_sibling[i] = first_child[parent];
+        first_child[parent] = i;
+    }
+
+    // without recursion, as straight-line code makes the tree as deep as
+    // the function is long. ~i on the stack leaves block i.
+    int* stack = checked_malloc(sizeof(int) * 2 * count);
+    int depth = 0;
+    stack[depth++] = 0;
+    while (depth > 0) {
+        int i = stack[--depth];
+        if (i < 0) {
+            if (leave) leave(order[~i], data);
+            continue;
+        }
+        enter(order[i], data);
+        stack[depth++] = ~i;
+        for (int c = first_child[i]; c >= 0; c = next_sibling[c]) {
+            stack[depth++] = c;
+        }
+    }
+
+    free(stack);
+    free(next_sibling);
+    free(first_child);
+    free(order);
+}
+
+int ir_operand_count(IrInstr* in) {
+    return 3 + in->arg_count;
+}
+
+IrOperand* ir_operand(IrInstr* in, int k) {
+    switch (k) {
+        case 0:
+            return &in->a;
+        case 1:
+            return &in->b;
+        case 2:
+            return &in->c;
+        default:
+            return &in->args[k - 3];
+    }
+}
+
+//
+// printing
+//
+
+static const char* opcode_names[] = {
+    "copy", "add", "sub", "mul", "div", "mod", "neg", "not",
+    "eq", "ne", "gt", "ge", "lt", "le",
+    "select", "string", "address", "load_global", "store_global", "load", "store", "call", "phi",
+    "vector", "jump", "branch", "return",
+};
+
+static const char* vector_kind_names[] = {
+    "store", "sum", "min", "max",
+};
+
+static const char* vector_step_names[] = {
+    NULL, NULL, "add", "sub", "mul", "neg", "shl",
+};
+
+static void operand_print(IrOperand o, FILE* out) {
+    switch (o.kind) {
+        case IR_OPERAND_TEMP:
+            fprintf(out, "t%ld", o.value);
+            break;
+        case IR_OPERAND_CONSTANT:
+            fprintf(out, "%ld", o.value);
+            break;
+        case IR_OPERAND_NONE:
+            fprintf(out, "_");
+            break;
+    }
+}
+
+static void instr_print(IrInstr* in, FILE* out) {
+    fprintf(out, "    ");
+    if (in->dst >= 0) {
+        fprintf(out, "t%d = ", in->dst);
+    }
+    fprintf(out, "%s", opcode_names[in->op]);
+
+    switch (in->op) {
+        case IR_STRING:
+            fprintf(out, " \"%s\"", in->string);
+            break;
+        case IR_ADDRESS:
+        case IR_LOAD_GLOBAL:
+            fprintf(out, " %s", in->name);
+            break;
+        case IR_STORE_GLOBAL:
+            fprintf(out, " %s, ", in->name);
+            operand_print(in->a, out);
+            break;
+        case IR_CALL:
+            fprintf(out, " %s(", in->name);
+            for (int k = 0; k < in->arg_count; k++) {
+                if (k > 0) fprintf(out, ", ");
+                operand_print(in->args[k], out);
+            }
+            fprintf(out, ")");
+            break;
+        case IR_PHI:
+            for (int k = 0; k < in->arg_count; k++) {
+                fprintf(out, k == 0 ? " [" : ", [");
+                operand_print(in->args[k], out);
+                fprintf(out, ", b%d]", in->phi_blocks[k]->id);
+            }
+            break;
+        case IR_VECTOR: {
+            IrVector* v = in->vector;
+            fprintf(out, " %s", vector_kind_names[v->kind]);
+            if (v->kind == IR_VECTOR_STORE) {
+                fprintf(out, " %s[i] =", v->name);
+            } else {
+                fprintf(out, " ");
+                operand_print(in->a, out);
+                fprintf(out, ",");
+            }
+            for (int k = 0; k < v->step_count; k++) {
+                IrVectorStep* step = &v->steps[k];
+                if (step->kind == IR_VECTOR_ELEMENT) {
+                    fprintf(out, " %s[i]", step->name);
+                } else if (step->kind == IR_VECTOR_SCALAR) {
+                    fprintf(out, " ");
+                    operand_print(in->args[step->index], out);
+                } else if (step->kind == IR_VECTOR_SHL) {
+                    fprintf(out, " shl %d", step->index);
+                } else {
+                    fprintf(out, " %s", vector_step_names[step->kind]);
+                }
+            }
+            fprintf(out, " for i in [%ld, %ld)", v->start, v->start + v->count);
+        } break;
+        case IR_JUMP:
+            fprintf(out, " b%d", in->targets[0]->id);
+            break;
+        case IR_BRANCH:
+            fprintf(out, " ");
+            operand_print(in->a, out);
+            fprintf(out, ", b%d, b%d", in->targets[0]->id, in->targets[1]->id);
+            break;
+        default:
+            for (int k = 0; k < 3; k++) {
+                IrOperand* o = ir_operand(in, k);
+                if (o->kind == IR_OPERAND_NONE) break;
+                fprintf(out, k == 0 ? " " : ", ");
+                operand_print(*o, out);
+            }
+            break;
+    }
+    fprintf(out, "\n");
+}
+
+void ir_print(IrFunction* f, FILE* out) {
+    fprintf(out, "function %s: %d params, %d variables, %d temporaries\n",
+            f->name, f->param_count, f->variable_count, f->temp_count);
+    for (int i = 0; i < f->block_count; i++) {
+        IrBlock* b = f->blocks[i];
+        fprintf(out, "b%d:", b->id);
+        if (b->pred_count > 0) {
+            fprintf(out, "  ; preds");
+            for (int k = 0; k < b->pred_count; k++) {
+                fprintf(out, " b%d", b->preds[k]->id);
+            }
+        }
+        fprintf(out, "\n");
+        for (IrInstr* in = b->first; in != NULL; in = in->next) {
+            instr_print(in, out);
+        }
+    }
+}
+
+//
+// verification
+//
+
+static void verify_error(IrFunction* f, IrBlock* b, const char* message) {
+    fprintf(current_context->messages, "Error: invalid IR in %s, block b%d: %s.\n", f->name, b->id, message);
+    ir_print(f, current_context->messages);
+    assert(0);
+}
+
+void ir_verify(IrFunction* f) {
+    if (f->block_count == 0) {
+        fprintf(current_context->messages, "Error: invalid IR in %s: no entry block.\n", f->name);
+        assert(0);
+    }
+
+    char* placed = checked_calloc(f->next_block_id, 1);
+    for (int i = 0; i < f->block_count; i++) {
+        placed[f->blocks[i]->id] = 1;
+    }
+
+    for (int i = 0; i < f->block_count; i++) {
+        IrBlock* b = f->blocks[i];
+        if (!b->last || !ir_is_terminator(b->last->op)) {
+            verify_error(f, b, "the block does not end in a terminator");
+        }
+
+        IrInstr* prev = NULL;
+        for (IrInstr* in = b->first; in != NULL; prev = in, in = in->next) {
+            if (in->block != b || in->prev != prev) {
+                verify_error(f, b, "broken instruction list");
+            }
+            if (in != b->last && ir_is_terminator(in->op)) {
+                verify_error(f, b, "terminator in the middle of the block");
+            }
+            if (in->op == IR_PHI) {
+                if (prev && prev->op != IR_PHI) {
+                    verify_error(f, b, "phi after the start of the block");
+                }
+                if (in->arg_count != b->pred_count) {
+                    verify_error(f, b, "phi without one argument per predecessor");
+                }
+                for (int k = 0; k < in->arg_count; k++) {
+                    int found = 0;
+                    for (int p = 0; p < b->pred_count; p++) {
+                        found += b->preds[p] == in->phi_blocks[k];
+                    }
+                    if (found != 1) {
+                        verify_error(f, b, "phi argument from a block that is not a predecessor");
+                    }
+                }
+            }
+            if (in->dst >= f->temp_count) {
+                verify_error(f, b, "definition of an unknown temporary");
+            }
+            for (int k = 0; k < ir_operand_count(in); k++) {
+                IrOperand* o = ir_operand(in, k);
+                if (o->kind == IR_OPERAND_TEMP && (o->value < 0 || o->value >= f->temp_count)) {
+                    verify_error(f, b, "use of an unknown temporary");
+                }
+            }
+        }
+        if (prev != b->last) {
+            verify_error(f, b, "broken instruction list");
+        }
+
+        IrBlock* succs[2];
+        int succ_count = ir_successors(b, succs);
+        for (int k = 0; k < succ_count; k++) {
+            if (!placed[succs[k]->id]) {
+                verify_error(f, b, "jump to a block that is not placed");
+            }
+            int found = 0;
+            for (int p = 0; p < succs[k]->pred_count; p++) {
+                found += succs[k]->preds[p] == b;
+            }
+            if (found != 1) {
+                verify_error(f, succs[k], "predecessors are out of date");
+            }
+        }
+        for (int p = 0; p < b->pred_count; p++) {
+            IrBlock* pred_succs[2];
+            int pred_succ_count = ir_successors(b->preds[p], pred_succs);
+            int found = 0;
+            for (int k = 0; k < pred_succ_count; k++) {
+                found += pred_succs[k] == b;
+            }
+            if (found != 1) {
+                verify_error(f, b, "predecessors are out of date");
+            }
+        }
+    }
+    free(placed);
+}
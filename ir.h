@@ -0,0 +1,260 @@
+#ifndef IR_H
+#define IR_H
+
+#include <stdio.h>
+
+#include "decl.h"
+#include "arena.h"
+
+/*
+The intermediate representation between the AST and the x64 backend.
+
+A function is a control-flow graph of basic blocks. Each block is a list of
+three-address instructions ending in exactly one terminator: a jump, a
+two-way branch or a return. Values live in temporaries, of which there are
+as many as needed. The first variable_count temporaries are the function's
+variables, parameters first, numbered by Symbol->which. Variables are
+assigned any number of times, as is the temporary holding the value of an
+&& or || on the paths that compute it; every other temporary is defined
+once by the instruction that computes it.
+
+Optimizations (ir_opt.h) put a function into SSA form, where every
+temporary is defined once and IR_PHI instructions at the start of a block
+merge the values that reach it, and take it out of SSA form again before
+instruction selection.
+
+Operands are temporaries or constants:
+
+    t7 = add t3, 1
+    t8 = lt t7, t2
+    branch t8, b2, b3
+
+ir_lower (ir_lower.c) builds the IR of a function from its AST, codegen
+selects x64 instructions from it (x64_codegen.c). Everything in a function
+is allocated from its own arena and released by ir_function_delete.
+*/
+
+typedef enum {
+    IR_COPY,        // dst = a
+    IR_ADD,         // dst = a + b
+    IR_SUB,
+    IR_MUL,
+    IR_DIV,         // truncating, traps on division by zero
+    IR_MOD,
+    IR_NEG,         // dst = -a
+    IR_NOT,         // dst = !a, for booleans that are 0 or 1
+
+    // dst = 1 if the comparison holds, 0 otherwise
+    IR_EQ,
+    IR_NE,
+    IR_GT,
+    IR_GE,
+    IR_LT,
+    IR_LE,
+
+    IR_SELECT,      // dst = a ? b : c
+    IR_STRING,      // dst = address of a copy of string
+    IR_ADDRESS,     // dst = address of the global name
+    IR_LOAD_GLOBAL, // dst = the global name
+    IR_STORE_GLOBAL,// the global name = a
+    IR_LOAD,        // dst = a[b], a being the address of 8-byte elements
+    IR_STORE,       // a[b] = c
+    IR_CALL,        // dst = name(args), dst may be -1
+    IR_PHI,         // dst = args[k] when control came from phi_blocks[k], in SSA form only
+    IR_VECTOR,      // a loop over global arrays in vector registers, see IrVector
+
+    // terminators
+    IR_JUMP,        // to targets[0]
+    IR_BRANCH,      // to targets[0] if a is nonzero, else to targets[1]
+    IR_RETURN,      // a, which may be absent
+} IrOpcode_t;
+
+typedef enum {
+    IR_OPERAND_NONE,
+    IR_OPERAND_TEMP,
+    IR_OPERAND_CONSTANT,
+} IrOperand_t;
+
+typedef struct {
+    IrOperand_t kind;
+    long value;         // temporary number or constant
+} IrOperand;
+
+// the loop an IR_VECTOR runs, for every i from start to start + count - 1:
+// it stores an expression into name[i], or reduces it into dst starting
+// from a. start and count are multiples of the number of elements in a
+// vector register, so that every access is aligned.
+typedef enum {
+    IR_VECTOR_STORE,    // name[i] = the expression
+    IR_VECTOR_SUM,      // dst = a + the sum of the expression
+    IR_VECTOR_MIN,      // dst = the least of a and the expression
+    IR_VECTOR_MAX,
+} IrVector_t;
+
+// the expression in postfix order
+typedef enum {
+    IR_VECTOR_ELEMENT,  // name[i]
+    IR_VECTOR_SCALAR,   // args[index], the same for every i
+    IR_VECTOR_ADD,
+    IR_VECTOR_SUB,
+    IR_VECTOR_MUL,
+    IR_VECTOR_NEG,
+    IR_VECTOR_SHL,      // by index bits
+} IrVectorStep_t;
+
+typedef struct {
+    IrVectorStep_t kind;
+    const char* name;
+    int index;
+} IrVectorStep;
+
+typedef struct {
+    IrVector_t kind;
+    const char* name;   // IR_VECTOR_STORE
+    long start;
+    long count;
+    IrVectorStep* steps;
+    int step_count;
+} IrVector;
+
+typedef struct IrInstr IrInstr;
+typedef struct IrBlock IrBlock;
+typedef struct IrFunction IrFunction;
+
+struct IrInstr {
+    IrOpcode_t op;
+    int dst;            // the temporary defined, or -1
+    IrOperand a;
+    IrOperand b;
+    IrOperand c;
+
+    const char* name;   // global or function, interned
+    const char* string; // IR_STRING, with escape sequences as in the source
+
+    IrOperand* args;    // IR_CALL, IR_PHI and IR_VECTOR
+    int arg_count;
+    IrBlock** phi_blocks;
+    IrVector* vector;
+
+    IrBlock* targets[2];
+
+    IrBlock* block;
+    IrInstr* prev;
+    IrInstr* next;
+};
+
+struct IrBlock {
+    int id;
+    IrInstr* first;
+    IrInstr* last;      // the terminator once the block is complete
+
+    // filled in by ir_compute_predecessors
+    IrBlock** preds;
+    int pred_count;
+    int pred_capacity;
+
+    // filled in by ir_compute_dominators
+    IrBlock* idom;      // immediate dominator, NULL for the entry
+    int rpo;            // position in reverse postorder
+
+    int label;          // used by instruction selection
+};
+
+struct IrFunction {
+    const char* name;
+    int defined;        // 0 for a function only declared, without a body
+    int param_count;
+    int variable_count;
+    int temp_count;
+
+    IrBlock** blocks;   // in layout order, blocks[0] is the entry
+    int block_count;
+    int block_capacity;
+    int next_block_id;
+
+    Arena* arena;
+};
+
+IrFunction* ir_function_create(const char* name, int param_count, int variable_count);
+
+void ir_function_delete(IrFunction* f);
+
+// a copy of f in an arena that holds nothing else, deleting f. the blocks
+// and instructions that optimization replaced are left behind in f's
+// arena, which this lets go of for functions that are kept for a while.
+IrFunction* ir_function_compact(IrFunction* f);
+
+// a new empty block, which is not part of the function until it is placed
+IrBlock* ir_block_create(IrFunction* f);
+
+// puts b into the layout right after the block after, or at the end if
+// after is NULL
+void ir_block_place(IrFunction* f, IrBlock* b, IrBlock* after);
+
+// a new temporary
+int ir_temp_create(IrFunction* f);
+
+IrOperand ir_temp(int t);
+
+IrOperand ir_constant(long value);
+
+IrOperand ir_none();
+
+int ir_is_temp(IrOperand o, int t);
+
+// a new instruction in no block. the fields not given are empty.
+IrInstr* ir_instr_create(IrFunction* f, IrOpcode_t op, int dst, IrOperand a, IrOperand b);
+
+// a new phi for dst with room for one argument per predecessor of b, which
+// are yet to be filled in
+IrInstr* ir_phi_create(IrFunction* f, IrBlock* b, int dst);
+
+void ir_append(IrBlock* b, IrInstr* in);
+
+void ir_insert_before(IrInstr* at, IrInstr* in);
+
+// unlinks in from its block
+void ir_remove(IrInstr* in);
+
+int ir_is_terminator(IrOpcode_t op);
+
+// the blocks control may go to from b, in out. returns how many there are.
+int ir_successors(IrBlock* b, IrBlock* out[2]);
+
+void ir_compute_predecessors(IrFunction* f);
+
+// drops the blocks that can not be reached from the entry. predecessors
+// are recomputed, and phis lose the arguments of edges that are gone.
+void ir_remove_unreachable_blocks(IrFunction* f);
+
+// fills in idom and rpo of every block. all blocks must be reachable and
+// predecessors up to date.
+void ir_compute_dominators(IrFunction* f);
+
+// whether every path from the entry to b goes through a
+int ir_dominates(IrBlock* a, IrBlock* b);
+
+typedef void (*IrBlockVisit)(IrBlock* b, void* data);
+
+// visits the dominator tree from the entry down: enter is called for a
+// block before the blocks it immediately dominates, leave, if not NULL,
+// after them. dominators must be up to date.
+void ir_walk_dominator_tree(IrFunction* f, IrBlockVisit enter, IrBlockVisit leave, void* data);
+
+// the operands an instruction reads are ir_operand(in, 0) up to
+// ir_operand(in, ir_operand_count(in) - 1): a, b, c and then the arguments
+// of a call. some may be IR_OPERAND_NONE.
+int ir_operand_count(IrInstr* in);
+
+IrOperand* ir_operand(IrInstr* in, int k);
+
+void ir_print(IrFunction* f, FILE* out);
+
+// checks the invariants above and that predecessors are up to date,
+// reporting the first violation and aborting
+void ir_verify(IrFunction* f);
+
+// the IR of a function declaration
+IrFunction* ir_lower(Decl* d);
+
+#endif
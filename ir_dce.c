@@ -0,0 +1,143 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ir_opt.h"
+#include "util.h"
+
+/*
+Dead code elimination in SSA form. Branches whose condition value
+numbering found to be constant become jumps, the blocks no longer
+reached go, and a block that is the only way into the next is merged
+with it. Of the instructions left, those with an effect are live:
+stores, vector loops that store, calls, terminators and divisions that
+may trap. So is every instruction computing an operand of a live one,
+phis included; everything else is removed. An assignment to a local that is overwritten, or never
+read, before it is used is one of these.
+*/
+
+typedef struct {
+    IrInstr** items;
+    int count;
+    int capacity;
+} Worklist;
+
+static void push(Worklist* w, IrInstr* in) {
+    if (w->count == w->capacity) {
+        w->capacity = w->capacity ? 2 * w->capacity : 64;
+        w->items = checked_realloc(w->items, sizeof(IrInstr*) * w->capacity);
+    }
+    w->items[w->count++] = in;
+}
+
+static int has_effect(IrInstr* in) {
+    switch (in->op) {
+        case IR_STORE:
+        case IR_STORE_GLOBAL:
+        case IR_CALL:
+        case IR_JUMP:
+        case IR_BRANCH:
+        case IR_RETURN:
+            return 1;
+        case IR_VECTOR:
+            return in->vector->kind == IR_VECTOR_STORE;
+        case IR_DIV:
+        case IR_MOD:
+            // traps on zero, and on LONG_MIN / -1
+            return in->b.kind != IR_OPERAND_CONSTANT || in->b.value == 0 || in->b.value == -1;
+        default:
+            return 0;
+    }
+}
+
+// appends to a block the block it jumps to, if it is the only way there.
+// the successor is left empty and unreachable.
+static int merge_blocks(IrFunction* f) {
+    int merged = 0;
+    for (int i = 0; i < f->block_count; i++) {
+        IrBlock* b = f->blocks[i];
+        while (b->last && b->last->op == IR_JUMP) {
+            IrBlock* s = b->last->targets[0];
+            if (s == b || s->pred_count != 1 || s->first->op == IR_PHI) break;
+
+            ir_remove(b->last);
+            IrInstr* next;
+            for (IrInstr* in = s->first; in != NULL; in = next) {
+                next = in->next;
+                ir_remove(in);
+                ir_append(b, in);
+            }
+            IrBlock* succs[2];
+            int succ_count = ir_successors(b, succs);
+            for (int k = 0; k < succ_count; k++) {
+                for (IrInstr* phi = succs[k]->first; phi != NULL && phi->op == IR_PHI; phi = phi->next) {
+                    for (int j = 0; j < phi->arg_count; j++) {
+                        if (phi->phi_blocks[j] == s) phi->phi_blocks[j] = b;
+                    }
+                }
+            }
+            merged = 1;
+        }
+    }
+    return merged;
+}
+
+void ir_dce(IrFunction* f) {
+    int changed = 0;
+    for (int i = 0; i < f->block_count; i++) {
+        IrInstr* last = f->blocks[i]->last;
+        if (last->op == IR_BRANCH && last->a.kind == IR_OPERAND_CONSTANT) {
+            last->op = IR_JUMP;
+            last->targets[0] = last->a.value ? last->targets[0] : last->targets[1];
+            last->targets[1] = NULL;
+            last->a = ir_none();
+            changed = 1;
+        }
+    }
+    if (changed) {
+        ir_remove_unreachable_blocks(f);
+    }
+    if (merge_blocks(f)) {
+        ir_remove_unreachable_blocks(f);
+    }
+
+    IrInstr** defs = checked_calloc(f->temp_count, sizeof(IrInstr*));
+    char* live = checked_calloc(f->temp_count, 1);
+    Worklist w = {0};
+
+    for (int i = 0; i < f->block_count; i++) {
+        for (IrInstr* in = f->blocks[i]->first; in != NULL; in = in->next) {
+            if (in->dst >= 0) defs[in->dst] = in;
+            if (has_effect(in)) {
+                push(&w, in);
+            }
+        }
+    }
+
+    while (w.count > 0) {
+        IrInstr* in = w.items[--w.count];
+        for (int k = 0; k < ir_operand_count(in); k++) {
+            IrOperand* o = ir_operand(in, k);
+            if (o->kind != IR_OPERAND_TEMP || live[o->value]) continue;
+            live[o->value] = 1;
+            // parameters have no defining instruction
+            IrInstr* def = defs[o->value];
+            if (!def) continue;
+            push(&w, def);
+        }
+    }
+
+    for (int i = 0; i < f->block_count; i++) {
+        IrInstr* next;
+        for (IrInstr* in = f->blocks[i]->first; in != NULL; in = next) {
+            next = in->next;
+            if (!has_effect(in) && !live[in->dst]) {
+                ir_remove(in);
+            }
+        }
+    }
+
+    free(w.items);
+    free(live);
+    free(defs);
+}
@@ -0,0 +1,385 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+
+#include "ir_opt.h"
+#include "hash_table.h"
+#include "util.h"
+
+/*
+Dominator-based value numbering, after Briggs, Cooper and Simpson, "Value
+Numbering". The blocks are visited in a preorder walk of the dominator
+tree with a table from expressions to the temporary that first computed
+them. Entries made in a block are removed when the walk leaves it, so a
+lookup only finds computations that dominate the current one.
+
+An expression is its opcode and its operands after replacement, so that
+t3 = add t1, t2 and t5 = add t2, t1 get the same key once t1 and t2 are
+known, and chains of computations on the same values collapse in one
+pass. Loads also carry the memory they read: a number that changes at
+every store and call, and is only carried into a block from its single
+predecessor. A store makes a later load of the same element read the
+stored value.
+*/
+
+typedef struct {
+    IrFunction* f;
+
+    IrOperand* value;       // per temporary, what its uses read instead
+
+    struct hash_table* table;
+    char** log;             // keys entered, to remove them again
+    int log_count;
+    int log_capacity;
+    int* marks;             // per block, by rpo: where the log was on entry
+
+    int* memory_out;        // per block, by rpo: the state of memory and
+    int* globals_out;       // of the global variables when leaving it
+    int epoch_count;
+} Numbering;
+
+static IrOperand replacement(Numbering* n, IrOperand o) {
+    return o.kind == IR_OPERAND_TEMP ? n->value[o.value] : o;
+}
+
+static void operand_key(char* out, IrOperand o) {
+    switch (o.kind) {
+        case IR_OPERAND_NONE:
+            strcpy(out, " -");
+            break;
+        case IR_OPERAND_TEMP:
+            sprintf(out, " t%ld", o.value);
+            break;
+        case IR_OPERAND_CONSTANT:
+            sprintf(out, " %ld", o.value);
+            break;
+    }
+}
+
+// the key of an expression. epoch tells apart the states of memory for
+// loads, and is 0 for everything else.
+static char* expression_key(char* out, IrOpcode_t op, IrOperand a, IrOperand b, IrOperand c, const char* name, int epoch) {
+    char* p = out + sprintf(out, "%d %d", op, epoch);
+    operand_key(p, a);
+    p += strlen(p);
+    operand_key(p, b);
+    p += strlen(p);
+    operand_key(p, c);
+    p += strlen(p);
+    if (name) {
+        // names are interned
+        sprintf(p, " %p", (void*)name);
+    }
+    return out;
+}
+
+static void remember(Numbering* n, const char* key, IrOperand v) {
+    IrOperand* stored = arena_alloc(n->f->arena, sizeof(IrOperand));
+    *stored = v;
+    hash_table_insert(n->table, key, stored);
+
+    if (n->log_count == n->log_capacity) {
+        n->log_capacity = n->log_capacity ? 2 * n->log_capacity : 64;
+        n->log = checked_realloc(n->log, sizeof(char*) * n->log_capacity);
+    }
+    char* copy = arena_alloc(n->f->arena, strlen(key) + 1);
+    strcpy(copy, key);
+    n->log[n->log_count++] = copy;
+}
+
+//
+// folding
+//
+
+static int is_constant(IrOperand o, long value) {
+    return o.kind == IR_OPERAND_CONSTANT && o.value == value;
+}
+
+static int is_pure(IrOpcode_t op) {
+    switch (op) {
+        case IR_ADD:
+        case IR_SUB:
+        case IR_MUL:
+        case IR_DIV:
+        case IR_MOD:
+        case IR_NEG:
+        case IR_NOT:
+        case IR_EQ:
+        case IR_NE:
+        case IR_GT:
+        case IR_GE:
+        case IR_LT:
+        case IR_LE:
+        case IR_SELECT:
+        case IR_ADDRESS:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static int is_commutative(IrOpcode_t op) {
+    return op == IR_ADD || op == IR_MUL || op == IR_EQ || op == IR_NE;
+}
+
+// the value of in if its operands are constants, as the generated code
+// computes it. divisions that trap are left to run time.
+static int evaluate(IrInstr* in, long* result) {
+    if (in->a.kind != IR_OPERAND_CONSTANT) return 0;
+    long a = in->a.value;
+    if (in->op == IR_NEG) {
+        *result = (long)-(unsigned long)a;
+        return 1;
+    }
+    if (in->op == IR_NOT) {
+        *result = !a;
+        return 1;
+    }
+    if (in->op == IR_SELECT) {
+        // only the condition needs to be known
+        return 0;
+    }
+
+    if (in->b.kind != IR_OPERAND_CONSTANT) return 0;
+    long b = in->b.value;
+    unsigned long ua = a;
+    unsigned long ub = b;
+    switch (in->op) {
+        case IR_ADD: *result = (long)(ua + ub); return 1;
+        case IR_SUB: *result = (long)(ua - ub); return 1;
+        case IR_MUL: *result = (long)(ua * ub); return 1;
+        case IR_DIV:
+        case IR_MOD:
+            if (b == 0 || (a == LONG_MIN && b == -1)) {
+                return 0;
+            }
+            *result = in->op == IR_DIV ? a / b : a % b;
+            return 1;
+        case IR_EQ: *result = a == b; return 1;
+        case IR_NE: *result = a != b; return 1;
+        case IR_GT: *result = a > b; return 1;
+        case IR_GE: *result = a >= b; return 1;
+        case IR_LT: *result = a < b; return 1;
+        case IR_LE: *result = a <= b; return 1;
+        default: return 0;
+    }
+}
+
+// identities such as x + 0 and x - x, that give an operand or a constant
+static int simplify(IrInstr* in, IrOperand* result) {
+    IrOperand a = in->a;
+    IrOperand b = in->b;
+    int same = a.kind == IR_OPERAND_TEMP && b.kind == IR_OPERAND_TEMP && a.value == b.value;
+
+    switch (in->op) {
+        case IR_ADD:
+            if (is_constant(a, 0)) { *result = b; return 1; }
+            if (is_constant(b, 0)) { *result = a; return 1; }
+            return 0;
+        case IR_SUB:
+            if (is_constant(b, 0)) { *result = a; return 1; }
+            if (same) { *result = ir_constant(0); return 1; }
+            return 0;
+        case IR_MUL:
+            if (is_constant(a, 1)) { *result = b; return 1; }
+            if (is_constant(b, 1)) { *result = a; return 1; }
+            if (is_constant(a, 0) || is_constant(b, 0)) { *result = ir_constant(0); return 1; }
+            return 0;
+        case IR_DIV:
+            if (is_constant(b, 1)) { *result = a; return 1; }
+            return 0;
+        case IR_EQ:
+        case IR_GE:
+        case IR_LE:
+            if (same) { *result = ir_constant(1); return 1; }
+            return 0;
+        case IR_NE:
+        case IR_GT:
+        case IR_LT:
+            if (same) { *result = ir_constant(0); return 1; }
+            return 0;
+        case IR_SELECT:
+            if (a.kind == IR_OPERAND_CONSTANT) { *result = a.value ? b : in->c; return 1; }
+            if (b.kind == in->c.kind && b.value == in->c.value) { *result = b; return 1; }
+            return 0;
+        default:
+            return 0;
+    }
+}
+
+// the single value of a phi whose arguments are all the same, or itself
+static int phi_value(IrInstr* phi, IrOperand* result) {
+    int found = 0;
+    for (int k = 0; k < phi->arg_count; k++) {
+        IrOperand o = phi->args[k];
+        if (ir_is_temp(o, phi->dst)) continue;
+        if (found && (o.kind != result->kind || o.value != result->value)) {
+            return 0;
+        }
+        *result = o;
+        found = 1;
+    }
+    return found;
+}
+
+//
+// the walk
+//
+
+static void number_block(IrBlock* b, void* data) {
+    Numbering* n = data;
+    n->marks[b->rpo] = n->log_count;
+    int memory;
+    int globals;
+    if (b->pred_count == 1) {
+        memory = n->memory_out[b->preds[0]->rpo];
+        globals = n->globals_out[b->preds[0]->rpo];
+    } else {
+        memory = n->epoch_count++;
+        globals = n->epoch_count++;
+    }
+
+    char key[128];
+    IrInstr* next;
+    for (IrInstr* in = b->first; in != NULL; in = next) {
+        next = in->next;
+        for (int k = 0; k < ir_operand_count(in); k++) {
+            IrOperand* o = ir_operand(in, k);
+            *o = replacement(n, *o);
+        }
+
+        IrOperand result;
+        long constant;
+        if (in->op == IR_PHI) {
+            if (phi_value(in, &result)) {
+                n->value[in->dst] = result;
+                ir_remove(in);
+            }
+            continue;
+        }
+        if (in->op == IR_COPY) {
+            n->value[in->dst] = in->a;
+            ir_remove(in);
+            continue;
+        }
+        if (is_pure(in->op)) {
+            if (evaluate(in, &constant)) {
+                n->value[in->dst] = ir_constant(constant);
+                ir_remove(in);
+                continue;
+            }
+            if (simplify(in, &result)) {
+                n->value[in->dst] = result;
+                ir_remove(in);
+                continue;
+            }
+            if (is_commutative(in->op) && (in->a.kind == IR_OPERAND_CONSTANT
+                    || (in->b.kind == IR_OPERAND_TEMP && in->b.value < in->a.value))) {
+                IrOperand swap = in->a;
+                in->a = in->b;
+                in->b = swap;
+            }
+        }
+
+        switch (in->op) {
+            case IR_LOAD:
+            case IR_LOAD_GLOBAL: {
+                int epoch = in->op == IR_LOAD ? memory : globals;
+                expression_key(key, in->op, in->a, in->b, in->c, in->name, epoch);
+                IrOperand* known = hash_table_lookup(n->table, key);
+                if (known) {
+                    n->value[in->dst] = *known;
+                    ir_remove(in);
+                } else {
+                    remember(n, key, ir_temp(in->dst));
+                }
+            } break;
+            case IR_STORE:
+                memory = n->epoch_count++;
+                expression_key(key, IR_LOAD, in->a, in->b, ir_none(), NULL, memory);
+                remember(n, key, in->c);
+                break;
+            case IR_STORE_GLOBAL:
+                globals = n->epoch_count++;
+                expression_key(key, IR_LOAD_GLOBAL, ir_none(), ir_none(), ir_none(), in->name, globals);
+                remember(n, key, in->a);
+                break;
+            case IR_CALL:
+                memory = n->epoch_count++;
+                globals = n->epoch_count++;
+                break;
+            case IR_VECTOR:
+                if (in->vector->kind == IR_VECTOR_STORE) {
+                    memory = n->epoch_count++;
+                }
+                break;
+            default:
+                if (is_pure(in->op)) {
+                    expression_key(key, in->op, in->a, in->b, in->c, in->name, 0);
+                    IrOperand* known = hash_table_lookup(n->table, key);
+                    if (known) {
+                        n->value[in->dst] = *known;
+                        ir_remove(in);
+                    } else {
+                        remember(n, key, ir_temp(in->dst));
+                    }
+                }
+                break;
+        }
+    }
+    n->memory_out[b->rpo] = memory;
+    n->globals_out[b->rpo] = globals;
+
+    // this block's arguments to the phis of its successors
+    IrBlock* succs[2];
+    int succ_count = ir_successors(b, succs);
+    for (int s = 0; s < succ_count; s++) {
+        for (IrInstr* phi = succs[s]->first; phi != NULL && phi->op == IR_PHI; phi = phi->next) {
+            for (int k = 0; k < phi->arg_count; k++) {
+                if (phi->phi_blocks[k] == b) {
+                    phi->args[k] = replacement(n, phi->args[k]);
+                }
+            }
+        }
+    }
+
+}
+
+// forgets what was computed in the block
+static void number_leave(IrBlock* b, void* data) {
+    Numbering* n = data;
+    while (n->log_count > n->marks[b->rpo]) {
+        hash_table_remove(n->table, n->log[--n->log_count]);
+    }
+}
+
+void ir_gvn(IrFunction* f) {
+    ir_compute_dominators(f);
+
+    int count = f->block_count;
+    Numbering n;
+    n.f = f;
+    n.marks = checked_malloc(sizeof(int) * count);
+    n.memory_out = checked_malloc(sizeof(int) * count);
+    n.globals_out = checked_malloc(sizeof(int) * count);
+
+    n.value = checked_malloc(sizeof(IrOperand) * f->temp_count);
+    for (int t = 0; t < f->temp_count; t++) {
+        n.value[t] = ir_temp(t);
+    }
+    n.table = hash_table_create(0, 0);
+    n.log = NULL;
+    n.log_count = 0;
+    n.log_capacity = 0;
+    n.epoch_count = 1;
+
+    ir_walk_dominator_tree(f, number_block, number_leave, &n);
+
+    hash_table_delete(n.table);
+    free(n.log);
+    free(n.value);
+    free(n.globals_out);
+    free(n.memory_out);
+    free(n.marks);
+}
@@ -0,0 +1,511 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "ir_opt.h"
+#include "context.h"
+#include "hash_table.h"
+#include "timing.h"
+#include "util.h"
+
+/*
+Inlining across the functions of a program. A call to a function of the
+same program is replaced by a copy of the callee's body: the arguments
+are copied into fresh temporaries standing for its parameters, every
+return becomes a copy into the call's result and a jump to the rest of
+the caller's block, and the copy is optimized along with the caller.
+
+Functions are optimized callees first, so that a callee is inlined in its
+optimized form, including what it inlined itself. The order comes from
+the strongly connected components of the call graph, which are completed
+callees first; functions calling each other, directly or through others,
+share a component and are never inlined into each other.
+
+Whether a call is inlined is decided by a cost model: the size of the
+callee, counted in IR instructions, less what the call would cost and
+what constant arguments would let fold. A call is inlined when that is at
+most the --inline-threshold, and the caller has not grown past a limit.
+
+Every optimized function is kept until the whole program is, since the
+functions calling it may inline it and reachability is only known at the
+end. But once every caller of a function is optimized and none of them
+calls it any more, having inlined it or optimized the call away, nothing
+can call it again and it is released right away.
+*/
+
+// what a call costs besides its arguments: the call and return, the
+// prologue and epilogue, and the registers saved around it
+#define INLINE_CALL_COST 8
+// moving an argument into place and out of it again in the callee
+#define INLINE_ARGUMENT_COST 2
+// callers are not inlined into past this size
+#define INLINE_CALLER_LIMIT 2000
+
+typedef struct {
+    Decl** decls;
+    IrFunction** functions;         // NULL until lowered, and once released
+    int count;
+    struct hash_table* by_name;     // index + 1 of the function with the name
+
+    int** callees;                  // per function, the indices it calls
+    int* callee_count;
+    int* component;                 // per function, its component of the call graph
+
+    // per function, once it is optimized
+    int* size;
+    int** param_uses;
+
+    // for releasing functions that can no longer be reached, when the
+    // program has a main to reach them from
+    int main;                       // its index, or -1
+    char* optimized;
+    int* waiting_callers;           // calls to it in functions not yet optimized
+    int* references;                // calls to it in optimized functions still kept
+} Program;
+
+// the function a call goes to, or -1 if it is not in the program
+static int program_lookup(Program* p, const char* name) {
+    void* found = hash_table_lookup(p->by_name, name);
+    return found ? (int)(intptr_t)found - 1 : -1;
+}
+
+//
+// the call graph
+//
+
+// the calls are taken from the AST, so that functions need not be lowered
+// before their turn comes. out is NULL while counting them.
+static int expr_callees(Program* p, Expr* e, int* out) {
+    int count = 0;
+    for (; e != NULL; e = e->right) {
+        if (e->kind == EXPR_CALL && e->left && e->left->kind == EXPR_NAME) {
+            int callee = program_lookup(p, e->left->name);
+            if (callee >= 0) {
+                if (out) out[count] = callee;
+                count++;
+            }
+        } else {
+            count += expr_callees(p, e->left, out ? out + count : NULL);
+        }
+    }
+    return count;
+}
+
+static int stmt_callees(Program* p, Stmt* s, int* out) {
+    int count = 0;
+    for (; s != NULL; s = s->next) {
+        for (Decl* d = s->kind == STMT_DECL ? s->decl : NULL; d != NULL; d = d->next) {
+            count += expr_callees(p, d->value, out ? out + count : NULL);
+        }
+        count += expr_callees(p, s->init_expr, out ? out + count : NULL);
+        count += expr_callees(p, s->expr, out ? out + count : NULL);
+        count += expr_callees(p, s->next_expr, out ? out + count : NULL);
+        count += stmt_callees(p, s->body, out ? out + count : NULL);
+        count += stmt_callees(p, s->else_body, out ? out + count : NULL);
+    }
+    return count;
+}
+
+static void collect_callees(Program* p, int i) {
+    Stmt* code = p->decls[i]->code;
+    p->callee_count[i] = stmt_callees(p, code, NULL);
+    p->callees[i] = checked_malloc(sizeof(int) * p->callee_count[i]);
+    stmt_callees(p, code, p->callees[i]);
+}
+
+// Tarjan's algorithm, with an explicit stack since call chains can be as
+// long as the program. fills in p->component and writes the functions to
+// order as their components are completed. returns how many there are.
+static int call_graph_order(Program* p, int* order) {
+    int n = p->count;
+    int* index = checked_malloc(sizeof(int) * n);
+    int* low = checked_malloc(sizeof(int) * n);
+    char* on_stack = checked_malloc(n);
+    int* stack = checked_malloc(sizeof(int) * n);
+    int* frames = checked_malloc(sizeof(int) * n);
+    int* next_edge = checked_malloc(sizeof(int) * n);
+    for (int i = 0; i < n; i++) {
+        index[i] = -1;
+        on_stack[i] = 0;
+    }
+
+    int next_index = 0;
+    int stack_count = 0;
+    int ordered = 0;
+    for (int root = 0; root < n; root++) {
+        if (p->decls[root]->type->kind != TYPE_FUNCTION || index[root] >= 0) continue;
+
+        int frame_count = 0;
+        frames[frame_count++] = root;
+        next_edge[root] = 0;
+        index[root] = low[root] = next_index++;
+        stack[stack_count++] = root;
+        on_stack[root] = 1;
+
+        while (frame_count > 0) {
+            int v = frames[frame_count - 1];
+            if (next_edge[v] < p->callee_count[v]) {
+                int w = p->callees[v][next_edge[v]++];
+                if (index[w] < 0) {
+                    frames[frame_count++] = w;
+                    next_edge[w] = 0;
+                    index[w] = low[w] = next_index++;
+                    stack[stack_count++] = w;
+                    on_stack[w] = 1;
+                } else if (on_stack[w] && index[w] < low[v]) {
+                    low[v] = index[w];
+                }
+                continue;
+            }
+
+            frame_count--;
+            if (frame_count > 0) {
+                int parent = frames[frame_count - 1];
+                if (low[v] < low[parent]) {
+                    low[parent] = low[v];
+                }
+            }
+            if (low[v] == index[v]) {
+                int w;
+                do {
+                    w = stack[--stack_count];
+                    on_stack[w] = 0;
+                    p->component[w] = v;
+                    order[ordered++] = w;
+                } while (w != v);
+            }
+        }
+    }
+
+    free(next_edge);
+    free(frames);
+    free(stack);
+    free(on_stack);
+    free(low);
+    free(index);
+    return ordered;
+}
+
+//
+// cost model
+//
+
+static int instr_size(IrInstr* in) {
+    switch (in->op) {
+        case IR_CALL:
+            return 1 + in->arg_count;
+        case IR_VECTOR:
+            return 8 + in->vector->step_count;
+        default:
+            return 1;
+    }
+}
+
+static int function_size(IrFunction* f) {
+    int size = 0;
+    for (int b = 0; b < f->block_count; b++) {
+        for (IrInstr* in = f->blocks[b]->first; in != NULL; in = in->next) {
+            size += instr_size(in);
+        }
+    }
+    return size;
+}
+
+// per parameter, how many instructions read it
+static int* count_param_uses(IrFunction* f) {
+    int* uses = checked_calloc(f->param_count + 1, sizeof(int));
+    for (int b = 0; b < f->block_count; b++) {
+        for (IrInstr* in = f->blocks[b]->first; in != NULL; in = in->next) {
+            for (int k = 0; k < ir_operand_count(in); k++) {
+                IrOperand* o = ir_operand(in, k);
+                if (o->kind == IR_OPERAND_TEMP && o->value < f->param_count) {
+                    uses[o->value]++;
+                }
+            }
+        }
+    }
+    return uses;
+}
+
+// the size of the callee less what inlining the call saves: the call
+// itself, passing the arguments, and each instruction reading a parameter
+// that is given a constant, which may then fold
+static int inline_cost(Program* p, int callee, IrInstr* call) {
+    int cost = p->size[callee] - INLINE_CALL_COST;
+    for (int k = 0; k < call->arg_count; k++) {
+        cost -= INLINE_ARGUMENT_COST;
+        if (call->args[k].kind == IR_OPERAND_CONSTANT) {
+            cost -= p->param_uses[callee][k];
+        }
+    }
+    return cost;
+}
+
+//
+// inlining
+//
+
+static IrOperand map_operand(IrOperand o, int* temps) {
+    return o.kind == IR_OPERAND_TEMP ? ir_temp(temps[o.value]) : o;
+}
+
+static IrOperand* map_operands(IrFunction* f, IrOperand* args, int count, int* temps) {
+    IrOperand* copy = arena_alloc(f->arena, sizeof(IrOperand) * (count + 1));
+    for (int k = 0; k < count; k++) {
+        copy[k] = map_operand(args[k], temps);
+    }
+    return copy;
+}
+
+// strings such as the formats of prints and vectors live in the callee's
+// arena, which goes away with the callee
+static const char* copy_string(IrFunction* f, const char* string) {
+    size_t length = strlen(string);
+    char* copy = arena_alloc(f->arena, length + 1);
+    memcpy(copy, string, length + 1);
+    return copy;
+}
+
+static IrVector* copy_vector(IrFunction* f, IrVector* vector) {
+    IrVector* copy = arena_alloc(f->arena, sizeof(IrVector));
+    *copy = *vector;
+    copy->steps = arena_alloc(f->arena, sizeof(IrVectorStep) * (vector->step_count + 1));
+    memcpy(copy->steps, vector->steps, sizeof(IrVectorStep) * vector->step_count);
+    return copy;
+}
+
+// replaces call, in f, with the body of g. g is out of SSA form. returns
+// the block with the instructions that followed the call.
+static IrBlock* inline_call(IrFunction* f, IrInstr* call, IrFunction* g) {
+    IrBlock* before = call->block;
+    IrBlock* after = ir_block_create(f);
+    while (call->next) {
+        IrInstr* in = call->next;
+        ir_remove(in);
+        ir_append(after, in);
+    }
+
+    int* temps = checked_malloc(sizeof(int) * (g->temp_count + 1));
+    for (int t = 0; t < g->temp_count; t++) {
+        temps[t] = ir_temp_create(f);
+    }
+    IrBlock** blocks = checked_malloc(sizeof(IrBlock*) * (g->next_block_id + 1));
+    IrBlock* last = before;
+    for (int b = 0; b < g->block_count; b++) {
+        blocks[g->blocks[b]->id] = ir_block_create(f);
+        ir_block_place(f, blocks[g->blocks[b]->id], last);
+        last = blocks[g->blocks[b]->id];
+    }
+    ir_block_place(f, after, last);
+
+    for (int k = 0; k < g->param_count; k++) {
+        ir_insert_before(call, ir_instr_create(f, IR_COPY, temps[k], call->args[k], ir_none()));
+    }
+    ir_remove(call);
+    IrInstr* enter = ir_instr_create(f, IR_JUMP, -1, ir_none(), ir_none());
+    enter->targets[0] = blocks[g->blocks[0]->id];
+    ir_append(before, enter);
+
+    for (int b = 0; b < g->block_count; b++) {
+        IrBlock* copy = blocks[g->blocks[b]->id];
+        for (IrInstr* in = g->blocks[b]->first; in != NULL; in = in->next) {
+            if (in->op == IR_RETURN) {
+                // a function that falls off its end returns nothing, as
+                // good as zero
+                if (call->dst >= 0) {
+                    IrOperand result = in->a.kind != IR_OPERAND_NONE ? map_operand(in->a, temps) : ir_constant(0);
+                    ir_append(copy, ir_instr_create(f, IR_COPY, call->dst, result, ir_none()));
+                }
+                IrInstr* leave = ir_instr_create(f, IR_JUMP, -1, ir_none(), ir_none());
+                leave->targets[0] = after;
+                ir_append(copy, leave);
+                continue;
+            }
+
+            int dst = in->dst >= 0 ? temps[in->dst] : -1;
+            IrInstr* c = ir_instr_create(f, in->op, dst, map_operand(in->a, temps), map_operand(in->b, temps));
+            c->c = map_operand(in->c, temps);
+            c->name = in->name;
+            if (in->string) {
+                c->string = copy_string(f, in->string);
+            }
+            if (in->arg_count > 0) {
+                c->args = map_operands(f, in->args, in->arg_count, temps);
+                c->arg_count = in->arg_count;
+            }
+            if (in->vector) {
+                c->vector = copy_vector(f, in->vector);
+            }
+            for (int k = 0; k < 2; k++) {
+                c->targets[k] = in->targets[k] ? blocks[in->targets[k]->id] : NULL;
+            }
+            ir_append(copy, c);
+        }
+    }
+
+    free(blocks);
+    free(temps);
+    return after;
+}
+
+// inlines the calls in the function i that the cost model allows
+static void inline_calls(Program* p, int i) {
+    IrFunction* f = p->functions[i];
+    int threshold = current_context->inline_threshold;
+    int size = function_size(f);
+    int inlined = 0;
+
+    for (int b = 0; b < f->block_count && size < INLINE_CALLER_LIMIT; b++) {
+        for (IrInstr* in = f->blocks[b]->first; in != NULL; in = in->next) {
+            if (in->op != IR_CALL) continue;
+            int callee = program_lookup(p, in->name);
+            if (callee < 0 || p->component[callee] == p->component[i]) continue;
+            IrFunction* g = p->functions[callee];
+            if (!g || !g->defined || g->param_count != in->arg_count || inline_cost(p, callee, in) > threshold) continue;
+
+            size += p->size[callee] - instr_size(in);
+            IrBlock* after = inline_call(f, in, g);
+            inlined = 1;
+
+            // what was inlined has been through this already, carry on
+            // after it
+            while (f->blocks[b] != after) b++;
+            b--;
+            break;
+        }
+    }
+
+    if (inlined) {
+        ir_compute_predecessors(f);
+        ir_verify(f);
+    }
+}
+
+//
+// releasing functions early
+//
+
+// adds delta to the references of every function f calls
+static void count_references(Program* p, IrFunction* f, int delta) {
+    for (int b = 0; b < f->block_count; b++) {
+        for (IrInstr* in = f->blocks[b]->first; in != NULL; in = in->next) {
+            int callee = in->op == IR_CALL ? program_lookup(p, in->name) : -1;
+            if (callee >= 0) {
+                p->references[callee] += delta;
+            }
+        }
+    }
+}
+
+static int unreachable(Program* p, int i) {
+    return p->main >= 0 && i != p->main && p->functions[i] && p->optimized[i]
+        && p->waiting_callers[i] == 0 && p->references[i] == 0;
+}
+
+// deletes the function i if nothing can call it any more, and then the
+// functions only it called. a function leaves p->functions when it is
+// put on the worklist, which has room for every function.
+static void release_unreachable(Program* p, int i, IrFunction** worklist) {
+    int pending = 0;
+    if (unreachable(p, i)) {
+        worklist[pending++] = p->functions[i];
+        p->functions[i] = NULL;
+    }
+    while (pending > 0) {
+        IrFunction* f = worklist[--pending];
+        count_references(p, f, -1);
+        for (int b = 0; b < f->block_count; b++) {
+            for (IrInstr* in = f->blocks[b]->first; in != NULL; in = in->next) {
+                int callee = in->op == IR_CALL ? program_lookup(p, in->name) : -1;
+                if (callee >= 0 && unreachable(p, callee)) {
+                    worklist[pending++] = p->functions[callee];
+                    p->functions[callee] = NULL;
+                }
+            }
+        }
+        ir_function_delete(f);
+    }
+}
+
+void ir_optimize_program(Decl** decls, IrFunction** functions, int count) {
+    Program p;
+    p.decls = decls;
+    p.functions = functions;
+    p.count = count;
+    p.by_name = hash_table_create(0, 0);
+    p.callees = checked_malloc(sizeof(int*) * (count + 1));
+    p.callee_count = checked_malloc(sizeof(int) * (count + 1));
+    p.component = checked_malloc(sizeof(int) * (count + 1));
+    p.size = checked_malloc(sizeof(int) * (count + 1));
+    p.param_uses = checked_malloc(sizeof(int*) * (count + 1));
+    p.optimized = checked_malloc(count + 1);
+    p.waiting_callers = checked_malloc(sizeof(int) * (count + 1));
+    p.references = checked_malloc(sizeof(int) * (count + 1));
+    int* order = checked_malloc(sizeof(int) * (count + 1));
+    IrFunction** worklist = checked_malloc(sizeof(IrFunction*) * (count + 1));
+
+    for (int i = 0; i < count; i++) {
+        p.callees[i] = NULL;
+        p.callee_count[i] = 0;
+        p.param_uses[i] = NULL;
+        p.optimized[i] = 0;
+        p.waiting_callers[i] = 0;
+        p.references[i] = 0;
+        functions[i] = NULL;
+        if (decls[i]->type->kind == TYPE_FUNCTION) {
+            hash_table_insert(p.by_name, decls[i]->name, (void*)(intptr_t)(i + 1));
+        }
+    }
+    p.main = program_lookup(&p, "main");
+    for (int i = 0; i < count; i++) {
+        if (decls[i]->type->kind == TYPE_FUNCTION) {
+            collect_callees(&p, i);
+            for (int k = 0; k < p.callee_count[i]; k++) {
+                p.waiting_callers[p.callees[i][k]]++;
+            }
+        }
+    }
+
+    int ordered = call_graph_order(&p, order);
+    for (int k = 0; k < ordered; k++) {
+        int i = order[k];
+        timing_begin(decls[i]->name);
+        functions[i] = ir_lower(decls[i]);
+        ir_verify(functions[i]);
+        if (current_context->inline_threshold > 0) {
+            inline_calls(&p, i);
+        }
+        ir_optimize(functions[i]);
+        // kept until the whole program is optimized, unless released
+        functions[i] = ir_function_compact(functions[i]);
+        p.size[i] = function_size(functions[i]);
+        p.param_uses[i] = count_param_uses(functions[i]);
+        p.optimized[i] = 1;
+
+        count_references(&p, functions[i], 1);
+        for (int c = 0; c < p.callee_count[i]; c++) {
+            int callee = p.callees[i][c];
+            p.waiting_callers[callee]--;
+            release_unreachable(&p, callee, worklist);
+        }
+        release_unreachable(&p, i, worklist);
+        timing_end();
+    }
+
+    for (int i = 0; i < count; i++) {
+        free(p.param_uses[i]);
+        free(p.callees[i]);
+    }
+    free(worklist);
+    free(order);
+    free(p.references);
+    free(p.waiting_callers);
+    free(p.optimized);
+    free(p.param_uses);
+    free(p.size);
+    free(p.component);
+    free(p.callee_count);
+    free(p.callees);
+    hash_table_delete(p.by_name);
+}
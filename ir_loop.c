@@ -0,0 +1,583 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ir_opt.h"
+#include "util.h"
+
+/*
+Loop optimization in SSA form. A block heads a loop when blocks it
+dominates jump back to it, and its natural loop is every block that
+reaches one of those back edges without going through it. Each header is
+first given a preheader: a block that is the only way into the loop from
+outside and jumps straight to the header.
+
+Loops are then visited from the innermost out. An instruction whose
+operands do not change in the loop, and that neither traps nor reads
+memory the loop may store to, moves to the preheader and runs once;
+leaving an inner loop may make it invariant in the loop around it too.
+Then a multiplication of an induction variable, a header phi stepped by
+an invariant amount on every iteration, by an invariant becomes an
+induction variable of its own, stepped by the product: the i * n of a
+subscript a[i * n + j] is kept up to date with one addition.
+*/
+
+typedef struct {
+    IrBlock* header;
+    IrBlock* preheader;
+    IrBlock* latch;         // the only block in the loop jumping to the header, or NULL
+    IrBlock** blocks;       // in reverse postorder, the header first
+    int block_count;
+} Loop;
+
+typedef struct {
+    IrFunction* f;
+    Loop* loops;
+    int loop_count;
+
+    int* mark;              // per block id: the loop whose blocks were marked last
+    IrBlock** stack;        // for walking back from the latches
+    IrBlock** found;        // the blocks of the loop being collected
+    int current;            // the loop being optimized
+
+    // per temporary, grown as temporaries are created
+    IrBlock** def_block;    // NULL for parameters
+    int* replacement;       // the temporary that replaces a removed one, or -1
+    int temp_capacity;
+} LoopState;
+
+static int is_header(IrBlock* b) {
+    for (int k = 0; k < b->pred_count; k++) {
+        if (ir_dominates(b, b->preds[k])) return 1;
+    }
+    return 0;
+}
+
+//
+// preheaders
+//
+
+// moves the arguments of the phis of h that come from outside the loop,
+// which are no longer predecessors of h, to pre: directly if there is one,
+// into a phi of pre otherwise
+static void move_phi_arguments(IrFunction* f, IrBlock* h, IrBlock* pre) {
+    for (IrInstr* phi = h->first; phi != NULL && phi->op == IR_PHI; phi = phi->next) {
+        IrInstr* merged = pre->pred_count > 1 ? ir_phi_create(f, pre, ir_temp_create(f)) : NULL;
+        IrOperand from_outside = ir_none();
+        int kept = 0;
+        for (int j = 0; j < phi->arg_count; j++) {
+            IrBlock* source = phi->phi_blocks[j];
+            if (ir_dominates(h, source)) {
+                phi->args[kept] = phi->args[j];
+                phi->phi_blocks[kept] = source;
+                kept++;
+                continue;
+            }
+            from_outside = phi->args[j];
+            for (int m = 0; merged && m < merged->arg_count; m++) {
+                if (merged->phi_blocks[m] == source && merged->args[m].kind == IR_OPERAND_NONE) {
+                    merged->args[m] = from_outside;
+                    break;
+                }
+            }
+        }
+        // there was at least one argument from outside, so this fits
+        phi->args[kept] = merged ? ir_temp(merged->dst) : from_outside;
+        phi->phi_blocks[kept] = pre;
+        phi->arg_count = kept + 1;
+        if (merged) {
+            ir_append(pre, merged);
+        }
+    }
+}
+
+// gives every loop header that needs one a new preheader, laid out right
+// before it
+static void add_preheaders(IrFunction* f) {
+    ir_compute_dominators(f);
+    int first_new = f->next_block_id;
+    int added = 0;
+
+    for (int i = 0; i < f->block_count; i++) {
+        IrBlock* h = f->blocks[i];
+        if (!is_header(h)) continue;
+
+        int outside = 0;
+        IrBlock* only = NULL;
+        for (int k = 0; k < h->pred_count; k++) {
+            if (!ir_dominates(h, h->preds[k])) {
+                outside++;
+                only = h->preds[k];
+            }
+        }
+        if (outside == 1 && only->last->op == IR_JUMP) continue;
+
+        IrBlock* pre = ir_block_create(f);
+        pre->preds = arena_alloc(f->arena, sizeof(IrBlock*) * outside);
+        pre->pred_capacity = outside;
+        int kept = 0;
+        for (int k = 0; k < h->pred_count; k++) {
+            IrBlock* p = h->preds[k];
+            if (ir_dominates(h, p)) {
+                h->preds[kept++] = p;
+                continue;
+            }
+            pre->preds[pre->pred_count++] = p;
+            for (int j = 0; j < 2; j++) {
+                if (p->last->targets[j] == h) p->last->targets[j] = pre;
+            }
+        }
+        h->preds[kept++] = pre;
+        h->pred_count = kept;
+
+        move_phi_arguments(f, h, pre);
+        IrInstr* jump = ir_instr_create(f, IR_JUMP, -1, ir_none(), ir_none());
+        jump->targets[0] = h;
+        ir_append(pre, jump);
+        added++;
+    }
+    if (added == 0) return;
+
+    IrBlock** blocks = arena_alloc(f->arena, sizeof(IrBlock*) * (f->block_count + added));
+    int count = 0;
+    for (int i = 0; i < f->block_count; i++) {
+        IrBlock* b = f->blocks[i];
+        for (int k = 0; k < b->pred_count; k++) {
+            if (b->preds[k]->id >= first_new) blocks[count++] = b->preds[k];
+        }
+        blocks[count++] = b;
+    }
+    f->blocks = blocks;
+    f->block_count = count;
+    f->block_capacity = count;
+    ir_compute_predecessors(f);
+}
+
+//
+// finding loops
+//
+
+static int compare_rpo(const void* a, const void* b) {
+    return (*(IrBlock* const*)a)->rpo - (*(IrBlock* const*)b)->rpo;
+}
+
+static int compare_size(const void* a, const void* b) {
+    return ((const Loop*)a)->block_count - ((const Loop*)b)->block_count;
+}
+
+// the natural loop of h, marking its blocks with index
+static void collect_loop(LoopState* s, IrBlock* h, int index, Loop* loop) {
+    IrBlock** stack = s->stack;
+    int depth = 0;
+
+    loop->header = h;
+    loop->preheader = NULL;
+    loop->latch = NULL;
+    loop->blocks = s->found;
+    loop->block_count = 0;
+
+    s->mark[h->id] = index;
+    loop->blocks[loop->block_count++] = h;
+    int latches = 0;
+    for (int k = 0; k < h->pred_count; k++) {
+        IrBlock* p = h->preds[k];
+        if (!ir_dominates(h, p)) {
+            loop->preheader = p;
+            continue;
+        }
+        loop->latch = p;
+        latches++;
+        if (s->mark[p->id] != index) {
+            s->mark[p->id] = index;
+            stack[depth++] = p;
+        }
+    }
+    if (latches > 1) {
+        loop->latch = NULL;
+    }
+
+    while (depth > 0) {
+        IrBlock* b = stack[--depth];
+        loop->blocks[loop->block_count++] = b;
+        for (int k = 0; k < b->pred_count; k++) {
+            IrBlock* p = b->preds[k];
+            if (s->mark[p->id] != index) {
+                s->mark[p->id] = index;
+                stack[depth++] = p;
+            }
+        }
+    }
+    qsort(loop->blocks, loop->block_count, sizeof(IrBlock*), compare_rpo);
+    loop->blocks = checked_malloc(sizeof(IrBlock*) * loop->block_count);
+    memcpy(loop->blocks, s->found, sizeof(IrBlock*) * loop->block_count);
+}
+
+// every loop of f, innermost first
+static void find_loops(LoopState* s) {
+    IrFunction* f = s->f;
+    ir_compute_dominators(f);
+
+    s->loops = checked_malloc(sizeof(Loop) * f->block_count);
+    s->loop_count = 0;
+    s->stack = checked_malloc(sizeof(IrBlock*) * f->block_count);
+    s->found = checked_malloc(sizeof(IrBlock*) * f->block_count);
+    for (int i = 0; i < f->block_count; i++) {
+        IrBlock* h = f->blocks[i];
+        if (!is_header(h)) continue;
+        collect_loop(s, h, s->loop_count, &s->loops[s->loop_count]);
+        s->loop_count++;
+    }
+    // a loop inside another has fewer blocks
+    qsort(s->loops, s->loop_count, sizeof(Loop), compare_size);
+    free(s->stack);
+    free(s->found);
+    for (int i = 0; i < f->next_block_id; i++) {
+        s->mark[i] = -1;
+    }
+}
+
+//
+// invariant code motion
+//
+
+static void ensure_temps(LoopState* s) {
+    int count = s->f->temp_count;
+    if (count <= s->temp_capacity) return;
+
+    int capacity = s->temp_capacity * 2 > count ? s->temp_capacity * 2 : count;
+    s->def_block = checked_realloc(s->def_block, sizeof(IrBlock*) * capacity);
+    s->replacement = checked_realloc(s->replacement, sizeof(int) * capacity);
+    for (int t = s->temp_capacity; t < capacity; t++) {
+        s->def_block[t] = NULL;
+        s->replacement[t] = -1;
+    }
+    s->temp_capacity = capacity;
+}
+
+static int in_loop(LoopState* s, IrBlock* b) {
+    return b != NULL && s->mark[b->id] == s->current;
+}
+
+static int is_invariant(LoopState* s, IrOperand o) {
+    return o.kind != IR_OPERAND_TEMP || !in_loop(s, s->def_block[o.value]);
+}
+
+// what the loop does to memory, which decides the loads that may move
+typedef struct {
+    int has_call;
+    int has_store;
+    const char** stored_globals;
+    int stored_global_count;
+    IrBlock** exiting;      // blocks with a successor outside the loop
+    int exiting_count;
+} LoopEffects;
+
+static void loop_effects(LoopState* s, Loop* loop, LoopEffects* e) {
+    memset(e, 0, sizeof(*e));
+    int global_capacity = 0;
+    e->exiting = checked_malloc(sizeof(IrBlock*) * loop->block_count);
+
+    for (int i = 0; i < loop->block_count; i++) {
+        IrBlock* b = loop->blocks[i];
+        for (IrInstr* in = b->first; in != NULL; in = in->next) {
+            if (in->op == IR_CALL) {
+                e->has_call = 1;
+            } else if (in->op == IR_STORE || (in->op == IR_VECTOR && in->vector->kind == IR_VECTOR_STORE)) {
+                e->has_store = 1;
+            } else if (in->op == IR_STORE_GLOBAL) {
+                if (e->stored_global_count == global_capacity) {
+                    global_capacity = global_capacity ? 2 * global_capacity : 8;
+                    e->stored_globals = checked_realloc(e->stored_globals, sizeof(const char*) * global_capacity);
+                }
+                e->stored_globals[e->stored_global_count++] = in->name;
+            }
+        }
+        IrBlock* succs[2];
+        int succ_count = ir_successors(b, succs);
+        for (int k = 0; k < succ_count; k++) {
+            if (!in_loop(s, succs[k])) {
+                e->exiting[e->exiting_count++] = b;
+                break;
+            }
+        }
+    }
+}
+
+static int stores_global(LoopEffects* e, const char* name) {
+    for (int i = 0; i < e->stored_global_count; i++) {
+        // names are interned
+        if (e->stored_globals[i] == name) return 1;
+    }
+    return 0;
+}
+
+// whether b runs on every trip into the loop before it can be left, so
+// that what b does may as well be done on the way in
+static int runs_before_exit(LoopEffects* e, IrBlock* b) {
+    for (int i = 0; i < e->exiting_count; i++) {
+        if (!ir_dominates(b, e->exiting[i])) return 0;
+    }
+    return 1;
+}
+
+// whether in may run once before the loop instead of where it is, given
+// that its operands are invariant. strings and addresses are not moved:
+// they cost no more to compute again than a register held across the
+// loop.
+static int is_hoistable(LoopEffects* e, IrInstr* in) {
+    switch (in->op) {
+        case IR_COPY:
+        case IR_ADD:
+        case IR_SUB:
+        case IR_MUL:
+        case IR_NEG:
+        case IR_NOT:
+        case IR_EQ:
+        case IR_NE:
+        case IR_GT:
+        case IR_GE:
+        case IR_LT:
+        case IR_LE:
+        case IR_SELECT:
+            return 1;
+        case IR_DIV:
+        case IR_MOD:
+            // only divisions that can not trap run where they did not before
+            return in->b.kind == IR_OPERAND_CONSTANT && in->b.value != 0 && in->b.value != -1;
+        case IR_LOAD_GLOBAL:
+            return !e->has_call && !stores_global(e, in->name);
+        case IR_LOAD:
+            // an address is only known to be valid where the load ran anyway
+            return !e->has_call && !e->has_store && runs_before_exit(e, in->block);
+        default:
+            return 0;
+    }
+}
+
+static void hoist_invariants(LoopState* s, Loop* loop, LoopEffects* e) {
+    IrBlock* pre = loop->preheader;
+    for (int i = 0; i < loop->block_count; i++) {
+        IrInstr* next;
+        for (IrInstr* in = loop->blocks[i]->first; in != NULL; in = next) {
+            next = in->next;
+            if (in->op == IR_PHI || in->dst < 0 || !is_hoistable(e, in)) continue;
+
+            int invariant = 1;
+            for (int k = 0; k < ir_operand_count(in) && invariant; k++) {
+                invariant = is_invariant(s, *ir_operand(in, k));
+            }
+            if (!invariant) continue;
+
+            ir_remove(in);
+            ir_insert_before(pre->last, in);
+            s->def_block[in->dst] = pre;
+        }
+    }
+}
+
+//
+// induction variables
+//
+
+typedef struct {
+    int phi;                // the value in the current iteration
+    IrOperand initial;      // from the preheader
+    IrOperand step;         // added to phi on every iteration, subtracted if negated
+    int negated;
+    IrInstr* update;        // the next value, phi + step
+} InductionVariable;
+
+// whether phi, in the header of loop, is an induction variable
+static int induction_variable(LoopState* s, Loop* loop, IrInstr* phi, InductionVariable* iv) {
+    if (phi->arg_count != 2) return 0;
+
+    IrOperand next = ir_none();
+    iv->initial = ir_none();
+    for (int k = 0; k < 2; k++) {
+        if (phi->phi_blocks[k] == loop->latch) {
+            next = phi->args[k];
+        } else {
+            iv->initial = phi->args[k];
+        }
+    }
+    if (next.kind != IR_OPERAND_TEMP || iv->initial.kind == IR_OPERAND_NONE) return 0;
+
+    IrBlock* b = s->def_block[next.value];
+    if (!in_loop(s, b)) return 0;
+    IrInstr* update = NULL;
+    for (IrInstr* in = b->first; in != NULL; in = in->next) {
+        if (in->dst == next.value) update = in;
+    }
+    if (!update) return 0;
+
+    iv->phi = phi->dst;
+    iv->update = update;
+    if (update->op == IR_ADD && ir_is_temp(update->a, phi->dst) && is_invariant(s, update->b)) {
+        iv->step = update->b;
+        iv->negated = 0;
+        return 1;
+    }
+    if (update->op == IR_ADD && ir_is_temp(update->b, phi->dst) && is_invariant(s, update->a)) {
+        iv->step = update->a;
+        iv->negated = 0;
+        return 1;
+    }
+    if (update->op == IR_SUB && ir_is_temp(update->a, phi->dst) && is_invariant(s, update->b)) {
+        iv->step = update->b;
+        iv->negated = 1;
+        return 1;
+    }
+    return 0;
+}
+
+// a * b, computed in the preheader unless a constant makes that needless
+static IrOperand product_before_loop(LoopState* s, Loop* loop, IrOperand a, IrOperand b) {
+    if (a.kind == IR_OPERAND_CONSTANT && b.kind == IR_OPERAND_CONSTANT) {
+        return ir_constant((long)((unsigned long)a.value * (unsigned long)b.value));
+    }
+    if (b.kind == IR_OPERAND_CONSTANT) {
+        IrOperand swap = a;
+        a = b;
+        b = swap;
+    }
+    if (a.kind == IR_OPERAND_CONSTANT && (a.value == 0 || a.value == 1)) {
+        return a.value ? b : a;
+    }
+    int t = ir_temp_create(s->f);
+    ir_insert_before(loop->preheader->last, ir_instr_create(s->f, IR_MUL, t, a, b));
+    ensure_temps(s);
+    s->def_block[t] = loop->preheader;
+    return ir_temp(t);
+}
+
+// replaces in, iv * factor, by a new induction variable
+static void reduce_multiplication(LoopState* s, Loop* loop, InductionVariable* iv, IrOperand factor, IrInstr* in) {
+    IrFunction* f = s->f;
+    IrOperand initial = product_before_loop(s, loop, iv->initial, factor);
+    IrOperand step = product_before_loop(s, loop, iv->step, factor);
+
+    int value = ir_temp_create(f);
+    int next = ir_temp_create(f);
+    ensure_temps(s);
+
+    IrInstr* phi = ir_phi_create(f, loop->header, value);
+    for (int k = 0; k < phi->arg_count; k++) {
+        phi->args[k] = phi->phi_blocks[k] == loop->preheader ? initial : ir_temp(next);
+    }
+    ir_insert_before(loop->header->first, phi);
+    s->def_block[value] = loop->header;
+
+    IrOpcode_t op = iv->negated ? IR_SUB : IR_ADD;
+    ir_insert_before(iv->update->next, ir_instr_create(f, op, next, ir_temp(value), step));
+    s->def_block[next] = iv->update->block;
+
+    s->replacement[in->dst] = value;
+    ir_remove(in);
+}
+
+static void reduce_strength(LoopState* s, Loop* loop) {
+    if (!loop->latch) return;
+
+    int iv_count = 0;
+    int iv_capacity = 0;
+    InductionVariable* ivs = NULL;
+    for (IrInstr* phi = loop->header->first; phi != NULL && phi->op == IR_PHI; phi = phi->next) {
+        if (iv_count == iv_capacity) {
+            iv_capacity = iv_capacity ? 2 * iv_capacity : 4;
+            ivs = checked_realloc(ivs, sizeof(InductionVariable) * iv_capacity);
+        }
+        if (induction_variable(s, loop, phi, &ivs[iv_count])) {
+            iv_count++;
+        }
+    }
+
+    for (int i = 0; i < loop->block_count && iv_count > 0; i++) {
+        IrInstr* next;
+        for (IrInstr* in = loop->blocks[i]->first; in != NULL; in = next) {
+            next = in->next;
+            if (in->op != IR_MUL) continue;
+            for (int v = 0; v < iv_count; v++) {
+                if (ir_is_temp(in->a, ivs[v].phi) && is_invariant(s, in->b)) {
+                    reduce_multiplication(s, loop, &ivs[v], in->b, in);
+                    break;
+                }
+                if (ir_is_temp(in->b, ivs[v].phi) && is_invariant(s, in->a)) {
+                    reduce_multiplication(s, loop, &ivs[v], in->a, in);
+                    break;
+                }
+            }
+        }
+    }
+    free(ivs);
+}
+
+// points the uses of removed multiplications at the induction variables
+// that replace them
+static void replace_uses(LoopState* s) {
+    IrFunction* f = s->f;
+    for (int i = 0; i < f->block_count; i++) {
+        for (IrInstr* in = f->blocks[i]->first; in != NULL; in = in->next) {
+            for (int k = 0; k < ir_operand_count(in); k++) {
+                IrOperand* o = ir_operand(in, k);
+                while (o->kind == IR_OPERAND_TEMP && o->value < s->temp_capacity && s->replacement[o->value] >= 0) {
+                    o->value = s->replacement[o->value];
+                }
+            }
+        }
+    }
+}
+
+void ir_loops(IrFunction* f) {
+    add_preheaders(f);
+
+    LoopState s;
+    memset(&s, 0, sizeof(s));
+    s.f = f;
+    s.mark = checked_malloc(sizeof(int) * f->next_block_id);
+    for (int i = 0; i < f->next_block_id; i++) {
+        s.mark[i] = -1;
+    }
+    find_loops(&s);
+    if (s.loop_count == 0) {
+        free(s.loops);
+        free(s.mark);
+        return;
+    }
+
+    ensure_temps(&s);
+    for (int i = 0; i < f->block_count; i++) {
+        for (IrInstr* in = f->blocks[i]->first; in != NULL; in = in->next) {
+            if (in->dst >= 0) s.def_block[in->dst] = f->blocks[i];
+        }
+    }
+
+    int reduced = 0;
+    for (int l = 0; l < s.loop_count; l++) {
+        Loop* loop = &s.loops[l];
+        s.current = l;
+        for (int i = 0; i < loop->block_count; i++) {
+            s.mark[loop->blocks[i]->id] = l;
+        }
+
+        LoopEffects e;
+        loop_effects(&s, loop, &e);
+        hoist_invariants(&s, loop, &e);
+        int temps_before = f->temp_count;
+        reduce_strength(&s, loop);
+        reduced |= f->temp_count != temps_before;
+
+        free(e.stored_globals);
+        free(e.exiting);
+    }
+    if (reduced) {
+        replace_uses(&s);
+    }
+
+    for (int l = 0; l < s.loop_count; l++) {
+        free(s.loops[l].blocks);
+    }
+    free(s.loops);
+    free(s.mark);
+    free(s.def_block);
+    free(s.replacement);
+}
@@ -0,0 +1,1385 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "ir.h"
+#include "symbol.h"
+#include "type.h"
+#include "expr.h"
+#include "stmt.h"
+#include "decl.h"
+#include "param_list.h"
+#include "context.h"
+#include "hash_table.h"
+#include "util.h"
+
+// where lowering appends instructions
+typedef struct {
+    IrFunction* f;
+    IrBlock* block;
+
+    // the StmtFacts of statements measured for loop unrolling, keyed by
+    // the Stmt pointer. created on first use.
+    struct hash_table* stmt_facts;
+} Lowering;
+
+static IrOperand expr_lower(Lowering* l, Expr* e);
+static void stmt_lower(Lowering* l, Stmt* s);
+
+//
+// evaluation order
+//
+
+static int is_reassociable(Expr_t kind) {
+    // integer arithmetic wraps, so these are exactly associative
+    return kind == EXPR_ADD || kind == EXPR_MUL;
+}
+
+// rewrites a op (b op c) into (a op b) op c, repeatedly, so that chains of
+// an associative operator lean left and need two registers instead of one
+// per operand. the operands stay in source order.
+static void expr_reassociate(Expr* e) {
+    while (e->right && e->right->kind == e->kind) {
+        Expr* r = e->right;
+        Expr* c = r->right;
+        r->right = r->left;
+        r->left = e->left;
+        e->left = r;
+        e->right = c;
+    }
+}
+
+// computes registers_needed and has_side_effects for e and its
+// subexpressions, reassociating on the way. registers_needed is the
+// Sethi-Ullman number: a binary operator whose operands need l and r
+// registers needs max(l, r) if they differ, since the heavier side can go
+// first, and l+1 otherwise.
+static void expr_label(Expr* e) {
+    if (!e || e->registers_needed) return;
+
+    if (is_reassociable(e->kind)) {
+        expr_reassociate(e);
+    }
+    expr_label(e->left);
+    expr_label(e->right);
+
+    int l = e->left ? e->left->registers_needed : 0;
+    int r = e->right ? e->right->registers_needed : 0;
+
+    e->has_side_effects = (e->left && e->left->has_side_effects) ||
+                          (e->right && e->right->has_side_effects);
+
+    switch (e->kind) {
+        case EXPR_NAME:
+        case EXPR_STRING_LITERAL:
+        case EXPR_CHAR_LITERAL:
+        case EXPR_INTEGER_LITERAL:
+        case EXPR_BOOLEAN_LITERAL:
+        case EXPR_INIT_LIST:
+            e->registers_needed = 1;
+            break;
+        case EXPR_NEGATE:
+        case EXPR_LOGICAL_NOT:
+            e->registers_needed = l;
+            break;
+        case EXPR_ASSIGN:
+            e->registers_needed = r;
+            e->has_side_effects = 1;
+            break;
+        case EXPR_INCREMENT:
+        case EXPR_DECREMENT:
+            e->registers_needed = 1;
+            e->has_side_effects = 1;
+            break;
+        case EXPR_CALL:
+            e->registers_needed = r;
+            e->has_side_effects = 1;
+            break;
+        case EXPR_ARG:
+            // the later arguments are evaluated first and held
+            e->registers_needed = r ? (l > r ? l : r) + 1 : l;
+            break;
+        case EXPR_SUBSCRIPT:
+            // the index, then the address of the array next to it
+            e->registers_needed = r > 2 ? r : 2;
+            break;
+        default:
+            e->registers_needed = l == r ? l + 1 : (l > r ? l : r);
+            break;
+    }
+    if (e->registers_needed < 1) {
+        e->registers_needed = 1;
+    }
+}
+
+//
+// building blocks
+//
+
+// makes b the block that instructions are appended to, placing it after
+// the blocks lowered so far
+static void block_start(Lowering* l, IrBlock* b) {
+    ir_block_place(l->f, b, NULL);
+    l->block = b;
+}
+
+static IrInstr* emit(Lowering* l, IrOpcode_t op, int dst, IrOperand a, IrOperand b) {
+    IrInstr* in = ir_instr_create(l->f, op, dst, a, b);
+    ir_append(l->block, in);
+    return in;
+}
+
+// dst = op a, b in a new temporary
+static IrOperand emit_value(Lowering* l, IrOpcode_t op, IrOperand a, IrOperand b) {
+    int t = ir_temp_create(l->f);
+    emit(l, op, t, a, b);
+    return ir_temp(t);
+}
+
+static void emit_jump(Lowering* l, IrBlock* target) {
+    IrInstr* in = emit(l, IR_JUMP, -1, ir_none(), ir_none());
+    in->targets[0] = target;
+}
+
+static void emit_branch(Lowering* l, IrOperand condition, IrBlock* if_true, IrBlock* if_false) {
+    if (condition.kind == IR_OPERAND_CONSTANT) {
+        emit_jump(l, condition.value ? if_true : if_false);
+        return;
+    }
+    IrInstr* in = emit(l, IR_BRANCH, -1, condition, ir_none());
+    in->targets[0] = if_true;
+    in->targets[1] = if_false;
+}
+
+static IrOperand emit_address(Lowering* l, const char* name) {
+    IrOperand a = emit_value(l, IR_ADDRESS, ir_none(), ir_none());
+    l->block->last->name = name;
+    return a;
+}
+
+static IrOperand emit_string(Lowering* l, const char* string) {
+    IrOperand a = emit_value(l, IR_STRING, ir_none(), ir_none());
+    l->block->last->string = string;
+    return a;
+}
+
+static int is_variable(Lowering* l, IrOperand o) {
+    return o.kind == IR_OPERAND_TEMP && o.value < l->f->variable_count;
+}
+
+// o, copied out of its variable if later, which is evaluated while o is
+// held, might assign to it
+static IrOperand hold(Lowering* l, IrOperand o, int later_has_side_effects) {
+    if (is_variable(l, o) && later_has_side_effects) {
+        return emit_value(l, IR_COPY, o, ir_none());
+    }
+    return o;
+}
+
+// variable = value. a value that was just computed into a new temporary is
+// computed into the variable instead.
+static IrOperand assign_variable(Lowering* l, int variable, IrOperand value) {
+    IrInstr* last = l->block->last;
+    if (value.kind == IR_OPERAND_TEMP && !is_variable(l, value)
+        && last && !ir_is_terminator(last->op) && last->dst == value.value
+    ) {
+        last->dst = variable;
+    } else if (!ir_is_temp(value, variable)) {
+        emit(l, IR_COPY, variable, value, ir_none());
+    }
+    return ir_temp(variable);
+}
+
+//
+// expressions
+//
+
+static IrOpcode_t binary_opcode(Expr_t kind) {
+    switch (kind) {
+        case EXPR_ADD:
+            return IR_ADD;
+        case EXPR_SUB:
+            return IR_SUB;
+        case EXPR_MUL:
+            return IR_MUL;
+        case EXPR_DIV:
+            return IR_DIV;
+        case EXPR_MODULO:
+            return IR_MOD;
+        case EXPR_CMP_EQUAL:
+            return IR_EQ;
+        case EXPR_CMP_NOT_EQUAL:
+            return IR_NE;
+        case EXPR_CMP_GT:
+            return IR_GT;
+        case EXPR_CMP_GT_EQUAL:
+            return IR_GE;
+        case EXPR_CMP_LT:
+            return IR_LT;
+        case EXPR_CMP_LT_EQUAL:
+            return IR_LE;
+        default:
+            fprintf(current_context->messages, "Error: %d is not a binary operator.\n", kind);
+            assert(0);
+    }
+}
+
+// evaluates both operands of e, the one that needs more registers first
+// while nothing else is held. operands that have side effects are always
+// evaluated left to right.
+static IrOperand binary_lower(Lowering* l, Expr* e) {
+    IrOperand a;
+    IrOperand b;
+    if (e->right->registers_needed > e->left->registers_needed &&
+        !e->left->has_side_effects && !e->right->has_side_effects) {
+        b = expr_lower(l, e->right);
+        a = expr_lower(l, e->left);
+    } else {
+        a = hold(l, expr_lower(l, e->left), e->right->has_side_effects);
+        b = expr_lower(l, e->right);
+    }
+    return emit_value(l, binary_opcode(e->kind), a, b);
+}
+
+// a ^ n for a constant n, as a chain of multiplications: for each bit of n
+// below the top one the result is squared, and multiplied by a if the bit
+// is set
+static IrOperand power_chain_lower(Lowering* l, IrOperand a, long n) {
+    int top = 0;
+    while ((n >> top) > 1) {
+        top++;
+    }
+    IrOperand result = a;
+    for (int bit = top - 1; bit >= 0; bit--) {
+        result = emit_value(l, IR_MUL, result, result);
+        if ((n >> bit) & 1) {
+            result = emit_value(l, IR_MUL, result, a);
+        }
+    }
+    return result;
+}
+
+// a ^ n by squaring in a loop over the bits of n, lowest first. the result
+// is multiplied by the current square with a select, not a branch, when the
+// bit is set.
+static IrOperand power_loop_lower(Lowering* l, IrOperand a, IrOperand n) {
+    int result = ir_temp_create(l->f);
+    int square = ir_temp_create(l->f);
+    int exponent = ir_temp_create(l->f);
+    IrBlock* body_block = ir_block_create(l->f);
+    IrBlock* done_block = ir_block_create(l->f);
+
+    // rotated like a for loop: exponent > 0 is tested once on the way in
+    // and then at the bottom of the body
+    emit(l, IR_COPY, result, ir_constant(1), ir_none());
+    emit(l, IR_COPY, square, a, ir_none());
+    emit(l, IR_COPY, exponent, n, ir_none());
+    emit_branch(l, emit_value(l, IR_GT, ir_temp(exponent), ir_constant(0)), body_block, done_block);
+
+    block_start(l, body_block);
+    IrOperand odd = emit_value(l, IR_MOD, ir_temp(exponent), ir_constant(2));
+    IrOperand product = emit_value(l, IR_MUL, ir_temp(result), ir_temp(square));
+    emit(l, IR_SELECT, result, odd, product)->c = ir_temp(result);
+    emit(l, IR_MUL, square, ir_temp(square), ir_temp(square));
+    emit(l, IR_DIV, exponent, ir_temp(exponent), ir_constant(2));
+    emit_branch(l, emit_value(l, IR_GT, ir_temp(exponent), ir_constant(0)), body_block, done_block);
+
+    block_start(l, done_block);
+    return ir_temp(result);
+}
+
+// a ^ n. exponents that are not positive give 1, as in fold.c.
+static IrOperand power_lower(Lowering* l, Expr* e) {
+    IrOperand a = hold(l, expr_lower(l, e->left), e->right->has_side_effects);
+    IrOperand n = expr_lower(l, e->right);
+    if (n.kind != IR_OPERAND_CONSTANT) {
+        return power_loop_lower(l, a, n);
+    }
+    if (n.value <= 0) {
+        return ir_constant(1);
+    }
+    return power_chain_lower(l, a, n.value);
+}
+
+// the address of the first element of the array named by e
+static IrOperand array_lower(Lowering* l, Expr* e) {
+    if (e->symbol->kind == SYMBOL_GLOBAL) {
+        return emit_address(l, e->symbol->name);
+    }
+    // parameters hold the address
+    return ir_temp(e->symbol->which);
+}
+
+// generates the condition e as control flow: continues at if_true if e
+// evaluates to true and at if_false otherwise. && and || short-circuit,
+// and comparisons end in a branch on the comparison itself.
+static void cond_lower(Lowering* l, Expr* e, IrBlock* if_true, IrBlock* if_false) {
+    expr_label(e);
+
+    switch (e->kind) {
+        case EXPR_LOGICAL_AND: {
+            IrBlock* right = ir_block_create(l->f);
+            cond_lower(l, e->left, right, if_false);
+            block_start(l, right);
+            cond_lower(l, e->right, if_true, if_false);
+        } break;
+        case EXPR_LOGICAL_OR: {
+            IrBlock* right = ir_block_create(l->f);
+            cond_lower(l, e->left, if_true, right);
+            block_start(l, right);
+            cond_lower(l, e->right, if_true, if_false);
+        } break;
+        case EXPR_LOGICAL_NOT:
+            cond_lower(l, e->left, if_false, if_true);
+            break;
+        default:
+            emit_branch(l, expr_lower(l, e), if_true, if_false);
+            break;
+    }
+}
+
+// labels args and returns which of them come after one with side effects:
+// element i is set if an argument before i has side effects
+static int* side_effects_prefix(Expr** args, int arg_count) {
+    int* before = checked_malloc(sizeof(int) * (arg_count + 1));
+    before[0] = 0;
+    for (int i = 0; i < arg_count; i++) {
+        expr_label(args[i]);
+        before[i+1] = before[i] || args[i]->has_side_effects;
+    }
+    return before;
+}
+
+// the operands of a call, evaluated last to first. each one is held while
+// the arguments before it are evaluated.
+static void args_lower(Lowering* l, Expr** args, int arg_count, IrOperand* values) {
+    int* side_effects_before = side_effects_prefix(args, arg_count);
+    for (int i = arg_count-1; i >= 0; i--) {
+        values[i] = hold(l, expr_lower(l, args[i]), side_effects_before[i]);
+    }
+    free(side_effects_before);
+}
+
+// the EXPR_ARG list starting at arg as an array
+static Expr** args_collect(Expr* arg, int* arg_count) {
+    int count = 0;
+    for (Expr* current = arg; current != NULL; current = current->right) {
+        count++;
+    }
+
+    Expr** args = checked_malloc(sizeof(Expr*) * (count + 1));
+    count = 0;
+    for (Expr* current = arg; current != NULL; current = current->right) {
+        args[count++] = current->left;
+    }
+    *arg_count = count;
+    return args;
+}
+
+static IrOperand call_lower(Lowering* l, Expr* e) {
+    int arg_count;
+    Expr** args = args_collect(e->right, &arg_count);
+
+    IrInstr* call = ir_instr_create(l->f, IR_CALL, ir_temp_create(l->f), ir_none(), ir_none());
+    call->args = arena_alloc(l->f->arena, sizeof(IrOperand) * (arg_count + 1));
+    call->arg_count = arg_count;
+    args_lower(l, args, arg_count, call->args);
+
+    // e->left should always be set to an EXPR_NAME with the name of the
+    // function being called
+    assert(e->left && e->left->kind == EXPR_NAME);
+    call->name = e->left->name;
+    ir_append(l->block, call);
+
+    free(args);
+    return ir_temp(call->dst);
+}
+
+// x++ and x--, which evaluate to the new value of x
+static IrOperand increment_lower(Lowering* l, Expr* e, IrOpcode_t op) {
+    Symbol* s = e->left->symbol;
+    if (s->kind == SYMBOL_GLOBAL) {
+        IrOperand old_value = emit_value(l, IR_LOAD_GLOBAL, ir_none(), ir_none());
+        l->block->last->name = s->name;
+        IrOperand new_value = emit_value(l, op, old_value, ir_constant(1));
+        emit(l, IR_STORE_GLOBAL, -1, new_value, ir_none())->name = s->name;
+        return new_value;
+    }
+    emit(l, op, s->which, ir_temp(s->which), ir_constant(1));
+    return ir_temp(s->which);
+}
+
+static IrOperand assign_lower(Lowering* l, Expr* e) {
+    Expr* target = e->left;
+
+    if (target->kind == EXPR_SUBSCRIPT) {
+        IrOperand base = array_lower(l, target->left);
+        int later_side_effects = target->right->has_side_effects || e->right->has_side_effects;
+        base = hold(l, base, later_side_effects);
+        IrOperand index = hold(l, expr_lower(l, target->right), e->right->has_side_effects);
+        IrOperand value = expr_lower(l, e->right);
+        emit(l, IR_STORE, -1, base, index)->c = value;
+        return value;
+    }
+
+    IrOperand value = expr_lower(l, e->right);
+    Symbol* s = target->symbol;
+    if (s->kind == SYMBOL_GLOBAL) {
+        emit(l, IR_STORE_GLOBAL, -1, value, ir_none())->name = s->name;
+        return value;
+    }
+    return assign_variable(l, s->which, value);
+}
+
+static IrOperand expr_lower(Lowering* l, Expr* e) {
+    // the whole tree is labeled when lowering reaches its root
+    expr_label(e);
+
+    switch (e->kind) {
+        case EXPR_NAME: {
+            Symbol* s = e->symbol;
+            if (s->kind != SYMBOL_GLOBAL) {
+                // parameters and locals are temporaries, numbered as by the
+                // resolver
+                return ir_temp(s->which);
+            }
+            if (s->type->kind == TYPE_ARRAY || s->type->kind == TYPE_FUNCTION) {
+                return emit_address(l, s->name);
+            }
+            IrOperand value = emit_value(l, IR_LOAD_GLOBAL, ir_none(), ir_none());
+            l->block->last->name = s->name;
+            return value;
+        }
+        // literals
+        case EXPR_STRING_LITERAL:
+            return emit_string(l, e->string_literal);
+        case EXPR_CHAR_LITERAL:
+        case EXPR_INTEGER_LITERAL:
+        case EXPR_BOOLEAN_LITERAL:
+            return ir_constant(e->integer_value);
+        // arithmetic expressions
+        case EXPR_ADD:
+        case EXPR_SUB:
+        case EXPR_MUL:
+        case EXPR_DIV:
+        case EXPR_MODULO:
+            return binary_lower(l, e);
+        case EXPR_EXPONENT:
+            return power_lower(l, e);
+        case EXPR_NEGATE:
+            return emit_value(l, IR_NEG, expr_lower(l, e->left), ir_none());
+
+        // logical operations
+        case EXPR_LOGICAL_OR:
+        case EXPR_LOGICAL_AND: {
+            // result = 0; if (e) result = 1;
+            int result = ir_temp_create(l->f);
+            IrBlock* set = ir_block_create(l->f);
+            IrBlock* done = ir_block_create(l->f);
+
+            emit(l, IR_COPY, result, ir_constant(0), ir_none());
+            cond_lower(l, e, set, done);
+            block_start(l, set);
+            emit(l, IR_COPY, result, ir_constant(1), ir_none());
+            emit_jump(l, done);
+            block_start(l, done);
+            return ir_temp(result);
+        }
+        case EXPR_LOGICAL_NOT:
+            return emit_value(l, IR_NOT, expr_lower(l, e->left), ir_none());
+
+        // conditionals
+        case EXPR_CMP_EQUAL:
+        case EXPR_CMP_NOT_EQUAL:
+        case EXPR_CMP_GT:
+        case EXPR_CMP_GT_EQUAL:
+        case EXPR_CMP_LT:
+        case EXPR_CMP_LT_EQUAL:
+            return binary_lower(l, e);
+
+        // assignments
+        case EXPR_ASSIGN:
+            return assign_lower(l, e);
+        case EXPR_INCREMENT:
+            return increment_lower(l, e, IR_ADD);
+        case EXPR_DECREMENT:
+            return increment_lower(l, e, IR_SUB);
+
+        // misc.
+        case EXPR_CALL:
+            return call_lower(l, e);
+        case EXPR_INIT_LIST:
+            fprintf(current_context->messages, "FIXME: codegen EXPR_INIT_LIST unimplemented.\n");
+            return ir_constant(0);
+        case EXPR_ARG:
+            return expr_lower(l, e->left);
+        case EXPR_SUBSCRIPT: {
+            IrOperand base = hold(l, array_lower(l, e->left), e->right->has_side_effects);
+            IrOperand index = expr_lower(l, e->right);
+            return emit_value(l, IR_LOAD, base, index);
+        }
+    }
+    return ir_constant(0);
+}
+
+//
+// statements
+//
+
+// the assignment x = e if s is just that statement, possibly in a block
+static Expr* single_assignment(Stmt* s) {
+    if (!s || s->next) {
+        return NULL;
+    }
+    if (s->kind == STMT_BLOCK) {
+        return single_assignment(s->body);
+    }
+    if (s->kind != STMT_EXPR || !s->expr || s->expr->kind != EXPR_ASSIGN || s->expr->left->kind != EXPR_NAME) {
+        return NULL;
+    }
+    return s->expr;
+}
+
+// whether e is small and can be evaluated even when the program would not
+// have: no side effects, no division that could trap, no memory access
+// that could fault. budget is the number of nodes still allowed.
+static int is_speculatable(Expr* e, int* budget) {
+    if (!e) {
+        return 1;
+    }
+    if (--*budget < 0) {
+        return 0;
+    }
+    switch (e->kind) {
+        case EXPR_NAME:
+        case EXPR_INTEGER_LITERAL:
+        case EXPR_CHAR_LITERAL:
+        case EXPR_BOOLEAN_LITERAL:
+            return 1;
+        case EXPR_ADD:
+        case EXPR_SUB:
+        case EXPR_MUL:
+        case EXPR_NEGATE:
+        case EXPR_LOGICAL_NOT:
+        case EXPR_CMP_EQUAL:
+        case EXPR_CMP_NOT_EQUAL:
+        case EXPR_CMP_GT:
+        case EXPR_CMP_GT_EQUAL:
+        case EXPR_CMP_LT:
+        case EXPR_CMP_LT_EQUAL:
+            return is_speculatable(e->left, budget) && is_speculatable(e->right, budget);
+        default:
+            return 0;
+    }
+}
+
+// if (c) x = a; else x = b; and if (c) x = a; with small a and b, without
+// branching: both values are computed and an IR_SELECT picks one. returns
+// 0, lowering nothing, if s does not have this shape.
+static int select_lower(Lowering* l, Stmt* s) {
+    Expr* then_assign = single_assignment(s->body);
+    Expr* else_assign = single_assignment(s->else_body);
+    if (!then_assign || (s->else_body && !else_assign)) {
+        return 0;
+    }
+    if (else_assign && else_assign->left->symbol != then_assign->left->symbol) {
+        return 0;
+    }
+    // these branch anyway
+    if (s->expr->kind == EXPR_LOGICAL_AND || s->expr->kind == EXPR_LOGICAL_OR) {
+        return 0;
+    }
+
+    Expr* then_value = then_assign->right;
+    // without an else branch x keeps its value
+    Expr* else_value = else_assign ? else_assign->right : then_assign->left;
+
+    int budget = 6;
+    if (!is_speculatable(then_value, &budget) || !is_speculatable(else_value, &budget)) {
+        return 0;
+    }
+    expr_label(s->expr);
+
+    // the values are computed first, so that the comparison ends up right
+    // before the select, unless the condition has side effects that they
+    // must see
+    IrOperand condition;
+    IrOperand then_operand;
+    IrOperand else_operand;
+    if (s->expr->has_side_effects) {
+        condition = expr_lower(l, s->expr);
+        then_operand = expr_lower(l, then_value);
+        else_operand = expr_lower(l, else_value);
+    } else {
+        then_operand = expr_lower(l, then_value);
+        else_operand = expr_lower(l, else_value);
+        condition = expr_lower(l, s->expr);
+    }
+
+    IrOperand value = emit_value(l, IR_SELECT, condition, then_operand);
+    l->block->last->c = else_operand;
+
+    Symbol* x = then_assign->left->symbol;
+    if (x->kind == SYMBOL_GLOBAL) {
+        emit(l, IR_STORE_GLOBAL, -1, value, ir_none())->name = x->name;
+    } else {
+        assign_variable(l, x->which, value);
+    }
+    return 1;
+}
+
+static void print_lower(Lowering* l, Stmt* s) {
+    int arg_count;
+    Expr** args = args_collect(s->expr, &arg_count);
+
+    // every conversion specifier is two characters long
+    char* format_string = arena_alloc(l->f->arena, 2 * arg_count + 1);
+    char* format_string_end = format_string;
+    for (int i = 0; i < arg_count; i++) {
+        switch (args[i]->type->kind) {
+            case TYPE_CHAR:
+                strcpy(format_string_end, "%c");
+                break;
+            case TYPE_INTEGER:
+                strcpy(format_string_end, "%d");
+                break;
+            case TYPE_BOOLEAN:
+            case TYPE_STRING:
+            case TYPE_ARRAY:
+            case TYPE_FUNCTION:
+            default:
+                strcpy(format_string_end, "%s");
+                break;
+        }
+        format_string_end += 2;
+    }
+    *format_string_end = '\0';
+
+    // the format string comes first
+    IrInstr* call = ir_instr_create(l->f, IR_CALL, -1, ir_none(), ir_none());
+    call->name = "printf@PLT";
+    call->args = arena_alloc(l->f->arena, sizeof(IrOperand) * (arg_count + 1));
+    call->arg_count = arg_count + 1;
+
+    int* side_effects_before = side_effects_prefix(args, arg_count);
+    for (int i = arg_count-1; i >= 0; i--) {
+        IrOperand value;
+        switch (args[i]->type->kind) {
+            case TYPE_BOOLEAN: {
+                // the strings are loaded first, so that a comparison is
+                // right before the select
+                IrOperand true_string = emit_address(l, ".__STR_TRUE");
+                IrOperand false_string = emit_address(l, ".__STR_FALSE");
+                value = emit_value(l, IR_SELECT, expr_lower(l, args[i]), true_string);
+                l->block->last->c = false_string;
+            } break;
+            case TYPE_ARRAY:
+                if (args[i]->has_side_effects) {
+                    expr_lower(l, args[i]);
+                }
+                value = emit_address(l, ".__STR_ARRAY");
+                break;
+            case TYPE_FUNCTION:
+                if (args[i]->has_side_effects) {
+                    expr_lower(l, args[i]);
+                }
+                value = emit_address(l, ".__STR_FUNCTION");
+                break;
+            default:
+                value = expr_lower(l, args[i]);
+                break;
+        }
+        call->args[i+1] = hold(l, value, side_effects_before[i]);
+    }
+    call->args[0] = emit_string(l, format_string);
+    ir_append(l->block, call);
+
+    free(side_effects_before);
+    free(args);
+}
+
+static void decl_lower(Lowering* l, Decl* d) {
+    int variable = d->symbol->which;
+
+    switch (d->type->kind) {
+        case TYPE_STRING:
+            assign_variable(l, variable, emit_string(l, d->value ? d->value->string_literal : ""));
+            break;
+        case TYPE_BOOLEAN:
+        case TYPE_CHAR:
+        case TYPE_INTEGER:
+            // without an initializer the value is zero
+            assign_variable(l, variable, d->value ? expr_lower(l, d->value) : ir_constant(0));
+            break;
+        case TYPE_ARRAY:
+            // FIXME: incomplete
+            fprintf(current_context->messages, "FIXME: codegen for TYPE_ARRAY unimplemented.\n");
+            break;
+        case TYPE_FUNCTION:
+            break;
+        case TYPE_VOID:
+            fprintf(current_context->messages, "Error: cannot create variable of type void.\n");
+            assert(0);
+            break;
+    }
+}
+
+//
+// loop unrolling
+//
+
+// how many expression and statement nodes the copies of an unrolled loop
+// body may add up to
+#define UNROLL_BUDGET 256
+
+// bounds further out than this are left alone, so that trip counts can be
+// computed without overflow
+#define UNROLL_LIMIT (1L << 40)
+
+// a for loop that counts a local or parameter from one literal towards
+// another by a literal step, and how it is lowered: as factor copies of its
+// body per iteration, or not as a loop at all when factor is 0, followed by
+// the copies left over
+typedef struct {
+    Symbol* variable;
+    long start;
+    long step;
+    long trip_count;
+    long factor;
+    long remainder;
+} CountedLoop;
+
+// what loop unrolling has learned about a statement. loops are asked
+// again for every copy of the body around them, so each statement is
+// measured once.
+typedef struct {
+    // the nodes of the statement, counting a loop that is unrolled once
+    // per copy of its body, capped just past the budget; 0 until computed
+    int unrolled_size;
+    // for a for loop, whether its body leaves the loop variable alone; -1
+    // until computed
+    int keeps_variable;
+} StmtFacts;
+
+static unsigned pointer_hash(const char* key) {
+    uintptr_t p = (uintptr_t)key;
+    return (unsigned)(p ^ (p >> 32));
+}
+
+static StmtFacts* stmt_facts(Lowering* l, Stmt* s) {
+    if (!l->stmt_facts) {
+        l->stmt_facts = hash_table_create_by_pointer(0, pointer_hash);
+    }
+    StmtFacts* facts = hash_table_lookup(l->stmt_facts, (const char*)s);
+    if (!facts) {
+        facts = arena_alloc(l->f->arena, sizeof(StmtFacts));
+        facts->unrolled_size = 0;
+        facts->keeps_variable = -1;
+        hash_table_insert(l->stmt_facts, (const char*)s, facts);
+    }
+    return facts;
+}
+
+static int stmt_size(Lowering* l, Stmt* s);
+
+static int expr_size(Expr* e) {
+    if (!e) {
+        return 0;
+    }
+    return 1 + expr_size(e->left) + expr_size(e->right);
+}
+
+static int is_name_of(Expr* e, Symbol* s) {
+    return e && e->kind == EXPR_NAME && e->symbol == s;
+}
+
+static int is_literal(Expr* e, long* value) {
+    if (!e || e->kind != EXPR_INTEGER_LITERAL || e->integer_value > UNROLL_LIMIT || e->integer_value < -UNROLL_LIMIT) {
+        return 0;
+    }
+    *value = e->integer_value;
+    return 1;
+}
+
+static int expr_assigns(Expr* e, Symbol* s) {
+    if (!e) {
+        return 0;
+    }
+    if ((e->kind == EXPR_ASSIGN || e->kind == EXPR_INCREMENT || e->kind == EXPR_DECREMENT) && is_name_of(e->left, s)) {
+        return 1;
+    }
+    return expr_assigns(e->left, s) || expr_assigns(e->right, s);
+}
+
+static int stmt_assigns(Stmt* s, Symbol* v) {
+    for (; s != NULL; s = s->next) {
+        for (Decl* d = s->kind == STMT_DECL ? s->decl : NULL; d != NULL; d = d->next) {
+            if (expr_assigns(d->value, v)) return 1;
+        }
+        if (expr_assigns(s->init_expr, v) || expr_assigns(s->expr, v) || expr_assigns(s->next_expr, v)
+            || stmt_assigns(s->body, v) || stmt_assigns(s->else_body, v)
+        ) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// the step of next if it is x++, x--, x = x + c, x = c + x or x = x - c
+static int counted_step(Expr* next, Symbol* s, long* step) {
+    if (next->kind == EXPR_INCREMENT || next->kind == EXPR_DECREMENT) {
+        *step = next->kind == EXPR_INCREMENT ? 1 : -1;
+        return is_name_of(next->left, s);
+    }
+    if (next->kind != EXPR_ASSIGN || !is_name_of(next->left, s)) {
+        return 0;
+    }
+    Expr* e = next->right;
+    if (e->kind == EXPR_ADD && is_name_of(e->left, s) && is_literal(e->right, step)) return 1;
+    if (e->kind == EXPR_ADD && is_name_of(e->right, s) && is_literal(e->left, step)) return 1;
+    if (e->kind == EXPR_SUB && is_name_of(e->left, s) && is_literal(e->right, step)) {
+        *step = -*step;
+        return 1;
+    }
+    return 0;
+}
+
+// the number of times the body of for (x = a; x < b; x = x + c) runs,
+// also for <=, >, >= and != and the other forms of step; -1 if the loop
+// does not end or is not of that form. the body must leave x alone, and x
+// must not be a global, which a call could change.
+static long trip_count(Lowering* l, Stmt* s, CountedLoop* c) {
+    Expr* init = s->init_expr;
+    Expr* cond = s->expr;
+    if (!init || !cond || !s->next_expr || init->kind != EXPR_ASSIGN || init->left->kind != EXPR_NAME) {
+        return -1;
+    }
+    Symbol* x = init->left->symbol;
+    long a, b, step;
+    if (x->kind == SYMBOL_GLOBAL || x->type->kind != TYPE_INTEGER || !is_literal(init->right, &a)
+        || !counted_step(s->next_expr, x, &step) || step == 0
+    ) {
+        return -1;
+    }
+
+    Expr_t kind = cond->kind;
+    if (is_name_of(cond->left, x) && is_literal(cond->right, &b)) {
+        // x < b
+    } else if (is_name_of(cond->right, x) && is_literal(cond->left, &b)) {
+        // b > x, the same comparison mirrored
+        switch (kind) {
+            case EXPR_CMP_LT: kind = EXPR_CMP_GT; break;
+            case EXPR_CMP_LT_EQUAL: kind = EXPR_CMP_GT_EQUAL; break;
+            case EXPR_CMP_GT: kind = EXPR_CMP_LT; break;
+            case EXPR_CMP_GT_EQUAL: kind = EXPR_CMP_LT_EQUAL; break;
+            default: break;
+        }
+    } else {
+        return -1;
+    }
+    // walking the body is the costly part
+    StmtFacts* facts = stmt_facts(l, s);
+    if (facts->keeps_variable < 0) {
+        facts->keeps_variable = !stmt_assigns(s->body, x);
+    }
+    if (!facts->keeps_variable) {
+        return -1;
+    }
+
+    c->variable = x;
+    c->start = a;
+    c->step = step;
+
+    // counting down to b is counting up to -b
+    if (kind == EXPR_CMP_GT || kind == EXPR_CMP_GT_EQUAL) {
+        kind = kind == EXPR_CMP_GT ? EXPR_CMP_LT : EXPR_CMP_LT_EQUAL;
+        a = -a;
+        b = -b;
+        step = -step;
+    }
+    switch (kind) {
+        case EXPR_CMP_LT:
+            if (a >= b) return 0;
+            return step > 0 ? (b - a + step - 1) / step : -1;
+        case EXPR_CMP_LT_EQUAL:
+            if (a > b) return 0;
+            return step > 0 ? (b - a) / step + 1 : -1;
+        case EXPR_CMP_NOT_EQUAL:
+            if ((b - a) % step != 0 || (b - a) / step < 0) return -1;
+            return (b - a) / step;
+        default:
+            return -1;
+    }
+}
+
+// whether s is a loop to unroll, and how. loops whose trip count is known
+// are unrolled completely when all copies of the body fit the budget, and
+// otherwise by the unroll factor, or less if that does not fit, leaving
+// the copies for the last few iterations after the loop.
+static int counted_loop(Lowering* l, Stmt* s, CountedLoop* c) {
+    long trips = trip_count(l, s, c);
+    if (trips < 0) {
+        return 0;
+    }
+    c->trip_count = trips;
+
+    long size = stmt_size(l, s->body) + expr_size(s->next_expr);
+    if (size < 1) size = 1;
+    if (trips <= UNROLL_BUDGET / size) {
+        c->factor = 0;
+        c->remainder = trips;
+        return 1;
+    }
+    long factor = current_context->unroll_factor;
+    if (factor > trips) factor = trips;
+    while (factor >= 2 && (factor + trips % factor) * size > UNROLL_BUDGET) {
+        factor--;
+    }
+    if (factor < 2) {
+        return 0;
+    }
+    c->factor = factor;
+    c->remainder = trips % factor;
+    return 1;
+}
+
+// nodes in the statement s alone, counting a loop that will be unrolled
+// once for every copy of its body. computed once per statement, from the
+// inside out, and capped just past the budget.
+static int stmt_size_single(Lowering* l, Stmt* s) {
+    StmtFacts* facts = stmt_facts(l, s);
+    if (facts->unrolled_size) {
+        return facts->unrolled_size;
+    }
+    long size = 1;
+    for (Decl* d = s->kind == STMT_DECL ? s->decl : NULL; d != NULL; d = d->next) {
+        size += 1 + expr_size(d->value);
+    }
+    CountedLoop c;
+    long copies = s->kind == STMT_FOR && counted_loop(l, s, &c) ? c.factor + c.remainder : 1;
+    long body = stmt_size(l, s->body) + expr_size(s->next_expr);
+    size += expr_size(s->init_expr) + 2 * expr_size(s->expr) + copies * body + stmt_size(l, s->else_body);
+    if (size > UNROLL_BUDGET) {
+        size = UNROLL_BUDGET + 1;
+    }
+    facts->unrolled_size = (int)size;
+    return facts->unrolled_size;
+}
+
+// nodes in s and the statements after it, stopping once past the budget
+static int stmt_size(Lowering* l, Stmt* s) {
+    int size = 0;
+    for (; s != NULL; s = s->next) {
+        size += stmt_size_single(l, s);
+        if (size > UNROLL_BUDGET) {
+            return UNROLL_BUDGET + 1;
+        }
+    }
+    return size;
+}
+
+static void counted_loop_lower(Lowering* l, Stmt* s, CountedLoop* c) {
+    expr_lower(l, s->init_expr);
+
+    if (c->factor > 0) {
+        IrBlock* body_block = ir_block_create(l->f);
+        IrBlock* done_block = ir_block_create(l->f);
+        emit_jump(l, body_block);
+
+        block_start(l, body_block);
+        for (long k = 0; k < c->factor; k++) {
+            stmt_lower(l, s->body);
+            expr_lower(l, s->next_expr);
+        }
+        // the condition holds until the variable reaches the value it has
+        // after the last full round, the loop runs at least once
+        long end = c->start + (c->trip_count / c->factor) * c->factor * c->step;
+        IrOperand more = emit_value(l, c->step > 0 ? IR_LT : IR_GT, ir_temp(c->variable->which), ir_constant(end));
+        emit_branch(l, more, body_block, done_block);
+
+        block_start(l, done_block);
+    }
+    for (long k = 0; k < c->remainder; k++) {
+        stmt_lower(l, s->body);
+        expr_lower(l, s->next_expr);
+    }
+}
+
+//
+// vectorization
+//
+
+// limits on the expression of a vector loop, so that its scalars, its
+// intermediate values and the few registers the loop needs besides fit in
+// the 16 vector registers
+#define VECTOR_MAX_STEPS 24
+#define VECTOR_MAX_REGISTERS 16
+
+// the body of a loop being vectorized
+typedef struct {
+    Symbol* variable;       // the loop variable
+    Symbol* reduction;      // the variable reduced into, if any
+    IrVectorStep steps[VECTOR_MAX_STEPS];
+    int step_count;
+    Expr* scalars[VECTOR_MAX_REGISTERS];
+    int scalar_count;
+    int depth;              // values of the expression at the same time
+    int max_depth;
+} VectorBody;
+
+static int is_integer_array(Expr* e) {
+    return e->kind == EXPR_NAME && e->symbol->kind == SYMBOL_GLOBAL
+        && e->symbol->type->kind == TYPE_ARRAY && e->symbol->type->subtype->kind == TYPE_INTEGER;
+}
+
+static int vector_step(VectorBody* v, IrVectorStep_t kind, const char* name, int index) {
+    if (v->step_count == VECTOR_MAX_STEPS) {
+        return 0;
+    }
+    IrVectorStep* step = &v->steps[v->step_count++];
+    step->kind = kind;
+    step->name = name;
+    step->index = index;
+
+    if (kind == IR_VECTOR_ELEMENT || kind == IR_VECTOR_SCALAR) {
+        v->depth++;
+    } else if (kind != IR_VECTOR_NEG && kind != IR_VECTOR_SHL) {
+        v->depth--;
+    }
+    if (v->depth > v->max_depth) {
+        v->max_depth = v->depth;
+    }
+    return 1;
+}
+
+// a scalar operand, the same in every iteration: a literal, or an integer
+// that the loop does not assign
+static int vector_scalar(VectorBody* v, Expr* e) {
+    if (e->kind == EXPR_NAME) {
+        Symbol* s = e->symbol;
+        if (s == v->variable || s == v->reduction || s->type->kind != TYPE_INTEGER) {
+            return 0;
+        }
+    }
+    for (int k = 0; k < v->scalar_count; k++) {
+        Expr* known = v->scalars[k];
+        if (known->kind == e->kind && known->symbol == e->symbol && known->integer_value == e->integer_value) {
+            return vector_step(v, IR_VECTOR_SCALAR, NULL, k);
+        }
+    }
+    if (v->scalar_count == VECTOR_MAX_REGISTERS) {
+        return 0;
+    }
+    v->scalars[v->scalar_count] = e;
+    return vector_step(v, IR_VECTOR_SCALAR, NULL, v->scalar_count++);
+}
+
+// adds the steps computing e for element i, if vector instructions can:
+// additions, subtractions, negations and multiplications of elements of
+// global integer arrays at the index of the loop and scalars
+static int vector_expr(VectorBody* v, Expr* e) {
+    switch (e->kind) {
+        case EXPR_SUBSCRIPT:
+            return is_integer_array(e->left) && is_name_of(e->right, v->variable)
+                && vector_step(v, IR_VECTOR_ELEMENT, e->left->symbol->name, 0);
+        case EXPR_INTEGER_LITERAL:
+        case EXPR_NAME:
+            return vector_scalar(v, e);
+        case EXPR_ADD:
+        case EXPR_SUB:
+            return vector_expr(v, e->left) && vector_expr(v, e->right)
+                && vector_step(v, e->kind == EXPR_ADD ? IR_VECTOR_ADD : IR_VECTOR_SUB, NULL, 0);
+        case EXPR_MUL: {
+            // by a power of two as a shift
+            Expr* other = e->left->kind == EXPR_INTEGER_LITERAL ? e->right : e->left;
+            Expr* factor = other == e->left ? e->right : e->left;
+            if (factor->kind == EXPR_INTEGER_LITERAL && factor->integer_value > 0
+                && (factor->integer_value & (factor->integer_value - 1)) == 0
+            ) {
+                int shift = 0;
+                while ((1L << shift) != factor->integer_value) shift++;
+                return vector_expr(v, other) && vector_step(v, IR_VECTOR_SHL, NULL, shift);
+            }
+            return vector_expr(v, e->left) && vector_expr(v, e->right)
+                && vector_step(v, IR_VECTOR_MUL, NULL, 0);
+        }
+        case EXPR_NEGATE:
+            return vector_expr(v, e->left) && vector_step(v, IR_VECTOR_NEG, NULL, 0);
+        default:
+            return 0;
+    }
+}
+
+static int expr_equal(Expr* a, Expr* b) {
+    if (!a || !b) {
+        return a == b;
+    }
+    return a->kind == b->kind && a->symbol == b->symbol && a->integer_value == b->integer_value
+        && expr_equal(a->left, b->left) && expr_equal(a->right, b->right);
+}
+
+// the only statement of s, looking into blocks
+static Stmt* single_statement(Stmt* s) {
+    while (s && !s->next && s->kind == STMT_BLOCK) {
+        s = s->body;
+    }
+    return s && !s->next ? s : NULL;
+}
+
+// what the body of a loop does to every element, if it is one of
+//   a[i] = e;                      IR_VECTOR_STORE
+//   s = s + e;  s = e + s;         IR_VECTOR_SUM, also s = s - e
+//   if (e < m) { m = e; }          IR_VECTOR_MIN, for any order of e and m
+//   if (e > m) { m = e; }          IR_VECTOR_MAX, also with <= and >=
+// with e as vector_expr takes it. sets v->reduction and the name of the
+// array stored to.
+static int vector_body(VectorBody* v, Stmt* body, IrVector_t* kind, const char** name) {
+    Stmt* s = single_statement(body);
+    if (!s) {
+        return 0;
+    }
+    if (s->kind == STMT_IF_ELSE && !s->else_body) {
+        Stmt* then = single_statement(s->body);
+        Expr* cond = s->expr;
+        if (!then || then->kind != STMT_EXPR || then->expr->kind != EXPR_ASSIGN
+            || then->expr->left->kind != EXPR_NAME || current_context->march < MARCH_SSE4_2
+        ) {
+            return 0;
+        }
+        Symbol* m = then->expr->left->symbol;
+        Expr* e = then->expr->right;
+        int greater;
+        if (cond->kind == EXPR_CMP_GT || cond->kind == EXPR_CMP_GT_EQUAL) {
+            greater = 1;
+        } else if (cond->kind == EXPR_CMP_LT || cond->kind == EXPR_CMP_LT_EQUAL) {
+            greater = 0;
+        } else {
+            return 0;
+        }
+        // m < e is e > m
+        if (is_name_of(cond->left, m) && expr_equal(cond->right, e)) {
+            greater = !greater;
+        } else if (!is_name_of(cond->right, m) || !expr_equal(cond->left, e)) {
+            return 0;
+        }
+        if (m->kind == SYMBOL_GLOBAL || m->type->kind != TYPE_INTEGER || m == v->variable) {
+            return 0;
+        }
+        v->reduction = m;
+        *kind = greater ? IR_VECTOR_MAX : IR_VECTOR_MIN;
+        return vector_expr(v, e);
+    }
+    if (s->kind != STMT_EXPR || s->expr->kind != EXPR_ASSIGN) {
+        return 0;
+    }
+    Expr* target = s->expr->left;
+    Expr* value = s->expr->right;
+    if (target->kind == EXPR_SUBSCRIPT) {
+        if (!is_integer_array(target->left) || !is_name_of(target->right, v->variable)) {
+            return 0;
+        }
+        *kind = IR_VECTOR_STORE;
+        *name = target->left->symbol->name;
+        return vector_expr(v, value);
+    }
+
+    Symbol* r = target->symbol;
+    if (r->kind == SYMBOL_GLOBAL || r->type->kind != TYPE_INTEGER || r == v->variable) {
+        return 0;
+    }
+    v->reduction = r;
+    *kind = IR_VECTOR_SUM;
+    if (value->kind == EXPR_ADD && is_name_of(value->left, r)) {
+        return vector_expr(v, value->right);
+    }
+    if (value->kind == EXPR_ADD && is_name_of(value->right, r)) {
+        return vector_expr(v, value->left);
+    }
+    if (value->kind == EXPR_SUB && is_name_of(value->left, r)) {
+        return vector_expr(v, value->right) && vector_step(v, IR_VECTOR_NEG, NULL, 0);
+    }
+    return 0;
+}
+
+// a counted loop by steps of one whose body vector_body takes becomes
+// scalar iterations up to the first index that is a multiple of the
+// vector width, the IR_VECTOR for as many whole vectors as there are
+// from there, and scalar iterations for the elements left. global arrays
+// are aligned to 32 bytes, so the vector accesses are aligned.
+static int vector_loop_lower(Lowering* l, Stmt* s) {
+    CountedLoop c;
+    long trips = trip_count(l, s, &c);
+    if (trips < 0 || c.step != 1 || c.start < 0 || c.start + trips > INT32_MAX) {
+        return 0;
+    }
+
+    VectorBody v;
+    memset(&v, 0, sizeof(v));
+    v.variable = c.variable;
+    IrVector_t kind;
+    const char* name = NULL;
+    if (!vector_body(&v, s->body, &kind, &name)
+        || v.scalar_count + v.max_depth + 4 > VECTOR_MAX_REGISTERS
+    ) {
+        return 0;
+    }
+
+    long lanes = current_context->march >= MARCH_AVX2 ? 4 : 2;
+    long peel = (lanes - c.start % lanes) % lanes;
+    if (trips < peel + 2 * lanes) {
+        return 0;
+    }
+    long count = (trips - peel) / lanes * lanes;
+    long rest = trips - peel - count;
+
+    expr_lower(l, s->init_expr);
+    for (long k = 0; k < peel; k++) {
+        stmt_lower(l, s->body);
+        expr_lower(l, s->next_expr);
+    }
+
+    IrVector* vector = arena_alloc(l->f->arena, sizeof(IrVector));
+    vector->kind = kind;
+    vector->name = name;
+    vector->start = c.start + peel;
+    vector->count = count;
+    vector->steps = arena_alloc(l->f->arena, sizeof(IrVectorStep) * v.step_count);
+    memcpy(vector->steps, v.steps, sizeof(IrVectorStep) * v.step_count);
+    vector->step_count = v.step_count;
+
+    IrOperand* args = arena_alloc(l->f->arena, sizeof(IrOperand) * (v.scalar_count + 1));
+    for (int k = 0; k < v.scalar_count; k++) {
+        args[k] = expr_lower(l, v.scalars[k]);
+    }
+    if (kind == IR_VECTOR_STORE) {
+        emit(l, IR_VECTOR, -1, ir_none(), ir_none());
+    } else {
+        emit_value(l, IR_VECTOR, ir_temp(v.reduction->which), ir_none());
+    }
+    IrInstr* in = l->block->last;
+    in->vector = vector;
+    in->args = args;
+    in->arg_count = v.scalar_count;
+    if (kind != IR_VECTOR_STORE) {
+        assign_variable(l, v.reduction->which, ir_temp(in->dst));
+    }
+
+    assign_variable(l, c.variable->which, ir_constant(vector->start + count));
+    for (long k = 0; k < rest; k++) {
+        stmt_lower(l, s->body);
+        expr_lower(l, s->next_expr);
+    }
+    return 1;
+}
+
+static void stmt_lower_single(Lowering* l, Stmt* s) {
+    switch (s->kind) {
+        case STMT_DECL:
+            for (Decl* d = s->decl; d != NULL; d = d->next) {
+                decl_lower(l, d);
+            }
+            break;
+        case STMT_EXPR:
+            if (s->expr) {
+                expr_lower(l, s->expr);
+            }
+            break;
+        case STMT_IF_ELSE: {
+            if (select_lower(l, s)) {
+                break;
+            }
+
+            IrBlock* then_block = ir_block_create(l->f);
+            IrBlock* else_block = s->else_body ? ir_block_create(l->f) : NULL;
+            IrBlock* done_block = ir_block_create(l->f);
+
+            cond_lower(l, s->expr, then_block, else_block ? else_block : done_block);
+
+            block_start(l, then_block);
+            stmt_lower(l, s->body);
+            emit_jump(l, done_block);
+
+            if (else_block) {
+                block_start(l, else_block);
+                stmt_lower(l, s->else_body);
+                emit_jump(l, done_block);
+            }
+            block_start(l, done_block);
+        } break;
+        case STMT_FOR: {
+            if (vector_loop_lower(l, s)) {
+                break;
+            }
+            CountedLoop counted;
+            if (counted_loop(l, s, &counted)) {
+                counted_loop_lower(l, s, &counted);
+                break;
+            }
+            // rotated: the condition is tested once on the way in and then
+            // at the bottom of the body, so that an iteration takes one
+            // branch instead of a branch and a jump
+            IrBlock* body_block = ir_block_create(l->f);
+            IrBlock* done_block = ir_block_create(l->f);
+
+            if (s->init_expr) {
+                expr_lower(l, s->init_expr);
+            }
+            if (s->expr) {
+                cond_lower(l, s->expr, body_block, done_block);
+            } else {
+                emit_jump(l, body_block);
+            }
+
+            block_start(l, body_block);
+            stmt_lower(l, s->body);
+            if (s->next_expr) {
+                expr_lower(l, s->next_expr);
+            }
+            if (s->expr) {
+                cond_lower(l, s->expr, body_block, done_block);
+            } else {
+                emit_jump(l, body_block);
+            }
+
+            block_start(l, done_block);
+        } break;
+        case STMT_PRINT:
+            print_lower(l, s);
+            break;
+        case STMT_RETURN:
+            emit(l, IR_RETURN, -1, s->expr ? expr_lower(l, s->expr) : ir_none(), ir_none());
+            // whatever follows is unreachable, but still needs a block
+            block_start(l, ir_block_create(l->f));
+            break;
+        case STMT_BLOCK:
+            stmt_lower(l, s->body);
+            break;
+    }
+}
+
+static void stmt_lower(Lowering* l, Stmt* s) {
+    for (; s != NULL; s = s->next) {
+        stmt_lower_single(l, s);
+    }
+}
+
+IrFunction* ir_lower(Decl* d) {
+    int param_count = param_list_length(d->type->params);
+
+    Lowering l;
+    l.stmt_facts = NULL;
+    l.f = ir_function_create(d->name, param_count, param_count + d->local_var_count);
+    l.f->defined = d->code != NULL;
+    block_start(&l, ir_block_create(l.f));
+
+    stmt_lower(&l, d->code);
+    emit(&l, IR_RETURN, -1, ir_none(), ir_none());
+
+    ir_compute_predecessors(l.f);
+    if (l.stmt_facts) {
+        hash_table_delete(l.stmt_facts);
+    }
+    return l.f;
+}
@@ -0,0 +1,18 @@
+#include "ir_opt.h"
+
+void ir_optimize(IrFunction* f) {
+    ir_ssa_construct(f);
+    ir_verify(f);
+
+    ir_gvn(f);
+    ir_verify(f);
+
+    ir_loops(f);
+    ir_verify(f);
+
+    ir_dce(f);
+    ir_verify(f);
+
+    ir_ssa_destruct(f);
+    ir_verify(f);
+}
@@ -0,0 +1,53 @@
+#ifndef IR_OPT_H
+#define IR_OPT_H
+
+#include "ir.h"
+
+/*
+Optimizations on the IR of a function, run by ir_optimize between lowering
+and instruction selection.
+
+The passes work on SSA form: ir_ssa_construct gives every temporary a
+single definition, inserting phis where values merge, and ir_ssa_destruct
+turns the phis back into copies. Variables stop being special in between,
+each assignment defines a new temporary.
+*/
+
+// into SSA form. blocks that can not be reached are removed first.
+void ir_ssa_construct(IrFunction* f);
+
+// out of SSA form, coalescing phis with their arguments where their values
+// are not live at the same time and copying where they are
+void ir_ssa_destruct(IrFunction* f);
+
+// global value numbering over the dominator tree, in SSA form. an
+// instruction computing a value already computed on every path to it is
+// removed and its uses read the earlier result; copies are propagated and
+// operations on constants folded. loads are reused until a store or call
+// may have changed memory.
+void ir_gvn(IrFunction* f);
+
+// loop optimization, in SSA form: every loop gets a preheader, invariant
+// instructions move there from the innermost loop they can leave, and
+// multiplications of induction variables by invariants become induction
+// variables themselves
+void ir_loops(IrFunction* f);
+
+// dead code elimination, in SSA form: branches on constants become jumps,
+// blocks that can no longer be reached are removed, and so are
+// instructions whose values are not used and that have no effect
+void ir_dce(IrFunction* f);
+
+// SSA construction, value numbering, loop optimization, dead code
+// elimination and SSA destruction, verifying the IR after each
+void ir_optimize(IrFunction* f);
+
+// the optimized IR of every function of a program, lowered and optimized
+// callees before their callers, first inlining the calls to small
+// functions that do not call back into the caller (ir_inline.c).
+// functions[i] is set for decls[i], NULL for declarations that are not
+// functions. in a program with a main, the functions that nothing calls
+// any more are deleted as soon as that is known and are NULL too.
+void ir_optimize_program(Decl** decls, IrFunction** functions, int count);
+
+#endif
@@ -0,0 +1,743 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ir_opt.h"
+#include "util.h"
+
+static int* int_array(int length, int value) {
+    int* a = checked_malloc(sizeof(int) * length);
+    for (int i = 0; i < length; i++) {
+        a[i] = value;
+    }
+    return a;
+}
+
+typedef struct {
+    int* items;
+    int count;
+    int capacity;
+} IntList;
+
+static void int_list_push(IntList* l, int value) {
+    if (l->count == l->capacity) {
+        l->capacity = l->capacity ? 2 * l->capacity : 4;
+        l->items = checked_realloc(l->items, sizeof(int) * l->capacity);
+    }
+    l->items[l->count++] = value;
+}
+
+static IntList* int_lists(int length) {
+    IntList* lists = checked_calloc(length, sizeof(IntList));
+    return lists;
+}
+
+static void int_lists_delete(IntList* lists, int length) {
+    for (int i = 0; i < length; i++) {
+        free(lists[i].items);
+    }
+    free(lists);
+}
+
+// the blocks of f in reverse postorder, after ir_compute_dominators
+static IrBlock** blocks_by_rpo(IrFunction* f) {
+    IrBlock** order = checked_malloc(sizeof(IrBlock*) * f->block_count);
+    for (int i = 0; i < f->block_count; i++) {
+        order[f->blocks[i]->rpo] = f->blocks[i];
+    }
+    return order;
+}
+
+//
+// construction
+//
+
+/*
+SSA construction after Cytron et al., "Efficiently Computing Static Single
+Assignment Form and the Control Dependence Graph": phis for a temporary
+go at the iterated dominance frontier of the blocks that define it, then a
+walk of the dominator tree gives every definition a new temporary and
+every use the definition that reaches it.
+
+Only temporaries that are assigned more than once, or are variables, need
+renaming, and of those only the ones that are used in a block other than
+the one defining them get phis (the semi-pruned form of Briggs et al.).
+A variable that is read where no assignment reaches reads 0.
+*/
+
+typedef struct {
+    IrFunction* f;
+    int renamed_count;      // temporaries below this may be renamed
+    char* renamed;
+    int* phi_variable;      // per phi, the temporary it merges
+    IntList* versions;      // per renamed temporary, the stack of its definitions
+    IntList log;            // the temporaries pushed, to pop them again
+    int* marks;             // per block, by rpo: where the log was on entry
+} Renaming;
+
+static IrOperand current_version(Renaming* r, int t) {
+    IntList* v = &r->versions[t];
+    if (v->count == 0) {
+        return ir_constant(0);
+    }
+    return ir_temp(v->items[v->count-1]);
+}
+
+static void push_version(Renaming* r, int t, int version) {
+    int_list_push(&r->versions[t], version);
+    int_list_push(&r->log, t);
+}
+
+static void rename_block(IrBlock* b, void* data) {
+    Renaming* r = data;
+    r->marks[b->rpo] = r->log.count;
+
+    for (IrInstr* in = b->first; in != NULL; in = in->next) {
+        if (in->op == IR_PHI) {
+            push_version(r, r->phi_variable[in->dst], in->dst);
+            continue;
+        }
+        for (int k = 0; k < ir_operand_count(in); k++) {
+            IrOperand* o = ir_operand(in, k);
+            if (o->kind == IR_OPERAND_TEMP && o->value < r->renamed_count && r->renamed[o->value]) {
+                *o = current_version(r, o->value);
+            }
+        }
+        if (in->dst >= 0 && in->dst < r->renamed_count && r->renamed[in->dst]) {
+            int version = ir_temp_create(r->f);
+            push_version(r, in->dst, version);
+            in->dst = version;
+        }
+    }
+
+    IrBlock* succs[2];
+    int succ_count = ir_successors(b, succs);
+    for (int s = 0; s < succ_count; s++) {
+        for (IrInstr* phi = succs[s]->first; phi != NULL && phi->op == IR_PHI; phi = phi->next) {
+            for (int k = 0; k < phi->arg_count; k++) {
+                if (phi->phi_blocks[k] == b) {
+                    phi->args[k] = current_version(r, r->phi_variable[phi->dst]);
+                }
+            }
+        }
+    }
+
+}
+
+// back to the versions of the block's dominator
+static void rename_leave(IrBlock* b, void* data) {
+    Renaming* r = data;
+    while (r->log.count > r->marks[b->rpo]) {
+        r->versions[r->log.items[--r->log.count]].count--;
+    }
+}
+
+void ir_ssa_construct(IrFunction* f) {
+    ir_remove_unreachable_blocks(f);
+    ir_compute_dominators(f);
+
+    int n = f->block_count;
+    int temp_count = f->temp_count;
+    IrBlock** order = blocks_by_rpo(f);
+
+    // dominance frontiers: a join point is in the frontier of each block
+    // from its predecessors up to, but not including, its dominator
+    IntList* frontier = int_lists(n);
+    int* last_added = int_array(n, -1);
+    for (int i = 0; i < n; i++) {
+        IrBlock* b = order[i];
+        if (b->pred_count < 2) continue;
+        for (int k = 0; k < b->pred_count; k++) {
+            for (IrBlock* runner = b->preds[k]; runner != b->idom; runner = runner->idom) {
+                if (last_added[runner->rpo] == i) break;
+                last_added[runner->rpo] = i;
+                int_list_push(&frontier[runner->rpo], i);
+            }
+        }
+    }
+
+    // what to rename, and which of those are used outside their block
+    int* def_count = int_array(temp_count, 0);
+    char* global = checked_calloc(temp_count, 1);
+    int* defined_in = int_array(temp_count, -1);
+    for (int i = 0; i < n; i++) {
+        for (IrInstr* in = order[i]->first; in != NULL; in = in->next) {
+            for (int k = 0; k < ir_operand_count(in); k++) {
+                IrOperand* o = ir_operand(in, k);
+                if (o->kind == IR_OPERAND_TEMP && defined_in[o->value] != i) {
+                    global[o->value] = 1;
+                }
+            }
+            if (in->dst >= 0) {
+                def_count[in->dst]++;
+                defined_in[in->dst] = i;
+            }
+        }
+    }
+
+    char* renamed = checked_malloc(temp_count);
+    IntList* def_blocks = int_lists(temp_count);
+    for (int t = 0; t < temp_count; t++) {
+        renamed[t] = t < f->variable_count || def_count[t] > 1;
+    }
+    for (int i = 0; i < n; i++) {
+        for (IrInstr* in = order[i]->first; in != NULL; in = in->next) {
+            int t = in->dst;
+            if (t < 0 || !renamed[t] || !global[t]) continue;
+            IntList* blocks = &def_blocks[t];
+            if (blocks->count == 0 || blocks->items[blocks->count-1] != i) {
+                int_list_push(blocks, i);
+            }
+        }
+    }
+
+    // phis at the iterated dominance frontiers
+    IntList phi_variables = {0};
+    int* has_phi = int_array(n, -1);
+    int* queued = int_array(n, -1);
+    IntList worklist = {0};
+    for (int t = 0; t < temp_count; t++) {
+        if (def_blocks[t].count == 0) continue;
+        worklist.count = 0;
+        for (int j = 0; j < def_blocks[t].count; j++) {
+            int_list_push(&worklist, def_blocks[t].items[j]);
+            queued[def_blocks[t].items[j]] = t;
+        }
+        while (worklist.count > 0) {
+            int x = worklist.items[--worklist.count];
+            for (int j = 0; j < frontier[x].count; j++) {
+                int y = frontier[x].items[j];
+                if (has_phi[y] == t) continue;
+                has_phi[y] = t;
+
+                IrBlock* b = order[y];
+                IrInstr* phi = ir_phi_create(f, b, ir_temp_create(f));
+                if (b->first) {
+                    ir_insert_before(b->first, phi);
+                } else {
+                    ir_append(b, phi);
+                }
+                int_list_push(&phi_variables, phi->dst);
+                int_list_push(&phi_variables, t);
+
+                if (queued[y] != t) {
+                    queued[y] = t;
+                    int_list_push(&worklist, y);
+                }
+            }
+        }
+    }
+
+    Renaming r;
+    r.f = f;
+    r.renamed_count = temp_count;
+    r.renamed = renamed;
+    r.phi_variable = int_array(f->temp_count, -1);
+    for (int j = 0; j < phi_variables.count; j += 2) {
+        r.phi_variable[phi_variables.items[j]] = phi_variables.items[j+1];
+    }
+    r.versions = int_lists(temp_count);
+    r.log.items = NULL;
+    r.log.count = 0;
+    r.log.capacity = 0;
+    r.marks = int_array(n, 0);
+
+    // parameters arrive in their own temporaries
+    for (int t = 0; t < f->param_count; t++) {
+        int_list_push(&r.versions[t], t);
+    }
+    ir_walk_dominator_tree(f, rename_block, rename_leave, &r);
+
+    free(r.marks);
+    free(r.log.items);
+    int_lists_delete(r.versions, temp_count);
+    free(r.phi_variable);
+    free(worklist.items);
+    free(queued);
+    free(has_phi);
+    free(phi_variables.items);
+    int_lists_delete(def_blocks, temp_count);
+    free(renamed);
+    free(defined_in);
+    free(global);
+    free(def_count);
+    free(last_added);
+    int_lists_delete(frontier, n);
+    free(order);
+}
+
+//
+// destruction
+//
+
+/*
+Out of SSA form, phis become copies at the end of the predecessors. A
+phi and its arguments are first coalesced into one temporary wherever
+their live ranges do not overlap, which is where the variable of the
+source program was, unless value numbering made two of its values live
+at once. Only what is left needs a copy. Copies go on edges that leave a
+block with a single successor and end in a jump; other edges are split
+first. The copies of one edge happen at once, so they are ordered to not
+overwrite a value still to be read, breaking cycles with a temporary.
+*/
+
+typedef struct {
+    IrFunction* f;
+    int* block_index;       // per block id, into f->blocks
+    IrBlock** def_block;    // per temporary
+    int* def_position;      // within the block: -1 for parameters, 0 for phis, then 1, 2, ...
+    IntList* live_out;      // per temporary in a phi: the blocks it is live out of, by index, sorted
+} Liveness;
+
+static int has_phis(IrBlock* b) {
+    return b->first && b->first->op == IR_PHI;
+}
+
+// removes phis whose value is never used, and then those only they used
+static void remove_dead_phis(IrFunction* f) {
+    int* use_count = int_array(f->temp_count, 0);
+    IrInstr** phis = checked_calloc(f->temp_count, sizeof(IrInstr*));
+    for (int i = 0; i < f->block_count; i++) {
+        for (IrInstr* in = f->blocks[i]->first; in != NULL; in = in->next) {
+            for (int k = 0; k < ir_operand_count(in); k++) {
+                IrOperand* o = ir_operand(in, k);
+                if (o->kind == IR_OPERAND_TEMP) use_count[o->value]++;
+            }
+            if (in->op == IR_PHI) phis[in->dst] = in;
+        }
+    }
+
+    IntList dead = {0};
+    for (int t = 0; t < f->temp_count; t++) {
+        if (phis[t] && use_count[t] == 0) int_list_push(&dead, t);
+    }
+    while (dead.count > 0) {
+        IrInstr* phi = phis[dead.items[--dead.count]];
+        for (int k = 0; k < phi->arg_count; k++) {
+            if (phi->args[k].kind != IR_OPERAND_TEMP) continue;
+            int t = phi->args[k].value;
+            if (--use_count[t] == 0 && phis[t]) int_list_push(&dead, t);
+        }
+        ir_remove(phi);
+    }
+
+    free(dead.items);
+    free(phis);
+    free(use_count);
+}
+
+// puts a block on every edge into a block with phis that does not leave
+// its predecessor by a plain jump. the new blocks go right before the
+// block they jump to, where they fall through.
+static void split_edges(IrFunction* f) {
+    int first_new = f->next_block_id;
+    int split_count = 0;
+    for (int i = 0; i < f->block_count; i++) {
+        IrBlock* b = f->blocks[i];
+        if (!has_phis(b)) continue;
+
+        for (int k = 0; k < b->pred_count; k++) {
+            IrBlock* p = b->preds[k];
+            if (p->last->op == IR_JUMP) continue;
+
+            IrBlock* middle = ir_block_create(f);
+            IrInstr* jump = ir_instr_create(f, IR_JUMP, -1, ir_none(), ir_none());
+            jump->targets[0] = b;
+            ir_append(middle, jump);
+            for (int j = 0; j < 2; j++) {
+                if (p->last->targets[j] == b) p->last->targets[j] = middle;
+            }
+            for (IrInstr* phi = b->first; phi != NULL && phi->op == IR_PHI; phi = phi->next) {
+                for (int j = 0; j < phi->arg_count; j++) {
+                    if (phi->phi_blocks[j] == p) phi->phi_blocks[j] = middle;
+                }
+            }
+            b->preds[k] = middle;
+            split_count++;
+        }
+    }
+    if (split_count == 0) return;
+
+    IrBlock** blocks = arena_alloc(f->arena, sizeof(IrBlock*) * (f->block_count + split_count));
+    int count = 0;
+    for (int i = 0; i < f->block_count; i++) {
+        IrBlock* b = f->blocks[i];
+        if (has_phis(b)) {
+            for (int k = 0; k < b->pred_count; k++) {
+                if (b->preds[k]->id >= first_new) blocks[count++] = b->preds[k];
+            }
+        }
+        blocks[count++] = b;
+    }
+    f->blocks = blocks;
+    f->block_count = count;
+    f->block_capacity = count;
+    ir_compute_predecessors(f);
+}
+
+// drops the blocks split_edges added that coalescing left without copies,
+// sending their predecessor straight to where they jump
+static void remove_empty_splits(IrFunction* f, int first_split) {
+    int kept = 0;
+    for (int i = 0; i < f->block_count; i++) {
+        IrBlock* b = f->blocks[i];
+        if (b->id < first_split || b->first != b->last) {
+            f->blocks[kept++] = b;
+            continue;
+        }
+        IrInstr* last = b->preds[0]->last;
+        for (int j = 0; j < 2; j++) {
+            if (last->targets[j] == b) last->targets[j] = b->last->targets[0];
+        }
+        if (last->op == IR_BRANCH && last->targets[0] == last->targets[1]) {
+            last->op = IR_JUMP;
+            last->targets[1] = NULL;
+            last->a = ir_none();
+        }
+    }
+    if (kept == f->block_count) return;
+    f->block_count = kept;
+    ir_compute_predecessors(f);
+}
+
+static int compare_ints(const void* a, const void* b) {
+    return *(const int*)a - *(const int*)b;
+}
+
+// the blocks that each temporary in a phi is live out of, found by walking
+// back from its uses to its definition. this is proportional to the size
+// of the live ranges, where sets over all blocks would be to the size of
+// the function squared.
+static void compute_live_out(Liveness* l, const char* in_phi) {
+    IrFunction* f = l->f;
+    int n = f->block_count;
+    int temp_count = f->temp_count;
+
+    // per temporary, where it is used: 2 * block index when it is live into
+    // the block, 2 * block index + 1 when it is live out of it (for phis)
+    IntList* uses = int_lists(temp_count);
+    for (int i = 0; i < n; i++) {
+        for (IrInstr* in = f->blocks[i]->first; in != NULL; in = in->next) {
+            if (in->op == IR_PHI) {
+                for (int j = 0; j < in->arg_count; j++) {
+                    IrOperand o = in->args[j];
+                    if (o.kind == IR_OPERAND_TEMP && in_phi[o.value]) {
+                        int_list_push(&uses[o.value], 2 * l->block_index[in->phi_blocks[j]->id] + 1);
+                    }
+                }
+                continue;
+            }
+            for (int j = 0; j < ir_operand_count(in); j++) {
+                IrOperand* o = ir_operand(in, j);
+                if (o->kind == IR_OPERAND_TEMP && in_phi[o->value]) {
+                    int_list_push(&uses[o->value], 2 * i);
+                }
+            }
+        }
+    }
+
+    int* live_in = int_array(n, -1);
+    int* live_out = int_array(n, -1);
+    IntList worklist = {0};
+    for (int t = 0; t < temp_count; t++) {
+        if (!in_phi[t] || !l->def_block[t]) continue;
+        int def = l->block_index[l->def_block[t]->id];
+        IntList* out = &l->live_out[t];
+
+        worklist.count = 0;
+        for (int j = 0; j < uses[t].count; j++) {
+            int b = uses[t].items[j] / 2;
+            if (uses[t].items[j] % 2 && live_out[b] != t) {
+                live_out[b] = t;
+                int_list_push(out, b);
+            }
+            if (b != def && live_in[b] != t) {
+                live_in[b] = t;
+                int_list_push(&worklist, b);
+            }
+        }
+        while (worklist.count > 0) {
+            IrBlock* b = f->blocks[worklist.items[--worklist.count]];
+            for (int k = 0; k < b->pred_count; k++) {
+                int p = l->block_index[b->preds[k]->id];
+                if (live_out[p] != t) {
+                    live_out[p] = t;
+                    int_list_push(out, p);
+                }
+                if (p != def && live_in[p] != t) {
+                    live_in[p] = t;
+                    int_list_push(&worklist, p);
+                }
+            }
+        }
+        if (out->count > 1) {
+            qsort(out->items, out->count, sizeof(int), compare_ints);
+        }
+    }
+
+    free(worklist.items);
+    free(live_out);
+    free(live_in);
+    int_lists_delete(uses, temp_count);
+}
+
+static int is_live_out(Liveness* l, int t, IrBlock* b) {
+    int i = l->block_index[b->id];
+    IntList* out = &l->live_out[t];
+    int lo = 0;
+    int hi = out->count - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (out->items[mid] == i) return 1;
+        if (out->items[mid] < i) {
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return 0;
+}
+
+static int used_after(IrBlock* b, int position, int t) {
+    int p = 1;
+    for (IrInstr* in = b->first; in != NULL; in = in->next) {
+        if (in->op == IR_PHI) continue;
+        if (p > position) {
+            for (int k = 0; k < ir_operand_count(in); k++) {
+                if (ir_is_temp(*ir_operand(in, k), t)) return 1;
+            }
+        }
+        p++;
+    }
+    return 0;
+}
+
+// whether x is live right after position p of block b
+static int live_at(Liveness* l, int x, IrBlock* b, int p) {
+    if (!l->def_block[x] || (l->def_block[x] == b && l->def_position[x] > p)) {
+        return 0;
+    }
+    return is_live_out(l, x, b) || used_after(b, p, x);
+}
+
+// whether x and y hold values at the same time. in SSA form one of them is
+// then live where the other is defined.
+static int interfere(Liveness* l, int x, int y) {
+    if (!l->def_block[x] || !l->def_block[y]) {
+        return 0;
+    }
+    return live_at(l, x, l->def_block[y], l->def_position[y])
+        || live_at(l, y, l->def_block[x], l->def_position[x]);
+}
+
+typedef struct {
+    int* parent;    // union-find
+    int* next;      // members of a class, linked from its root
+    int* last;
+    int* size;
+    char* has_param;
+} Classes;
+
+static int class_find(Classes* c, int t) {
+    while (c->parent[t] != t) {
+        c->parent[t] = c->parent[c->parent[t]];
+        t = c->parent[t];
+    }
+    return t;
+}
+
+// merges the classes of x and y unless two of their members interfere
+static void try_coalesce(Classes* c, Liveness* l, int x, int y) {
+    int a = class_find(c, x);
+    int b = class_find(c, y);
+    if (a == b || (c->has_param[a] && c->has_param[b])) {
+        return;
+    }
+    // big classes are not worth the quadratic check
+    if (c->size[a] * c->size[b] > 256) {
+        return;
+    }
+    for (int m = a; m >= 0; m = c->next[m]) {
+        for (int o = b; o >= 0; o = c->next[o]) {
+            if (interfere(l, m, o)) return;
+        }
+    }
+
+    c->parent[b] = a;
+    c->next[c->last[a]] = b;
+    c->last[a] = c->last[b];
+    c->size[a] += c->size[b];
+    c->has_param[a] |= c->has_param[b];
+}
+
+// dsts[i] = srcs[i] for all i at once, as copies before the instruction at
+static void parallel_copy(IrFunction* f, IrInstr* at, int* dsts, IrOperand* srcs, int count) {
+    char* pending = checked_malloc(count);
+    memset(pending, 1, count);
+    int left = count;
+
+    while (left > 0) {
+        int progress = 0;
+        for (int i = 0; i < count; i++) {
+            if (!pending[i]) continue;
+            int blocked = 0;
+            for (int j = 0; j < count; j++) {
+                if (j != i && pending[j] && ir_is_temp(srcs[j], dsts[i])) {
+                    blocked = 1;
+                    break;
+                }
+            }
+            if (blocked) continue;
+            ir_insert_before(at, ir_instr_create(f, IR_COPY, dsts[i], srcs[i], ir_none()));
+            pending[i] = 0;
+            left--;
+            progress = 1;
+        }
+        if (progress) continue;
+
+        // a cycle: the value of one destination is saved first
+        for (int i = 0; i < count; i++) {
+            if (!pending[i]) continue;
+            int saved = ir_temp_create(f);
+            ir_insert_before(at, ir_instr_create(f, IR_COPY, saved, ir_temp(dsts[i]), ir_none()));
+            for (int j = 0; j < count; j++) {
+                if (pending[j] && ir_is_temp(srcs[j], dsts[i])) srcs[j] = ir_temp(saved);
+            }
+            break;
+        }
+    }
+    free(pending);
+}
+
+void ir_ssa_destruct(IrFunction* f) {
+    remove_dead_phis(f);
+    int first_split = f->next_block_id;
+    split_edges(f);
+
+    int temp_count = f->temp_count;
+    Liveness l;
+    l.f = f;
+    l.live_out = int_lists(temp_count);
+    l.block_index = int_array(f->next_block_id, -1);
+    l.def_block = checked_calloc(temp_count, sizeof(IrBlock*));
+    l.def_position = int_array(temp_count, 0);
+    for (int i = 0; i < f->block_count; i++) {
+        IrBlock* b = f->blocks[i];
+        l.block_index[b->id] = i;
+        int p = 1;
+        for (IrInstr* in = b->first; in != NULL; in = in->next) {
+            if (in->dst >= 0) {
+                l.def_block[in->dst] = b;
+                l.def_position[in->dst] = in->op == IR_PHI ? 0 : p;
+            }
+            if (in->op != IR_PHI) p++;
+        }
+    }
+    for (int t = 0; t < f->param_count; t++) {
+        l.def_block[t] = f->blocks[0];
+        l.def_position[t] = -1;
+    }
+    char* in_phi = checked_calloc(temp_count, 1);
+    for (int i = 0; i < f->block_count; i++) {
+        for (IrInstr* phi = f->blocks[i]->first; phi != NULL && phi->op == IR_PHI; phi = phi->next) {
+            in_phi[phi->dst] = 1;
+            for (int k = 0; k < phi->arg_count; k++) {
+                if (phi->args[k].kind == IR_OPERAND_TEMP) in_phi[phi->args[k].value] = 1;
+            }
+        }
+    }
+    compute_live_out(&l, in_phi);
+
+    Classes c;
+    c.parent = int_array(temp_count, 0);
+    c.next = int_array(temp_count, -1);
+    c.last = int_array(temp_count, 0);
+    c.size = int_array(temp_count, 1);
+    c.has_param = checked_malloc(temp_count);
+    for (int t = 0; t < temp_count; t++) {
+        c.parent[t] = t;
+        c.last[t] = t;
+        c.has_param[t] = t < f->param_count;
+    }
+    for (int i = 0; i < f->block_count; i++) {
+        for (IrInstr* phi = f->blocks[i]->first; phi != NULL && phi->op == IR_PHI; phi = phi->next) {
+            for (int k = 0; k < phi->arg_count; k++) {
+                if (phi->args[k].kind == IR_OPERAND_TEMP) {
+                    try_coalesce(&c, &l, phi->dst, phi->args[k].value);
+                }
+            }
+        }
+    }
+
+    // every class becomes one temporary: its parameter, if any, as that is
+    // where the value arrives, or else its lowest
+    int* representative = int_array(temp_count, -1);
+    for (int t = 0; t < temp_count; t++) {
+        int root = class_find(&c, t);
+        int r = representative[root];
+        if (r < 0 || (t < f->param_count) || (r >= f->param_count && t < r)) {
+            representative[root] = t;
+        }
+    }
+    for (int i = 0; i < f->block_count; i++) {
+        for (IrInstr* in = f->blocks[i]->first; in != NULL; in = in->next) {
+            for (int k = 0; k < ir_operand_count(in); k++) {
+                IrOperand* o = ir_operand(in, k);
+                if (o->kind == IR_OPERAND_TEMP) {
+                    o->value = representative[class_find(&c, o->value)];
+                }
+            }
+            if (in->dst >= 0) {
+                in->dst = representative[class_find(&c, in->dst)];
+            }
+        }
+    }
+
+    // what is left of the phis are copies at the end of each predecessor
+    int* dsts = NULL;
+    IrOperand* srcs = NULL;
+    for (int i = 0; i < f->block_count; i++) {
+        IrBlock* b = f->blocks[i];
+        if (!has_phis(b)) continue;
+
+        int phi_count = 0;
+        for (IrInstr* phi = b->first; phi != NULL && phi->op == IR_PHI; phi = phi->next) {
+            phi_count++;
+        }
+        dsts = checked_realloc(dsts, sizeof(int) * phi_count);
+        srcs = checked_realloc(srcs, sizeof(IrOperand) * phi_count);
+
+        for (int k = 0; k < b->pred_count; k++) {
+            IrBlock* p = b->preds[k];
+            int count = 0;
+            for (IrInstr* phi = b->first; phi != NULL && phi->op == IR_PHI; phi = phi->next) {
+                for (int j = 0; j < phi->arg_count; j++) {
+                    if (phi->phi_blocks[j] != p || ir_is_temp(phi->args[j], phi->dst)) continue;
+                    dsts[count] = phi->dst;
+                    srcs[count] = phi->args[j];
+                    count++;
+                }
+            }
+            parallel_copy(f, p->last, dsts, srcs, count);
+        }
+
+        while (has_phis(b)) {
+            ir_remove(b->first);
+        }
+    }
+    free(srcs);
+    free(dsts);
+    remove_empty_splits(f, first_split);
+
+    free(representative);
+    free(c.has_param);
+    free(c.size);
+    free(c.last);
+    free(c.next);
+    free(c.parent);
+    free(l.def_position);
+    free(l.def_block);
+    free(in_phi);
+    free(l.block_index);
+    int_lists_delete(l.live_out, temp_count);
+}
@@ -1,91 +1,396 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
 #include "expr.h"
 #include "decl.h"
 #include "stmt.h"
 #include "type.h"
 #include "typecheck.h"
+#include "fold.h"
 #include "param_list.h"
 #include "scope.h"
 #include "x64_codegen.h"
+#include "x64_peephole.h"
+#include "timing.h"
+#include "context.h"
+#include "thread_pool.h"
 
 #include "hash_table.h"
 
 #include "parser.h"
+#include "util.h"
 
 #define DEBUG 0
 
-extern int yyparse();
-extern Decl* parser_result;
+static void usage() {
+    printf("Usage: bminor [-c] [-march=ARCH] [--dump-ir] [--time-report] [--peephole-report]\n");
+    printf("              [--unroll-factor=N] [--inline-threshold=N] [--time-trace=FILE] filename\n");
+    printf("       bminor -j N [-c] [-march=ARCH] [--dump-ir] [--time-report] [--peephole-report]\n");
+    printf("              [--unroll-factor=N] [--inline-threshold=N] file...\n");
+    printf("  -c                 write an ELF object file (output.o, or x.o with -j)\n");
+    printf("                     instead of assembly, no assembler needed\n");
+    printf("  -march=ARCH        the processors to generate code for: x86-64 (SSE2, the\n");
+    printf("                     default), x86-64-v2 (SSE4.2), x86-64-v3 or x86-64-v4 (AVX2),\n");
+    printf("                     or native for the one compiling\n");
+    printf("  --dump-ir          print the intermediate representation of every function\n");
+    printf("  --time-report      print wall time, CPU time and peak RSS per phase\n");
+    printf("  --peephole-report  print how often each peephole rule fired\n");
+    printf("  --unroll-factor=N  copies of the body per iteration of a partially unrolled\n");
+    printf("                     loop (default 4, 1 turns partial unrolling off)\n");
+    printf("  --inline-threshold=N\n");
+    printf("                     inline a call when the callee, in IR instructions, is at\n");
+    printf("                     most N bigger than what the call costs (default 25, 0\n");
+    printf("                     turns inlining off)\n");
+    printf("  --time-trace=FILE  write the same measurements as a Chrome trace-event JSON file\n");
+    printf("  -j N               compile every file on N threads (0: one per CPU), writing\n");
+    printf("                     each x.b to x.s\n");
+}
 
-extern int yylex();
-extern FILE* yyin;
+// the extensions -march=name allows. returns 0 for an unknown name.
+static int parse_march(const char* name, March_t* march) {
+    if (strcmp(name, "x86-64") == 0) {
+        *march = MARCH_SSE2;
+    } else if (strcmp(name, "x86-64-v2") == 0) {
+        *march = MARCH_SSE4_2;
+    } else if (strcmp(name, "x86-64-v3") == 0 || strcmp(name, "x86-64-v4") == 0) {
+        *march = MARCH_AVX2;
+    } else if (strcmp(name, "native") == 0) {
+        __builtin_cpu_init();
+        *march = __builtin_cpu_supports("avx2") ? MARCH_AVX2
+               : __builtin_cpu_supports("sse4.2") ? MARCH_SSE4_2
+               : MARCH_SSE2;
+    } else {
+        return 0;
+    }
+    return 1;
+}
 
-int scope_error = 0;
-int type_error = 0;
+// runs every phase on the current context. returns 0 on success; errors
+// have been written to context->messages.
+static int compile(CompilerContext* context, const char* output_filename, Output_t format, int print_program) {
+    context->input = fopen(context->filename, "r");
+    if (!context->input) {
+        fprintf(context->messages, "Could not open file '%s'.\n", context->filename);
+        return 1;
+    }
 
-struct hash_table* scope_stack[SCOPE_STACK_MAX];
+    // parsing
+    timing_begin("parse");
+    int parse_status = parse(context);
+    timing_end();
+    if (parse_status != 0) {
+        fprintf(context->messages, "Parse failed!\n");
+        return 1;
+    }
 
-int main(int argc, char** argv) {
-    if (argc != 2) {
-        printf("Require one argument: filename.\n");
-        return EXIT_FAILURE;
+    // re-outputting
+    if (print_program) {
+        timing_begin("print");
+        fprintf(context->messages, "Parse successful!\n");
+        fprintf(context->messages, "Result is:\n");
+        if (context->program) {
+            decl_print(context->program);
+        } else {
+            fprintf(context->messages, "null\n");
+        }
+        timing_end();
     }
 
-    char* filename = argv[1];
-    yyin = fopen(filename, "r");
-    if (!yyin) {
-        printf("Could not open file '%s'.", filename);
-        return EXIT_FAILURE;
+    // resolving symbols
+    timing_begin("resolve");
+    scope_init();
+    decl_resolve(context->program);
+    scope_cleanup();
+    timing_end();
+    if (context->scope_error != 0) {
+        fprintf(context->messages, "Error(s) encountered when resolving symbols. Exiting...\n");
+        return 1;
+    }
+
+    // typechecking
+    timing_begin("typecheck");
+    decl_typecheck(context->program);
+    timing_end();
+    if (context->type_error != 0) {
+        fprintf(context->messages, "Error(s) encountered when typechecking. Exiting...\n");
+        return 1;
     }
 
-#if 0
-    // print out token values
-    printf("token values are:\n");
-    enum yytokentype t;
-    while ((t = yylex())) {
-        printf("%d\n", t);
+    // constant folding
+    timing_begin("fold");
+    decl_fold(context->program);
+    timing_end();
+
+    // codegen
+    timing_begin("codegen");
+    int codegen_ok = codegen(context->program, output_filename, format);
+    timing_end();
+    if (!codegen_ok) {
+        return 1;
     }
 
+    timing_begin("free");
+    context_free_program(context);
+    timing_end();
+
+    return 0;
+}
+
+//
+// batch mode
+//
+
+typedef struct {
+    const char* filename;
+    char* output_filename;
+    long size;
+    int failed;
+} BatchJob;
+
+static int batch_time_report = 0;
+static int batch_dump_ir = 0;
+static int batch_peephole_report = 0;
+static int batch_unroll_factor = -1;
+static int batch_inline_threshold = -1;
+static March_t batch_march = MARCH_SSE2;
+static Output_t batch_output_format = OUTPUT_ASSEMBLY;
+
+// keeps the messages of different files from interleaving
+static pthread_mutex_t batch_output_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// x.b becomes x.s (or x.o), any other name gets the extension appended
+static char* output_filename_for(const char* filename, Output_t format) {
+    size_t length = strlen(filename);
+    if (length > 2 && strcmp(filename + length - 2, ".b") == 0) {
+        length -= 2;
+    }
+
+    char* name = checked_malloc(length + 3);
+    memcpy(name, filename, length);
+    strcpy(name + length, format == OUTPUT_OBJECT ? ".o" : ".s");
+    return name;
+}
+
+static void batch_compile(void* arg) {
+    BatchJob* job = arg;
+
+    char* messages = NULL;
+    size_t messages_size = 0;
+
+    CompilerContext* context = context_create(job->filename);
+    context->messages = open_memstream(&messages, &messages_size);
+    if (!context->messages) {
+        printf("Error: ran out of memory.");
+        exit(1);
+    }
+    context->dump_ir = batch_dump_ir;
+    if (batch_unroll_factor >= 0) {
+        context->unroll_factor = batch_unroll_factor;
+    }
+    if (batch_inline_threshold >= 0) {
+        context->inline_threshold = batch_inline_threshold;
+    }
+    context->march = batch_march;
+    context_make_current(context);
+
+    job->failed = compile(context, job->output_filename, batch_output_format, 0);
+    if (batch_time_report) {
+        timing_report(context->messages);
+    }
+    if (batch_peephole_report) {
+        peephole_report(context->messages);
+    }
+
+    fclose(context->messages);
+    context_delete(context);
+
+    // everything a file produced is printed in one piece, every line
+    // prefixed with the file name
+    if (messages_size > 0) {
+        pthread_mutex_lock(&batch_output_lock);
+        char* line = messages;
+        while (*line != '\0') {
+            char* end = strchr(line, '\n');
+            int length = end ? (int)(end - line) : (int)strlen(line);
+            printf("%s: %.*s\n", job->filename, length, line);
+            line += length + (end ? 1 : 0);
+        }
+        fflush(stdout);
+        pthread_mutex_unlock(&batch_output_lock);
+    }
+    free(messages);
+}
+
+static int compare_by_size_descending(const void* a, const void* b) {
+    const BatchJob* ja = a;
+    const BatchJob* jb = b;
+    return (ja->size < jb->size) - (ja->size > jb->size);
+}
+
+static int batch_main(char** filenames, int file_count, int thread_count) {
+    BatchJob* jobs = checked_malloc(sizeof(BatchJob) * file_count);
+    for (int i = 0; i < file_count; i++) {
+        jobs[i].filename = filenames[i];
+        jobs[i].output_filename = output_filename_for(filenames[i], batch_output_format);
+        jobs[i].failed = 0;
+
+        struct stat st;
+        jobs[i].size = stat(filenames[i], &st) == 0 ? (long)st.st_size : 0;
+    }
+
+    // biggest files first, so that no big file is left for last while the
+    // other workers sit idle
+    qsort(jobs, file_count, sizeof(BatchJob), compare_by_size_descending);
+
+    ThreadPool* pool = thread_pool_create(thread_count);
+    for (int i = 0; i < file_count; i++) {
+        thread_pool_submit(pool, batch_compile, &jobs[i]);
+    }
+    thread_pool_delete(pool);
+
+    int failures = 0;
+    for (int i = 0; i < file_count; i++) {
+        failures += jobs[i].failed;
+        free(jobs[i].output_filename);
+    }
+    free(jobs);
+
+    if (failures > 0) {
+        printf("%d of %d file(s) failed to compile.\n", failures, file_count);
+        return EXIT_FAILURE;
+    }
     return EXIT_SUCCESS;
-#endif
+}
 
-    // parsing
-    if (yyparse() != 0) {
-        printf("Parse failed!\n");
+int main(int argc, char** argv) {
+    char** filenames = malloc(sizeof(char*) * argc);
+    int file_count = 0;
+    int time_report = 0;
+    int dump_ir = 0;
+    int peephole = 0;
+    int unroll_factor = -1;
+    int inline_threshold = -1;
+    March_t march = MARCH_SSE2;
+    const char* time_trace_filename = NULL;
+    int thread_count = -1;
+    Output_t format = OUTPUT_ASSEMBLY;
+
+    if (filenames == NULL) {
+        printf("Error: ran out of memory.");
         return EXIT_FAILURE;
     }
 
-    // re-outputting
-    printf("Parse successful!\n");
-    printf("Result is:\n");
-    if (parser_result) {
-        decl_print(parser_result);
-    } else {
-        printf("null\n");
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-c") == 0) {
+            format = OUTPUT_OBJECT;
+        } else if (strcmp(argv[i], "--dump-ir") == 0) {
+            dump_ir = 1;
+        } else if (strcmp(argv[i], "--time-report") == 0) {
+            time_report = 1;
+        } else if (strcmp(argv[i], "--peephole-report") == 0) {
+            peephole = 1;
+        } else if (strncmp(argv[i], "-march=", 7) == 0) {
+            if (!parse_march(argv[i] + 7, &march)) {
+                printf("Unknown architecture '%s'.\n", argv[i] + 7);
+                usage();
+                return EXIT_FAILURE;
+            }
+        } else if (strncmp(argv[i], "--unroll-factor=", 16) == 0) {
+            const char* factor = argv[i] + 16;
+            char* end;
+            unroll_factor = (int)strtol(factor, &end, 10);
+            if (*factor == '\0' || *end != '\0' || unroll_factor < 1) {
+                printf("Invalid unroll factor '%s'.\n", factor);
+                usage();
+                return EXIT_FAILURE;
+            }
+        } else if (strncmp(argv[i], "--inline-threshold=", 19) == 0) {
+            const char* threshold = argv[i] + 19;
+            char* end;
+            inline_threshold = (int)strtol(threshold, &end, 10);
+            if (*threshold == '\0' || *end != '\0' || inline_threshold < 0) {
+                printf("Invalid inline threshold '%s'.\n", threshold);
+                usage();
+                return EXIT_FAILURE;
+            }
+        } else if (strncmp(argv[i], "--time-trace=", 13) == 0) {
+            time_trace_filename = argv[i] + 13;
+        } else if (strncmp(argv[i], "-j", 2) == 0) {
+            const char* count = argv[i][2] != '\0' ? argv[i] + 2 : (i + 1 < argc ? argv[++i] : "");
+            char* end;
+            thread_count = (int)strtol(count, &end, 10);
+            if (*count == '\0' || *end != '\0' || thread_count < 0) {
+                printf("Invalid thread count '%s'.\n", count);
+                usage();
+                return EXIT_FAILURE;
+            }
+        } else if (argv[i][0] == '-') {
+            printf("Unknown option '%s'.\n", argv[i]);
+            usage();
+            return EXIT_FAILURE;
+        } else {
+            filenames[file_count++] = argv[i];
+        }
     }
 
-    // resolving symbols
-    scope_stack[0] = hash_table_create(0, 0);
-    decl_resolve(parser_result);
-    if (scope_error != 0) {
-        printf("Error(s) encountered when resolving symbols. Exiting...\n");
-        exit(1);
+    if (file_count == 0 || (file_count > 1 && thread_count < 0)) {
+        printf("Require one argument: filename, or -j N and any number of files.\n");
+        usage();
+        return EXIT_FAILURE;
     }
-    hash_table_delete(scope_stack[0]);
 
-    // typechecking
-    decl_typecheck(parser_result);
-    if (type_error != 0) {
-        printf("Error(s) encountered when typechecking. Exiting...\n");
-        exit(1);
+    timing_enabled = time_report || time_trace_filename != NULL;
+
+    if (thread_count >= 0) {
+        if (time_trace_filename != NULL) {
+            printf("--time-trace cannot be combined with -j.\n");
+            return EXIT_FAILURE;
+        }
+        batch_time_report = time_report;
+        batch_dump_ir = dump_ir;
+        batch_peephole_report = peephole;
+        batch_unroll_factor = unroll_factor;
+        batch_inline_threshold = inline_threshold;
+        batch_march = march;
+        batch_output_format = format;
+        int status = batch_main(filenames, file_count, thread_count);
+        free(filenames);
+        return status;
     }
 
-    // codegen
-    codegen(parser_result, "output.s");
+    CompilerContext* context = context_create(filenames[0]);
+    context->dump_ir = dump_ir;
+    if (unroll_factor >= 0) {
+        context->unroll_factor = unroll_factor;
+    }
+    if (inline_threshold >= 0) {
+        context->inline_threshold = inline_threshold;
+    }
+    context->march = march;
+    context_make_current(context);
+    free(filenames);
+
+    const char* output_filename = format == OUTPUT_OBJECT ? "output.o" : "output.s";
+    if (compile(context, output_filename, format, 1) != 0) {
+        return EXIT_FAILURE;
+    }
+
+    if (time_report) {
+        timing_report(stdout);
+    }
+    if (peephole) {
+        peephole_report(stdout);
+    }
+    if (time_trace_filename != NULL
+        && !timing_write_trace(time_trace_filename)
+    ) {
+        printf("Could not write trace file '%s'.\n", time_trace_filename);
+        return EXIT_FAILURE;
+    }
+    context_delete(context);
 
-    decl_delete(parser_result);
-    fclose(yyin);
     return EXIT_SUCCESS;
 }
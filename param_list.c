@@ -1,15 +1,16 @@
 #include <stdlib.h>
 #include <stdio.h>
-#include <string.h>
 
 #include "param_list.h"
 #include "type.h"
 #include "typecheck.h"
+#include "arena.h"
+#include "context.h"
 
 ParamList* param_list_create(
-    char* name, Type* type, ParamList* next
+    const char* name, Type* type, ParamList* next
 ) {
-    ParamList* p = malloc(sizeof(*p));
+    ParamList* p = arena_alloc(current_context->ast_arena, sizeof(*p));
     p->name = name;
     p->type = type;
     p->next = next;
@@ -17,23 +18,14 @@ ParamList* param_list_create(
     return p;
 }
 
-void param_list_delete(ParamList* p) {
-    if (!p) return;
-
-    type_delete(p->type);
-    free(p->name);
-    param_list_delete(p->next);
-    free(p);
-}
-
 void param_list_print(ParamList* p) {
     if (!p) return;
 
-    printf("%s: ", p->name);
+    fprintf(current_context->messages, "%s: ", p->name);
     type_print(p->type);
 
     if (p->next) {
-        printf(", ");
+        fprintf(current_context->messages, ", ");
         param_list_print(p->next);
     }
 }
@@ -42,7 +34,8 @@ int param_list_equals(ParamList* a, ParamList* b) {
     if (a == b) return 1;
     if (!a || !b) return 0;
 
-    if (strcmp(a->name, b->name) != 0) {
+    // names are interned
+    if (a->name != b->name) {
         return 0;
     }
 
@@ -69,7 +62,7 @@ ParamList* param_list_copy(ParamList* p) {
     if (!p) return 0;
 
     ParamList* new_p = param_list_create(0, 0, 0);
-    new_p->name = strdup(p->name);
+    new_p->name = p->name;
     new_p->type = type_copy(p->type);
     new_p->next = param_list_copy(p->next);
 
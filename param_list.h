@@ -6,7 +6,8 @@
 typedef struct ParamList ParamList;
 
 struct ParamList {
-    char* name;
+    // interned, see intern.h
+    const char* name;
     Type* type;
     ParamList* next;
 
@@ -14,11 +15,9 @@ struct ParamList {
 };
 
 ParamList* param_list_create(
-    char* name, Type* type, ParamList* next
+    const char* name, Type* type, ParamList* next
 );
 
-void param_list_delete(ParamList* p);
-
 void param_list_print(ParamList* p);
 
 int param_list_equals(ParamList* a, ParamList* b);
@@ -8,90 +8,177 @@
 #include "scope.h"
 #include "symbol.h"
 #include "hash_table.h"
+#include "intern.h"
+#include "arena.h"
+#include "context.h"
+#include "util.h"
+
+/*
+All scopes share one table that maps each name to the chain of bindings
+currently visible for it, innermost first. Binding a name pushes onto its
+chain and records the name in an undo log; leaving a scope pops the chains
+of every name bound since the scope was entered. Entering a scope only
+remembers the length of the undo log, and a lookup is a single probe of the
+table no matter how deeply scopes are nested.
+*/
+
+typedef struct Binding Binding;
+typedef struct ScopeName ScopeName;
+
+struct Binding {
+    Symbol* symbol;
+    int level;
+    Binding* shadowed;
+};
+
+struct ScopeName {
+    Binding* top;
+};
+
+typedef struct {
+    // length of the undo log when the scope was entered
+    int undo_mark;
+} ScopeLevel;
+
+struct ScopeState {
+    // maps atoms to ScopeName
+    struct hash_table* table;
+
+    ScopeName** undo_log;
+    int undo_log_length;
+    int undo_log_capacity;
+
+    ScopeLevel* levels;
+    int top;
+    int levels_capacity;
+
+    // parameters and then locals are numbered consecutively per function,
+    // giving each its own variable in code generation
+    int function_parameter_slots;
+    int function_local_count;
+
+    const char* current_function_name;
+};
+
+static void decl_resolve_single(Decl* d);
+static void stmt_resolve_single(Stmt* s);
+
+static void* grow_array(void* array, int* capacity, size_t element_size) {
+    *capacity = *capacity ? *capacity * 2 : 64;
+    array = checked_realloc(array, element_size * *capacity);
+    return array;
+}
+
+void scope_init() {
+    ScopeState* st = checked_calloc(1, sizeof(*st));
+
+    // names are atoms: their hash is already known, and each is stored
+    // once and compared by pointer
+    st->table = hash_table_create_by_pointer(0, intern_hash);
+    st->levels = grow_array(st->levels, &st->levels_capacity, sizeof(ScopeLevel));
+    st->levels[0].undo_mark = 0;
 
-#define X64_NUM_ARGUMENT_REGISTERS 6
+    current_context->scope = st;
+}
 
-static int scope_stack_top = 0;
-static const char* current_function_name = NULL;
-extern int scope_error;
+void scope_cleanup() {
+    ScopeState* st = current_context->scope;
+    if (!st) return;
 
-extern struct hash_table* scope_stack[SCOPE_STACK_MAX];
+    hash_table_delete(st->table);
+    free(st->undo_log);
+    free(st->levels);
+    free(st);
 
-// stores the current number of variables declared in each scope
-// this is used to set the 'which' property on symbols for code generation
-int scope_stack_local_var_counts[SCOPE_STACK_MAX];
-int scope_stack_parameter_counts[SCOPE_STACK_MAX];
+    current_context->scope = NULL;
+}
 
 void scope_enter() {
-    //printf("entering scope...\n");
-    scope_stack_top++;
-    if (scope_stack_top >= SCOPE_STACK_MAX) {
-        printf("Maximum scope level reached.\n");
-        printf("I'm so sorry for your loss.\n");
-        exit(1);
+    ScopeState* st = current_context->scope;
+    st->top++;
+    if (st->top >= st->levels_capacity) {
+        st->levels = grow_array(st->levels, &st->levels_capacity, sizeof(ScopeLevel));
     }
-
-    // only create a new hash table if the slot in the underlying array is null
-    // if it is non-null, it means there is an empty hash_table there and there is no
-    // need to allocate another
-    scope_stack[scope_stack_top] = hash_table_create(0, 0);
-    scope_stack_local_var_counts[scope_stack_top] = 0;
+    st->levels[st->top].undo_mark = st->undo_log_length;
 }
 
 void scope_exit() {
-    //printf("exiting scope...\n");
-    if (scope_stack_top == 0) {
-        printf("**(Compiler Bug)**: Attempt to delete global scope. Exiting.\n");
+    ScopeState* st = current_context->scope;
+    if (st->top == 0) {
+        fprintf(current_context->messages, "**(Compiler Bug)**: Attempt to delete global scope. Exiting.\n");
         exit(1);
     }
 
-    hash_table_delete(scope_stack[scope_stack_top]);
-    scope_stack[scope_stack_top] = NULL;
-    scope_stack_top--;
+    // unbind everything bound in this scope, newest first
+    int mark = st->levels[st->top].undo_mark;
+    while (st->undo_log_length > mark) {
+        ScopeName* name = st->undo_log[--st->undo_log_length];
+        name->top = name->top->shadowed;
+    }
+
+    st->top--;
 }
 
 int scope_level() {
-    return scope_stack_top+1;
+    return current_context->scope->top+1;
 }
 
 void scope_bind(const char* name, Symbol* symbol) {
-    assert(scope_stack_top >= 0 && scope_stack_top < SCOPE_STACK_MAX);
-
+    ScopeState* st = current_context->scope;
     if (symbol->kind == SYMBOL_LOCAL) {
-        symbol->which = scope_stack_local_var_counts[scope_stack_top]
-                        + scope_stack_parameter_counts[scope_stack_top];
-        scope_stack_local_var_counts[scope_stack_top]++;
+        symbol->which = st->function_parameter_slots + st->function_local_count;
+        st->function_local_count++;
+    }
+
+    ScopeName* scope_name = hash_table_lookup(st->table, name);
+    if (scope_name == NULL) {
+        scope_name = arena_alloc(current_context->ast_arena, sizeof(ScopeName));
+        hash_table_insert(st->table, name, scope_name);
     }
 
-    hash_table_insert(scope_stack[scope_stack_top], name, symbol);
+    Binding* binding = arena_alloc(current_context->ast_arena, sizeof(Binding));
+    binding->symbol = symbol;
+    binding->level = st->top;
+    binding->shadowed = scope_name->top;
+    scope_name->top = binding;
+
+    if (st->undo_log_length == st->undo_log_capacity) {
+        st->undo_log = grow_array(st->undo_log, &st->undo_log_capacity, sizeof(ScopeName*));
+    }
+    st->undo_log[st->undo_log_length++] = scope_name;
 }
 
 Symbol* scope_lookup(const char* name) {
-    int current_level = scope_stack_top;
-    Symbol* s = NULL;
-    while (s == NULL && current_level >= 0) {
-        s = hash_table_lookup(scope_stack[current_level], name);
-        current_level--;
+    ScopeName* scope_name = hash_table_lookup(current_context->scope->table, name);
+    if (scope_name == NULL || scope_name->top == NULL) {
+        return NULL;
     }
-
-    return s;
+    return scope_name->top->symbol;
 }
 
 Symbol* scope_lookup_current(const char* name) {
-    assert(scope_stack_top < SCOPE_STACK_MAX);
-    assert(scope_stack[scope_stack_top]);
-
-    return hash_table_lookup(scope_stack[scope_stack_top], name);
+    ScopeState* st = current_context->scope;
+    ScopeName* scope_name = hash_table_lookup(st->table, name);
+    if (scope_name == NULL || scope_name->top == NULL
+        || scope_name->top->level != st->top
+    ) {
+        return NULL;
+    }
+    return scope_name->top->symbol;
 }
 
 void decl_resolve(Decl* d) {
-    if (!d) return;
+    for (; d != NULL; d = d->next) {
+        decl_resolve_single(d);
+    }
+}
 
+static void decl_resolve_single(Decl* d) {
     Symbol_t kind = scope_level() > 1 ? SYMBOL_LOCAL : SYMBOL_GLOBAL;
 
     if (scope_lookup_current(d->name) != NULL) {
-        printf("Error: Variable '%s' was redeclared.\n", d->name);
-        scope_error = 1;
+        fprintf(current_context->messages, "Error: Variable '%s' was redeclared.\n", d->name);
+        current_context->scope_error = 1;
     }
     d->symbol = symbol_create(kind, d->type, d->name);
 
@@ -99,22 +186,29 @@ void decl_resolve(Decl* d) {
     scope_bind(d->name, d->symbol);
 
     if (d->code) {
+        ScopeState* st = current_context->scope;
+        const char* outer_function_name = st->current_function_name;
+        int outer_parameter_slots = st->function_parameter_slots;
+        int outer_local_count = st->function_local_count;
+
         if (d->type->kind == TYPE_FUNCTION) {
-            current_function_name = d->name;
+            st->current_function_name = d->name;
         }
+        st->function_parameter_slots = 0;
+        st->function_local_count = 0;
 
         scope_enter();
 
         param_list_resolve(d->type->params);
         stmt_resolve(d->code->body);
-        d->local_var_count = scope_stack_local_var_counts[scope_stack_top];
+        d->local_var_count = st->function_local_count;
 
         scope_exit();
 
-        current_function_name = NULL;
+        st->current_function_name = outer_function_name;
+        st->function_parameter_slots = outer_parameter_slots;
+        st->function_local_count = outer_local_count;
     }
-
-    decl_resolve(d->next);
 }
 
 void expr_resolve(Expr* e) {
@@ -123,8 +217,8 @@ void expr_resolve(Expr* e) {
     if (e->kind == EXPR_NAME) {
         e->symbol = scope_lookup(e->name);
         if (e->symbol == NULL) {
-            printf("Error: Identifier '%s' used before it was declared.\n", e->name);
-            scope_error = 1;
+            fprintf(current_context->messages, "Error: Identifier '%s' used before it was declared.\n", e->name);
+            current_context->scope_error = 1;
         }
     } else {
         expr_resolve(e->left);
@@ -133,19 +227,23 @@ void expr_resolve(Expr* e) {
 }
 
 void stmt_resolve(Stmt* s) {
-    if (!s) return;
+    for (; s != NULL; s = s->next) {
+        stmt_resolve_single(s);
+    }
+}
 
+static void stmt_resolve_single(Stmt* s) {
     if (s->kind == STMT_BLOCK) {
         scope_enter();
         stmt_resolve(s->body);
         scope_exit();
     } else {
         if (s->kind == STMT_RETURN) {
-            if (current_function_name == NULL) {
-                printf("Error: return statement outside of function.\n");
-                scope_error = 1;
+            if (current_context->scope->current_function_name == NULL) {
+                fprintf(current_context->messages, "Error: return statement outside of function.\n");
+                current_context->scope_error = 1;
             }
-            s->function_name = strdup(current_function_name);
+            s->function_name = current_context->scope->current_function_name;
         }
         decl_resolve(s->decl);
         expr_resolve(s->init_expr);
@@ -154,7 +252,6 @@ void stmt_resolve(Stmt* s) {
         stmt_resolve(s->body);
         stmt_resolve(s->else_body);
     }
-    stmt_resolve(s->next);
 }
 
 void param_list_resolve(ParamList* p) {
@@ -162,9 +259,7 @@ void param_list_resolve(ParamList* p) {
     for (int i = 0; current != NULL; i++, current = current->next) {
         current->symbol = symbol_create(SYMBOL_PARAM, current->type, current->name);
         current->symbol->which = i;
-        if (i < X64_NUM_ARGUMENT_REGISTERS) {
-            scope_stack_parameter_counts[scope_stack_top]++;
-        }
+        current_context->scope->function_parameter_slots++;
         scope_bind(current->name, current->symbol);
     }
 }
@@ -7,10 +7,12 @@
 #include "param_list.h"
 #include "symbol.h"
 
-#define SCOPE_STACK_MAX 256
+// scope_init must be called before resolving a program and creates the
+// global scope in the current context. scope_cleanup releases the symbol
+// table afterwards. errors are reported in current_context->scope_error.
+void scope_init();
 
-extern struct hash_table* scope_stack[SCOPE_STACK_MAX];
-extern int scope_error;
+void scope_cleanup();
 
 void scope_enter();
 
@@ -18,6 +20,9 @@ void scope_exit();
 
 int scope_level();
 
+// names passed to scope_bind and scope_lookup* must be atoms (see intern.h).
+// scope_bind also numbers locals: every local of a function gets its own
+// stack slot ('which'), after the slots of the register parameters.
 void scope_bind(const char* name, Symbol* sym);
 
 Symbol* scope_lookup(const char* name);
@@ -4,6 +4,8 @@
 #include "stmt.h"
 #include "decl.h"
 #include "expr.h"
+#include "arena.h"
+#include "context.h"
 
 Stmt* stmt_create(
     Stmt_t kind,
@@ -15,7 +17,7 @@ Stmt* stmt_create(
     Stmt* else_body,
     Stmt* next
 ) {
-    Stmt* s = malloc(sizeof(*s));
+    Stmt* s = arena_alloc(current_context->ast_arena, sizeof(*s));
     s->kind = kind;
     s->decl = decl;
     s->init_expr = init_expr;
@@ -29,20 +31,6 @@ Stmt* stmt_create(
     return s;
 }
 
-void stmt_delete(Stmt* s) {
-    if (!s) return;
-
-    decl_delete(s->decl);
-    expr_delete(s->init_expr);
-    expr_delete(s->expr);
-    expr_delete(s->next_expr);
-    stmt_delete(s->body);
-    stmt_delete(s->else_body);
-    stmt_delete(s->next);
-
-    free(s);
-}
-
 Stmt* stmt_create_if_else(
     Expr* expr, Stmt* body, Stmt* else_body
 ) {
@@ -92,15 +80,16 @@ Stmt* stmt_create_expr(Expr* expr) {
 
 void indent_print(char* string, int level);
 void _stmt_print(Stmt* s, int indent);
+static void stmt_print_single(Stmt* s, int indent);
 void body_print(Stmt *body, int indent_level, int indent_first);
 void stmt_print(Stmt* s);
 
 void indent_print(char* string, int level) {
     for (int i = 0; i < level; i++) {
-        printf("    ");
+        fprintf(current_context->messages, "    ");
     }
 
-    printf("%s", string);
+    fprintf(current_context->messages, "%s", string);
 }
 
 // indent_first == boolean
@@ -111,19 +100,23 @@ void body_print(Stmt *s, int indent_level, int indent_first) {
         if (indent_first) {
             indent_print("{\n", indent_level);
         } else {
-            printf("{\n");
+            fprintf(current_context->messages, "{\n");
         }
         _stmt_print(s->body, indent_level + 1);
         indent_print("}\n", indent_level);
     } else {
-        printf("\n");
+        fprintf(current_context->messages, "\n");
         _stmt_print(s, indent_level + 1);
     }
 }
 
 void _stmt_print(Stmt* s, int indent) {
-    if (!s) return;
+    for (; s != NULL; s = s->next) {
+        stmt_print_single(s, indent);
+    }
+}
 
+static void stmt_print_single(Stmt* s, int indent) {
     switch (s->kind) {
         case STMT_DECL:
             indent_print("", indent);
@@ -132,47 +125,45 @@ void _stmt_print(Stmt* s, int indent) {
         case STMT_EXPR:
             indent_print("", indent);
             expr_print(s->expr);
-            printf(";\n");
+            fprintf(current_context->messages, ";\n");
             break;
         case STMT_IF_ELSE:
             indent_print("if (", indent);
             expr_print(s->expr);
-            printf(") ");
+            fprintf(current_context->messages, ") ");
             body_print(s->body, indent, 0);
 
             if (s->else_body) {
                 indent_print("else (", indent);
                 expr_print(s->expr);
-                printf(") ");
+                fprintf(current_context->messages, ") ");
                 body_print(s->body, indent, 0);
             }
             break;
         case STMT_FOR:
             indent_print("for (", indent);
             expr_print(s->init_expr);
-            printf("; ");
+            fprintf(current_context->messages, "; ");
             expr_print(s->expr);
-            printf("; ");
+            fprintf(current_context->messages, "; ");
             expr_print(s->next_expr);
-            printf(") ");
+            fprintf(current_context->messages, ") ");
             body_print(s->body, indent, 0);
             break;
         case STMT_PRINT:
             indent_print("print ", indent);
             expr_print(s->expr);
-            printf(";\n");
+            fprintf(current_context->messages, ";\n");
             break;
         case STMT_RETURN:
             indent_print("return ", indent);
             expr_print(s->expr);
-            printf(";\n");
+            fprintf(current_context->messages, ";\n");
             break;
         case STMT_BLOCK:
             body_print(s, indent, 1);
             break;
     }
-
-    _stmt_print(s->next, indent);
 }
 
 void stmt_print(Stmt* s) {
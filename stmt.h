@@ -44,8 +44,6 @@ Stmt* stmt_create(
     Stmt* next
 );
 
-void stmt_delete(Stmt* s);
-
 Stmt* stmt_create_if_else(
     Expr* expr, Stmt* body, Stmt* else_body
 );
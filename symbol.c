@@ -2,20 +2,16 @@
 
 #include "symbol.h"
 #include "type.h"
+#include "arena.h"
+#include "context.h"
 
-Symbol* symbol_create(Symbol_t kind, Type* type, char* name) {
-    Symbol* s = malloc(sizeof(*s));
+Symbol* symbol_create(Symbol_t kind, Type* type, const char* name) {
+    Symbol* s = arena_alloc(current_context->ast_arena, sizeof(*s));
     s->kind = kind;
     s->type = type;
     s->name = name;
+    s->which = 0;
+    s->assignment_count = 0;
+    s->constant_value = NULL;
     return s;
 }
-
-void symbol_delete(Symbol* s) {
-    if (!s) return;
-
-    type_delete(s->type);
-    free(s->name);
-
-    free(s);
-}
@@ -3,6 +3,7 @@
 
 // forward declare to break include cycle
 typedef struct Type Type;
+typedef struct Expr Expr;
 
 typedef enum {
     SYMBOL_LOCAL,
@@ -15,12 +16,15 @@ typedef struct Symbol Symbol;
 struct Symbol {
     Symbol_t kind;
     Type* type;
-    char* name;
+    const char* name;
     int which;
-};
 
-Symbol* symbol_create(Symbol_t kind, Type* type, char* name);
+    // filled in by constant folding, see fold.c: how often the variable
+    // is assigned to, and the literal it always holds, if any
+    int assignment_count;
+    Expr* constant_value;
+};
 
-void symbol_delete(Symbol* s);
+Symbol* symbol_create(Symbol_t kind, Type* type, const char* name);
 
 #endif
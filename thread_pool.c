@@ -0,0 +1,242 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "thread_pool.h"
+#include "util.h"
+
+// compiling deeply nested programs recurses deeply, so workers get a
+// bigger stack than the usual default
+#define THREAD_POOL_STACK_SIZE (64 * 1024 * 1024)
+
+typedef struct {
+    thread_pool_task_t run;
+    void* arg;
+} Task;
+
+// a growable ring buffer. the owner pushes and pops at the back, thieves
+// take from the front.
+typedef struct {
+    pthread_mutex_t lock;
+    Task* tasks;
+    int front;
+    int length;
+    int capacity;
+} TaskDeque;
+
+typedef struct {
+    ThreadPool* pool;
+    int index;
+} Worker;
+
+struct ThreadPool {
+    int thread_count;
+    pthread_t* threads;
+    Worker* workers;
+    TaskDeque* deques;
+
+    // deque the next submitted task goes to
+    int next_deque;
+
+    // protects the fields below
+    pthread_mutex_t lock;
+    pthread_cond_t work_available;
+    pthread_cond_t all_done;
+    int queued;     // tasks sitting in a deque
+    int pending;    // tasks submitted but not finished
+    int stopping;
+};
+
+static void deque_push_back(TaskDeque* d, Task task) {
+    pthread_mutex_lock(&d->lock);
+    if (d->length == d->capacity) {
+        int new_capacity = d->capacity ? d->capacity * 2 : 64;
+        Task* tasks = checked_malloc(sizeof(Task) * new_capacity);
+        for (int i = 0; i < d->length; i++) {
+            tasks[i] = d->tasks[(d->front + i) % d->capacity];
+        }
+        free(d->tasks);
+        d->tasks = tasks;
+        d->front = 0;
+        d->capacity = new_capacity;
+    }
+    d->tasks[(d->front + d->length) % d->capacity] = task;
+    d->length++;
+    pthread_mutex_unlock(&d->lock);
+}
+
+static int deque_pop_back(TaskDeque* d, Task* task) {
+    int found = 0;
+    pthread_mutex_lock(&d->lock);
+    if (d->length > 0) {
+        d->length--;
+        *task = d->tasks[(d->front + d->length) % d->capacity];
+        found = 1;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return found;
+}
+
+static int deque_pop_front(TaskDeque* d, Task* task) {
+    int found = 0;
+    pthread_mutex_lock(&d->lock);
+    if (d->length > 0) {
+        *task = d->tasks[d->front];
+        d->front = (d->front + 1) % d->capacity;
+        d->length--;
+        found = 1;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return found;
+}
+
+static int take_task(ThreadPool* pool, int self, Task* task) {
+    if (deque_pop_back(&pool->deques[self], task)) {
+        return 1;
+    }
+
+    // steal, starting with the next worker so thieves spread out
+    for (int i = 1; i < pool->thread_count; i++) {
+        int victim = (self + i) % pool->thread_count;
+        if (deque_pop_front(&pool->deques[victim], task)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void* worker_main(void* arg) {
+    Worker* worker = arg;
+    ThreadPool* pool = worker->pool;
+
+    while (1) {
+        Task task;
+        if (take_task(pool, worker->index, &task)) {
+            pthread_mutex_lock(&pool->lock);
+            pool->queued--;
+            pthread_mutex_unlock(&pool->lock);
+
+            task.run(task.arg);
+
+            pthread_mutex_lock(&pool->lock);
+            pool->pending--;
+            if (pool->pending == 0) {
+                pthread_cond_broadcast(&pool->all_done);
+            }
+            pthread_mutex_unlock(&pool->lock);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        while (pool->queued == 0 && !pool->stopping) {
+            pthread_cond_wait(&pool->work_available, &pool->lock);
+        }
+        int done = pool->queued == 0 && pool->stopping;
+        pthread_mutex_unlock(&pool->lock);
+
+        if (done) break;
+    }
+
+    return NULL;
+}
+
+ThreadPool* thread_pool_create(int thread_count) {
+    if (thread_count <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        thread_count = cpus > 0 ? (int)cpus : 1;
+    }
+
+    ThreadPool* pool = checked_malloc(sizeof(*pool));
+    pool->thread_count = thread_count;
+    pool->threads = checked_malloc(sizeof(pthread_t) * thread_count);
+    pool->workers = checked_malloc(sizeof(Worker) * thread_count);
+    pool->deques = checked_malloc(sizeof(TaskDeque) * thread_count);
+    pool->next_deque = 0;
+    pool->queued = 0;
+    pool->pending = 0;
+    pool->stopping = 0;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_available, NULL);
+    pthread_cond_init(&pool->all_done, NULL);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, THREAD_POOL_STACK_SIZE);
+
+    for (int i = 0; i < thread_count; i++) {
+        TaskDeque* d = &pool->deques[i];
+        pthread_mutex_init(&d->lock, NULL);
+        d->tasks = NULL;
+        d->front = 0;
+        d->length = 0;
+        d->capacity = 0;
+
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+    }
+
+    for (int i = 0; i < thread_count; i++) {
+        if (pthread_create(&pool->threads[i], &attr, worker_main, &pool->workers[i]) != 0) {
+            printf("Error: could not start worker thread.\n");
+            exit(1);
+        }
+    }
+
+    pthread_attr_destroy(&attr);
+    return pool;
+}
+
+void thread_pool_submit(ThreadPool* pool, thread_pool_task_t run, void* arg) {
+    Task task = { run, arg };
+
+    // counted before it is queued, so that it cannot be taken and finish
+    // before it was counted
+    pthread_mutex_lock(&pool->lock);
+    pool->pending++;
+    pool->queued++;
+    int index = pool->next_deque;
+    pool->next_deque = (pool->next_deque + 1) % pool->thread_count;
+    pthread_mutex_unlock(&pool->lock);
+
+    deque_push_back(&pool->deques[index], task);
+    pthread_cond_signal(&pool->work_available);
+}
+
+void thread_pool_wait(ThreadPool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0) {
+        pthread_cond_wait(&pool->all_done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void thread_pool_delete(ThreadPool* pool) {
+    thread_pool_wait(pool);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->work_available);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->thread_count; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    for (int i = 0; i < pool->thread_count; i++) {
+        pthread_mutex_destroy(&pool->deques[i].lock);
+        free(pool->deques[i].tasks);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_available);
+    pthread_cond_destroy(&pool->all_done);
+
+    free(pool->deques);
+    free(pool->workers);
+    free(pool->threads);
+    free(pool);
+}
+
+int thread_pool_thread_count(ThreadPool* pool) {
+    return pool->thread_count;
+}
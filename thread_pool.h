@@ -0,0 +1,29 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+/*
+A fixed set of worker threads running submitted tasks. Every worker has its
+own deque: it runs tasks from the back of its own deque and, once that is
+empty, steals from the front of the other workers' deques. Submitted tasks
+are spread over the deques round-robin, so workers only contend for a lock
+when one of them runs out of work.
+*/
+
+typedef struct ThreadPool ThreadPool;
+
+typedef void (*thread_pool_task_t)(void* arg);
+
+// thread_count of zero starts one worker per online CPU
+ThreadPool* thread_pool_create(int thread_count);
+
+void thread_pool_submit(ThreadPool* pool, thread_pool_task_t task, void* arg);
+
+// blocks until every task submitted so far has finished
+void thread_pool_wait(ThreadPool* pool);
+
+// waits for outstanding tasks, then stops and joins the workers
+void thread_pool_delete(ThreadPool* pool);
+
+int thread_pool_thread_count(ThreadPool* pool);
+
+#endif
@@ -0,0 +1,197 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "timing.h"
+#include "context.h"
+#include "util.h"
+
+// only this many of the slowest children are listed under each phase in the
+// table. the trace file always contains every span.
+#define TIMING_REPORT_MAX_CHILDREN 10
+
+int timing_enabled = 0;
+
+// the spans of one compilation, see CompilerContext
+struct Timing {
+    TimingSpan* spans;
+    int span_count;
+    int span_capacity;
+
+    // index of the innermost span that has not ended yet, -1 if none
+    int open_span;
+
+    double wall_origin;
+};
+
+static Timing* current_timing() {
+    Timing* t = current_context->timing;
+    if (t == NULL) {
+        t = checked_calloc(1, sizeof(*t));
+        t->open_span = -1;
+        t->wall_origin = -1;
+        current_context->timing = t;
+    }
+    return t;
+}
+
+static double clock_seconds(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long peak_rss_kb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    // ru_maxrss is reported in kilobytes on Linux
+    return usage.ru_maxrss;
+}
+
+void timing_begin(const char* name) {
+    if (!timing_enabled) return;
+
+    Timing* t = current_timing();
+    if (t->span_count == t->span_capacity) {
+        t->span_capacity = t->span_capacity ? t->span_capacity * 2 : 64;
+        t->spans = checked_realloc(t->spans, sizeof(*t->spans) * t->span_capacity);
+    }
+
+    TimingSpan* span = &t->spans[t->span_count];
+    span->name = strdup(name ? name : "(null)");
+    span->parent = t->open_span;
+    span->depth = t->open_span < 0 ? 0 : t->spans[t->open_span].depth + 1;
+    span->wall_time = 0;
+    span->cpu_time = 0;
+    span->peak_rss_kb = 0;
+
+    span->wall_start = clock_seconds(CLOCK_MONOTONIC);
+    span->cpu_start = clock_seconds(CLOCK_THREAD_CPUTIME_ID);
+    if (t->wall_origin < 0) {
+        t->wall_origin = span->wall_start;
+    }
+
+    t->open_span = t->span_count++;
+}
+
+void timing_end() {
+    if (!timing_enabled) return;
+
+    Timing* t = current_timing();
+    if (t->open_span < 0) {
+        printf("**(Compiler Bug)**: timing_end called without a matching timing_begin.\n");
+        exit(1);
+    }
+
+    TimingSpan* span = &t->spans[t->open_span];
+    span->wall_time = clock_seconds(CLOCK_MONOTONIC) - span->wall_start;
+    span->cpu_time = clock_seconds(CLOCK_THREAD_CPUTIME_ID) - span->cpu_start;
+    span->peak_rss_kb = peak_rss_kb();
+
+    t->open_span = span->parent;
+}
+
+static int compare_by_wall_time(const void* a, const void* b) {
+    const TimingSpan* sa = *(const TimingSpan* const*)a;
+    const TimingSpan* sb = *(const TimingSpan* const*)b;
+    return (sa->wall_time < sb->wall_time) - (sa->wall_time > sb->wall_time);
+}
+
+static void report_row(FILE* out, TimingSpan* span) {
+    fprintf(out, "%*s%-*s %12.3f %12.3f %14ld\n",
+            span->depth * 2, "",
+            40 - span->depth * 2, span->name,
+            span->wall_time * 1000,
+            span->cpu_time * 1000,
+            span->peak_rss_kb);
+}
+
+void timing_report(FILE* out) {
+    fprintf(out, "%-40s %12s %12s %14s\n",
+            "Phase", "Wall (ms)", "CPU (ms)", "Peak RSS (KB)");
+
+    Timing* t = current_timing();
+    TimingSpan** children = checked_malloc(sizeof(TimingSpan*) * (t->span_count + 1));
+
+    for (int i = 0; i < t->span_count; i++) {
+        if (t->spans[i].depth != 0) continue;
+
+        report_row(out, &t->spans[i]);
+
+        // collect direct children and list the slowest ones
+        int child_count = 0;
+        for (int j = i + 1; j < t->span_count && t->spans[j].depth > 0; j++) {
+            if (t->spans[j].parent == i) {
+                children[child_count++] = &t->spans[j];
+            }
+        }
+
+        qsort(children, child_count, sizeof(TimingSpan*), compare_by_wall_time);
+        for (int j = 0; j < child_count && j < TIMING_REPORT_MAX_CHILDREN; j++) {
+            report_row(out, children[j]);
+        }
+        if (child_count > TIMING_REPORT_MAX_CHILDREN) {
+            fprintf(out, "  (%d more)\n", child_count - TIMING_REPORT_MAX_CHILDREN);
+        }
+    }
+
+    free(children);
+}
+
+static void write_json_string(FILE* out, const char* s) {
+    fputc('"', out);
+    for (; *s != '\0'; s++) {
+        if (*s == '"' || *s == '\\') {
+            fputc('\\', out);
+            fputc(*s, out);
+        } else if ((unsigned char)*s < 0x20) {
+            fprintf(out, "\\u%04x", *s);
+        } else {
+            fputc(*s, out);
+        }
+    }
+    fputc('"', out);
+}
+
+// writes the spans in the Chrome trace-event format, viewable with
+// chrome://tracing or https://ui.perfetto.dev
+int timing_write_trace(const char* filename) {
+    FILE* out = fopen(filename, "w");
+    if (!out) {
+        return 0;
+    }
+
+    Timing* t = current_timing();
+    fprintf(out, "{\"traceEvents\":[\n");
+    for (int i = 0; i < t->span_count; i++) {
+        TimingSpan* span = &t->spans[i];
+        fprintf(out, "{\"name\":");
+        write_json_string(out, span->name);
+        fprintf(out,
+                ",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,"
+                "\"ts\":%.3f,\"dur\":%.3f,"
+                "\"args\":{\"cpu_ms\":%.3f,\"peak_rss_kb\":%ld}}%s\n",
+                span->depth == 0 ? "phase" : "decl",
+                (span->wall_start - t->wall_origin) * 1e6,
+                span->wall_time * 1e6,
+                span->cpu_time * 1000,
+                span->peak_rss_kb,
+                i + 1 < t->span_count ? "," : "");
+    }
+    fprintf(out, "],\"displayTimeUnit\":\"ms\"}\n");
+
+    fclose(out);
+    return 1;
+}
+
+void timing_delete(Timing* t) {
+    if (!t) return;
+
+    for (int i = 0; i < t->span_count; i++) {
+        free(t->spans[i].name);
+    }
+    free(t->spans);
+    free(t);
+}
@@ -0,0 +1,41 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdio.h>
+
+// Spans nest: a span begun while another is still open is recorded as its
+// child. Times are in seconds, peak RSS is the process high-water mark (in
+// kilobytes) observed when the span ended.
+typedef struct TimingSpan TimingSpan;
+
+struct TimingSpan {
+    char* name;
+    int depth;
+    int parent;
+
+    double wall_start;
+    double wall_time;
+    double cpu_start;
+    double cpu_time;
+    long peak_rss_kb;
+};
+
+// the spans of one compilation, owned by its CompilerContext. the functions
+// below record into and report on the current context.
+typedef struct Timing Timing;
+
+// non-zero when --time-report or --time-trace was given. timing_begin and
+// timing_end do nothing while this is zero.
+extern int timing_enabled;
+
+void timing_begin(const char* name);
+
+void timing_end();
+
+void timing_report(FILE* out);
+
+int timing_write_trace(const char* filename);
+
+void timing_delete(Timing* t);
+
+#endif
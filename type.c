@@ -4,9 +4,11 @@
 #include "type.h"
 #include "expr.h"
 #include "param_list.h"
+#include "arena.h"
+#include "context.h"
 
 Type* type_create(Type_t kind) {
-    Type* t = malloc(sizeof(*t));
+    Type* t = arena_alloc(current_context->ast_arena, sizeof(*t));
     t->kind = kind;
     t->subtype = 0;
     t->params = 0;
@@ -14,14 +16,6 @@ Type* type_create(Type_t kind) {
     return t;
 }
 
-void type_delete(Type* t) {
-    if (!t) return;
-
-    type_delete(t->subtype);
-    param_list_delete(t->params);
-    free(t);
-}
-
 Type* type_create_array(Type* subtype, Expr* size_expr) {
     Type* t = type_create(TYPE_ARRAY);
     t->subtype = subtype;
@@ -41,32 +35,32 @@ void type_print(Type* t) {
 
     switch (t->kind) {
         case TYPE_VOID:
-            printf("void");
+            fprintf(current_context->messages, "void");
             break;
         case TYPE_BOOLEAN:
-            printf("boolean");
+            fprintf(current_context->messages, "boolean");
             break;
         case TYPE_CHAR:
-            printf("char");
+            fprintf(current_context->messages, "char");
             break;
         case TYPE_INTEGER:
-            printf("integer");
+            fprintf(current_context->messages, "integer");
             break;
         case TYPE_STRING:
-            printf("string");
+            fprintf(current_context->messages, "string");
             break;
         case TYPE_ARRAY:
-            printf("array [");
+            fprintf(current_context->messages, "array [");
             expr_print(t->size_expr);
-            printf("] ");
+            fprintf(current_context->messages, "] ");
             type_print(t->subtype);
             break;
         case TYPE_FUNCTION:
-            printf("function ");
+            fprintf(current_context->messages, "function ");
             type_print(t->subtype);
-            printf(" (");
+            fprintf(current_context->messages, " (");
             param_list_print(t->params);
-            printf(")");
+            fprintf(current_context->messages, ")");
             break;
         default:
             break;
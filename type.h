@@ -25,8 +25,6 @@ struct Type {
 
 Type* type_create(Type_t kind);
 
-void type_delete(Type* t);
-
 Type* type_create_array(Type* subtype, Expr* size_expr);
 
 Type* type_create_function(Type* return_type, ParamList* params);
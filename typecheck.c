@@ -8,10 +8,12 @@
 #include "expr.h"
 #include "decl.h"
 #include "stmt.h"
+#include "context.h"
 
 #include <stdarg.h>
 
-extern int type_error;
+static void decl_typecheck_single(Decl* d);
+static void stmt_typecheck_single(Stmt* s);
 
 void error_print(const char* fmt, ...) {
     va_list args;
@@ -28,18 +30,18 @@ void error_print(const char* fmt, ...) {
                     expr_print(va_arg(args, Expr*));
                     break;
                 case 's':
-                    printf("%s", va_arg(args, char*));
+                    fprintf(current_context->messages, "%s", va_arg(args, char*));
                     break;
                 case '%':
-                    putchar('%');
+                    fputc('%', current_context->messages);
                     break;
                 default:
-                    printf("Error in 'error_print': reached unexpected character %c after %%.\n", *fmt);
+                    fprintf(current_context->messages, "Error in 'error_print': reached unexpected character %c after %%.\n", *fmt);
                     exit(1);
                     break;
             }
         } else {
-            putchar(*fmt);
+            fputc(*fmt, current_context->messages);
         }
 
         fmt++;
@@ -66,7 +68,7 @@ int type_equals(Type* a, Type* b) {
             return type_equals(a->subtype, b->subtype)
                     && param_list_equals(a->params, b->params);
         default:
-            printf("Compiler bug: enum case not handled.\n");
+            fprintf(current_context->messages, "Compiler bug: enum case not handled.\n");
             assert(0);
     }
 }
@@ -107,8 +109,12 @@ int is_compile_time_constant(Expr* e) {
 }
 
 void decl_typecheck(Decl* d) {
-    if (!d) return;
+    for (; d != NULL; d = d->next) {
+        decl_typecheck_single(d);
+    }
+}
 
+static void decl_typecheck_single(Decl* d) {
     // type check arrays
     if (d->type->kind == TYPE_ARRAY) {
         if (!d->value && !d->type->size_expr) {
@@ -117,7 +123,7 @@ void decl_typecheck(Decl* d) {
                 \n\tA size expression or initial value must be included.\n\n",
                 d->name
             );
-            type_error = 1;
+            current_context->type_error = 1;
         }
 
         if (d->type->size_expr) {
@@ -140,7 +146,7 @@ void decl_typecheck(Decl* d) {
                  Got declaration (%s: %T = %E), which is of type (%T) = (%T).\n",
                 d->name, d->symbol->type, d->value, d->symbol->type, t
             );
-            type_error = 1;
+            current_context->type_error = 1;
         }
 
         if (d->type->kind == TYPE_ARRAY && d->type->size_expr
@@ -160,20 +166,22 @@ void decl_typecheck(Decl* d) {
                 \n\tFound: (%E)\n\n",
                 d->value
             );
-            type_error = 1;
+            current_context->type_error = 1;
         }
     }
 
     if (d->code) {
         stmt_typecheck(d->code);
     }
-
-    decl_typecheck(d->next);
 }
 
 void stmt_typecheck(Stmt* s) {
-    if (!s) return;
+    for (; s != NULL; s = s->next) {
+        stmt_typecheck_single(s);
+    }
+}
 
+static void stmt_typecheck_single(Stmt* s) {
     Type* t;
     switch (s->kind) {
         case STMT_DECL:
@@ -181,16 +189,14 @@ void stmt_typecheck(Stmt* s) {
             break;
         case STMT_EXPR:
             t = expr_typecheck(s->expr);
-            //type_delete(t);
             break;
         case STMT_IF_ELSE:
             t = expr_typecheck(s->expr);
             if (t->kind != TYPE_BOOLEAN) {
                 error_print("Type error: if statement condition must be a boolean.\n\tGot expression (%E), which is of type (%T).\n", s->expr, t);
-                type_error = 1;
+                current_context->type_error = 1;
             }
 
-            //type_delete(t);
             stmt_typecheck(s->body);
             stmt_typecheck(s->else_body);
             break;
@@ -199,10 +205,9 @@ void stmt_typecheck(Stmt* s) {
 
             if (t == NULL || t->kind != TYPE_BOOLEAN) {
                 error_print("Type error: for loop condition must be a boolean.\n\tGot expression (%E), which is of type (%T)\n", s->expr, t);
-                type_error = 1;
+                current_context->type_error = 1;
             }
 
-            //type_delete(t);
             stmt_typecheck(s->body);
             break;
         case STMT_PRINT:
@@ -215,8 +220,6 @@ void stmt_typecheck(Stmt* s) {
             stmt_typecheck(s->body);
             break;
     }
-
-    stmt_typecheck(s->next);
 }
 
 Type* expr_typecheck(Expr* e) {
@@ -236,7 +239,7 @@ Type* expr_typecheck(Expr* e) {
         case EXPR_MODULO:
             if (lt->kind != TYPE_INTEGER || rt->kind != TYPE_INTEGER) {
                 error_print("Type error: arithmetic operations require integers. \n\tGot the expression (%E), which is of type (%T) + (%T)\n", e, lt, rt);
-                type_error = 1;
+                current_context->type_error = 1;
             }
             result = type_create(TYPE_INTEGER);
             break;
@@ -252,7 +255,7 @@ Type* expr_typecheck(Expr* e) {
         case EXPR_NEGATE:
             if (lt->kind != TYPE_INTEGER) {
                 error_print("Type error: negate operator requries an integer.\n\tGot expression (%E), which is of type (%T).\n", lt);
-                type_error = 1;
+                current_context->type_error = 1;
             }
             result = type_create(TYPE_INTEGER);
             break;
@@ -260,14 +263,14 @@ Type* expr_typecheck(Expr* e) {
         case EXPR_LOGICAL_AND:
             if (lt->kind != TYPE_BOOLEAN || rt->kind != TYPE_BOOLEAN) {
                 error_print("Type error: logical operators require boolean arguments.\n\tGot the expression (%E), which is of type (%T) %s (%T)\n", e, lt, e->kind == EXPR_LOGICAL_OR ? "||" : "&&", rt);
-                type_error = 1;
+                current_context->type_error = 1;
             }
             result = type_create(TYPE_BOOLEAN);
             break;
         case EXPR_LOGICAL_NOT:
             if (lt->kind != TYPE_BOOLEAN) {
                 error_print("Type error: logical negation requires a boolean.\n\tGot the expression (%E) which is of type (%T)\n", e, lt);
-                type_error = 1;
+                current_context->type_error = 1;
             }
             result = type_create(TYPE_BOOLEAN);
             break;
@@ -275,14 +278,14 @@ Type* expr_typecheck(Expr* e) {
         case EXPR_CMP_NOT_EQUAL:
             if (!type_equals(lt, rt)) {
                 error_print("Type error: comparison operators may only be used on two values of the same type.\n\tGot the expression (%E), which is of the type (%T) %s (%T).\n", e, lt, e->kind == EXPR_CMP_EQUAL ? "==" : "!=", rt);
-                type_error = 1;
+                current_context->type_error = 1;
             }
 
             if (lt->kind == TYPE_VOID ||
                 lt->kind == TYPE_ARRAY ||
                 lt->kind == TYPE_FUNCTION) {
                 error_print("Type error: cannot compare values of non-atomic types. \n\tGot the expression (%E), which is of type (%T)\n", e, lt);
-                type_error = 1;
+                current_context->type_error = 1;
             }
             result = type_create(TYPE_BOOLEAN);
             break;
@@ -292,7 +295,7 @@ Type* expr_typecheck(Expr* e) {
         case EXPR_CMP_LT_EQUAL:
             if (lt->kind != TYPE_INTEGER || rt->kind != TYPE_INTEGER) {
                 error_print("Type error: cannot use relative comparison operators on non-integer types.\n\tGot expression (%E), with operands of type (%T), (%T)\n", e, lt, rt);
-                type_error = 1;
+                current_context->type_error = 1;
             }
             result = type_create(TYPE_BOOLEAN);
             break;
@@ -322,45 +325,42 @@ Type* expr_typecheck(Expr* e) {
             if (lt->kind == TYPE_ARRAY) {
                 if (rt->kind != TYPE_INTEGER) {
                     error_print("Type error: array subscript must be an integer.\n\tGot expression (%E), which is of type (%T).\n", e->right, rt);
-                    type_error = 1;
+                    current_context->type_error = 1;
                 }
                 result = type_copy(lt->subtype);
             } else {
                 error_print("Type error: subscript target is not an array.\n\tGot expression (%E), which is of type (%T)\n", e->left, lt);
-                type_error = 1;
+                current_context->type_error = 1;
                 result = type_copy(lt);
             }
             break;
         case EXPR_ASSIGN:
             if (lt->kind != rt->kind) {
                 error_print("Type error: cannot assign to a variable of a different type.\n\tGot expression (%E), which is of type (%T) = (%T).\n", e, lt, rt);
-                type_error = 1;
+                current_context->type_error = 1;
             }
             result = type_copy(lt);
             break;
         case EXPR_INCREMENT:
             if (lt->kind != TYPE_INTEGER) {
                 error_print("Type error: cannot use increment operator on non-integer.\n\tGot expression (%E), which is of type (%T).\n", e, lt);
-                type_error = 1;
+                current_context->type_error = 1;
             }
             result = type_create(TYPE_INTEGER);
             break;
         case EXPR_DECREMENT:
             if (lt->kind != TYPE_INTEGER) {
                 error_print("Type error: cannot use decrement operator on non-integer.\n\tGot expression (%E), which is of type (%T).\n", e, lt);
-                type_error = 1;
+                current_context->type_error = 1;
             }
             result = type_create(TYPE_INTEGER);
             break;
         default:
-            printf("Compiler bug: enum case not handled.\n");
+            fprintf(current_context->messages, "Compiler bug: enum case not handled.\n");
             assert(0);
     }
     e->type = result;
 
-    //type_delete(lt);
-    //type_delete(rt);
-
     assert(result != NULL);
     return result;
 }
@@ -10,8 +10,6 @@ int type_equals(Type* a, Type* b);
 
 Type* type_copy(Type* t);
 
-void type_delete(Type* t);
-
 Type* expr_typecheck(Expr* e);
 
 void decl_typecheck(Decl* d);
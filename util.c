@@ -0,0 +1,24 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "util.h"
+
+static void* checked(void* p) {
+    if (p == NULL) {
+        printf("Error: ran out of memory.");
+        exit(1);
+    }
+    return p;
+}
+
+void* checked_malloc(size_t size) {
+    return checked(malloc(size ? size : 1));
+}
+
+void* checked_realloc(void* p, size_t size) {
+    return checked(realloc(p, size ? size : 1));
+}
+
+void* checked_calloc(size_t count, size_t size) {
+    return checked(calloc(count ? count : 1, size ? size : 1));
+}
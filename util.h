@@ -0,0 +1,12 @@
+#ifndef UTIL_H
+#define UTIL_H
+
+#include <stddef.h>
+
+// malloc, realloc and calloc that report running out of memory and exit
+// instead of returning NULL. a size of zero still gets a unique pointer.
+void* checked_malloc(size_t size);
+void* checked_realloc(void* p, size_t size);
+void* checked_calloc(size_t count, size_t size);
+
+#endif
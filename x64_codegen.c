@@ -1,6 +1,8 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
+#include <limits.h>
 #include <assert.h>
 
 #include "x64_codegen.h"
@@ -8,747 +10,978 @@
 #include "expr.h"
 #include "stmt.h"
 #include "decl.h"
+#include "timing.h"
+#include "context.h"
+#include "hash_table.h"
+#include "x64_emit.h"
+#include "x64_regalloc.h"
+#include "ir.h"
+#include "ir_opt.h"
+#include "util.h"
 
-#define X64_NUM_SCRATCH_REGISTERS 7
 #define X64_NUM_ARGUMENT_REGISTERS 6
 
-FILE* output_file = NULL;
+static void decl_codegen_single(Decl* d, IrFunction* f);
 
-const char* argument_registers[X64_NUM_ARGUMENT_REGISTERS] = {
-    "%rdi", "%rsi", "%rdx", "%rcx", "%r8", "%r9",
+const Register_t argument_registers[X64_NUM_ARGUMENT_REGISTERS] = {
+    X64_RDI, X64_RSI, X64_RDX, X64_RCX, X64_R8, X64_R9,
 };
 
-struct ScratchTable {
-    const char* name[X64_NUM_SCRATCH_REGISTERS];
-    int in_use[X64_NUM_SCRATCH_REGISTERS];
-};
+//
+// label stuff
+//
 
-struct ScratchTable scratch_table = {
-    { "%rbx", "%r10", "%r11", "%r12", "%r13", "%r14", "%r15" },
-    { 0, 0, 0, 0, 0, 0, 0 },
-};
+int label_create() {
+    return current_context->current_label_num++;
+}
 
-int scratch_alloc() {
-    for (int r = 0; r < X64_NUM_SCRATCH_REGISTERS; r++) {
-        if (!scratch_table.in_use[r]) {
-            scratch_table.in_use[r] = 1;
-            return r;
-        }
+static Operand reg(Register_t r) {
+    return operand_register(r);
+}
+
+static Operand imm(long value) {
+    return operand_immediate(value);
+}
+
+// calls target with args. the first six go in registers, the rest on the
+// stack, and %rsp is kept 16-byte aligned. the result is left in %rax.
+static void call_codegen(Operand target, const Operand* args, int arg_count) {
+    int stack_args = arg_count > X64_NUM_ARGUMENT_REGISTERS ? arg_count - X64_NUM_ARGUMENT_REGISTERS : 0;
+    int padding = stack_args % 2;
+
+    if (padding) {
+        instr2(X64_SUBQ, imm(8), reg(X64_RSP));
     }
-    printf("Error: All registers are in use.\n");
-    assert(0);
+    for (int i = arg_count-1; i >= X64_NUM_ARGUMENT_REGISTERS; i--) {
+        instr1(X64_PUSHQ, args[i]);
+    }
+    for (int i = 0; i < arg_count && i < X64_NUM_ARGUMENT_REGISTERS; i++) {
+        instr2(X64_MOVQ, args[i], reg(argument_registers[i]));
+    }
+
+    // zero floating point args
+    instr2(X64_XORQ, reg(X64_RAX), reg(X64_RAX));
+    instr1(X64_CALL, target);
+
+    if (stack_args + padding > 0) {
+        instr2(X64_ADDQ, imm(8 * (stack_args + padding)), reg(X64_RSP));
+    }
+}
+
+//
+// operands
+//
+
+static int fits_in_32(long value) {
+    return value >= -2147483648L && value <= 2147483647L;
+}
+
+// temporaries of the IR are the virtual registers of the same number
+static Operand temp(int t) {
+    return reg(virtual_register(t));
 }
 
-void scratch_free(int r) {
-    if (r < 0 || r >= X64_NUM_SCRATCH_REGISTERS) {
-        printf("Error: Register value passed to scratch_free (%d) is not a valid register.\n", r);
-        assert(0);
+// o as a register, moving a constant into a new one
+static Operand in_register(IrOperand o) {
+    if (o.kind == IR_OPERAND_TEMP) {
+        return temp(o.value);
     }
-    scratch_table.in_use[r] = 0;
+    Operand r = reg(vreg_create());
+    instr2(X64_MOVQ, imm(o.value), r);
+    return r;
 }
 
-const char* scratch_name(int r) {
-    if (r < 0 || r >= X64_NUM_SCRATCH_REGISTERS) {
-        printf("Error: Register value passed to scratch_name (%d) is not a valid register.\n", r);
-        assert(0);
+// o as the source of an arithmetic instruction: an immediate if it fits
+static Operand source(IrOperand o) {
+    if (o.kind == IR_OPERAND_CONSTANT && fits_in_32(o.value)) {
+        return imm(o.value);
     }
-    return scratch_table.name[r];
+    return in_register(o);
+}
+
+// o as the source of a MOVQ, which takes 64-bit immediates
+static Operand value(IrOperand o) {
+    return o.kind == IR_OPERAND_CONSTANT ? imm(o.value) : temp(o.value);
+}
+
+// the element base[index] of an array of quads
+static Operand element(IrOperand base, IrOperand index) {
+    Operand b = in_register(base);
+    if (index.kind == IR_OPERAND_CONSTANT && fits_in_32(8 * index.value)) {
+        return operand_memory(b.base, 8 * index.value);
+    }
+    return operand_indexed(b.base, in_register(index).base, 8);
 }
 
 //
-// label stuff
+// comparisons
 //
 
-int current_label_num = 0;
+static int is_comparison(IrOpcode_t op) {
+    return op >= IR_EQ && op <= IR_LE;
+}
 
-int label_create() {
-    return current_label_num++;
+static Opcode_t comparison_jump(IrOpcode_t op) {
+    switch (op) {
+        case IR_EQ:
+            return X64_JE;
+        case IR_NE:
+            return X64_JNE;
+        case IR_GT:
+            return X64_JG;
+        case IR_GE:
+            return X64_JGE;
+        case IR_LT:
+            return X64_JL;
+        case IR_LE:
+            return X64_JLE;
+        default:
+            fprintf(current_context->messages, "Error: %d is not a comparison.\n", op);
+            assert(0);
+    }
 }
 
-const char* label_name(int label) {
-    char* temp = malloc(sizeof(char) * 256);
-    sprintf(temp, ".L%d", label);
-    return temp;
+// the comparison that holds for b op' a exactly when a op b holds
+static IrOpcode_t comparison_swap(IrOpcode_t op) {
+    switch (op) {
+        case IR_GT:
+            return IR_LT;
+        case IR_GE:
+            return IR_LE;
+        case IR_LT:
+            return IR_GT;
+        case IR_LE:
+            return IR_GE;
+        default:
+            return op;
+    }
 }
 
-const char* symbol_codegen(Symbol* s) {
-    char* name = malloc(sizeof(char) * 256);
-    if (name == NULL) {
-        printf("Error: ran out of memory.");
-        assert(0);
+// the jump taken exactly when jump is not
+static Opcode_t jump_inverse(Opcode_t jump) {
+    switch (jump) {
+        case X64_JE:
+            return X64_JNE;
+        case X64_JNE:
+            return X64_JE;
+        case X64_JG:
+            return X64_JLE;
+        case X64_JGE:
+            return X64_JL;
+        case X64_JL:
+            return X64_JGE;
+        case X64_JLE:
+            return X64_JG;
+        default:
+            fprintf(current_context->messages, "Error: %d is not a conditional jump.\n", jump);
+            assert(0);
     }
+}
 
-    if (s->kind == SYMBOL_GLOBAL) {
-        sprintf(name, "%s(%%rip)", s->name);
-    } else if (s->kind == SYMBOL_LOCAL) {
-        // (s->which+1) here to convert from zero-based
-        int offset = (s->which+1)*8;
-        sprintf(name, "-%d(%%rbp)", offset);
-    } else if (s->kind == SYMBOL_PARAM) {
-        if (s->which < X64_NUM_ARGUMENT_REGISTERS) {
-            sprintf(name, "-%d(%%rbp)", (s->which+1)*8);
-        } else {
-            int offset = 32 + ((s->which - X64_NUM_ARGUMENT_REGISTERS) * 8);
-            sprintf(name, "%d(%%rbp)", offset);
-        }
+// sets the flags with a single CMPQ for the comparison in, with an
+// immediate when one operand is a constant. returns the conditional jump
+// that is taken exactly when the comparison holds.
+static Opcode_t compare_codegen(IrInstr* in) {
+    IrOperand a = in->a;
+    IrOperand b = in->b;
+    IrOpcode_t op = in->op;
+    if (a.kind == IR_OPERAND_CONSTANT && b.kind == IR_OPERAND_TEMP) {
+        a = in->b;
+        b = in->a;
+        op = comparison_swap(op);
     }
-    //printf("s->name gets symbol %s\n", name);
 
-    return name;
+    Operand right = source(b);
+    Operand left = in_register(a);
+    instr2(X64_CMPQ, right, left);
+    return comparison_jump(op);
 }
 
-void expr_codegen(Expr* e) {
-    if (!e) return;
+// sets the flags for the condition of a branch or select: from the
+// comparison fused into it, if any, or by testing the condition itself.
+// returns the conditional jump taken when the condition is true.
+static Opcode_t condition_codegen(IrOperand condition, IrInstr* fused) {
+    if (fused) {
+        return compare_codegen(fused);
+    }
+    instr2(X64_CMPQ, imm(0), in_register(condition));
+    return X64_JNE;
+}
 
-    switch (e->kind) {
-        case EXPR_NAME: {
-            const char* symbol = symbol_codegen(e->symbol);
-            e->reg = scratch_alloc();
-            fprintf(output_file, "MOVQ %s, %s\n",
-                symbol,
-                scratch_name(e->reg));
-            free((void*) symbol);
-        } break;
-        // literals
-        case EXPR_STRING_LITERAL: {
-            // .data
-            // .<label>:
-            //     .str <value>
-            // .text
-            fprintf(output_file, ".data\n");
+//
+// vector loops
+//
 
-            const char* str_label = label_name(label_create());
+#define NUM_VECTOR_REGISTERS 16
 
-            fprintf(output_file, "%s:\n", str_label);
+// the vector registers of the loop being generated. they are not
+// allocated like the general registers, nothing is kept in them past the
+// loop.
+typedef struct {
+    int bytes;      // 16 for SSE2, 32 for AVX2
+    int taken;      // bit n is set while register n is in use
+} VectorRegisters;
 
-            fprintf(output_file, "\t.string \"%s\"\n", e->string_literal);
-            fprintf(output_file, ".text\n");
+static Operand vec(VectorRegisters* v, int n) {
+    return operand_vector(n, v->bytes);
+}
 
-            e->reg = scratch_alloc();
-            fprintf(output_file, "LEAQ %s(%%rip), %s\n",
-                    str_label,
-                    scratch_name(e->reg));
+static int vector_take(VectorRegisters* v) {
+    for (int n = 0; n < NUM_VECTOR_REGISTERS; n++) {
+        if (!(v->taken & (1 << n))) {
+            v->taken |= 1 << n;
+            return n;
+        }
+    }
+    fprintf(current_context->messages, "Error: ran out of vector registers.\n");
+    assert(0);
+    return -1;
+}
 
-            free((void*)str_label);
-        } break;
-        case EXPR_CHAR_LITERAL:
-        case EXPR_INTEGER_LITERAL:
-        case EXPR_BOOLEAN_LITERAL:
-            e->reg = scratch_alloc();
-            fprintf(output_file, "MOVQ $%d, %s\n",
-                e->integer_value,
-                scratch_name(e->reg));
-            break;
-        // arithmetic expressions
-        case EXPR_ADD:
-            expr_codegen(e->left);
-            expr_codegen(e->right);
+static void vector_give_back(VectorRegisters* v, int n) {
+    v->taken &= ~(1 << n);
+}
 
-            fprintf(output_file, "ADDQ %s, %s\n",
-                scratch_name(e->left->reg),
-                scratch_name(e->right->reg));
+// o in every quad of register n
+static void broadcast(VectorRegisters* v, IrOperand o, int n) {
+    if (o.kind == IR_OPERAND_CONSTANT && o.value == 0) {
+        instr2(X64_PXOR, vec(v, n), vec(v, n));
+        return;
+    }
+    instr2(X64_MOVQ_XMM, in_register(o), operand_vector(n, 16));
+    if (v->bytes == 32) {
+        instr2(X64_VPBROADCASTQ, operand_vector(n, 16), vec(v, n));
+    } else {
+        instr2(X64_PUNPCKLQDQ, vec(v, n), vec(v, n));
+    }
+}
 
-            e->reg = e->right->reg;
-            scratch_free(e->left->reg);
-            break;
-        case EXPR_SUB:
-            expr_codegen(e->left);
-            expr_codegen(e->right);
+// a = a * b in every quad, from products of the 32-bit halves, the only
+// multiplication SSE2 and AVX2 have: the high halves are only needed in
+// the cross products, which end up in the high half of the result
+static void vector_multiply(VectorRegisters* v, int a, int b) {
+    int high = vector_take(v);
+    int cross = vector_take(v);
+    instr2(X64_MOVDQA, vec(v, a), vec(v, high));
+    instr2(X64_PSRLQ, imm(32), vec(v, high));
+    instr2(X64_PMULUDQ, vec(v, b), vec(v, high));
+    instr2(X64_MOVDQA, vec(v, b), vec(v, cross));
+    instr2(X64_PSRLQ, imm(32), vec(v, cross));
+    instr2(X64_PMULUDQ, vec(v, a), vec(v, cross));
+    instr2(X64_PADDQ, vec(v, cross), vec(v, high));
+    instr2(X64_PSLLQ, imm(32), vec(v, high));
+    instr2(X64_PMULUDQ, vec(v, b), vec(v, a));
+    instr2(X64_PADDQ, vec(v, high), vec(v, a));
+    vector_give_back(v, cross);
+    vector_give_back(v, high);
+}
 
-            fprintf(output_file, "SUBQ %s, %s\n",
-                scratch_name(e->right->reg),
-                scratch_name(e->left->reg));
+// acc = acc + x, or the lesser or greater of the two, in every quad. x may
+// be changed.
+static void vector_combine(VectorRegisters* v, IrVector_t kind, int acc, int x) {
+    if (kind == IR_VECTOR_SUM) {
+        instr2(X64_PADDQ, vec(v, x), vec(v, acc));
+        return;
+    }
+    // a mask of the quads where x wins, then (x & mask) | (acc & ~mask)
+    int mask = vector_take(v);
+    if (kind == IR_VECTOR_MIN) {
+        instr2(X64_MOVDQA, vec(v, acc), vec(v, mask));
+        instr2(X64_PCMPGTQ, vec(v, x), vec(v, mask));
+    } else {
+        instr2(X64_MOVDQA, vec(v, x), vec(v, mask));
+        instr2(X64_PCMPGTQ, vec(v, acc), vec(v, mask));
+    }
+    instr2(X64_PAND, vec(v, mask), vec(v, x));
+    instr2(X64_PANDN, vec(v, acc), vec(v, mask));
+    instr2(X64_POR, vec(v, mask), vec(v, x));
+    instr2(X64_MOVDQA, vec(v, x), vec(v, acc));
+    vector_give_back(v, mask);
+}
 
-            e->reg = e->left->reg;
-            scratch_free(e->right->reg);
-            break;
-        case EXPR_MUL: {
-            expr_codegen(e->left);
-            expr_codegen(e->right);
+// a value of the expression: a register, and whether the loop body took
+// it and may change it
+typedef struct {
+    int n;
+    int owned;
+} VectorValue;
 
-            fprintf(output_file, "MOVQ %s, %%rax\n", scratch_name(e->left->reg));
-            fprintf(output_file, "IMULQ %s\n",       scratch_name(e->right->reg));
-            fprintf(output_file, "MOVQ %%rax, %s\n", scratch_name(e->right->reg));
+static VectorValue vector_writable(VectorRegisters* v, VectorValue value) {
+    if (value.owned) {
+        return value;
+    }
+    VectorValue copy = {vector_take(v), 1};
+    instr2(X64_MOVDQA, vec(v, value.n), vec(v, copy.n));
+    return copy;
+}
 
-            e->reg = e->right->reg;
-            scratch_free(e->left->reg);
-        } break;
-        case EXPR_DIV:
-            expr_codegen(e->left);
-            expr_codegen(e->right);
+static void vector_release(VectorRegisters* v, VectorValue value) {
+    if (value.owned) {
+        vector_give_back(v, value.n);
+    }
+}
 
-            fprintf(output_file, "MOVQ %s, %%rax\n", scratch_name(e->left->reg));
-            fprintf(output_file, "CQO\n");
-            fprintf(output_file, "IDIVQ %s\n", scratch_name(e->right->reg));
-            fprintf(output_file, "MOVQ %%rax, %s\n", scratch_name(e->left->reg));
+// the register holding the address of the global array name, loading it
+// into a new one the first time
+static Register_t array_base(const char** names, Register_t* bases, int* count, const char* name) {
+    for (int k = 0; k < *count; k++) {
+        if (names[k] == name) return bases[k];
+    }
+    names[*count] = name;
+    bases[*count] = vreg_create();
+    instr2(X64_LEAQ, operand_global(name), reg(bases[*count]));
+    return bases[(*count)++];
+}
 
-            e->reg = e->left->reg;
-            scratch_free(e->right->reg);
-            break;
-        case EXPR_EXPONENT:
-            printf("FIXME: codegen EXPR_EXPONENT unimplemented.\n");
-            break;
-        case EXPR_MODULO: {
-            expr_codegen(e->left);
-            expr_codegen(e->right);
+// the loop of an IR_VECTOR, a whole vector per iteration. the scalars of
+// the expression and the start of a reduction are spread over vector
+// registers first; a reduction keeps one result per quad and combines
+// them after the loop.
+static void vector_codegen(IrInstr* in) {
+    IrVector* vector = in->vector;
+    VectorRegisters v;
+    v.bytes = current_context->march >= MARCH_AVX2 ? 32 : 16;
+    v.taken = 0;
+
+    int* scalars = checked_malloc(sizeof(int) * (in->arg_count + 1));
+    const char** names = checked_malloc(sizeof(const char*) * (vector->step_count + 1));
+    Register_t* bases = checked_malloc(sizeof(Register_t) * (vector->step_count + 1));
+    VectorValue* stack = checked_malloc(sizeof(VectorValue) * (vector->step_count + 1));
+    int base_count = 0;
+
+    for (int k = 0; k < in->arg_count; k++) {
+        scalars[k] = vector_take(&v);
+        broadcast(&v, in->args[k], scalars[k]);
+    }
+    int acc = -1;
+    if (vector->kind == IR_VECTOR_SUM) {
+        // the start in one quad, zeros in the others
+        acc = vector_take(&v);
+        instr2(X64_PXOR, vec(&v, acc), vec(&v, acc));
+        if (in->a.kind != IR_OPERAND_CONSTANT || in->a.value != 0) {
+            instr2(X64_MOVQ_XMM, in_register(in->a), operand_vector(acc, 16));
+        }
+    } else if (vector->kind != IR_VECTOR_STORE) {
+        acc = vector_take(&v);
+        broadcast(&v, in->a, acc);
+    }
+    for (int k = 0; k < vector->step_count; k++) {
+        if (vector->steps[k].kind == IR_VECTOR_ELEMENT) {
+            array_base(names, bases, &base_count, vector->steps[k].name);
+        }
+    }
+    Register_t store_base = vector->kind == IR_VECTOR_STORE
+        ? array_base(names, bases, &base_count, vector->name)
+        : X64_NO_REGISTER;
+    Register_t index = vreg_create();
+    instr2(X64_MOVQ, imm(vector->start), reg(index));
+
+    int loop = label_create();
+    instr_label(loop);
+    int depth = 0;
+    for (int k = 0; k < vector->step_count; k++) {
+        IrVectorStep* step = &vector->steps[k];
+        switch (step->kind) {
+            case IR_VECTOR_ELEMENT: {
+                Register_t base = array_base(names, bases, &base_count, step->name);
+                VectorValue e = {vector_take(&v), 1};
+                instr2(X64_MOVDQA, operand_indexed(base, index, 8), vec(&v, e.n));
+                stack[depth++] = e;
+            } break;
+            case IR_VECTOR_SCALAR: {
+                VectorValue s = {scalars[step->index], 0};
+                stack[depth++] = s;
+            } break;
+            case IR_VECTOR_NEG: {
+                VectorValue a = stack[--depth];
+                VectorValue r = {vector_take(&v), 1};
+                instr2(X64_PXOR, vec(&v, r.n), vec(&v, r.n));
+                instr2(X64_PSUBQ, vec(&v, a.n), vec(&v, r.n));
+                vector_release(&v, a);
+                stack[depth++] = r;
+            } break;
+            case IR_VECTOR_SHL: {
+                VectorValue a = vector_writable(&v, stack[--depth]);
+                instr2(X64_PSLLQ, imm(step->index), vec(&v, a.n));
+                stack[depth++] = a;
+            } break;
+            case IR_VECTOR_ADD:
+            case IR_VECTOR_SUB:
+            case IR_VECTOR_MUL: {
+                VectorValue b = stack[--depth];
+                VectorValue a = stack[--depth];
+                if (step->kind != IR_VECTOR_SUB && !a.owned && b.owned) {
+                    VectorValue swap = a;
+                    a = b;
+                    b = swap;
+                }
+                a = vector_writable(&v, a);
+                if (step->kind == IR_VECTOR_MUL) {
+                    vector_multiply(&v, a.n, b.n);
+                } else {
+                    instr2(step->kind == IR_VECTOR_ADD ? X64_PADDQ : X64_PSUBQ, vec(&v, b.n), vec(&v, a.n));
+                }
+                vector_release(&v, b);
+                stack[depth++] = a;
+            } break;
+        }
+    }
+    assert(depth == 1);
+    if (vector->kind == IR_VECTOR_STORE) {
+        instr2(X64_MOVDQA, vec(&v, stack[0].n), operand_indexed(store_base, index, 8));
+        vector_release(&v, stack[0]);
+    } else {
+        VectorValue x = vector_writable(&v, stack[0]);
+        vector_combine(&v, vector->kind, acc, x.n);
+        vector_release(&v, x);
+    }
+    instr2(X64_ADDQ, imm(v.bytes / 8), reg(index));
+    instr2(X64_CMPQ, imm(vector->start + vector->count), reg(index));
+    instr1(X64_JL, operand_label(loop));
+
+    if (acc >= 0) {
+        int half = vector_take(&v);
+        if (v.bytes == 32) {
+            instr2(X64_VEXTRACTI128, vec(&v, acc), operand_vector(half, 16));
+            instr0(X64_VZEROUPPER);
+            v.bytes = 16;
+            vector_combine(&v, vector->kind, acc, half);
+        }
+        instr2(X64_MOVDQA, vec(&v, acc), vec(&v, half));
+        instr2(X64_PUNPCKHQDQ, vec(&v, half), vec(&v, half));
+        vector_combine(&v, vector->kind, acc, half);
+        instr2(X64_MOVQ_XMM, vec(&v, acc), temp(in->dst));
+    } else if (v.bytes == 32) {
+        instr0(X64_VZEROUPPER);
+    }
 
-            fprintf(output_file, "MOVQ %s, %%rax\n", scratch_name(e->left->reg));
-            fprintf(output_file, "CQO\n");
-            fprintf(output_file, "IDIVQ %s\n", scratch_name(e->right->reg));
-            fprintf(output_file, "MOVQ %%rdx, %s\n", scratch_name(e->left->reg));
+    free(stack);
+    free(bases);
+    free(names);
+    free(scalars);
+}
 
-            e->reg = e->left->reg;
-            scratch_free(e->right->reg);
-        } break;
-        case EXPR_NEGATE:
-            expr_codegen(e->left);
+//
+// instruction selection
+//
 
-            fprintf(output_file, "NEG %s\n", scratch_name(e->left->reg));
+// the state of instruction selection for one function
+typedef struct {
+    IrFunction* f;
+    int* use_count;     // per temporary
+    IrInstr* fused;     // a comparison left for the next instruction
+} Selection;
+
+// whether the comparison in can set the flags for the branch or select
+// right after it instead of computing a boolean
+static int is_fusable(Selection* sel, IrInstr* in) {
+    IrInstr* next = in->next;
+    if (!is_comparison(in->op) || !next || in->dst < sel->f->variable_count || sel->use_count[in->dst] != 1) {
+        return 0;
+    }
+    if (next->op == IR_BRANCH) {
+        return ir_is_temp(next->a, in->dst);
+    }
+    return next->op == IR_SELECT && ir_is_temp(next->a, in->dst);
+}
 
-            e->reg = e->left->reg;
-            break;
+// dst = a op b for an x64 instruction op that computes dst = dst op source
+static void two_address_codegen(Opcode_t op, int commutative, IrInstr* in) {
+    Operand dst = temp(in->dst);
+    if (ir_is_temp(in->a, in->dst)) {
+        instr2(op, source(in->b), dst);
+    } else if (ir_is_temp(in->b, in->dst)) {
+        if (commutative) {
+            instr2(op, source(in->a), dst);
+        } else {
+            // dst = a - dst
+            instr1(X64_NEGQ, dst);
+            instr2(X64_ADDQ, source(in->a), dst);
+        }
+    } else {
+        Operand b = source(in->b);
+        instr2(X64_MOVQ, value(in->a), dst);
+        instr2(op, b, dst);
+    }
+}
 
-        // logical operations
-        case EXPR_LOGICAL_OR: {
-            // FIXME: probably a very inefficient implementation
-            expr_codegen(e->left);
-            expr_codegen(e->right);
-
-            const char* label_1 = label_name(label_create());
-            const char* label_2 = label_name(label_create());
-            const char* end_label = label_name(label_create());
-
-            fprintf(output_file, "CMP $0, %s\n", scratch_name(e->left->reg));
-            fprintf(output_file, "JE %s\n", label_1);
-            fprintf(output_file, "MOV $1, %s\n", scratch_name(e->left->reg));
-            fprintf(output_file, "JMP %s\n", end_label);
-            fprintf(output_file, "%s:\n", label_1);
-
-            fprintf(output_file, "CMP $0, %s\n", scratch_name(e->right->reg));
-            fprintf(output_file, "JE %s\n", label_2);
-            fprintf(output_file, "MOV $1, %s\n", scratch_name(e->left->reg));
-            fprintf(output_file, "JMP %s\n", end_label);
-            fprintf(output_file, "%s:\n", label_2);
-
-            fprintf(output_file, "MOV $0, %s\n", scratch_name(e->left->reg));
-            fprintf(output_file, "%s:\n", end_label);
-
-            e->reg = e->left->reg;
-            scratch_free(e->right->reg);
-
-            free((void*) label_1);
-            free((void*) label_2);
-            free((void*) end_label);
-        } break;
-        case EXPR_LOGICAL_AND: {
-            // FIXME: probably a very inefficient implementation
-            expr_codegen(e->left);
-            expr_codegen(e->right);
-
-            const char* label = label_name(label_create());
-            const char* end_label = label_name(label_create());
-
-            fprintf(output_file, "CMP $0, %s\n", scratch_name(e->left->reg));
-            fprintf(output_file, "JE %s\n", label);
-            fprintf(output_file, "CMP $0, %s\n", scratch_name(e->right->reg));
-            fprintf(output_file, "JE %s\n", label);
-            fprintf(output_file, "MOVQ $1, %s\n", scratch_name(e->left->reg));
-            fprintf(output_file, "JMP %s\n", end_label);
-
-            fprintf(output_file, "%s:\n", label);
-            fprintf(output_file, "MOVQ $0, %s\n", scratch_name(e->left->reg));
-            fprintf(output_file, "%s:\n", end_label);
-
-            e->reg = e->left->reg;
-            scratch_free(e->right->reg);
-
-            free((void*) label);
-            free((void*) end_label);
-        } break;
-        case EXPR_LOGICAL_NOT: {
-            expr_codegen(e->left);
+// dst = op a, for an x64 instruction that works in place
+static void one_address_codegen(Opcode_t op, Operand source, IrInstr* in) {
+    Operand dst = temp(in->dst);
+    if (!ir_is_temp(in->a, in->dst)) {
+        instr2(X64_MOVQ, value(in->a), dst);
+    }
+    if (source.kind == OPERAND_IMMEDIATE) {
+        instr2(op, source, dst);
+    } else {
+        instr1(op, dst);
+    }
+}
 
-            const char* top_label = label_name(label_create());
-            const char* end_label = label_name(label_create());
+//
+// multiplication and division by constants
+//
 
-            fprintf(output_file, "CMP $0, %s\n", scratch_name(e->left->reg));
-            fprintf(output_file, "JE %s\n", top_label);
+// k if v is 2^k, -1 otherwise
+static int exact_log2(unsigned long v) {
+    if (v == 0 || (v & (v - 1)) != 0) return -1;
+    int k = 0;
+    while (v > 1) {
+        v >>= 1;
+        k++;
+    }
+    return k;
+}
 
-            fprintf(output_file, "XOR %s, %s\n",
-                    scratch_name(e->left->reg),
-                    scratch_name(e->left->reg));
-            fprintf(output_file, "JMP %s\n", end_label);
-            fprintf(output_file, "%s:\n", top_label);
+// a new virtual register holding x scaled by 3, 5 or 9, with one LEAQ
+static Operand scaled(Operand x, unsigned long m) {
+    Operand t = reg(vreg_create());
+    instr2(X64_LEAQ, operand_indexed(x.base, x.base, (int)m - 1), t);
+    return t;
+}
 
-            fprintf(output_file, "MOVQ $1, %s\n", scratch_name(e->left->reg));
-            fprintf(output_file, "%s:\n", end_label);
+// a new virtual register holding x shifted by count, or x itself
+static Operand shifted(Opcode_t shift, Operand x, int count) {
+    if (count == 0) return x;
+    Operand t = reg(vreg_create());
+    instr2(X64_MOVQ, x, t);
+    instr2(shift, imm(count), t);
+    return t;
+}
 
-            e->reg = e->left->reg;
+// product, or a new copy of it if it is still x
+static Operand writable(Operand product, Operand x) {
+    if (product.base != x.base) return product;
+    Operand t = reg(vreg_create());
+    instr2(X64_MOVQ, x, t);
+    return t;
+}
 
-            free((void*) top_label);
-            free((void*) end_label);
-        } break;
+// x * m for odd m, with at most two LEAQs or a shift and an add or
+// subtract. NO_REGISTER if m takes more.
+static Operand multiply_odd(Operand x, unsigned long m) {
+    static const unsigned long scales[] = {3, 5, 9};
+    if (m == 1) return x;
+    for (int i = 0; i < 3; i++) {
+        if (m == scales[i]) return scaled(x, m);
+        for (int j = 0; j < 3; j++) {
+            if (m == scales[i] * scales[j]) return scaled(scaled(x, scales[i]), scales[j]);
+        }
+    }
+    int up = exact_log2(m - 1);
+    int down = exact_log2(m + 1);
+    if (up > 0 || down > 0) {
+        Operand t = shifted(X64_SHLQ, x, up > 0 ? up : down);
+        instr2(up > 0 ? X64_ADDQ : X64_SUBQ, x, t);
+        return t;
+    }
+    return reg(X64_NO_REGISTER);
+}
 
-        // conditionals
-        case EXPR_CMP_EQUAL:
-        case EXPR_CMP_NOT_EQUAL:
-        case EXPR_CMP_GT:
-        case EXPR_CMP_GT_EQUAL:
-        case EXPR_CMP_LT:
-        case EXPR_CMP_LT_EQUAL: {
-            expr_codegen(e->left);
-            expr_codegen(e->right);
-
-            const char* top_label = label_name(label_create());
-            const char* end_label = label_name(label_create());
-
-            fprintf(output_file, "CMP %s, %s\n",
-                    scratch_name(e->right->reg),
-                    scratch_name(e->left->reg));
-
-            switch (e->kind) {
-                case EXPR_CMP_EQUAL:
-                    fprintf(output_file, "JE %s\n", top_label);
-                    break;
-                case EXPR_CMP_NOT_EQUAL:
-                    fprintf(output_file, "JNE %s\n", top_label);
-                    break;
-                case EXPR_CMP_GT:
-                    fprintf(output_file, "JG %s\n", top_label);
-                    break;
-                case EXPR_CMP_GT_EQUAL:
-                    fprintf(output_file, "JGE %s\n", top_label);
-                    break;
-                case EXPR_CMP_LT:
-                    fprintf(output_file, "JL %s\n", top_label);
-                    break;
-                case EXPR_CMP_LT_EQUAL:
-                    fprintf(output_file, "JLE %s\n", top_label);
-                    break;
-                default:
-                    // unreachable because of outer switch
-                    break;
-            }
+// dst = x * c by shifts and LEAQs, as c is a small odd number times a power
+// of two, negated if c is negative. returns 0, emitting nothing, when it
+// is not and an IMULQ is the better choice.
+static int multiply_by_constant(IrOperand x, long c, Operand dst) {
+    if (c == 0) {
+        instr2(X64_MOVQ, imm(0), dst);
+        return 1;
+    }
+    if (x.kind != IR_OPERAND_TEMP) return 0;
 
-            fprintf(output_file, "MOVQ $0, %s\n", scratch_name(e->right->reg));
-            fprintf(output_file, "JMP %s\n", end_label);
-            fprintf(output_file, "%s:\n", top_label);
+    unsigned long magnitude = c < 0 ? -(unsigned long)c : (unsigned long)c;
+    int k = 0;
+    while ((magnitude & 1) == 0) {
+        magnitude >>= 1;
+        k++;
+    }
+    Operand product = multiply_odd(temp(x.value), magnitude);
+    if (product.base == X64_NO_REGISTER) return 0;
+
+    // the LEAQs and shifts leave a new register that can be changed in place
+    Operand x_register = temp(x.value);
+    if (k > 0) {
+        product = writable(product, x_register);
+        instr2(X64_SHLQ, imm(k), product);
+    }
+    if (c < 0) {
+        product = writable(product, x_register);
+        instr1(X64_NEGQ, product);
+    }
+    instr2(X64_MOVQ, product, dst);
+    return 1;
+}
 
-            fprintf(output_file, "MOVQ $1, %s\n", scratch_name(e->right->reg));
-            fprintf(output_file, "%s:\n", end_label);
+// the multiplier and shift that divide by d >= 3 with a multiplication:
+// x / d is the high half of magic * x, plus x when magic is negative,
+// shifted right by shift and rounded toward zero (Hacker's Delight, 10-1)
+static void division_magic(unsigned long d, long* magic, int* shift) {
+    const unsigned long two63 = 1UL << 63;
+    unsigned long anc = two63 - 1 - two63 % d;
+    unsigned long q1 = two63 / anc;
+    unsigned long r1 = two63 - q1 * anc;
+    unsigned long q2 = two63 / d;
+    unsigned long r2 = two63 - q2 * d;
+    unsigned long delta;
+    int p = 63;
+    do {
+        p++;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc) {
+            q1++;
+            r1 -= anc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= d) {
+            q2++;
+            r2 -= d;
+        }
+        delta = d - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
 
-            scratch_free(e->left->reg);
-            e->reg = e->right->reg;
+    *magic = (long)(q2 + 1);
+    *shift = p - 64;
+}
 
-            free((void*) top_label);
-            free((void*) end_label);
-        } break;
+// a new virtual register holding x / d, rounded toward zero, for
+// 2 <= |d| < 2^63. powers of two are shifted, adding d - 1 first to
+// negative x; other divisors are multiplied by their magic number.
+static Operand quotient_by_constant(Operand x, long d) {
+    unsigned long magnitude = d < 0 ? -(unsigned long)d : (unsigned long)d;
+    Operand q = reg(vreg_create());
+
+    int k = exact_log2(magnitude);
+    if (k > 0) {
+        // the sign bits of x, shifted down to d - 1 when it is negative
+        instr2(X64_MOVQ, x, q);
+        if (k > 1) {
+            instr2(X64_SARQ, imm(63), q);
+        }
+        instr2(X64_SHRQ, imm(64 - k), q);
+        instr2(X64_ADDQ, x, q);
+        instr2(X64_SARQ, imm(k), q);
+    } else {
+        long magic;
+        int shift;
+        division_magic(magnitude, &magic, &shift);
+        instr2(X64_MOVQ, imm(magic), reg(X64_RAX));
+        instr1(X64_IMULQ, x);
+        instr2(X64_MOVQ, reg(X64_RDX), q);
+        if (magic < 0) {
+            instr2(X64_ADDQ, x, q);
+        }
+        if (shift > 0) {
+            instr2(X64_SARQ, imm(shift), q);
+        }
+        // plus one for negative x, rounding toward zero
+        Operand sign = shifted(X64_SHRQ, x, 63);
+        instr2(X64_ADDQ, sign, q);
+    }
 
-        // assignments
-        case EXPR_ASSIGN: {
-            const char* symbol = symbol_codegen(e->left->symbol);
+    if (d < 0) {
+        instr1(X64_NEGQ, q);
+    }
+    return q;
+}
 
-            expr_codegen(e->right);
-            fprintf(output_file, "MOVQ %s, %s\n",
-                    scratch_name(e->right->reg),
-                    symbol);
-            e->reg = e->right->reg;
+// dst = x / d or x % d without IDIVQ. returns 0, emitting nothing, for
+// the divisors where IDIVQ is kept: 0 and -1 must still trap, LONG_MIN
+// has no magnitude, and 1 is left to value numbering.
+static int divide_by_constant(IrInstr* in) {
+    if (in->a.kind != IR_OPERAND_TEMP || in->b.kind != IR_OPERAND_CONSTANT) return 0;
+    long d = in->b.value;
+    if (d == 0 || d == 1 || d == -1 || d == LONG_MIN) return 0;
+
+    Operand x = temp(in->a.value);
+    Operand q = quotient_by_constant(x, d);
+    if (in->op == IR_DIV) {
+        instr2(X64_MOVQ, q, temp(in->dst));
+        return 1;
+    }
 
-            free((void*) symbol);
-        } break;
-        case EXPR_INCREMENT: {
-            const char* symbol = symbol_codegen(e->left->symbol);
+    // x - x / d * d, the remainder with the sign of x
+    Operand product = reg(vreg_create());
+    instr2(X64_MOVQ, q, product);
+    if (d > 0 && exact_log2(d) > 0) {
+        instr2(X64_SHLQ, imm(exact_log2(d)), product);
+    } else if (fits_in_32(d)) {
+        instr2(X64_IMULQ, imm(d), product);
+    } else {
+        instr2(X64_IMULQ, in_register(in->b), product);
+    }
+    Operand r = reg(vreg_create());
+    instr2(X64_MOVQ, x, r);
+    instr2(X64_SUBQ, product, r);
+    instr2(X64_MOVQ, r, temp(in->dst));
+    return 1;
+}
 
-            expr_codegen(e->left);
-            fprintf(output_file, "INC %s\n", scratch_name(e->left->reg));
-            fprintf(output_file, "MOVQ %s, %s\n",
-                    scratch_name(e->left->reg),
-                    symbol);
-            e->reg = e->left->reg;
+static void select_codegen(Selection* sel, IrInstr* in) {
+    Operand dst = temp(in->dst);
+    if (in->a.kind == IR_OPERAND_CONSTANT) {
+        IrOperand chosen = in->a.value ? in->b : in->c;
+        if (!ir_is_temp(chosen, in->dst)) {
+            instr2(X64_MOVQ, value(chosen), dst);
+        }
+        return;
+    }
 
-            free((void*) symbol);
-        } break;
-        case EXPR_DECREMENT: {
-            const char* symbol = symbol_codegen(e->left->symbol);
+    // MOVQ leaves the flags alone
+    Opcode_t jump = condition_codegen(in->a, sel->fused);
+    if (ir_is_temp(in->c, in->dst)) {
+        instr2(X64_CMOVE + (jump - X64_JE), in_register(in->b), dst);
+    } else if (ir_is_temp(in->b, in->dst)) {
+        instr2(X64_CMOVE + (jump_inverse(jump) - X64_JE), in_register(in->c), dst);
+    } else {
+        Operand then_value = in_register(in->b);
+        instr2(X64_MOVQ, value(in->c), dst);
+        instr2(X64_CMOVE + (jump - X64_JE), then_value, dst);
+    }
+}
 
-            expr_codegen(e->left);
-            fprintf(output_file, "DEC %s\n", scratch_name(e->left->reg));
-            fprintf(output_file, "MOVQ %s, %s\n",
-                    scratch_name(e->left->reg),
-                    symbol);
-            e->reg = e->left->reg;
+static void call_instr_codegen(IrInstr* in) {
+    Operand* args = checked_malloc(sizeof(Operand) * (in->arg_count + 1));
+    for (int i = 0; i < in->arg_count; i++) {
+        args[i] = source(in->args[i]);
+    }
+    call_codegen(operand_symbol(in->name), args, in->arg_count);
+    free(args);
 
-            free((void*) symbol);
-        } break;
+    if (in->dst >= 0) {
+        instr2(X64_MOVQ, reg(X64_RAX), temp(in->dst));
+    }
+}
 
-        // misc.
-        case EXPR_CALL: {
-            // load the arguments into registers/onto stack
-            {
-                Expr* current_arg = e->right;
-                int arg_count = 0;
-                // this puts a practical limit of 2048 for number of function
-                // parameters. big whoop
-                Expr* arg_stack[2048];
-                for (; current_arg != NULL;
-                    arg_count++, current_arg = current_arg->right
-                ) {
-                    arg_stack[arg_count] = current_arg;
-                }
+// jumps to target unless it is the block laid out next
+static void jump_codegen(Opcode_t jump, IrBlock* target, IrBlock* next) {
+    if (target != next) {
+        instr1(jump, operand_label(target->label));
+    }
+}
 
-                for (int j = arg_count-1; j >= 0; j--) {
-                    current_arg = arg_stack[j];
-                    expr_codegen(current_arg);
-                    //printf("current_arg->reg is %d\n", current_arg->reg);
-                    fprintf(output_file,
-                            "PUSHQ %s\n",
-                            scratch_name(current_arg->reg));
-                    scratch_free(current_arg->reg);
-                }
+static void branch_codegen(Selection* sel, IrInstr* in, IrBlock* next) {
+    IrBlock* if_true = in->targets[0];
+    IrBlock* if_false = in->targets[1];
+    if (in->a.kind == IR_OPERAND_CONSTANT) {
+        jump_codegen(X64_JMP, in->a.value ? if_true : if_false, next);
+        return;
+    }
 
-                for (int i = 0;
-                     i < (X64_NUM_ARGUMENT_REGISTERS < arg_count ? X64_NUM_ARGUMENT_REGISTERS : arg_count);
-                     i++
-                ) {
-                    fprintf(output_file,
-                            "POPQ %s\n",
-                            argument_registers[i]);
-                }
-            }
-            // zero floating point args
-            fprintf(output_file, "XOR %%rax, %%rax\n\n");
-
-            // save the caller-saved registers
-            fprintf(output_file, "PUSHQ %%r10\n");
-            fprintf(output_file, "PUSHQ %%r11\n");
-
-            // call the function
-            // e->left should always be set to an EXPR_NAME with the name of
-            // the function being called
-            assert(e->left && e->left->kind == EXPR_NAME);
-            fprintf(output_file, "CALL %s\n", e->left->name);
-
-            // restore the caller-saved registers
-            fprintf(output_file, "POPQ %%r11\n");
-            fprintf(output_file, "POPQ %%r10\n");
-
-            // save the argument into a scratch register
-            e->reg = scratch_alloc();
-            fprintf(output_file,
-                    "MOVQ %%rax, %s\n",
-                    scratch_name(e->reg));
-        } break;
-        case EXPR_INIT_LIST:
-            printf("FIXME: codegen EXPR_INIT_LIST unimplemented.\n");
-            break;
-        case EXPR_ARG:
-            expr_codegen(e->left);
-            e->reg = e->left->reg;
-            break;
-        case EXPR_SUBSCRIPT:
-            // generate code for the index expression
-            expr_codegen(e->right);
-
-            int base_reg = scratch_alloc();
-            const char* base_reg_name = scratch_name(base_reg);
-            const char* index_reg_name = scratch_name(e->right->reg);
-
-            // load address of the array
-            fprintf(output_file, "LEAQ %s, %s\n",
-                    symbol_codegen(e->left->symbol),
-                    base_reg_name);
-            
-            // move the indexed value into a register
-            fprintf(output_file, "MOVQ 0(%s, %s, 8), %s\n",
-                    base_reg_name,
-                    index_reg_name,
-                    index_reg_name);
-
-            e->reg = e->right->reg;
-            // free scratch register and allocated string
-            scratch_free(base_reg);
-            //free((void*) base_reg_name);
-            //free((void*) index_reg_name);
-            break;
+    Opcode_t jump = condition_codegen(in->a, sel->fused);
+    if (if_true == next) {
+        instr1(jump_inverse(jump), operand_label(if_false->label));
+    } else {
+        instr1(jump, operand_label(if_true->label));
+        jump_codegen(X64_JMP, if_false, next);
     }
 }
 
-void stmt_codegen(Stmt* s) {
-    if (!s) return;
-
-    switch (s->kind) {
-        case STMT_DECL:
-            decl_codegen(s->decl);
+static void instr_codegen(Selection* sel, IrInstr* in, IrBlock* next) {
+    switch (in->op) {
+        case IR_COPY:
+            if (!ir_is_temp(in->a, in->dst)) {
+                instr2(X64_MOVQ, value(in->a), temp(in->dst));
+            }
             break;
-        case STMT_EXPR:
-            expr_codegen(s->expr);
-            scratch_free(s->expr->reg);
+        case IR_ADD:
+            two_address_codegen(X64_ADDQ, 1, in);
             break;
-        case STMT_IF_ELSE: {
-            const char* else_label = label_name(label_create());
-            const char* done_label = label_name(label_create());
-
-            // condition expr
-            expr_codegen(s->expr);
-            fprintf(output_file, "CMP $0, %s\n", scratch_name(s->expr->reg));
-            scratch_free(s->expr->reg);
-            fprintf(output_file, "JE %s\n", else_label);
-
-            // if branch
-            stmt_codegen(s->body);
-            fprintf(output_file, "JMP %s\n", done_label);
-
-            // else branch
-            fprintf(output_file, "%s:\n", else_label);
-            stmt_codegen(s->else_body);
-            fprintf(output_file, "%s:\n", done_label);
-
-            free((void*) else_label);
-            free((void*) done_label);
-        } break;
-        case STMT_FOR: {
-            const char* top_label  = label_name(label_create());
-            const char* done_label = label_name(label_create());
-
-            // init expr
-            if (s->init_expr) {
-                expr_codegen(s->init_expr);
-                scratch_free(s->init_expr->reg);
+        case IR_SUB:
+            two_address_codegen(X64_SUBQ, 0, in);
+            break;
+        case IR_MUL:
+            if (in->b.kind == IR_OPERAND_CONSTANT && multiply_by_constant(in->a, in->b.value, temp(in->dst))) {
+                break;
             }
-
-            fprintf(output_file, "%s:\n", top_label);
-
-            // condition expr
-            if (s->expr) {
-                expr_codegen(s->expr);
-                fprintf(output_file, "CMP $0, %s\n", scratch_name(s->expr->reg));
-                scratch_free(s->expr->reg);
-                fprintf(output_file, "JE %s\n", done_label);
+            if (in->a.kind == IR_OPERAND_CONSTANT && multiply_by_constant(in->b, in->a.value, temp(in->dst))) {
+                break;
             }
-
-            // body
-            stmt_codegen(s->body);
-
-            // next expr
-            if (s->next_expr) {
-                expr_codegen(s->next_expr);
-                scratch_free(s->next_expr->reg);
+            two_address_codegen(X64_IMULQ, 1, in);
+            break;
+        case IR_DIV:
+        case IR_MOD: {
+            if (divide_by_constant(in)) {
+                break;
             }
-            fprintf(output_file, "JMP %s\n", top_label);
-
-            fprintf(output_file, "%s:\n", done_label);
-
-            free((void*) top_label);
-            free((void*) done_label);
+            Operand b = in_register(in->b);
+            instr2(X64_MOVQ, value(in->a), reg(X64_RAX));
+            instr0(X64_CQO);
+            instr1(X64_IDIVQ, b);
+            instr2(X64_MOVQ, reg(in->op == IR_DIV ? X64_RAX : X64_RDX), temp(in->dst));
         } break;
-        case STMT_PRINT: {
-            
-            Expr* current_arg = s->expr;
-            char format_string[4096];
-            format_string[0] = '\0';
-            int arg_count = 0;
-            // FIXME: again. practical limit of 2048 on number of args
-            Expr* arg_stack[2048];
-            while (current_arg != NULL) {
-                arg_stack[arg_count] = current_arg;
-                const char* format_string_append = NULL;
-                switch (current_arg->left->type->kind) {
-                    case TYPE_CHAR:
-                        format_string_append = "%c";
-                        break;
-                    case TYPE_INTEGER:
-                        format_string_append = "%d";
-                        break;
-                    case TYPE_BOOLEAN:
-                    case TYPE_STRING:
-                    case TYPE_ARRAY:
-                    case TYPE_FUNCTION:
-                    default:
-                        format_string_append = "%s";
-                        break;
-                }
-
-                strcat(format_string, format_string_append);
-
-                current_arg = current_arg->right;
-                arg_count++;
+        case IR_NEG:
+            one_address_codegen(X64_NEGQ, reg(X64_NO_REGISTER), in);
+            break;
+        case IR_NOT:
+            // booleans are 0 or 1
+            one_address_codegen(X64_XORQ, imm(1), in);
+            break;
+        case IR_EQ:
+        case IR_NE:
+        case IR_GT:
+        case IR_GE:
+        case IR_LT:
+        case IR_LE: {
+            if (is_fusable(sel, in)) {
+                sel->fused = in;
+                return;
             }
+            Opcode_t jump = compare_codegen(in);
+            instr1(X64_SETE + (jump - X64_JE), temp(in->dst));
+            instr2(X64_MOVZBQ, temp(in->dst), temp(in->dst));
+        } break;
+        case IR_SELECT:
+            select_codegen(sel, in);
+            break;
+        case IR_STRING: {
+            // .data
+            // .<label>:
+            //     .str <value>
+            // .text
+            int str_label = label_create();
 
-            for (int i = arg_count-1; i >= 0; i--) {
-                current_arg = arg_stack[i];
-                expr_codegen(current_arg->left);
-                switch (current_arg->left->type->kind) {
-                    case TYPE_BOOLEAN: {
-                        const char* else_label = label_name(label_create());
-                        const char* end_label  = label_name(label_create());
-
-                        fprintf(output_file, "CMP $0, %s\n",
-                                scratch_name(current_arg->left->reg));
-                        fprintf(output_file, "JE %s\n",
-                                else_label);
-
-                        fprintf(output_file, "LEAQ .__STR_TRUE(%%rip), %s\n",
-                                scratch_name(current_arg->left->reg));
-                        fprintf(output_file, "JMP %s\n", end_label);
-
-                        fprintf(output_file, "%s:\n", else_label);
-                        fprintf(output_file, "LEAQ .__STR_FALSE(%%rip), %s\n",
-                                scratch_name(current_arg->left->reg));
-
-                        fprintf(output_file, "%s:\n", end_label);
-
-                        free((void*) else_label);
-                        free((void*) end_label);
-                    } break;
-                    case TYPE_CHAR:
-                        break;
-                    case TYPE_INTEGER:
-                        break;
-                    case TYPE_STRING:
-                        break;
-                    case TYPE_ARRAY:
-                        fprintf(output_file, "LEAQ .__STR_ARRAY(%%rip), %s\n",
-                                scratch_name(current_arg->left->reg));
-                        break;
-                    case TYPE_FUNCTION:
-                        fprintf(output_file, "LEAQ .__STR_FUNCTION(%%rip), %s\n",
-                                scratch_name(current_arg->left->reg));
-                        break;
-                    default:
-                        break;
-                }
-
-                fprintf(output_file,
-                        "PUSHQ %s\n",
-                        scratch_name(current_arg->left->reg));
+            emit_section(SECTION_DATA);
+            emit_label(str_label);
+            emit_string(in->string);
+            emit_section(SECTION_TEXT);
 
-                scratch_free(current_arg->left->reg);
-                current_arg = current_arg->right;
+            instr2(X64_LEAQ, operand_label_address(str_label), temp(in->dst));
+        } break;
+        case IR_ADDRESS:
+            instr2(X64_LEAQ, operand_global(in->name), temp(in->dst));
+            break;
+        case IR_LOAD_GLOBAL:
+            instr2(X64_MOVQ, operand_global(in->name), temp(in->dst));
+            break;
+        case IR_STORE_GLOBAL:
+            instr2(X64_MOVQ, source(in->a), operand_global(in->name));
+            break;
+        case IR_LOAD:
+            instr2(X64_MOVQ, element(in->a, in->b), temp(in->dst));
+            break;
+        case IR_STORE: {
+            Operand stored = source(in->c);
+            instr2(X64_MOVQ, stored, element(in->a, in->b));
+        } break;
+        case IR_CALL:
+            call_instr_codegen(in);
+            break;
+        case IR_VECTOR:
+            vector_codegen(in);
+            break;
+        case IR_JUMP:
+            jump_codegen(X64_JMP, in->targets[0], next);
+            break;
+        case IR_BRANCH:
+            branch_codegen(sel, in, next);
+            break;
+        case IR_RETURN:
+            if (in->a.kind != IR_OPERAND_NONE) {
+                instr2(X64_MOVQ, value(in->a), reg(X64_RAX));
             }
-
-            for (int i = 0;
-                 i < (X64_NUM_ARGUMENT_REGISTERS-1 < arg_count
-                      ? X64_NUM_ARGUMENT_REGISTERS-1 : arg_count);
-                 i++
-            ) {
-                fprintf(output_file,
-                        "POPQ %s\n",
-                        argument_registers[i+1]);
+            if (next) {
+                instr1(X64_JMP, operand_label(current_context->return_label));
             }
+            break;
+        case IR_PHI:
+            // ir_optimize leaves SSA form before selection
+            fprintf(current_context->messages, "Error: phi in %s.\n", sel->f->name);
+            assert(0);
+            break;
+    }
+    sel->fused = NULL;
+}
 
-            const char* format_string_label = label_name(label_create());
-
-            fprintf(output_file, ".data\n");
-            fprintf(output_file, "%s:\n", format_string_label);
-            fprintf(output_file, "\t.string \"%s\"\n", format_string);
-            fprintf(output_file, ".text\n");
-
-            fprintf(output_file, "LEAQ %s(%%rip), %s\n",
-                    format_string_label, argument_registers[0]);
-
-            fprintf(output_file, "XOR %%rax, %%rax\n");
-
-            // save the caller-saved registers
-            fprintf(output_file, "PUSHQ %%r10\n");
-            fprintf(output_file, "PUSHQ %%r11\n");
+// selects instructions for the IR of a function, in the layout order of
+// its blocks. jumps to the next block are left out, and comparisons that
+// only feed the branch or select after them set the flags for it directly.
+static void function_codegen(IrFunction* f) {
+    // every temporary gets a virtual register. the prologue and epilogue
+    // are written by the register allocator.
+    function_begin(f->temp_count);
+
+    int outer_return_label = current_context->return_label;
+    current_context->return_label = label_create();
+    for (int i = 0; i < f->block_count; i++) {
+        f->blocks[i]->label = label_create();
+    }
 
-            fprintf(output_file, "CALL printf@PLT\n");
+    Selection sel;
+    sel.f = f;
+    sel.fused = NULL;
+    sel.use_count = checked_calloc(f->temp_count + 1, sizeof(int));
+    for (int i = 0; i < f->block_count; i++) {
+        for (IrInstr* in = f->blocks[i]->first; in != NULL; in = in->next) {
+            for (int k = 0; k < ir_operand_count(in); k++) {
+                IrOperand* o = ir_operand(in, k);
+                if (o->kind == IR_OPERAND_TEMP) {
+                    sel.use_count[o->value]++;
+                }
+            }
+        }
+    }
 
-            fprintf(output_file, "POPQ %%r11\n");
-            fprintf(output_file, "POPQ %%r10\n");
+    // move the arguments into their variables
+    for (int i = 0; i < f->param_count; i++) {
+        Operand argument = i < X64_NUM_ARGUMENT_REGISTERS
+            ? reg(argument_registers[i])
+            : operand_memory(X64_RBP, 16 + (i - X64_NUM_ARGUMENT_REGISTERS) * 8);
+        instr2(X64_MOVQ, argument, temp(i));
+    }
 
-            free((void*) format_string_label);
-        } break;
-        case STMT_RETURN:
-            expr_codegen(s->expr);
-            fprintf(output_file, "MOVQ %s, %%rax\n", scratch_name(s->expr->reg));
-            fprintf(output_file, "JMP .%s_epilogue\n", s->function_name);
-            scratch_free(s->expr->reg);
-            break;
-        case STMT_BLOCK:
-            stmt_codegen(s->body);
-            break;
+    for (int i = 0; i < f->block_count; i++) {
+        IrBlock* b = f->blocks[i];
+        IrBlock* next = i + 1 < f->block_count ? f->blocks[i+1] : NULL;
+        instr_label(b->label);
+        for (IrInstr* in = b->first; in != NULL; in = in->next) {
+            instr_codegen(&sel, in, next);
+        }
     }
 
-    fprintf(output_file, "\n");
-    stmt_codegen(s->next);
+    instr_label(current_context->return_label);
+    function_end();
+
+    free(sel.use_count);
+    current_context->return_label = outer_return_label;
 }
 
-void decl_codegen(Decl* d) {
-    if (!d) return;
+// the optimized IR of a function declaration
+static IrFunction* function_ir(Decl* d) {
+    IrFunction* f = ir_lower(d);
+    ir_verify(f);
+    ir_optimize(f);
+    return f;
+}
 
+// d as code or data. f is the IR of a function, if it has been built
+// already.
+static void decl_codegen_single(Decl* d, IrFunction* f) {
     switch (d->type->kind) {
-        case TYPE_FUNCTION:
+        case TYPE_FUNCTION: {
             // directives and label
-            fprintf(output_file, ".text\n");
-            fprintf(output_file, ".global %s\n", d->name);
-            fprintf(output_file, "%s:\n", d->name);
-
-            // ***********
-            // ** Prologue
-            // ***********
-            // save the old base pointer and set the new one
-            fprintf(output_file, "PUSHQ %%rbp\n");
-            fprintf(output_file, "MOVQ %%rsp, %%rbp\n");
-
-            // save arguments
-            {
-                ParamList* current = d->type->params;
-                for (int i = 0; i < X64_NUM_ARGUMENT_REGISTERS && current != NULL;
-                    i++, current = current->next
-                ) {
-                    fprintf(output_file,
-                            "PUSHQ %s\n",
-                            argument_registers[i]);
-                }
-            }
+            emit_section(SECTION_TEXT);
+            emit_global(d->name);
+            emit_symbol_label(d->name);
 
-            // allocate space for local variables FIXME: incomplete
-            if (d->local_var_count > 0) {
-                fprintf(output_file,
-                        "\nSUBQ $%d, %%rsp\n\n",
-                        8 * d->local_var_count);
+            if (!f) {
+                f = function_ir(d);
             }
-
-            // save callee-saved registers
-            fprintf(output_file, "PUSHQ %%rbx\n");
-            fprintf(output_file, "PUSHQ %%r12\n");
-            fprintf(output_file, "PUSHQ %%r13\n");
-            fprintf(output_file, "PUSHQ %%r14\n");
-            fprintf(output_file, "PUSHQ %%r15\n\n");
-            
-            // ***********
-            // ** Body
-            // ***********
-            stmt_codegen(d->code);
-
-            // ***********
-            // ** Epilogue
-            // ***********
-
-            fprintf(output_file, ".%s_epilogue:\n", d->name);
-
-            // restore callee-saved registers
-            fprintf(output_file, "POPQ %%r15\n");
-            fprintf(output_file, "POPQ %%r14\n");
-            fprintf(output_file, "POPQ %%r13\n");
-            fprintf(output_file, "POPQ %%r12\n");
-            fprintf(output_file, "POPQ %%rbx\n");
-
-            // reset stack pointer and recove base pointer
-            fprintf(output_file, "MOVQ %%rbp, %%rsp\n");
-            fprintf(output_file, "POPQ %%rbp\n");
-
-            // return
-            fprintf(output_file, "RET\n");
-            break;
+            if (current_context->dump_ir) {
+                ir_print(f, current_context->messages);
+            }
+            function_codegen(f);
+            ir_function_delete(f);
+        } break;
         case TYPE_ARRAY:
             // FIXME: incomplete
-            printf("FIXME: codegen for TYPE_ARRAY unimplemented.\n");
+            fprintf(current_context->messages, "FIXME: codegen for TYPE_ARRAY unimplemented.\n");
             if (d->symbol->kind == SYMBOL_GLOBAL) {
-                fprintf(output_file, ".global %s\n", d->symbol->name);
-                fprintf(output_file, ".data\n");
-                fprintf(output_file, "%s:\n", d->symbol->name);
+                emit_global(d->symbol->name);
+                emit_section(SECTION_DATA);
+                // for the aligned loads and stores of vector loops
+                emit_align(32);
+                emit_symbol_label(d->symbol->name);
 
                 int size = -1;
                 // should always be integer literal if it passes typechecking
@@ -769,16 +1002,13 @@ void decl_codegen(Decl* d) {
                             case TYPE_BOOLEAN:
                             case TYPE_CHAR:
                             case TYPE_INTEGER:
-                                fprintf(output_file,
-                                    "\t.quad %d\n",
-                                    element->left->integer_value
-                                );
+                                emit_quad(element->left->integer_value);
                                 break;
                             case TYPE_STRING:
-                                printf("FIXME: Array of string is not implemented.\n");
+                                fprintf(current_context->messages, "FIXME: Array of string is not implemented.\n");
                                 break;
                             case TYPE_ARRAY:
-                                printf("FIXME: Multi-dimensional arrays are not implemented.\n");
+                                fprintf(current_context->messages, "FIXME: Multi-dimensional arrays are not implemented.\n");
                                 break;
                             default:
                                 break;
@@ -789,132 +1019,181 @@ void decl_codegen(Decl* d) {
                     }
 
                     if (init_list_length < size) {
-                        fprintf(
-                            output_file,
-                            "\t.zero %d\n",
-                            (size - init_list_length) * 8
-                        );
+                        emit_zero((size - init_list_length) * 8);
                     }
                 } else {
-                    fprintf(output_file, ".zero %d\n", size * 8);
+                    emit_zero(size * 8);
                 }
-            } else {
-                const char* label = label_name(label_create());
-
-                free((void*) label);
             }
             break;
-        case TYPE_STRING:
-            if (d->symbol->kind == SYMBOL_GLOBAL) {
-                const char* label = label_name(label_create());
+        case TYPE_STRING: {
+            int label = label_create();
+            const char* init_value = "";
+            if (d->value) {
+                init_value = d->value->string_literal;
+            }
 
-                fprintf(output_file, ".global %s\n", d->symbol->name);
-                fprintf(output_file, ".data\n");
-                fprintf(output_file, "%s:\n", label);
-                const char* init_value = "";
-                if (d->value) {
-                    init_value = d->value->string_literal;
-                }
-                fprintf(output_file, "\t.string \"%s\"\n", init_value);
+            emit_global(d->symbol->name);
+            emit_section(SECTION_DATA);
+            emit_label(label);
+            emit_string(init_value);
 
-                fprintf(output_file, "%s:\n", d->symbol->name);
-                fprintf(output_file, "\t.quad %s\n", label);
+            emit_symbol_label(d->symbol->name);
+            emit_quad_label(label);
 
-                fprintf(output_file, ".text\n\n");
+            emit_section(SECTION_TEXT);
+        } break;
+        case TYPE_BOOLEAN:
+        case TYPE_CHAR:
+        case TYPE_INTEGER: {
+            // without an initializer the value is zero
+            long init_value = 0;
+            if (d->value) {
+                init_value = d->value->integer_value;
+            }
 
-                free((void*) label);
-            } else {
-                int reg = scratch_alloc();
-                const char* label = label_name(label_create());
+            emit_section(SECTION_DATA);
+            emit_symbol_label(d->symbol->name);
+            emit_quad(init_value);
+            emit_section(SECTION_TEXT);
+        } break;
+        case TYPE_VOID:
+            fprintf(current_context->messages, "Error: cannot create variable of type void.\n");
+            assert(0);
+            break;
+    }
+}
 
-                fprintf(output_file, ".data\n");
-                fprintf(output_file, "%s:\n", label);
-                const char* init_value = "";
-                if (d->value) {
-                    init_value = d->value->string_literal;
-                }
-                fprintf(output_file, "\t.string \"%s\"\n", init_value);
+void decl_codegen(Decl* d) {
+    for (; d != NULL; d = d->next) {
+        decl_codegen_single(d, NULL);
+    }
+}
 
-                fprintf(output_file, ".text\n\n");
-                fprintf(output_file, "LEAQ %s(%%rip), %s\n",
-                        label, scratch_name(reg));
+//
+// program
+//
 
-                const char* symbol = symbol_codegen(d->symbol);
-                fprintf(output_file, "MOVQ %s, %s\n",
-                        scratch_name(reg), symbol);
+static void mark_name(struct hash_table* by_name, int* next_same_name, char* reachable, int* worklist, int* count, const char* name) {
+    if (!name) return;
+    Decl** found = hash_table_lookup(by_name, name);
+    if (!found) return;
+    // a function may be declared before it is defined
+    for (int i = (int)(intptr_t)found - 1; i >= 0; i = next_same_name[i]) {
+        if (!reachable[i]) {
+            reachable[i] = 1;
+            worklist[(*count)++] = i;
+        }
+    }
+}
 
-                free((void*) label);
-                free((void*) symbol);
-            }
-            break;
-        case TYPE_BOOLEAN:
-        case TYPE_CHAR:
-        case TYPE_INTEGER:
-            // if no initializer value was given, create one with a value of zero
-            if (!d->value) {
-                switch (d->type->kind) {
-                    case TYPE_BOOLEAN:
-                        d->value = expr_create_boolean_literal(0);
-                        break;
-                    case TYPE_CHAR:
-                        d->value = expr_create_char_literal(0);
-                        break;
-                    case TYPE_INTEGER:
-                        d->value = expr_create_integer_literal(0);
-                        break;
-                    default:
-                        // unreachable due to the outer switch statement
-                        break;
-                }
-                d->value = expr_create_integer_literal(0);
-            }
+// which of the top-level declarations main can reach, through the
+// functions it calls and the globals and functions they name. a program
+// without main, such as a file of functions for another, keeps
+// everything.
+static void mark_reachable(Decl** decls, IrFunction** functions, int count, char* reachable) {
+    struct hash_table* by_name = hash_table_create(0, 0);
+    int* next_same_name = checked_malloc(sizeof(int) * (count + 1));
+    int* worklist = checked_malloc(sizeof(int) * (count + 1));
+
+    // names map to their last declaration, chained to the earlier ones
+    for (int i = 0; i < count; i++) {
+        void* previous = hash_table_remove(by_name, decls[i]->name);
+        next_same_name[i] = (int)(intptr_t)previous - 1;
+        hash_table_insert(by_name, decls[i]->name, (void*)(intptr_t)(i + 1));
+    }
 
-            if (d->symbol->kind == SYMBOL_GLOBAL) {
-                fprintf(output_file, ".data\n");
-                fprintf(output_file, "%s:\n", d->symbol->name);
-                int init_value = 0;
-                if (d->value) {
-                    init_value = d->value->integer_value;
+    int pending = 0;
+    memset(reachable, 0, count);
+    if (hash_table_lookup(by_name, "main")) {
+        mark_name(by_name, next_same_name, reachable, worklist, &pending, "main");
+    } else {
+        memset(reachable, 1, count);
+    }
+
+    while (pending > 0) {
+        IrFunction* f = functions[worklist[--pending]];
+        if (!f) continue;
+        for (int i = 0; i < f->block_count; i++) {
+            for (IrInstr* in = f->blocks[i]->first; in != NULL; in = in->next) {
+                mark_name(by_name, next_same_name, reachable, worklist, &pending, in->name);
+                // a vector loop names the arrays it reads and stores
+                if (in->op == IR_VECTOR) {
+                    mark_name(by_name, next_same_name, reachable, worklist, &pending, in->vector->name);
+                    for (int k = 0; k < in->vector->step_count; k++) {
+                        if (in->vector->steps[k].kind == IR_VECTOR_ELEMENT) {
+                            mark_name(by_name, next_same_name, reachable, worklist, &pending, in->vector->steps[k].name);
+                        }
+                    }
                 }
-                fprintf(output_file, "\t.quad %d\n", init_value);
-                fprintf(output_file, ".text\n\n");
-            } else {
-                const char* symbol = symbol_codegen(d->symbol);
-                expr_codegen(d->value);
-                //printf("d->value->reg is %d, d->symbol->name is %s\n", d->value, d->symbol->name);
-                fprintf(output_file,
-                    "MOVQ %s, %s\n",
-                    scratch_name(d->value->reg), symbol
-                );
-
-                scratch_free(d->value->reg);
-                free((void*) symbol);
             }
-            break;
-        case TYPE_VOID:
-            printf("Error: cannot create variable of type void.\n");
-            assert(0);
-            break;
+        }
     }
 
-    decl_codegen(d->next);
+    free(worklist);
+    free(next_same_name);
+    hash_table_delete(by_name);
 }
 
-FILE* codegen(Decl* decl, const char* output_filename) {
-    output_file = fopen(output_filename, "w+");
+int codegen(Decl* decl, const char* output_filename, Output_t format) {
+    if (!emitter_open(output_filename, format)) {
+        fprintf(current_context->messages, "Could not open output file '%s'.\n", output_filename);
+        return 0;
+    }
+
+    emit_section(SECTION_DATA);
+    emit_symbol_label(".__STR_TRUE");
+    emit_string("true");
+    emit_symbol_label(".__STR_FALSE");
+    emit_string("false");
+    emit_symbol_label(".__STR_ARRAY");
+    emit_string("(T_ARRAY)");
+    emit_symbol_label(".__STR_FUNCTION");
+    emit_string("(T_FUNCTION)");
+    emit_section(SECTION_TEXT);
+
+    int count = 0;
+    for (Decl* d = decl; d != NULL; d = d->next) {
+        count++;
+    }
+    Decl** decls = checked_malloc(sizeof(Decl*) * (count + 1));
+    IrFunction** functions = checked_malloc(sizeof(IrFunction*) * (count + 1));
+    char* reachable = checked_malloc(count + 1);
+
+    // top-level declarations get their own timing span so --time-report can
+    // show which functions dominate codegen. every function is optimized
+    // before anything is written, so that functions can be inlined into
+    // each other and calls optimized or inlined away do not keep a function
+    // in the output.
+    count = 0;
+    for (Decl* d = decl; d != NULL; d = d->next) {
+        decls[count++] = d;
+    }
+    timing_begin("optimize");
+    ir_optimize_program(decls, functions, count);
+    timing_end();
 
-    fprintf(output_file, ".data\n");
-    fprintf(output_file, ".__STR_TRUE:\n");
-    fprintf(output_file, "\t.string \"true\"\n");
-    fprintf(output_file, ".__STR_FALSE:\n");
-    fprintf(output_file, "\t.string \"false\"\n");
-    fprintf(output_file, ".__STR_ARRAY:\n");
-    fprintf(output_file, "\t.string \"(T_ARRAY)\"\n");
-    fprintf(output_file, ".__STR_FUNCTION:\n");
-    fprintf(output_file, "\t.string \"(T_FUNCTION)\"\n");
-    fprintf(output_file, ".text\n");
+    mark_reachable(decls, functions, count, reachable);
 
-    decl_codegen(decl);
+    timing_begin("emit");
+    for (int i = 0; i < count; i++) {
+        if (!reachable[i]) {
+            if (functions[i]) ir_function_delete(functions[i]);
+            continue;
+        }
+        timing_begin(decls[i]->name);
+        decl_codegen_single(decls[i], functions[i]);
+        timing_end();
+    }
+    timing_end();
 
-    return output_file;
+    free(reachable);
+    free(functions);
+    free(decls);
+
+    if (!emitter_close()) {
+        fprintf(current_context->messages, "Could not write output file '%s'.\n", output_filename);
+        return 0;
+    }
+    return 1;
 }
@@ -7,25 +7,22 @@
 #include "expr.h"
 #include "stmt.h"
 #include "decl.h"
+#include "x64_emit.h"
 
-int scratch_alloc();
-
-void scratch_free(int r);
-
-const char* scratch_name(int r);
+/*
+Code generation for the top-level declarations: data for globals, and for
+functions instruction selection from their IR (see ir.h), which hands
+instructions on virtual registers to the register allocator.
+*/
 
 int label_create();
 
-const char* label_name(int label);
-
-const char* symbol_codegen(Symbol* s);
-
-void expr_codegen(Expr* e);
-
-void stmt_codegen(Stmt* s);
-
+// global declarations as data, functions as code
 void decl_codegen(Decl* d);
 
-FILE* codegen(Decl* d, const char* output_filename);
+// writes the program to output_filename as assembly or as an object file,
+// leaving out the functions and globals main can not reach. returns 1 on
+// success, 0 if the file could not be written.
+int codegen(Decl* d, const char* output_filename, Output_t format);
 
 #endif
@@ -0,0 +1,462 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "x64_emit.h"
+#include "x64_object.h"
+#include "context.h"
+#include "util.h"
+
+// output is collected in a buffer of this size and written when it fills
+#define EMITTER_BUFFER_SIZE (1024 * 1024)
+
+struct Emitter {
+    int fd;
+    int failed;
+    ObjectWriter* object;   // NULL when writing assembly
+    size_t length;
+    char buffer[EMITTER_BUFFER_SIZE];
+};
+
+static const char* register_names[] = {
+    "%rax", "%rcx", "%rdx", "%rbx", "%rsp", "%rbp", "%rsi", "%rdi",
+    "%r8", "%r9", "%r10", "%r11", "%r12", "%r13", "%r14", "%r15",
+    "%rip",
+};
+
+// the low bytes of the registers above
+static const char* byte_register_names[] = {
+    "%al", "%cl", "%dl", "%bl", "%spl", "%bpl", "%sil", "%dil",
+    "%r8b", "%r9b", "%r10b", "%r11b", "%r12b", "%r13b", "%r14b", "%r15b",
+};
+
+static const char* opcode_names[] = {
+    [X64_MOVQ]  = "MOVQ",
+    [X64_LEAQ]  = "LEAQ",
+    [X64_ADDQ]  = "ADDQ",
+    [X64_SUBQ]  = "SUBQ",
+    [X64_IMULQ] = "IMULQ",
+    [X64_IDIVQ] = "IDIVQ",
+    [X64_CQO]   = "CQO",
+    [X64_NEGQ]  = "NEGQ",
+    [X64_INCQ]  = "INCQ",
+    [X64_DECQ]  = "DECQ",
+    [X64_XORQ]  = "XORQ",
+    [X64_CMPQ]  = "CMPQ",
+    [X64_SHLQ]  = "SHLQ",
+    [X64_SARQ]  = "SARQ",
+    [X64_SHRQ]  = "SHRQ",
+    [X64_PUSHQ] = "PUSHQ",
+    [X64_POPQ]  = "POPQ",
+    [X64_JMP]   = "JMP",
+    [X64_JE]    = "JE",
+    [X64_JNE]   = "JNE",
+    [X64_JG]    = "JG",
+    [X64_JGE]   = "JGE",
+    [X64_JL]    = "JL",
+    [X64_JLE]   = "JLE",
+    [X64_CALL]  = "CALL",
+    [X64_RET]   = "RET",
+    [X64_SETE]  = "SETE",
+    [X64_SETNE] = "SETNE",
+    [X64_SETG]  = "SETG",
+    [X64_SETGE] = "SETGE",
+    [X64_SETL]  = "SETL",
+    [X64_SETLE] = "SETLE",
+    [X64_MOVZBQ] = "MOVZBQ",
+    [X64_CMOVE]  = "CMOVE",
+    [X64_CMOVNE] = "CMOVNE",
+    [X64_CMOVG]  = "CMOVG",
+    [X64_CMOVGE] = "CMOVGE",
+    [X64_CMOVL]  = "CMOVL",
+    [X64_CMOVLE] = "CMOVLE",
+    [X64_MOVQ_XMM]    = "MOVQ",
+    [X64_MOVDQA]      = "MOVDQA",
+    [X64_PADDQ]       = "PADDQ",
+    [X64_PSUBQ]       = "PSUBQ",
+    [X64_PMULUDQ]     = "PMULUDQ",
+    [X64_PAND]        = "PAND",
+    [X64_PANDN]       = "PANDN",
+    [X64_POR]         = "POR",
+    [X64_PXOR]        = "PXOR",
+    [X64_PCMPGTQ]     = "PCMPGTQ",
+    [X64_PSLLQ]       = "PSLLQ",
+    [X64_PSRLQ]       = "PSRLQ",
+    [X64_PUNPCKLQDQ]  = "PUNPCKLQDQ",
+    [X64_PUNPCKHQDQ]  = "PUNPCKHQDQ",
+    [X64_VPBROADCASTQ] = "VPBROADCASTQ",
+    [X64_VEXTRACTI128] = "VEXTRACTI128",
+    [X64_VZEROUPPER]   = "VZEROUPPER",
+};
+
+//
+// operands
+//
+
+static Operand operand_create(Operand_t kind) {
+    Operand o;
+    o.kind = kind;
+    o.base = X64_NO_REGISTER;
+    o.index = X64_NO_REGISTER;
+    o.scale = 1;
+    o.value = 0;
+    o.label = -1;
+    o.symbol = NULL;
+    return o;
+}
+
+Operand operand_register(Register_t r) {
+    Operand o = operand_create(OPERAND_REGISTER);
+    o.base = r;
+    return o;
+}
+
+Operand operand_immediate(long value) {
+    Operand o = operand_create(OPERAND_IMMEDIATE);
+    o.value = value;
+    return o;
+}
+
+Operand operand_memory(Register_t base, long displacement) {
+    Operand o = operand_create(OPERAND_MEMORY);
+    o.base = base;
+    o.value = displacement;
+    return o;
+}
+
+Operand operand_indexed(Register_t base, Register_t index, int scale) {
+    Operand o = operand_create(OPERAND_MEMORY);
+    o.base = base;
+    o.index = index;
+    o.scale = scale;
+    return o;
+}
+
+Operand operand_label(int label) {
+    Operand o = operand_create(OPERAND_LABEL);
+    o.label = label;
+    return o;
+}
+
+Operand operand_label_address(int label) {
+    Operand o = operand_create(OPERAND_MEMORY);
+    o.base = X64_RIP;
+    o.label = label;
+    return o;
+}
+
+Operand operand_vector(int n, int bytes) {
+    Operand o = operand_create(OPERAND_VECTOR);
+    o.base = (Register_t)n;
+    o.scale = bytes;
+    return o;
+}
+
+Operand operand_symbol(const char* name) {
+    Operand o = operand_create(OPERAND_SYMBOL);
+    o.symbol = name;
+    return o;
+}
+
+Operand operand_global(const char* name) {
+    Operand o = operand_create(OPERAND_MEMORY);
+    o.base = X64_RIP;
+    o.symbol = name;
+    return o;
+}
+
+//
+// buffer
+//
+
+static void flush(Emitter* em) {
+    size_t written = 0;
+    while (written < em->length) {
+        ssize_t n = write(em->fd, em->buffer + written, em->length - written);
+        if (n <= 0) {
+            em->failed = 1;
+            break;
+        }
+        written += n;
+    }
+    em->length = 0;
+}
+
+static inline void put_char(Emitter* em, char c) {
+    if (em->length == EMITTER_BUFFER_SIZE) {
+        flush(em);
+    }
+    em->buffer[em->length++] = c;
+}
+
+static void put_bytes(Emitter* em, const char* s, size_t length) {
+    while (length > 0) {
+        if (em->length == EMITTER_BUFFER_SIZE) {
+            flush(em);
+        }
+        size_t space = EMITTER_BUFFER_SIZE - em->length;
+        size_t n = length < space ? length : space;
+        memcpy(em->buffer + em->length, s, n);
+        em->length += n;
+        s += n;
+        length -= n;
+    }
+}
+
+static void put_string(Emitter* em, const char* s) {
+    put_bytes(em, s, strlen(s));
+}
+
+static void put_long(Emitter* em, long value) {
+    char digits[24];
+    int n = 0;
+
+    // negate as unsigned so that LONG_MIN works too
+    unsigned long magnitude = value < 0 ? -(unsigned long)value : (unsigned long)value;
+    do {
+        digits[n++] = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude != 0);
+
+    if (value < 0) {
+        put_char(em, '-');
+    }
+    while (n > 0) {
+        put_char(em, digits[--n]);
+    }
+}
+
+static void put_label(Emitter* em, int label) {
+    put_bytes(em, ".L", 2);
+    put_long(em, label);
+}
+
+// byte is set for the operands of SETcc and the source of MOVZBQ, which
+// name the low byte of a register
+static void put_operand(Emitter* em, Operand o, int byte) {
+    switch (o.kind) {
+        case OPERAND_REGISTER:
+            put_string(em, byte ? byte_register_names[o.base] : register_names[o.base]);
+            break;
+        case OPERAND_IMMEDIATE:
+            put_char(em, '$');
+            put_long(em, o.value);
+            break;
+        case OPERAND_MEMORY:
+            if (o.label >= 0) {
+                put_label(em, o.label);
+            } else if (o.symbol != NULL) {
+                put_string(em, o.symbol);
+            } else {
+                put_long(em, o.value);
+            }
+            put_char(em, '(');
+            put_string(em, register_names[o.base]);
+            if (o.index != X64_NO_REGISTER) {
+                put_bytes(em, ", ", 2);
+                put_string(em, register_names[o.index]);
+                put_bytes(em, ", ", 2);
+                put_long(em, o.scale);
+            }
+            put_char(em, ')');
+            break;
+        case OPERAND_LABEL:
+            put_label(em, o.label);
+            break;
+        case OPERAND_SYMBOL:
+            put_string(em, o.symbol);
+            break;
+        case OPERAND_VECTOR:
+            put_string(em, o.scale == 32 ? "%ymm" : "%xmm");
+            put_long(em, o.base);
+            break;
+    }
+}
+
+//
+// output
+//
+
+int emitter_open(const char* filename, Output_t format) {
+    Emitter* em = checked_malloc(sizeof(*em));
+
+    em->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (em->fd < 0) {
+        free(em);
+        return 0;
+    }
+    em->failed = 0;
+    em->length = 0;
+    em->object = format == OUTPUT_OBJECT ? object_writer_create() : NULL;
+
+    current_context->emitter = em;
+    return 1;
+}
+
+int emitter_close() {
+    Emitter* em = current_context->emitter;
+    if (em->object) {
+        if (!object_writer_write(em->object, em->fd)) {
+            em->failed = 1;
+        }
+        object_writer_delete(em->object);
+    } else {
+        flush(em);
+    }
+    if (close(em->fd) != 0) {
+        em->failed = 1;
+    }
+
+    int ok = !em->failed;
+    free(em);
+    current_context->emitter = NULL;
+    return ok;
+}
+
+void emit0(Opcode_t op) {
+    Emitter* em = current_context->emitter;
+    if (em->object) {
+        object_instruction(em->object, op, 0, NULL);
+        return;
+    }
+    put_string(em, opcode_names[op]);
+    put_char(em, '\n');
+}
+
+void emit1(Opcode_t op, Operand a) {
+    Emitter* em = current_context->emitter;
+    if (em->object) {
+        object_instruction(em->object, op, 1, &a);
+        return;
+    }
+    put_string(em, opcode_names[op]);
+    put_char(em, ' ');
+    put_operand(em, a, op >= X64_SETE && op <= X64_SETLE);
+    put_char(em, '\n');
+}
+
+void emit2(Opcode_t op, Operand source, Operand destination) {
+    Emitter* em = current_context->emitter;
+    if (em->object) {
+        Operand operands[2] = {source, destination};
+        object_instruction(em->object, op, 2, operands);
+        return;
+    }
+    // the AVX2 forms of the packed instructions, on ymm registers, are
+    // spelled with a V and take the destination as their first source
+    int wide = (source.kind == OPERAND_VECTOR && source.scale == 32)
+            || (destination.kind == OPERAND_VECTOR && destination.scale == 32);
+    if (wide && op >= X64_MOVDQA && op <= X64_PUNPCKHQDQ) {
+        put_char(em, 'V');
+    }
+    put_string(em, opcode_names[op]);
+    put_char(em, ' ');
+    if (op == X64_VEXTRACTI128) {
+        put_bytes(em, "$1, ", 4);
+    }
+    put_operand(em, source, op == X64_MOVZBQ);
+    put_bytes(em, ", ", 2);
+    if (wide && op > X64_MOVDQA && op <= X64_PUNPCKHQDQ) {
+        put_operand(em, destination, 0);
+        put_bytes(em, ", ", 2);
+    }
+    put_operand(em, destination, 0);
+    put_char(em, '\n');
+}
+
+void emit_section(Section_t section) {
+    Emitter* em = current_context->emitter;
+    if (em->object) {
+        object_section(em->object, section);
+        return;
+    }
+    put_string(em, section == SECTION_TEXT ? ".text\n" : ".data\n");
+}
+
+void emit_label(int label) {
+    Emitter* em = current_context->emitter;
+    if (em->object) {
+        object_label(em->object, label);
+        return;
+    }
+    put_label(em, label);
+    put_bytes(em, ":\n", 2);
+}
+
+void emit_symbol_label(const char* name) {
+    Emitter* em = current_context->emitter;
+    if (em->object) {
+        object_symbol_label(em->object, name);
+        return;
+    }
+    put_string(em, name);
+    put_bytes(em, ":\n", 2);
+}
+
+void emit_global(const char* name) {
+    Emitter* em = current_context->emitter;
+    if (em->object) {
+        object_global(em->object, name);
+        return;
+    }
+    put_string(em, ".global ");
+    put_string(em, name);
+    put_char(em, '\n');
+}
+
+void emit_string(const char* text) {
+    Emitter* em = current_context->emitter;
+    if (em->object) {
+        object_string(em->object, text);
+        return;
+    }
+    put_string(em, "\t.string \"");
+    put_string(em, text);
+    put_bytes(em, "\"\n", 2);
+}
+
+void emit_quad(long value) {
+    Emitter* em = current_context->emitter;
+    if (em->object) {
+        object_quad(em->object, value);
+        return;
+    }
+    put_string(em, "\t.quad ");
+    put_long(em, value);
+    put_char(em, '\n');
+}
+
+void emit_quad_label(int label) {
+    Emitter* em = current_context->emitter;
+    if (em->object) {
+        object_quad_label(em->object, label);
+        return;
+    }
+    put_string(em, "\t.quad ");
+    put_label(em, label);
+    put_char(em, '\n');
+}
+
+void emit_zero(long bytes) {
+    Emitter* em = current_context->emitter;
+    if (em->object) {
+        object_zero(em->object, bytes);
+        return;
+    }
+    put_string(em, "\t.zero ");
+    put_long(em, bytes);
+    put_char(em, '\n');
+}
+
+void emit_align(int bytes) {
+    Emitter* em = current_context->emitter;
+    if (em->object) {
+        object_align(em->object, bytes);
+        return;
+    }
+    put_string(em, "\t.balign ");
+    put_long(em, bytes);
+    put_char(em, '\n');
+}
@@ -0,0 +1,218 @@
+#ifndef X64_EMIT_H
+#define X64_EMIT_H
+
+/*
+The assembly emitter. Code generation describes every instruction with an
+opcode and typed operands instead of formatting text itself; the emitter
+turns them into AT&T syntax in a large buffer that is written out in big
+chunks. Numbers are formatted by hand and nothing is allocated per
+instruction or operand.
+
+The emitter either prints assembly for the system assembler or, for
+OUTPUT_OBJECT, encodes the same instructions into an ELF64 object file
+itself (see x64_object.h); code generation does not need to know which.
+
+All functions write to the emitter of the current CompilerContext.
+*/
+
+// numbered as in the machine encoding
+typedef enum {
+    X64_RAX,
+    X64_RCX,
+    X64_RDX,
+    X64_RBX,
+    X64_RSP,
+    X64_RBP,
+    X64_RSI,
+    X64_RDI,
+    X64_R8,
+    X64_R9,
+    X64_R10,
+    X64_R11,
+    X64_R12,
+    X64_R13,
+    X64_R14,
+    X64_R15,
+    X64_RIP,
+    X64_NO_REGISTER,
+
+    // virtual registers are numbered from here on, see x64_regalloc.h
+    X64_FIRST_VIRTUAL = 32,
+} Register_t;
+
+typedef enum {
+    OPERAND_REGISTER,
+    OPERAND_IMMEDIATE,
+    // base + index*scale + displacement, or relative to a label or symbol
+    // when base is X64_RIP
+    OPERAND_MEMORY,
+    // jump targets
+    OPERAND_LABEL,
+    OPERAND_SYMBOL,
+    // %xmm<base>, or %ymm<base> when scale is 32 bytes instead of 16
+    OPERAND_VECTOR,
+} Operand_t;
+
+typedef struct Operand Operand;
+
+struct Operand {
+    Operand_t kind;
+    Register_t base;
+    Register_t index;
+    int scale;
+    long value;         // immediate, or displacement of a memory operand
+    int label;          // -1 unless the operand refers to .L<label>
+    const char* symbol; // NULL unless the operand refers to a named symbol
+};
+
+typedef enum {
+    X64_MOVQ,
+    X64_LEAQ,
+    X64_ADDQ,
+    X64_SUBQ,
+    // with one operand %rdx:%rax = %rax * operand, with two the destination
+    // register is multiplied by the source
+    X64_IMULQ,
+    X64_IDIVQ,
+    X64_CQO,
+    X64_NEGQ,
+    X64_INCQ,
+    X64_DECQ,
+    X64_XORQ,
+    X64_CMPQ,
+    // shift their destination by an immediate count: left, right keeping
+    // the sign, right filling with zeros
+    X64_SHLQ,
+    X64_SARQ,
+    X64_SHRQ,
+    X64_PUSHQ,
+    X64_POPQ,
+    X64_JMP,
+    X64_JE,
+    X64_JNE,
+    X64_JG,
+    X64_JGE,
+    X64_JL,
+    X64_JLE,
+    X64_CALL,
+    X64_RET,
+    // set the low byte of their operand to 1 if the condition holds and to
+    // 0 otherwise. conditions are in the same order as the jumps.
+    X64_SETE,
+    X64_SETNE,
+    X64_SETG,
+    X64_SETGE,
+    X64_SETL,
+    X64_SETLE,
+    // zero-extends the low byte of the source
+    X64_MOVZBQ,
+    // move if the condition holds. the destination is a register.
+    X64_CMOVE,
+    X64_CMOVNE,
+    X64_CMOVG,
+    X64_CMOVGE,
+    X64_CMOVL,
+    X64_CMOVLE,
+
+    // between a general register or memory and the low quad of an xmm
+    // register, clearing its high quad
+    X64_MOVQ_XMM,
+    // packed quads. on 16-byte operands these are the SSE2 instructions
+    // (PCMPGTQ is SSE4.2), on 32-byte operands the AVX2 forms, which are
+    // written and encoded with the destination as the first source too.
+    X64_MOVDQA,
+    X64_PADDQ,
+    X64_PSUBQ,
+    X64_PMULUDQ,    // full products of the low doublewords
+    X64_PAND,
+    X64_PANDN,      // destination = ~destination & source
+    X64_POR,
+    X64_PXOR,
+    X64_PCMPGTQ,    // destination = all ones where destination > source
+    X64_PSLLQ,      // by an immediate count
+    X64_PSRLQ,
+    X64_PUNPCKLQDQ, // destination = low quads of destination and source
+    X64_PUNPCKHQDQ, // destination = high quads of destination and source
+    // AVX2 only: every quad of a ymm destination = the low quad of an xmm
+    // source; an xmm destination = the high half of a ymm source; and
+    // clearing the high halves of all ymm registers before SSE code runs
+    X64_VPBROADCASTQ,
+    X64_VEXTRACTI128,
+    X64_VZEROUPPER,
+} Opcode_t;
+
+typedef enum {
+    SECTION_TEXT,
+    SECTION_DATA,
+} Section_t;
+
+typedef enum {
+    OUTPUT_ASSEMBLY,
+    OUTPUT_OBJECT,
+} Output_t;
+
+typedef struct Emitter Emitter;
+
+Operand operand_register(Register_t r);
+
+Operand operand_immediate(long value);
+
+Operand operand_memory(Register_t base, long displacement);
+
+// base + index*scale
+Operand operand_indexed(Register_t base, Register_t index, int scale);
+
+// .L<label> as a jump target
+Operand operand_label(int label);
+
+// the address of .L<label>, relative to %rip
+Operand operand_label_address(int label);
+
+// %xmm<n> if bytes is 16, %ymm<n> if it is 32
+Operand operand_vector(int n, int bytes);
+
+// a function as a call target, e.g. "printf@PLT"
+Operand operand_symbol(const char* name);
+
+// a global variable or named data label, relative to %rip
+Operand operand_global(const char* name);
+
+// returns 1 on success and 0 if the file could not be created
+int emitter_open(const char* filename, Output_t format);
+
+// writes out what is still buffered, or the whole object file, and closes
+// the file. returns 1 on success and 0 if any write failed.
+int emitter_close();
+
+void emit0(Opcode_t op);
+
+void emit1(Opcode_t op, Operand a);
+
+// AT&T operand order: source first
+void emit2(Opcode_t op, Operand source, Operand destination);
+
+void emit_section(Section_t section);
+
+// .L<label>:
+void emit_label(int label);
+
+// name:
+void emit_symbol_label(const char* name);
+
+// .global name
+void emit_global(const char* name);
+
+// .string "text". text is copied as is, escape sequences included.
+void emit_string(const char* text);
+
+void emit_quad(long value);
+
+// .quad .L<label>
+void emit_quad_label(int label);
+
+void emit_zero(long bytes);
+
+// pads the current section with zeros to a multiple of bytes, a power of two
+void emit_align(int bytes);
+
+#endif
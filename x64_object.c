@@ -0,0 +1,1062 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <unistd.h>
+#include <elf.h>
+
+#include "x64_object.h"
+#include "context.h"
+#include "hash_table.h"
+#include "util.h"
+
+#define NUM_SECTIONS 2
+
+// section header indices of the written file
+enum {
+    SHN_OBJECT_TEXT = 1,
+    SHN_OBJECT_DATA,
+    SHN_OBJECT_RELA_TEXT,
+    SHN_OBJECT_RELA_DATA,
+    SHN_OBJECT_SYMTAB,
+    SHN_OBJECT_STRTAB,
+    SHN_OBJECT_SHSTRTAB,
+    SHN_OBJECT_NOTE_STACK,
+    SHN_OBJECT_COUNT,
+};
+
+typedef struct {
+    unsigned char* data;
+    size_t length;
+    size_t capacity;
+} ByteBuffer;
+
+typedef struct {
+    char* name;
+    int section;    // Section_t, or -1 while undefined
+    long value;     // offset in the section
+    int global;
+    int elf_index;
+} ObjectSymbol;
+
+typedef struct {
+    int section;    // Section_t, or -1 while undefined
+    long offset;
+} LabelPosition;
+
+typedef enum {
+    FIXUP_PC32,
+    FIXUP_PLT32,
+    FIXUP_ABS64,
+} Fixup_t;
+
+// a field whose value depends on the address of a label or symbol
+typedef struct {
+    Fixup_t kind;
+    int section;    // section holding the field
+    long offset;    // of the field
+    long addend;
+    int label;      // target label, or -1
+    int symbol;     // target symbol, or -1
+} Fixup;
+
+struct ObjectWriter {
+    ByteBuffer sections[NUM_SECTIONS];   // indexed by Section_t
+    int alignment[NUM_SECTIONS];        // the largest asked for, at least 1
+    Section_t current;
+
+    LabelPosition* labels;
+    int label_capacity;
+
+    ObjectSymbol* symbols;
+    int symbol_count;
+    int symbol_capacity;
+    struct hash_table* symbol_index;    // name -> index + 1
+
+    Fixup* fixups;
+    int fixup_count;
+    int fixup_capacity;
+};
+
+static void* grow(void* array, int* capacity, size_t element_size, int needed) {
+    if (needed <= *capacity) {
+        return array;
+    }
+    int new_capacity = *capacity ? *capacity : 64;
+    while (new_capacity < needed) {
+        new_capacity *= 2;
+    }
+    array = checked_realloc(array, new_capacity * element_size);
+    *capacity = new_capacity;
+    return array;
+}
+
+//
+// byte buffers
+//
+
+static void buffer_reserve(ByteBuffer* b, size_t extra) {
+    if (b->length + extra <= b->capacity) {
+        return;
+    }
+    size_t capacity = b->capacity ? b->capacity : 4096;
+    while (capacity < b->length + extra) {
+        capacity *= 2;
+    }
+    b->data = checked_realloc(b->data, capacity);
+    b->capacity = capacity;
+}
+
+static void buffer_put(ByteBuffer* b, const void* bytes, size_t n) {
+    // an empty buffer may have no data to copy to yet
+    if (n == 0) {
+        return;
+    }
+    buffer_reserve(b, n);
+    memcpy(b->data + b->length, bytes, n);
+    b->length += n;
+}
+
+static void buffer_put8(ByteBuffer* b, unsigned value) {
+    buffer_reserve(b, 1);
+    b->data[b->length++] = (unsigned char)value;
+}
+
+// little endian, whatever the host
+static void buffer_put_le(ByteBuffer* b, uint64_t value, int size) {
+    buffer_reserve(b, size);
+    for (int i = 0; i < size; i++) {
+        b->data[b->length++] = (unsigned char)(value >> (8 * i));
+    }
+}
+
+static void buffer_patch32(ByteBuffer* b, long offset, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        b->data[offset + i] = (unsigned char)(value >> (8 * i));
+    }
+}
+
+static void buffer_align(ByteBuffer* b, size_t alignment) {
+    while (b->length % alignment != 0) {
+        buffer_put8(b, 0);
+    }
+}
+
+//
+// writer
+//
+
+ObjectWriter* object_writer_create() {
+    ObjectWriter* w = checked_calloc(1, sizeof(*w));
+    w->current = SECTION_TEXT;
+    for (int i = 0; i < NUM_SECTIONS; i++) {
+        w->alignment[i] = 1;
+    }
+    w->symbol_index = hash_table_create(0, 0);
+    if (w->symbol_index == NULL) {
+        printf("Error: ran out of memory.");
+        exit(1);
+    }
+    return w;
+}
+
+void object_writer_delete(ObjectWriter* w) {
+    if (!w) return;
+
+    for (int i = 0; i < NUM_SECTIONS; i++) {
+        free(w->sections[i].data);
+    }
+    for (int i = 0; i < w->symbol_count; i++) {
+        free(w->symbols[i].name);
+    }
+    free(w->symbols);
+    free(w->labels);
+    free(w->fixups);
+    hash_table_delete(w->symbol_index);
+    free(w);
+}
+
+static ByteBuffer* current_section(ObjectWriter* w) {
+    return &w->sections[w->current];
+}
+
+// returns the index of the symbol called name, creating it undefined and
+// local on first use
+static int symbol_lookup(ObjectWriter* w, const char* name) {
+    void* found = hash_table_lookup(w->symbol_index, name);
+    if (found) {
+        return (int)(intptr_t)found - 1;
+    }
+
+    w->symbols = grow(w->symbols, &w->symbol_capacity, sizeof(ObjectSymbol), w->symbol_count + 1);
+    ObjectSymbol* s = &w->symbols[w->symbol_count];
+    s->name = strdup(name);
+    if (s->name == NULL) {
+        printf("Error: ran out of memory.");
+        exit(1);
+    }
+    s->section = -1;
+    s->value = 0;
+    s->global = 0;
+    s->elf_index = 0;
+
+    if (!hash_table_insert(w->symbol_index, name, (void*)(intptr_t)(w->symbol_count + 1))) {
+        printf("Error: ran out of memory.");
+        exit(1);
+    }
+    return w->symbol_count++;
+}
+
+static LabelPosition* label_position(ObjectWriter* w, int label) {
+    assert(label >= 0);
+    int old_capacity = w->label_capacity;
+    w->labels = grow(w->labels, &w->label_capacity, sizeof(LabelPosition), label + 1);
+    for (int i = old_capacity; i < w->label_capacity; i++) {
+        w->labels[i].section = -1;
+        w->labels[i].offset = 0;
+    }
+    return &w->labels[label];
+}
+
+static void fixup_add(ObjectWriter* w, Fixup_t kind, long addend, int label, int symbol) {
+    w->fixups = grow(w->fixups, &w->fixup_capacity, sizeof(Fixup), w->fixup_count + 1);
+    Fixup* f = &w->fixups[w->fixup_count++];
+    f->kind = kind;
+    f->section = w->current;
+    f->offset = current_section(w)->length;
+    f->addend = addend;
+    f->label = label;
+    f->symbol = symbol;
+}
+
+//
+// instruction encoding
+//
+
+static int is_high_register(Register_t r) {
+    return r >= X64_R8 && r <= X64_R15;
+}
+
+static int fits_in_8(long value) {
+    return value >= -128 && value <= 127;
+}
+
+static int fits_in_32(long value) {
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+static void unsupported(Opcode_t op) {
+    fprintf(current_context->messages, "Error: cannot encode instruction %d with these operands.\n", op);
+    assert(0);
+}
+
+// a 32-bit field relative to the end of the instruction, which ends
+// trailing bytes after the field
+static void put_relative32(ObjectWriter* w, Fixup_t kind, Operand target, int trailing) {
+    long addend = -4 - trailing;
+    if (target.label >= 0) {
+        fixup_add(w, kind, addend, target.label, -1);
+    } else {
+        assert(target.symbol != NULL);
+        // in assembly a call through the PLT is spelled name@PLT, here the
+        // relocation type says so
+        const char* name = target.symbol;
+        char plain[256];
+        size_t length = strlen(name);
+        if (kind == FIXUP_PLT32 && length > 4 && length < sizeof(plain)
+            && strcmp(name + length - 4, "@PLT") == 0
+        ) {
+            memcpy(plain, name, length - 4);
+            plain[length - 4] = '\0';
+            name = plain;
+        }
+        fixup_add(w, kind, addend + target.value, -1, symbol_lookup(w, name));
+    }
+    buffer_put_le(current_section(w), 0, 4);
+}
+
+// the ModRM byte and whatever addressing bytes rm needs. reg is the
+// register (or opcode extension) of the ModRM reg field. immediate_size is
+// the number of bytes the caller emits after this.
+static void put_address(ObjectWriter* w, int reg, Operand rm, int immediate_size) {
+    ByteBuffer* b = current_section(w);
+    int reg_bits = (reg & 7) << 3;
+
+    if (rm.kind == OPERAND_REGISTER || rm.kind == OPERAND_VECTOR) {
+        buffer_put8(b, 0xC0 | reg_bits | (rm.base & 7));
+        return;
+    }
+    assert(rm.kind == OPERAND_MEMORY);
+
+    if (rm.base == X64_RIP) {
+        buffer_put8(b, 0x05 | reg_bits);
+        put_relative32(w, FIXUP_PC32, rm, immediate_size);
+        return;
+    }
+
+    // rbp and r13 cannot be used without a displacement, rsp and r12 only
+    // with a SIB byte
+    long displacement = rm.value;
+    int mod;
+    if (displacement == 0 && (rm.base & 7) != 5) {
+        mod = 0x00;
+    } else if (fits_in_8(displacement)) {
+        mod = 0x40;
+    } else {
+        mod = 0x80;
+    }
+
+    int need_sib = rm.index != X64_NO_REGISTER || (rm.base & 7) == 4;
+    buffer_put8(b, mod | reg_bits | (need_sib ? 4 : (rm.base & 7)));
+    if (need_sib) {
+        int scale_bits = rm.scale == 8 ? 3 : rm.scale == 4 ? 2 : rm.scale == 2 ? 1 : 0;
+        int index_bits = rm.index == X64_NO_REGISTER ? 4 : (rm.index & 7);
+        buffer_put8(b, (scale_bits << 6) | (index_bits << 3) | (rm.base & 7));
+    }
+
+    if (mod == 0x40) {
+        buffer_put8(b, displacement);
+    } else if (mod == 0x80) {
+        buffer_put_le(b, displacement, 4);
+    }
+}
+
+// whether the base of rm is one of r8-r15 (or xmm8-xmm15), which takes
+// an extra bit in the prefix
+static int has_high_base(Operand rm) {
+    return (rm.kind != OPERAND_MEMORY || rm.base != X64_RIP) && is_high_register(rm.base);
+}
+
+// the REX prefix, opcode and put_address
+static void put_modrm(ObjectWriter* w, int wide, const unsigned char* opcode, int opcode_length,
+                      int reg, Operand rm, int immediate_size) {
+    ByteBuffer* b = current_section(w);
+
+    int rex = wide ? 0x48 : 0x40;
+    if (reg >= X64_R8) rex |= 0x04;
+    if (has_high_base(rm)) rex |= 0x01;
+    if (rm.kind == OPERAND_MEMORY && is_high_register(rm.index)) rex |= 0x02;
+    if (rex != 0x40) {
+        buffer_put8(b, rex);
+    }
+    buffer_put(b, opcode, opcode_length);
+    put_address(w, reg, rm, immediate_size);
+}
+
+static void put_modrm1(ObjectWriter* w, int wide, unsigned char opcode, int reg, Operand rm, int immediate_size) {
+    put_modrm(w, wide, &opcode, 1, reg, rm, immediate_size);
+}
+
+// ADDQ, SUBQ, XORQ and CMPQ share their encodings, differing only in ext
+static void encode_arithmetic(ObjectWriter* w, Opcode_t op, int ext, Operand source, Operand destination) {
+    ByteBuffer* b = current_section(w);
+
+    if (source.kind == OPERAND_IMMEDIATE) {
+        if (fits_in_8(source.value)) {
+            put_modrm1(w, 1, 0x83, ext, destination, 1);
+            buffer_put8(b, source.value);
+        } else if (fits_in_32(source.value)) {
+            put_modrm1(w, 1, 0x81, ext, destination, 4);
+            buffer_put_le(b, source.value, 4);
+        } else {
+            unsupported(op);
+        }
+    } else if (source.kind == OPERAND_REGISTER) {
+        put_modrm1(w, 1, ext * 8 + 1, source.base, destination, 0);
+    } else if (destination.kind == OPERAND_REGISTER) {
+        put_modrm1(w, 1, ext * 8 + 3, destination.base, source, 0);
+    } else {
+        unsupported(op);
+    }
+}
+
+static void encode_move(ObjectWriter* w, Operand source, Operand destination) {
+    ByteBuffer* b = current_section(w);
+
+    if (source.kind == OPERAND_IMMEDIATE) {
+        if (fits_in_32(source.value)) {
+            put_modrm1(w, 1, 0xC7, 0, destination, 4);
+            buffer_put_le(b, source.value, 4);
+        } else if (destination.kind == OPERAND_REGISTER) {
+            // movabs
+            buffer_put8(b, 0x48 | (is_high_register(destination.base) ? 0x01 : 0));
+            buffer_put8(b, 0xB8 + (destination.base & 7));
+            buffer_put_le(b, source.value, 8);
+        } else {
+            unsupported(X64_MOVQ);
+        }
+    } else if (source.kind == OPERAND_REGISTER) {
+        put_modrm1(w, 1, 0x89, source.base, destination, 0);
+    } else if (destination.kind == OPERAND_REGISTER) {
+        put_modrm1(w, 1, 0x8B, destination.base, source, 0);
+    } else {
+        unsupported(X64_MOVQ);
+    }
+}
+
+// the two-operand IMULQ: a register destination, and an immediate or any
+// source
+static void encode_multiply(ObjectWriter* w, Operand source, Operand destination) {
+    ByteBuffer* b = current_section(w);
+
+    if (destination.kind != OPERAND_REGISTER) {
+        unsupported(X64_IMULQ);
+    }
+    if (source.kind == OPERAND_IMMEDIATE) {
+        if (fits_in_8(source.value)) {
+            put_modrm1(w, 1, 0x6B, destination.base, destination, 1);
+            buffer_put8(b, source.value);
+        } else if (fits_in_32(source.value)) {
+            put_modrm1(w, 1, 0x69, destination.base, destination, 4);
+            buffer_put_le(b, source.value, 4);
+        } else {
+            unsupported(X64_IMULQ);
+        }
+    } else if (source.kind == OPERAND_REGISTER || source.kind == OPERAND_MEMORY) {
+        unsigned char opcode[2] = {0x0F, 0xAF};
+        put_modrm(w, 1, opcode, 2, destination.base, source, 0);
+    } else {
+        unsupported(X64_IMULQ);
+    }
+}
+
+static void encode_push_pop(ObjectWriter* w, Opcode_t op, Operand a) {
+    ByteBuffer* b = current_section(w);
+    int push = op == X64_PUSHQ;
+
+    if (a.kind == OPERAND_REGISTER) {
+        if (is_high_register(a.base)) {
+            buffer_put8(b, 0x41);
+        }
+        buffer_put8(b, (push ? 0x50 : 0x58) + (a.base & 7));
+    } else if (a.kind == OPERAND_MEMORY) {
+        put_modrm1(w, 0, push ? 0xFF : 0x8F, push ? 6 : 0, a, 0);
+    } else if (push && a.kind == OPERAND_IMMEDIATE && fits_in_8(a.value)) {
+        buffer_put8(b, 0x6A);
+        buffer_put8(b, a.value);
+    } else if (push && a.kind == OPERAND_IMMEDIATE && fits_in_32(a.value)) {
+        buffer_put8(b, 0x68);
+        buffer_put_le(b, a.value, 4);
+    } else {
+        unsupported(op);
+    }
+}
+
+static void encode_jump(ObjectWriter* w, Opcode_t op, Operand target) {
+    ByteBuffer* b = current_section(w);
+
+    if (target.kind != OPERAND_LABEL && target.kind != OPERAND_SYMBOL) {
+        unsupported(op);
+    }
+
+    switch (op) {
+        case X64_JMP:  buffer_put8(b, 0xE9); break;
+        case X64_CALL: buffer_put8(b, 0xE8); break;
+        case X64_JE:   buffer_put8(b, 0x0F); buffer_put8(b, 0x84); break;
+        case X64_JNE:  buffer_put8(b, 0x0F); buffer_put8(b, 0x85); break;
+        case X64_JG:   buffer_put8(b, 0x0F); buffer_put8(b, 0x8F); break;
+        case X64_JGE:  buffer_put8(b, 0x0F); buffer_put8(b, 0x8D); break;
+        case X64_JL:   buffer_put8(b, 0x0F); buffer_put8(b, 0x8C); break;
+        case X64_JLE:  buffer_put8(b, 0x0F); buffer_put8(b, 0x8E); break;
+        default:       unsupported(op); break;
+    }
+
+    // calls go through the PLT so that they can reach shared libraries
+    put_relative32(w, target.kind == OPERAND_SYMBOL ? FIXUP_PLT32 : FIXUP_PC32, target, 0);
+}
+
+// the condition field of SETcc and CMOVcc, for the n-th condition in the
+// order E, NE, G, GE, L, LE
+static const unsigned char condition_codes[] = {0x4, 0x5, 0xF, 0xD, 0xC, 0xE};
+
+static void encode_set(ObjectWriter* w, Opcode_t op, Operand a) {
+    if (a.kind != OPERAND_REGISTER && a.kind != OPERAND_MEMORY) {
+        unsupported(op);
+    }
+    // without a REX prefix 4-7 would mean %ah, %ch, %dh and %bh
+    if (a.kind == OPERAND_REGISTER && a.base >= X64_RSP && a.base <= X64_RDI) {
+        buffer_put8(current_section(w), 0x40);
+    }
+    unsigned char opcode[2] = {0x0F, 0x90 + condition_codes[op - X64_SETE]};
+    put_modrm(w, 0, opcode, 2, 0, a, 0);
+}
+
+// MOVZBQ and CMOVcc: a register destination and any source
+static void encode_load(ObjectWriter* w, Opcode_t op, Operand source, Operand destination) {
+    if (destination.kind != OPERAND_REGISTER ||
+        (source.kind != OPERAND_REGISTER && source.kind != OPERAND_MEMORY)) {
+        unsupported(op);
+    }
+    unsigned char opcode[2] = {0x0F, op == X64_MOVZBQ ? 0xB6 : 0x40 + condition_codes[op - X64_CMOVE]};
+    put_modrm(w, 1, opcode, 2, destination.base, source, 0);
+}
+
+//
+// vector instructions
+//
+
+// the 66 prefix of the SSE instructions on quads goes before REX
+static void put_sse(ObjectWriter* w, int wide, const unsigned char* opcode, int opcode_length,
+                    int reg, Operand rm, int immediate_size) {
+    buffer_put8(current_section(w), 0x66);
+    put_modrm(w, wide, opcode, opcode_length, reg, rm, immediate_size);
+}
+
+// a 256-bit instruction with the 66 prefix, in the three-byte VEX form.
+// map selects the opcode table: 1 for 0F, 2 for 0F38, 3 for 0F3A. source is
+// the register of the vvvv field, 0 when the instruction has none.
+static void put_vex256(ObjectWriter* w, int map, int source, unsigned char opcode,
+                       int reg, Operand rm, int immediate_size) {
+    ByteBuffer* b = current_section(w);
+    int r = reg >= 8;
+    int x = rm.kind == OPERAND_MEMORY && is_high_register(rm.index);
+    buffer_put8(b, 0xC4);
+    buffer_put8(b, (!r << 7) | (!x << 6) | (!has_high_base(rm) << 5) | map);
+    // W0, vvvv inverted, L for 256 bits, pp for 66
+    buffer_put8(b, ((~source & 15) << 3) | 0x04 | 0x01);
+    buffer_put8(b, opcode);
+    put_address(w, reg, rm, immediate_size);
+}
+
+static int is_vector(Operand o, int bytes) {
+    return o.kind == OPERAND_VECTOR && o.scale == bytes;
+}
+
+// the opcode of a packed instruction of the form destination op= source,
+// after 0F or, for PCMPGTQ, after 0F 38
+static unsigned char packed_opcode(Opcode_t op) {
+    switch (op) {
+        case X64_PADDQ: return 0xD4;
+        case X64_PSUBQ: return 0xFB;
+        case X64_PMULUDQ: return 0xF4;
+        case X64_PAND: return 0xDB;
+        case X64_PANDN: return 0xDF;
+        case X64_POR: return 0xEB;
+        case X64_PXOR: return 0xEF;
+        case X64_PCMPGTQ: return 0x37;
+        case X64_PUNPCKLQDQ: return 0x6C;
+        case X64_PUNPCKHQDQ: return 0x6D;
+        default:
+            unsupported(op);
+            return 0;
+    }
+}
+
+static void encode_vector(ObjectWriter* w, Opcode_t op, Operand source, Operand destination) {
+    ByteBuffer* b = current_section(w);
+    int wide = is_vector(source, 32) || is_vector(destination, 32);
+
+    switch (op) {
+        case X64_MOVQ_XMM: {
+            if (is_vector(destination, 16) && source.kind != OPERAND_VECTOR) {
+                unsigned char opcode[2] = {0x0F, 0x6E};
+                put_sse(w, 1, opcode, 2, destination.base, source, 0);
+            } else if (is_vector(source, 16) && destination.kind != OPERAND_VECTOR) {
+                unsigned char opcode[2] = {0x0F, 0x7E};
+                put_sse(w, 1, opcode, 2, source.base, destination, 0);
+            } else {
+                unsupported(op);
+            }
+        } break;
+        case X64_MOVDQA: {
+            // loads are 6F, stores 7F
+            int load = destination.kind == OPERAND_VECTOR;
+            Operand reg = load ? destination : source;
+            Operand rm = load ? source : destination;
+            if (reg.kind != OPERAND_VECTOR || (rm.kind != OPERAND_VECTOR && rm.kind != OPERAND_MEMORY)) {
+                unsupported(op);
+            }
+            unsigned char opcode[2] = {0x0F, load ? 0x6F : 0x7F};
+            if (wide) {
+                put_vex256(w, 1, 0, opcode[1], reg.base, rm, 0);
+            } else {
+                put_sse(w, 0, opcode, 2, reg.base, rm, 0);
+            }
+        } break;
+        case X64_PSLLQ:
+        case X64_PSRLQ: {
+            if (source.kind != OPERAND_IMMEDIATE || destination.kind != OPERAND_VECTOR) {
+                unsupported(op);
+            }
+            int ext = op == X64_PSLLQ ? 6 : 2;
+            if (wide) {
+                put_vex256(w, 1, destination.base, 0x73, ext, destination, 1);
+            } else {
+                unsigned char opcode[2] = {0x0F, 0x73};
+                put_sse(w, 0, opcode, 2, ext, destination, 1);
+            }
+            buffer_put8(b, source.value);
+        } break;
+        case X64_VPBROADCASTQ:
+            if (!is_vector(destination, 32) || !is_vector(source, 16)) {
+                unsupported(op);
+            }
+            put_vex256(w, 2, 0, 0x59, destination.base, source, 0);
+            break;
+        case X64_VEXTRACTI128:
+            if (!is_vector(source, 32) || !is_vector(destination, 16)) {
+                unsupported(op);
+            }
+            put_vex256(w, 3, 0, 0x39, source.base, destination, 1);
+            buffer_put8(b, 1);
+            break;
+        default: {
+            if (destination.kind != OPERAND_VECTOR
+                || (source.kind != OPERAND_VECTOR && source.kind != OPERAND_MEMORY)
+            ) {
+                unsupported(op);
+            }
+            int map = op == X64_PCMPGTQ ? 2 : 1;
+            unsigned char opcode = packed_opcode(op);
+            if (wide) {
+                put_vex256(w, map, destination.base, opcode, destination.base, source, 0);
+            } else if (map == 2) {
+                unsigned char bytes[3] = {0x0F, 0x38, opcode};
+                put_sse(w, 0, bytes, 3, destination.base, source, 0);
+            } else {
+                unsigned char bytes[2] = {0x0F, opcode};
+                put_sse(w, 0, bytes, 2, destination.base, source, 0);
+            }
+        } break;
+    }
+}
+
+void object_instruction(ObjectWriter* w, Opcode_t op, int operand_count, const Operand* operands) {
+    ByteBuffer* b = current_section(w);
+    const Operand* a = operands;
+
+    switch (op) {
+        case X64_MOVQ:
+            assert(operand_count == 2);
+            encode_move(w, a[0], a[1]);
+            break;
+        case X64_LEAQ:
+            assert(operand_count == 2);
+            if (a[0].kind != OPERAND_MEMORY || a[1].kind != OPERAND_REGISTER) {
+                unsupported(op);
+            }
+            put_modrm1(w, 1, 0x8D, a[1].base, a[0], 0);
+            break;
+        case X64_ADDQ:
+            assert(operand_count == 2);
+            encode_arithmetic(w, op, 0, a[0], a[1]);
+            break;
+        case X64_SUBQ:
+            assert(operand_count == 2);
+            encode_arithmetic(w, op, 5, a[0], a[1]);
+            break;
+        case X64_XORQ:
+            assert(operand_count == 2);
+            encode_arithmetic(w, op, 6, a[0], a[1]);
+            break;
+        case X64_CMPQ:
+            assert(operand_count == 2);
+            encode_arithmetic(w, op, 7, a[0], a[1]);
+            break;
+        case X64_IMULQ:
+            if (operand_count == 2) {
+                encode_multiply(w, a[0], a[1]);
+                break;
+            }
+            // fall through
+        case X64_IDIVQ:
+        case X64_NEGQ:
+            assert(operand_count == 1);
+            if (a[0].kind != OPERAND_REGISTER && a[0].kind != OPERAND_MEMORY) {
+                unsupported(op);
+            }
+            put_modrm1(w, 1, 0xF7, op == X64_IMULQ ? 5 : op == X64_IDIVQ ? 7 : 3, a[0], 0);
+            break;
+        case X64_SHLQ:
+        case X64_SARQ:
+        case X64_SHRQ:
+            assert(operand_count == 2);
+            if (a[0].kind != OPERAND_IMMEDIATE || a[0].value < 0 || a[0].value > 63) {
+                unsupported(op);
+            }
+            put_modrm1(w, 1, 0xC1, op == X64_SHLQ ? 4 : op == X64_SARQ ? 7 : 5, a[1], 1);
+            buffer_put8(b, a[0].value);
+            break;
+        case X64_INCQ:
+        case X64_DECQ:
+            assert(operand_count == 1);
+            if (a[0].kind != OPERAND_REGISTER && a[0].kind != OPERAND_MEMORY) {
+                unsupported(op);
+            }
+            put_modrm1(w, 1, 0xFF, op == X64_INCQ ? 0 : 1, a[0], 0);
+            break;
+        case X64_CQO:
+            buffer_put8(b, 0x48);
+            buffer_put8(b, 0x99);
+            break;
+        case X64_PUSHQ:
+        case X64_POPQ:
+            assert(operand_count == 1);
+            encode_push_pop(w, op, a[0]);
+            break;
+        case X64_JMP:
+        case X64_JE:
+        case X64_JNE:
+        case X64_JG:
+        case X64_JGE:
+        case X64_JL:
+        case X64_JLE:
+        case X64_CALL:
+            assert(operand_count == 1);
+            encode_jump(w, op, a[0]);
+            break;
+        case X64_RET:
+            buffer_put8(b, 0xC3);
+            break;
+        case X64_SETE:
+        case X64_SETNE:
+        case X64_SETG:
+        case X64_SETGE:
+        case X64_SETL:
+        case X64_SETLE:
+            assert(operand_count == 1);
+            encode_set(w, op, a[0]);
+            break;
+        case X64_MOVZBQ:
+        case X64_CMOVE:
+        case X64_CMOVNE:
+        case X64_CMOVG:
+        case X64_CMOVGE:
+        case X64_CMOVL:
+        case X64_CMOVLE:
+            assert(operand_count == 2);
+            encode_load(w, op, a[0], a[1]);
+            break;
+        case X64_VZEROUPPER:
+            buffer_put8(b, 0xC5);
+            buffer_put8(b, 0xF8);
+            buffer_put8(b, 0x77);
+            break;
+        case X64_MOVQ_XMM:
+        case X64_MOVDQA:
+        case X64_PADDQ:
+        case X64_PSUBQ:
+        case X64_PMULUDQ:
+        case X64_PAND:
+        case X64_PANDN:
+        case X64_POR:
+        case X64_PXOR:
+        case X64_PCMPGTQ:
+        case X64_PSLLQ:
+        case X64_PSRLQ:
+        case X64_PUNPCKLQDQ:
+        case X64_PUNPCKHQDQ:
+        case X64_VPBROADCASTQ:
+        case X64_VEXTRACTI128:
+            assert(operand_count == 2);
+            encode_vector(w, op, a[0], a[1]);
+            break;
+    }
+}
+
+//
+// directives
+//
+
+void object_section(ObjectWriter* w, Section_t section) {
+    w->current = section;
+}
+
+void object_label(ObjectWriter* w, int label) {
+    LabelPosition* p = label_position(w, label);
+    assert(p->section < 0);
+    p->section = w->current;
+    p->offset = current_section(w)->length;
+}
+
+void object_symbol_label(ObjectWriter* w, const char* name) {
+    int i = symbol_lookup(w, name);
+    ObjectSymbol* s = &w->symbols[i];
+    if (s->section >= 0) {
+        fprintf(current_context->messages, "Error: symbol '%s' is already defined.\n", name);
+        assert(0);
+    }
+    s->section = w->current;
+    s->value = current_section(w)->length;
+}
+
+void object_global(ObjectWriter* w, const char* name) {
+    int i = symbol_lookup(w, name);
+    w->symbols[i].global = 1;
+}
+
+void object_string(ObjectWriter* w, const char* text) {
+    ByteBuffer* b = current_section(w);
+
+    // the escapes the assembler would have decoded
+    for (const char* p = text; *p != '\0'; p++) {
+        if (*p != '\\' || p[1] == '\0') {
+            buffer_put8(b, *p);
+            continue;
+        }
+        p++;
+        switch (*p) {
+            case 'n':  buffer_put8(b, '\n'); break;
+            case 't':  buffer_put8(b, '\t'); break;
+            case 'r':  buffer_put8(b, '\r'); break;
+            case 'a':  buffer_put8(b, '\a'); break;
+            case 'b':  buffer_put8(b, '\b'); break;
+            case 'f':  buffer_put8(b, '\f'); break;
+            case 'v':  buffer_put8(b, '\v'); break;
+            case '0': case '1': case '2': case '3':
+            case '4': case '5': case '6': case '7': {
+                int value = 0;
+                for (int i = 0; i < 3 && *p >= '0' && *p <= '7'; i++, p++) {
+                    value = value * 8 + (*p - '0');
+                }
+                p--;
+                buffer_put8(b, value);
+            } break;
+            default:   buffer_put8(b, *p); break;
+        }
+    }
+    buffer_put8(b, 0);
+}
+
+void object_quad(ObjectWriter* w, long value) {
+    buffer_put_le(current_section(w), value, 8);
+}
+
+void object_quad_label(ObjectWriter* w, int label) {
+    fixup_add(w, FIXUP_ABS64, 0, label, -1);
+    buffer_put_le(current_section(w), 0, 8);
+}
+
+void object_zero(ObjectWriter* w, long bytes) {
+    ByteBuffer* b = current_section(w);
+    buffer_reserve(b, bytes);
+    memset(b->data + b->length, 0, bytes);
+    b->length += bytes;
+}
+
+void object_align(ObjectWriter* w, int bytes) {
+    buffer_align(current_section(w), bytes);
+    if (bytes > w->alignment[w->current]) {
+        w->alignment[w->current] = bytes;
+    }
+}
+
+//
+// ELF output
+//
+
+static const uint32_t fixup_relocation_types[] = {
+    [FIXUP_PC32]  = R_X86_64_PC32,
+    [FIXUP_PLT32] = R_X86_64_PLT32,
+    [FIXUP_ABS64] = R_X86_64_64,
+};
+
+static const int section_symbol_index[NUM_SECTIONS] = {
+    [SECTION_TEXT] = 1,
+    [SECTION_DATA] = 2,
+};
+
+static const int section_header_index[NUM_SECTIONS] = {
+    [SECTION_TEXT] = SHN_OBJECT_TEXT,
+    [SECTION_DATA] = SHN_OBJECT_DATA,
+};
+
+static void put_relocation(ByteBuffer* rela, long offset, int symbol, uint32_t type, long addend) {
+    Elf64_Rela r;
+    r.r_offset = offset;
+    r.r_info = ELF64_R_INFO((uint64_t)symbol, type);
+    r.r_addend = addend;
+    buffer_put(rela, &r, sizeof(r));
+}
+
+// patches fixups that stay within a section and turns the others into
+// relocations, one buffer per section. symbols must have been numbered.
+static void resolve_fixups(ObjectWriter* w, ByteBuffer rela[NUM_SECTIONS]) {
+    for (int i = 0; i < w->fixup_count; i++) {
+        Fixup* f = &w->fixups[i];
+        uint32_t type = fixup_relocation_types[f->kind];
+
+        if (f->symbol >= 0) {
+            put_relocation(&rela[f->section], f->offset, w->symbols[f->symbol].elf_index, type, f->addend);
+            continue;
+        }
+
+        LabelPosition* target = label_position(w, f->label);
+        if (target->section < 0) {
+            fprintf(current_context->messages, "Error: label .L%d is never defined.\n", f->label);
+            assert(0);
+        }
+
+        if (f->kind != FIXUP_ABS64 && target->section == f->section) {
+            long value = target->offset + f->addend - f->offset;
+            buffer_patch32(&w->sections[f->section], f->offset, (uint32_t)value);
+        } else {
+            put_relocation(&rela[f->section], f->offset, section_symbol_index[target->section],
+                           type, target->offset + f->addend);
+        }
+    }
+}
+
+static size_t string_table_add(ByteBuffer* strtab, const char* name) {
+    size_t offset = strtab->length;
+    buffer_put(strtab, name, strlen(name) + 1);
+    return offset;
+}
+
+static void put_symbol(ByteBuffer* symtab, size_t name, int bind, int type, int section, long value) {
+    Elf64_Sym s;
+    memset(&s, 0, sizeof(s));
+    s.st_name = name;
+    s.st_info = ELF64_ST_INFO(bind, type);
+    s.st_other = STV_DEFAULT;
+    s.st_shndx = section;
+    s.st_value = value;
+    buffer_put(symtab, &s, sizeof(s));
+}
+
+static void section_header(Elf64_Shdr* h, size_t name, uint32_t type, uint64_t flags,
+                           size_t offset, size_t size, uint32_t link, uint32_t info,
+                           uint64_t alignment, uint64_t entry_size) {
+    memset(h, 0, sizeof(*h));
+    h->sh_name = name;
+    h->sh_type = type;
+    h->sh_flags = flags;
+    h->sh_offset = offset;
+    h->sh_size = size;
+    h->sh_link = link;
+    h->sh_info = info;
+    h->sh_addralign = alignment;
+    h->sh_entsize = entry_size;
+}
+
+int object_writer_write(ObjectWriter* w, int fd) {
+    ByteBuffer symtab = {0};
+    ByteBuffer strtab = {0};
+    ByteBuffer rela[NUM_SECTIONS] = {{0}};
+
+    // null symbol, then the two section symbols, then local symbols, then
+    // global and undefined ones, as ELF requires
+    buffer_put8(&strtab, 0);
+    put_symbol(&symtab, 0, STB_LOCAL, STT_NOTYPE, SHN_UNDEF, 0);
+    put_symbol(&symtab, 0, STB_LOCAL, STT_SECTION, SHN_OBJECT_TEXT, 0);
+    put_symbol(&symtab, 0, STB_LOCAL, STT_SECTION, SHN_OBJECT_DATA, 0);
+    int symbol_total = 3;
+
+    int first_global = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 1) {
+            first_global = symbol_total;
+        }
+        for (int i = 0; i < w->symbol_count; i++) {
+            ObjectSymbol* s = &w->symbols[i];
+            int global = s->global || s->section < 0;
+            if (global != pass) continue;
+
+            int section = s->section < 0 ? SHN_UNDEF : section_header_index[s->section];
+            int type = s->section == SECTION_TEXT && s->global ? STT_FUNC : STT_NOTYPE;
+            put_symbol(&symtab, string_table_add(&strtab, s->name),
+                       global ? STB_GLOBAL : STB_LOCAL, type, section, s->value);
+            s->elf_index = symbol_total++;
+        }
+    }
+
+    resolve_fixups(w, rela);
+
+    ByteBuffer shstrtab = {0};
+    buffer_put8(&shstrtab, 0);
+    size_t name_text = string_table_add(&shstrtab, ".text");
+    size_t name_data = string_table_add(&shstrtab, ".data");
+    size_t name_rela_text = string_table_add(&shstrtab, ".rela.text");
+    size_t name_rela_data = string_table_add(&shstrtab, ".rela.data");
+    size_t name_symtab = string_table_add(&shstrtab, ".symtab");
+    size_t name_strtab = string_table_add(&shstrtab, ".strtab");
+    size_t name_shstrtab = string_table_add(&shstrtab, ".shstrtab");
+    size_t name_note_stack = string_table_add(&shstrtab, ".note.GNU-stack");
+
+    // the file is assembled in memory and written in one go
+    ByteBuffer file = {0};
+    Elf64_Ehdr header;
+    buffer_put(&file, &header, sizeof(header));
+
+    buffer_align(&file, w->alignment[SECTION_TEXT]);
+    size_t offset_text = file.length;
+    buffer_put(&file, w->sections[SECTION_TEXT].data, w->sections[SECTION_TEXT].length);
+    buffer_align(&file, w->alignment[SECTION_DATA]);
+    size_t offset_data = file.length;
+    buffer_put(&file, w->sections[SECTION_DATA].data, w->sections[SECTION_DATA].length);
+    buffer_align(&file, 8);
+    size_t offset_rela_text = file.length;
+    buffer_put(&file, rela[SECTION_TEXT].data, rela[SECTION_TEXT].length);
+    size_t offset_rela_data = file.length;
+    buffer_put(&file, rela[SECTION_DATA].data, rela[SECTION_DATA].length);
+    size_t offset_symtab = file.length;
+    buffer_put(&file, symtab.data, symtab.length);
+    size_t offset_strtab = file.length;
+    buffer_put(&file, strtab.data, strtab.length);
+    size_t offset_shstrtab = file.length;
+    buffer_put(&file, shstrtab.data, shstrtab.length);
+    buffer_align(&file, 8);
+
+    Elf64_Shdr sections[SHN_OBJECT_COUNT];
+    memset(&sections[0], 0, sizeof(sections[0]));
+    section_header(&sections[SHN_OBJECT_TEXT], name_text, SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR,
+                   offset_text, w->sections[SECTION_TEXT].length, 0, 0, w->alignment[SECTION_TEXT], 0);
+    section_header(&sections[SHN_OBJECT_DATA], name_data, SHT_PROGBITS, SHF_ALLOC | SHF_WRITE,
+                   offset_data, w->sections[SECTION_DATA].length, 0, 0, w->alignment[SECTION_DATA], 0);
+    section_header(&sections[SHN_OBJECT_RELA_TEXT], name_rela_text, SHT_RELA, SHF_INFO_LINK,
+                   offset_rela_text, rela[SECTION_TEXT].length, SHN_OBJECT_SYMTAB, SHN_OBJECT_TEXT,
+                   8, sizeof(Elf64_Rela));
+    section_header(&sections[SHN_OBJECT_RELA_DATA], name_rela_data, SHT_RELA, SHF_INFO_LINK,
+                   offset_rela_data, rela[SECTION_DATA].length, SHN_OBJECT_SYMTAB, SHN_OBJECT_DATA,
+                   8, sizeof(Elf64_Rela));
+    section_header(&sections[SHN_OBJECT_SYMTAB], name_symtab, SHT_SYMTAB, 0,
+                   offset_symtab, symtab.length, SHN_OBJECT_STRTAB, first_global,
+                   8, sizeof(Elf64_Sym));
+    section_header(&sections[SHN_OBJECT_STRTAB], name_strtab, SHT_STRTAB, 0,
+                   offset_strtab, strtab.length, 0, 0, 1, 0);
+    section_header(&sections[SHN_OBJECT_SHSTRTAB], name_shstrtab, SHT_STRTAB, 0,
+                   offset_shstrtab, shstrtab.length, 0, 0, 1, 0);
+    // marks the stack as not executable
+    section_header(&sections[SHN_OBJECT_NOTE_STACK], name_note_stack, SHT_PROGBITS, 0,
+                   offset_shstrtab + shstrtab.length, 0, 0, 0, 1, 0);
+
+    size_t offset_sections = file.length;
+    buffer_put(&file, sections, sizeof(sections));
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.e_ident, ELFMAG, SELFMAG);
+    header.e_ident[EI_CLASS] = ELFCLASS64;
+    header.e_ident[EI_DATA] = ELFDATA2LSB;
+    header.e_ident[EI_VERSION] = EV_CURRENT;
+    header.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+    header.e_type = ET_REL;
+    header.e_machine = EM_X86_64;
+    header.e_version = EV_CURRENT;
+    header.e_shoff = offset_sections;
+    header.e_ehsize = sizeof(Elf64_Ehdr);
+    header.e_shentsize = sizeof(Elf64_Shdr);
+    header.e_shnum = SHN_OBJECT_COUNT;
+    header.e_shstrndx = SHN_OBJECT_SHSTRTAB;
+    memcpy(file.data, &header, sizeof(header));
+
+    int ok = 1;
+    size_t written = 0;
+    while (written < file.length) {
+        ssize_t n = write(fd, file.data + written, file.length - written);
+        if (n <= 0) {
+            ok = 0;
+            break;
+        }
+        written += n;
+    }
+
+    free(file.data);
+    free(symtab.data);
+    free(strtab.data);
+    free(shstrtab.data);
+    for (int i = 0; i < NUM_SECTIONS; i++) {
+        free(rela[i].data);
+    }
+    return ok;
+}
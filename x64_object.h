@@ -0,0 +1,49 @@
+#ifndef X64_OBJECT_H
+#define X64_OBJECT_H
+
+#include "x64_emit.h"
+
+/*
+The object file backend of the emitter. Instead of printing assembly it
+encodes every instruction into machine code and writes an ELF64
+relocatable object, so the output can go straight to the linker.
+
+Jumps to labels in the same section are resolved when the object is
+written. Everything else becomes a relocation: references to .data labels
+are made relative to the .data section symbol, references to named symbols
+(globals, functions, printf@PLT) to the symbol itself.
+
+Operands are given in AT&T order, as to emit2.
+*/
+
+typedef struct ObjectWriter ObjectWriter;
+
+ObjectWriter* object_writer_create();
+
+void object_writer_delete(ObjectWriter* w);
+
+void object_instruction(ObjectWriter* w, Opcode_t op, int operand_count, const Operand* operands);
+
+void object_section(ObjectWriter* w, Section_t section);
+
+void object_label(ObjectWriter* w, int label);
+
+void object_symbol_label(ObjectWriter* w, const char* name);
+
+void object_global(ObjectWriter* w, const char* name);
+
+// the bytes of text, with escape sequences decoded, and a terminating zero
+void object_string(ObjectWriter* w, const char* text);
+
+void object_quad(ObjectWriter* w, long value);
+
+void object_quad_label(ObjectWriter* w, int label);
+
+void object_zero(ObjectWriter* w, long bytes);
+
+void object_align(ObjectWriter* w, int bytes);
+
+// writes the ELF file to fd. returns 1 on success and 0 if a write failed.
+int object_writer_write(ObjectWriter* w, int fd);
+
+#endif
@@ -0,0 +1,237 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "x64_peephole.h"
+#include "context.h"
+#include "util.h"
+
+/*
+The rules look at the end of the code kept so far, and the pass appends
+one instruction at a time. When a rule fires the rules are tried again
+on the new end, so that one rewrite can make way for another: removing a
+jump to the next label may leave a conditional jump around it that can
+then be inverted.
+*/
+
+typedef int (*PeepholeRule)(MachineInstr* code, int* end);
+
+static int is_label(const MachineInstr* in) {
+    return in->label >= 0;
+}
+
+static int is_instr(const MachineInstr* in, Opcode_t op) {
+    return in->label < 0 && in->op == op;
+}
+
+static int is_jump(const MachineInstr* in) {
+    return in->label < 0 && in->op >= X64_JMP && in->op <= X64_JLE;
+}
+
+static int is_register(Operand o) {
+    return o.kind == OPERAND_REGISTER;
+}
+
+static int operand_equal(Operand a, Operand b) {
+    if (a.kind != b.kind) return 0;
+    switch (a.kind) {
+        case OPERAND_REGISTER:
+            return a.base == b.base;
+        case OPERAND_IMMEDIATE:
+            return a.value == b.value;
+        case OPERAND_MEMORY:
+            return a.base == b.base && a.index == b.index && a.scale == b.scale
+                && a.value == b.value && a.label == b.label && a.symbol == b.symbol;
+        case OPERAND_LABEL:
+            return a.label == b.label;
+        case OPERAND_SYMBOL:
+            return a.symbol == b.symbol;
+        case OPERAND_VECTOR:
+            return a.base == b.base && a.scale == b.scale;
+    }
+    return 0;
+}
+
+// whether o reads or is register r
+static int operand_uses(Operand o, Register_t r) {
+    if (o.kind == OPERAND_REGISTER) return o.base == r;
+    if (o.kind == OPERAND_MEMORY) return o.base == r || o.index == r;
+    return 0;
+}
+
+static Opcode_t jump_inverse(Opcode_t op) {
+    switch (op) {
+        case X64_JE: return X64_JNE;
+        case X64_JNE: return X64_JE;
+        case X64_JG: return X64_JLE;
+        case X64_JGE: return X64_JL;
+        case X64_JL: return X64_JGE;
+        case X64_JLE: return X64_JG;
+        default: return op;
+    }
+}
+
+//
+// rules
+//
+
+// movq %r, %r, left over from values that were given the same register
+static int move_to_itself(MachineInstr* code, int* end) {
+    MachineInstr* in = &code[*end - 1];
+    if (is_instr(in, X64_MOVQ) && is_register(in->operands[0])
+        && operand_equal(in->operands[0], in->operands[1])
+    ) {
+        (*end)--;
+        return 1;
+    }
+    return 0;
+}
+
+// pushq x, popq y: a move, or nothing when x is y
+static int push_pop(MachineInstr* code, int* end) {
+    if (*end < 2) return 0;
+    MachineInstr* push = &code[*end - 2];
+    MachineInstr* pop = &code[*end - 1];
+    if (!is_instr(push, X64_PUSHQ) || !is_instr(pop, X64_POPQ)) return 0;
+
+    Operand from = push->operands[0];
+    Operand to = pop->operands[0];
+    if (operand_equal(from, to)) {
+        *end -= 2;
+        return 1;
+    }
+    // x64 moves have at most one memory operand
+    if (from.kind == OPERAND_MEMORY && to.kind == OPERAND_MEMORY) return 0;
+    // the pop address is computed after %rsp comes back up
+    if (operand_uses(from, X64_RSP) || operand_uses(to, X64_RSP)) return 0;
+
+    push->op = X64_MOVQ;
+    push->operand_count = 2;
+    push->operands[0] = from;
+    push->operands[1] = to;
+    (*end)--;
+    return 1;
+}
+
+// movq a, b, movq b, a: the second move changes nothing
+static int store_reload(MachineInstr* code, int* end) {
+    if (*end < 2) return 0;
+    MachineInstr* first = &code[*end - 2];
+    MachineInstr* second = &code[*end - 1];
+    if (!is_instr(first, X64_MOVQ) || !is_instr(second, X64_MOVQ)) return 0;
+
+    Operand a = first->operands[0];
+    Operand b = first->operands[1];
+    if (!operand_equal(second->operands[0], b) || !operand_equal(second->operands[1], a)) return 0;
+    // movq 8(%rcx), %rcx changes the address a refers to
+    if (is_register(b) && operand_uses(a, b.base)) return 0;
+
+    (*end)--;
+    return 1;
+}
+
+// movq %r, m, movq m, %s: the value is still in %r
+static int reload_from_register(MachineInstr* code, int* end) {
+    if (*end < 2) return 0;
+    MachineInstr* first = &code[*end - 2];
+    MachineInstr* second = &code[*end - 1];
+    if (!is_instr(first, X64_MOVQ) || !is_instr(second, X64_MOVQ)) return 0;
+
+    Operand r = first->operands[0];
+    Operand m = first->operands[1];
+    if (!is_register(r) || m.kind != OPERAND_MEMORY) return 0;
+    if (!operand_equal(second->operands[0], m) || !is_register(second->operands[1])) return 0;
+
+    second->operands[0] = r;
+    return 1;
+}
+
+// jcc L1, jmp L2, L1: becomes the inverse jcc to L2
+static int jump_over_jump(MachineInstr* code, int* end) {
+    if (*end < 3) return 0;
+    MachineInstr* branch = &code[*end - 3];
+    MachineInstr* jump = &code[*end - 2];
+    MachineInstr* label = &code[*end - 1];
+    if (!is_jump(branch) || branch->op == X64_JMP || !is_instr(jump, X64_JMP) || !is_label(label)) return 0;
+    if (branch->operands[0].kind != OPERAND_LABEL || branch->operands[0].label != label->label) return 0;
+
+    branch->op = jump_inverse(branch->op);
+    branch->operands[0] = jump->operands[0];
+    *jump = *label;
+    (*end)--;
+    return 1;
+}
+
+// a jump to a label that directly follows it, maybe after other labels
+static int jump_to_next(MachineInstr* code, int* end) {
+    MachineInstr* label = &code[*end - 1];
+    if (!is_label(label)) return 0;
+
+    int i = *end - 2;
+    while (i >= 0 && is_label(&code[i])) i--;
+    if (i < 0 || !is_jump(&code[i])) return 0;
+    if (code[i].operands[0].kind != OPERAND_LABEL || code[i].operands[0].label != label->label) return 0;
+
+    for (int j = i; j < *end - 1; j++) {
+        code[j] = code[j + 1];
+    }
+    (*end)--;
+    return 1;
+}
+
+// an instruction after a jmp or ret that no label leads to
+static int unreachable(MachineInstr* code, int* end) {
+    if (*end < 2) return 0;
+    MachineInstr* before = &code[*end - 2];
+    if (is_label(&code[*end - 1])) return 0;
+    if (!is_instr(before, X64_JMP) && !is_instr(before, X64_RET)) return 0;
+
+    (*end)--;
+    return 1;
+}
+
+static const struct {
+    const char* name;
+    PeepholeRule apply;
+} rules[] = {
+    {"move to itself", move_to_itself},
+    {"push then pop", push_pop},
+    {"store then reload", store_reload},
+    {"reload from register", reload_from_register},
+    {"jump over jump", jump_over_jump},
+    {"jump to next label", jump_to_next},
+    {"unreachable code", unreachable},
+};
+
+#define RULE_COUNT (int)(sizeof(rules) / sizeof(rules[0]))
+
+void peephole_optimize(MachineInstr* code, int* length) {
+    if (!current_context->peephole_counts) {
+        current_context->peephole_counts = checked_calloc(RULE_COUNT, sizeof(long));
+    }
+    long* counts = current_context->peephole_counts;
+
+    int end = 0;
+    for (int i = 0; i < *length; i++) {
+        code[end++] = code[i];
+        int fired = 1;
+        while (fired && end > 0) {
+            fired = 0;
+            for (int r = 0; r < RULE_COUNT; r++) {
+                if (rules[r].apply(code, &end)) {
+                    counts[r]++;
+                    fired = 1;
+                    break;
+                }
+            }
+        }
+    }
+    *length = end;
+}
+
+void peephole_report(FILE* out) {
+    long* counts = current_context->peephole_counts;
+    fprintf(out, "%-40s %12s\n", "Peephole rule", "Fired");
+    for (int r = 0; r < RULE_COUNT; r++) {
+        fprintf(out, "%-40s %12ld\n", rules[r].name, counts ? counts[r] : 0);
+    }
+}
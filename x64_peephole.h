@@ -0,0 +1,30 @@
+#ifndef X64_PEEPHOLE_H
+#define X64_PEEPHOLE_H
+
+#include <stdio.h>
+
+#include "x64_emit.h"
+
+/*
+Peephole optimization of the machine code of a function, after register
+allocation has put it on machine registers and before it is emitted. A
+table of rules each match a few instructions in a row, such as a store
+followed by a load of the same slot or a jump to the label right after
+it, and rewrite or remove them. How often every rule fired is counted
+per compilation.
+*/
+
+typedef struct {
+    Opcode_t op;
+    int label;              // >= 0 for a label, which is not an instruction
+    int operand_count;
+    Operand operands[2];
+} MachineInstr;
+
+// rewrites code in place, updating length
+void peephole_optimize(MachineInstr* code, int* length);
+
+// how often each rule fired in the current context
+void peephole_report(FILE* out);
+
+#endif
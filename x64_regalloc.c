@@ -0,0 +1,813 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "x64_regalloc.h"
+#include "x64_peephole.h"
+#include "context.h"
+#include "util.h"
+
+#define NUM_CALLER_SAVED 6
+#define NUM_ALLOCATABLE 11
+#define NUM_TEMPORARIES 3
+
+#define ROLE_USE 1
+#define ROLE_DEF 2
+
+// caller-saved registers first: they are free to use when no call is in
+// the way, the others have to be saved in the prologue
+static const Register_t allocatable[NUM_ALLOCATABLE] = {
+    X64_RCX, X64_RSI, X64_RDI, X64_R8, X64_R9, X64_R10,
+    X64_RBX, X64_R12, X64_R13, X64_R14, X64_R15,
+};
+
+static const Register_t callee_saved[] = {
+    X64_RBX, X64_R12, X64_R13, X64_R14, X64_R15,
+};
+
+// never allocated, used to load spilled operands
+static const Register_t temporaries[NUM_TEMPORARIES] = {
+    X64_R11, X64_RDX, X64_RAX,
+};
+
+struct MachineFunction {
+    MachineInstr* code;
+    int length;
+    int capacity;
+    int vreg_count;
+    int first_label;    // labels of the function are numbered from here
+};
+
+typedef struct {
+    Register_t reg;
+    int role;
+} RegisterRef;
+
+typedef struct {
+    int vreg;
+    int block;
+    int upward_exposed;     // used in the block before any definition
+    int defines;
+} BlockOccurrence;
+
+static int* int_array(int length, int value) {
+    int* array = checked_malloc(sizeof(int) * length);
+    for (int i = 0; i < length; i++) {
+        array[i] = value;
+    }
+    return array;
+}
+
+//
+// collecting the body
+//
+
+void function_begin(int variable_count) {
+    assert(current_context->function == NULL);
+
+    MachineFunction* f = checked_calloc(1, sizeof(*f));
+    f->vreg_count = variable_count;
+    f->first_label = current_context->current_label_num;
+    current_context->function = f;
+}
+
+Register_t virtual_register(int n) {
+    return (Register_t)(X64_FIRST_VIRTUAL + n);
+}
+
+Register_t vreg_create() {
+    return virtual_register(current_context->function->vreg_count++);
+}
+
+static MachineInstr* instr_append() {
+    MachineFunction* f = current_context->function;
+    if (f->length == f->capacity) {
+        f->capacity = f->capacity ? f->capacity * 2 : 256;
+        f->code = checked_realloc(f->code, sizeof(MachineInstr) * f->capacity);
+    }
+    MachineInstr* in = &f->code[f->length++];
+    in->label = -1;
+    in->operand_count = 0;
+    return in;
+}
+
+void instr0(Opcode_t op) {
+    MachineInstr* in = instr_append();
+    in->op = op;
+}
+
+void instr1(Opcode_t op, Operand a) {
+    MachineInstr* in = instr_append();
+    in->op = op;
+    in->operand_count = 1;
+    in->operands[0] = a;
+}
+
+void instr2(Opcode_t op, Operand source, Operand destination) {
+    MachineInstr* in = instr_append();
+    in->op = op;
+    in->operand_count = 2;
+    in->operands[0] = source;
+    in->operands[1] = destination;
+}
+
+void instr_label(int label) {
+    MachineInstr* in = instr_append();
+    in->label = label;
+}
+
+//
+// instruction properties
+//
+
+static int is_virtual(Register_t r) {
+    return r >= X64_FIRST_VIRTUAL;
+}
+
+static int is_jump(const MachineInstr* in) {
+    if (in->label >= 0) return 0;
+    switch (in->op) {
+        case X64_JMP:
+        case X64_JE:
+        case X64_JNE:
+        case X64_JG:
+        case X64_JGE:
+        case X64_JL:
+        case X64_JLE:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static int ends_block(const MachineInstr* in) {
+    return is_jump(in) || (in->label < 0 && in->op == X64_RET);
+}
+
+static int register_role(Opcode_t op, int operand_count, int k) {
+    if (operand_count == 1) {
+        switch (op) {
+            case X64_POPQ:
+            case X64_SETE:
+            case X64_SETNE:
+            case X64_SETG:
+            case X64_SETGE:
+            case X64_SETL:
+            case X64_SETLE:
+                return ROLE_DEF;
+            case X64_NEGQ:
+            case X64_INCQ:
+            case X64_DECQ:
+                return ROLE_USE | ROLE_DEF;
+            default:
+                return ROLE_USE;
+        }
+    }
+    if (k == 0) {
+        return ROLE_USE;
+    }
+    switch (op) {
+        case X64_MOVQ:
+        case X64_LEAQ:
+        case X64_MOVZBQ:
+        case X64_MOVQ_XMM:
+            return ROLE_DEF;
+        case X64_CMPQ:
+            return ROLE_USE;
+        default:
+            return ROLE_USE | ROLE_DEF;
+    }
+}
+
+// the registers in, in an order where uses come before definitions.
+// returns how many there are.
+static int instr_registers(const MachineInstr* in, RegisterRef refs[4]) {
+    int count = 0;
+    for (int k = 0; k < in->operand_count; k++) {
+        const Operand* o = &in->operands[k];
+        if (o->kind == OPERAND_REGISTER) {
+            refs[count].reg = o->base;
+            refs[count].role = register_role(in->op, in->operand_count, k);
+            count++;
+        } else if (o->kind == OPERAND_MEMORY) {
+            if (o->base != X64_NO_REGISTER && o->base != X64_RIP) {
+                refs[count].reg = o->base;
+                refs[count].role = ROLE_USE;
+                count++;
+            }
+            if (o->index != X64_NO_REGISTER) {
+                refs[count].reg = o->index;
+                refs[count].role = ROLE_USE;
+                count++;
+            }
+        }
+    }
+    return count;
+}
+
+//
+// allocation
+//
+
+typedef struct {
+    MachineInstr* code;
+    int length;
+    int vreg_count;
+    int first_label;
+
+    int block_count;
+    int* block_of;          // per instruction
+    int* block_first;       // first instruction of each block
+    int* block_last;
+    int* pred_start;        // predecessors of b are preds[pred_start[b] .. pred_start[b+1]-1]
+    int* preds;
+
+    int* start;             // live interval of each virtual register, -1 if unused
+    int* end;
+
+    // reserved[k][i+1] - reserved[k][j] > 0 if caller-saved register k
+    // may not hold a virtual register anywhere in i..j
+    int* reserved[NUM_CALLER_SAVED];
+
+    int* location;          // register, or -(slot+1) when spilled
+    int spill_count;
+} Allocation;
+
+static void find_blocks(Allocation* a) {
+    int n = a->length;
+    int label_count = current_context->current_label_num - a->first_label;
+    int* label_position = int_array(label_count, -1);
+
+    a->block_of = int_array(n, 0);
+    a->block_first = int_array(n + 1, 0);
+    a->block_count = 0;
+    for (int i = 0; i < n; i++) {
+        if (i == 0 || a->code[i].label >= 0 || ends_block(&a->code[i-1])) {
+            a->block_first[a->block_count++] = i;
+        }
+        a->block_of[i] = a->block_count - 1;
+        if (a->code[i].label >= 0) {
+            label_position[a->code[i].label - a->first_label] = i;
+        }
+    }
+    a->block_last = int_array(a->block_count, 0);
+    for (int b = 0; b < a->block_count; b++) {
+        a->block_last[b] = (b + 1 < a->block_count ? a->block_first[b+1] : n) - 1;
+    }
+
+    // every block has at most two successors: a jump target and the next
+    // block
+    int* successors = int_array(2 * a->block_count, -1);
+    a->pred_start = int_array(a->block_count + 1, 0);
+    for (int b = 0; b < a->block_count; b++) {
+        MachineInstr* in = &a->code[a->block_last[b]];
+        int falls_through = !(in->label < 0 && (in->op == X64_JMP || in->op == X64_RET));
+        if (is_jump(in)) {
+            int target = label_position[in->operands[0].label - a->first_label];
+            assert(target >= 0);
+            successors[2*b] = a->block_of[target];
+        }
+        if (falls_through && b + 1 < a->block_count) {
+            successors[2*b+1] = b + 1;
+        }
+        for (int k = 0; k < 2; k++) {
+            if (successors[2*b+k] >= 0) {
+                a->pred_start[successors[2*b+k] + 1]++;
+            }
+        }
+    }
+    for (int b = 0; b < a->block_count; b++) {
+        a->pred_start[b+1] += a->pred_start[b];
+    }
+    a->preds = int_array(a->pred_start[a->block_count], 0);
+    int* fill = int_array(a->block_count, 0);
+    for (int b = 0; b < a->block_count; b++) {
+        for (int k = 0; k < 2; k++) {
+            int s = successors[2*b+k];
+            if (s >= 0) {
+                a->preds[a->pred_start[s] + fill[s]++] = b;
+            }
+        }
+    }
+
+    free(fill);
+    free(successors);
+    free(label_position);
+}
+
+// live intervals. a virtual register that is only used within one block,
+// and defined there before it is used, lives from its first to its last
+// occurrence. for the others, the blocks they are live in are found by
+// walking backwards from their uses to their definitions.
+static void compute_intervals(Allocation* a) {
+    int vcount = a->vreg_count;
+    a->start = int_array(vcount, -1);
+    a->end = int_array(vcount, -1);
+
+    int occurrence_capacity = 1024;
+    int occurrence_count = 0;
+    BlockOccurrence* occurrences = checked_malloc(sizeof(BlockOccurrence) * occurrence_capacity);
+    int* current = int_array(vcount, -1);   // occurrence in the block seen last
+    int* count_of = int_array(vcount + 1, 0);
+    int* needs_dataflow = int_array(vcount, 0);
+
+    for (int i = 0; i < a->length; i++) {
+        RegisterRef refs[4];
+        int ref_count = instr_registers(&a->code[i], refs);
+        int b = a->block_of[i];
+        for (int r = 0; r < ref_count; r++) {
+            if (!is_virtual(refs[r].reg)) continue;
+            int v = refs[r].reg - X64_FIRST_VIRTUAL;
+
+            if (a->start[v] < 0) {
+                a->start[v] = i;
+            }
+            a->end[v] = i;
+
+            if (current[v] < 0 || occurrences[current[v]].block != b) {
+                if (occurrence_count == occurrence_capacity) {
+                    occurrence_capacity *= 2;
+                    occurrences = checked_realloc(occurrences, sizeof(BlockOccurrence) * occurrence_capacity);
+                }
+                BlockOccurrence* o = &occurrences[occurrence_count];
+                o->vreg = v;
+                o->block = b;
+                o->upward_exposed = (refs[r].role & ROLE_USE) != 0;
+                o->defines = 0;
+                if (o->upward_exposed || current[v] >= 0) {
+                    needs_dataflow[v] = 1;
+                }
+                current[v] = occurrence_count++;
+                count_of[v+1]++;
+            }
+            if (refs[r].role & ROLE_DEF) {
+                occurrences[current[v]].defines = 1;
+            }
+        }
+    }
+
+    // group the occurrences by virtual register
+    for (int v = 0; v < vcount; v++) {
+        count_of[v+1] += count_of[v];
+    }
+    BlockOccurrence* by_vreg = checked_malloc(sizeof(BlockOccurrence) * (occurrence_count + 1));
+    int* fill = int_array(vcount, 0);
+    for (int i = 0; i < occurrence_count; i++) {
+        int v = occurrences[i].vreg;
+        by_vreg[count_of[v] + fill[v]++] = occurrences[i];
+    }
+
+    int* defined_in = int_array(a->block_count, -1);
+    int* live_in = int_array(a->block_count, -1);
+    int* worklist = int_array(a->block_count, 0);
+
+    for (int v = 0; v < vcount; v++) {
+        if (!needs_dataflow[v]) continue;
+
+        int start = a->start[v];
+        int end = a->end[v];
+        int pending = 0;
+
+        for (int i = count_of[v]; i < count_of[v+1]; i++) {
+            if (by_vreg[i].defines) {
+                defined_in[by_vreg[i].block] = v;
+            }
+        }
+        for (int i = count_of[v]; i < count_of[v+1]; i++) {
+            int b = by_vreg[i].block;
+            if (by_vreg[i].upward_exposed && live_in[b] != v) {
+                live_in[b] = v;
+                worklist[pending++] = b;
+            }
+        }
+
+        while (pending > 0) {
+            int b = worklist[--pending];
+            if (a->block_first[b] < start) {
+                start = a->block_first[b];
+            }
+            for (int p = a->pred_start[b]; p < a->pred_start[b+1]; p++) {
+                int pred = a->preds[p];
+                // live at the end of every predecessor
+                if (a->block_last[pred] > end) {
+                    end = a->block_last[pred];
+                }
+                if (live_in[pred] != v && defined_in[pred] != v) {
+                    live_in[pred] = v;
+                    worklist[pending++] = pred;
+                }
+            }
+        }
+
+        a->start[v] = start;
+        a->end[v] = end;
+    }
+
+    free(worklist);
+    free(live_in);
+    free(defined_in);
+    free(fill);
+    free(by_vreg);
+    free(needs_dataflow);
+    free(count_of);
+    free(current);
+    free(occurrences);
+}
+
+static int caller_saved_index(Register_t r) {
+    for (int k = 0; k < NUM_CALLER_SAVED; k++) {
+        if (allocatable[k] == r) return k;
+    }
+    return -1;
+}
+
+static void reserve(int* diff, int from, int to) {
+    if (from > to) return;
+    diff[from]++;
+    diff[to+1]--;
+}
+
+// where the code uses a caller-saved register itself: from a write to the
+// reads of it (arguments being set up for a call), from the start of the
+// function to the reads of parameter registers, and at every call, which
+// clobbers them all
+static void compute_reservations(Allocation* a) {
+    int n = a->length;
+    int* diff[NUM_CALLER_SAVED];
+    int open[NUM_CALLER_SAVED];
+    for (int k = 0; k < NUM_CALLER_SAVED; k++) {
+        diff[k] = int_array(n + 1, 0);
+        open[k] = -1;
+    }
+
+    for (int i = 0; i < n; i++) {
+        RegisterRef refs[4];
+        int ref_count = instr_registers(&a->code[i], refs);
+        for (int r = 0; r < ref_count; r++) {
+            int k = caller_saved_index(refs[r].reg);
+            if (k < 0) continue;
+            if (refs[r].role & ROLE_USE) {
+                reserve(diff[k], open[k] >= 0 ? open[k] : 0, i - 1);
+            }
+            if (refs[r].role & ROLE_DEF) {
+                open[k] = i + 1;
+            }
+        }
+        if (a->code[i].label < 0 && a->code[i].op == X64_CALL) {
+            for (int k = 0; k < NUM_CALLER_SAVED; k++) {
+                reserve(diff[k], open[k] >= 0 ? open[k] : i, i);
+                open[k] = -1;
+            }
+        }
+    }
+
+    for (int k = 0; k < NUM_CALLER_SAVED; k++) {
+        int* prefix = int_array(n + 1, 0);
+        int running = 0;
+        for (int i = 0; i < n; i++) {
+            running += diff[k][i];
+            prefix[i+1] = prefix[i] + (running > 0);
+        }
+        a->reserved[k] = prefix;
+        free(diff[k]);
+    }
+}
+
+static int register_allowed(Allocation* a, int index, int v) {
+    if (index >= NUM_CALLER_SAVED) {
+        return 1;
+    }
+    int* prefix = a->reserved[index];
+    return prefix[a->end[v] + 1] - prefix[a->start[v]] == 0;
+}
+
+static void linear_scan(Allocation* a) {
+    int vcount = a->vreg_count;
+    int n = a->length;
+    a->location = int_array(vcount, 0);
+    a->spill_count = 0;
+
+    // order by start with a counting sort
+    int* bucket = int_array(n + 1, 0);
+    for (int v = 0; v < vcount; v++) {
+        if (a->start[v] >= 0) bucket[a->start[v] + 1]++;
+    }
+    for (int i = 0; i < n; i++) {
+        bucket[i+1] += bucket[i];
+    }
+    int* order = int_array(bucket[n], 0);
+    int interval_count = bucket[n];
+    for (int v = 0; v < vcount; v++) {
+        if (a->start[v] >= 0) order[bucket[a->start[v]]++] = v;
+    }
+    free(bucket);
+
+    int* register_index = int_array(vcount, -1);    // into allocatable
+    int active[NUM_ALLOCATABLE];                    // sorted by end
+    int active_count = 0;
+    int is_free[NUM_ALLOCATABLE];
+    for (int k = 0; k < NUM_ALLOCATABLE; k++) {
+        is_free[k] = 1;
+    }
+
+    for (int i = 0; i < interval_count; i++) {
+        int v = order[i];
+
+        // expire intervals that ended before this one starts
+        int expired = 0;
+        while (expired < active_count && a->end[active[expired]] < a->start[v]) {
+            is_free[register_index[active[expired]]] = 1;
+            expired++;
+        }
+        memmove(active, active + expired, sizeof(int) * (active_count - expired));
+        active_count -= expired;
+
+        int chosen = -1;
+        for (int k = 0; k < NUM_ALLOCATABLE; k++) {
+            if (is_free[k] && register_allowed(a, k, v)) {
+                chosen = k;
+                break;
+            }
+        }
+
+        if (chosen < 0) {
+            // spill whichever interval ends last, if v could have its register
+            int victim = -1;
+            for (int j = active_count - 1; j >= 0; j--) {
+                if (register_allowed(a, register_index[active[j]], v)) {
+                    victim = j;
+                    break;
+                }
+            }
+            if (victim >= 0 && a->end[active[victim]] > a->end[v]) {
+                int spilled = active[victim];
+                chosen = register_index[spilled];
+                register_index[spilled] = -1;
+                a->location[spilled] = -(a->spill_count++ + 1);
+                memmove(active + victim, active + victim + 1, sizeof(int) * (active_count - victim - 1));
+                active_count--;
+            } else {
+                a->location[v] = -(a->spill_count++ + 1);
+                continue;
+            }
+        }
+
+        is_free[chosen] = 0;
+        register_index[v] = chosen;
+        a->location[v] = allocatable[chosen];
+
+        int j = active_count;
+        while (j > 0 && a->end[active[j-1]] > a->end[v]) {
+            active[j] = active[j-1];
+            j--;
+        }
+        active[j] = v;
+        active_count++;
+    }
+
+    free(register_index);
+    free(order);
+}
+
+//
+// output
+//
+
+typedef struct {
+    const int* location;
+    int saved_count;
+    int temporaries_used;   // bit k is set once temporaries[k] is taken
+
+    // the code on machine registers, for the peephole optimizer
+    MachineInstr* code;
+    int length;
+    int capacity;
+} Rewrite;
+
+static MachineInstr* put(Rewrite* rw, Opcode_t op, int operand_count) {
+    if (rw->length == rw->capacity) {
+        rw->capacity = rw->capacity ? rw->capacity * 2 : 256;
+        rw->code = checked_realloc(rw->code, sizeof(MachineInstr) * rw->capacity);
+    }
+    MachineInstr* in = &rw->code[rw->length++];
+    in->op = op;
+    in->label = -1;
+    in->operand_count = operand_count;
+    return in;
+}
+
+static void put0(Rewrite* rw, Opcode_t op) {
+    put(rw, op, 0);
+}
+
+static void put1(Rewrite* rw, Opcode_t op, Operand a) {
+    put(rw, op, 1)->operands[0] = a;
+}
+
+static void put2(Rewrite* rw, Opcode_t op, Operand source, Operand destination) {
+    MachineInstr* in = put(rw, op, 2);
+    in->operands[0] = source;
+    in->operands[1] = destination;
+}
+
+static Operand spill_slot(const Rewrite* rw, int slot) {
+    return operand_memory(X64_RBP, -8 * (rw->saved_count + slot + 1));
+}
+
+static Register_t take_temporary(Rewrite* rw) {
+    for (int k = 0; k < NUM_TEMPORARIES; k++) {
+        if (!(rw->temporaries_used & (1 << k))) {
+            rw->temporaries_used |= 1 << k;
+            return temporaries[k];
+        }
+    }
+    fprintf(current_context->messages, "Error: ran out of temporaries for spilled operands.\n");
+    assert(0);
+    return X64_NO_REGISTER;
+}
+
+// the machine register for a register inside an address, loading it into
+// a temporary if it was spilled
+static Register_t address_register(Rewrite* rw, Register_t r, Register_t* loaded) {
+    if (!is_virtual(r)) {
+        return r;
+    }
+    int location = rw->location[r - X64_FIRST_VIRTUAL];
+    if (location >= 0) {
+        return (Register_t)location;
+    }
+    Register_t t = take_temporary(rw);
+    put2(rw, X64_MOVQ, spill_slot(rw, -location - 1), operand_register(t));
+    *loaded = t;
+    return t;
+}
+
+static Operand rewrite_operand(Rewrite* rw, Operand o, Register_t* loaded) {
+    if (o.kind == OPERAND_MEMORY) {
+        o.base = address_register(rw, o.base, loaded);
+        o.index = address_register(rw, o.index, loaded);
+    } else if (o.kind == OPERAND_REGISTER && is_virtual(o.base)) {
+        int location = rw->location[o.base - X64_FIRST_VIRTUAL];
+        if (location >= 0) {
+            o.base = (Register_t)location;
+        } else {
+            o = spill_slot(rw, -location - 1);
+        }
+    }
+    return o;
+}
+
+static int fits_in_32(long value) {
+    return value >= -2147483648L && value <= 2147483647L;
+}
+
+static void emit_instr(Rewrite* rw, const MachineInstr* in) {
+    if (in->label >= 0) {
+        put(rw, 0, 0)->label = in->label;
+        return;
+    }
+
+    rw->temporaries_used = 0;
+    if (in->operand_count == 0) {
+        put0(rw, in->op);
+        return;
+    }
+    if (in->operand_count == 1) {
+        Register_t loaded = X64_NO_REGISTER;
+        put1(rw, in->op, rewrite_operand(rw, in->operands[0], &loaded));
+        return;
+    }
+
+    // the destination's address registers are loaded first, so that the
+    // source may reuse its own temporary for its value
+    Register_t dst_loaded = X64_NO_REGISTER;
+    Register_t src_loaded = X64_NO_REGISTER;
+    Operand dst = rewrite_operand(rw, in->operands[1], &dst_loaded);
+    Operand src = rewrite_operand(rw, in->operands[0], &src_loaded);
+
+    int src_memory = src.kind == OPERAND_MEMORY;
+    int dst_memory = dst.kind == OPERAND_MEMORY;
+    int large_immediate = src.kind == OPERAND_IMMEDIATE && !fits_in_32(src.value);
+
+    // MOVZBQ, CMOVcc and the two-operand IMULQ only write registers: a
+    // spilled destination is computed in a temporary and stored
+    if (dst_memory && ((in->op >= X64_MOVZBQ && in->op <= X64_CMOVLE) || in->op == X64_IMULQ)) {
+        Operand temporary = operand_register(take_temporary(rw));
+        if (in->op != X64_MOVZBQ) {
+            put2(rw, X64_MOVQ, dst, temporary);
+        }
+        put2(rw, in->op, src, temporary);
+        put2(rw, X64_MOVQ, temporary, dst);
+        return;
+    }
+
+    if (dst_memory && (src_memory || large_immediate || in->op == X64_LEAQ)) {
+        Register_t t = src_loaded != X64_NO_REGISTER ? src_loaded : take_temporary(rw);
+        Operand temporary = operand_register(t);
+        if (in->op == X64_LEAQ) {
+            put2(rw, X64_LEAQ, src, temporary);
+            put2(rw, X64_MOVQ, temporary, dst);
+            return;
+        }
+        put2(rw, X64_MOVQ, src, temporary);
+        src = temporary;
+    }
+
+    put2(rw, in->op, src, dst);
+}
+
+void function_end() {
+    MachineFunction* f = current_context->function;
+
+    Allocation a;
+    memset(&a, 0, sizeof(a));
+    a.code = f->code;
+    a.length = f->length;
+    a.vreg_count = f->vreg_count;
+    a.first_label = f->first_label;
+
+    find_blocks(&a);
+    compute_intervals(&a);
+    compute_reservations(&a);
+    linear_scan(&a);
+
+    // callee-saved registers that were used are saved below the frame
+    // pointer, spill slots come after them
+    int saved[5];
+    int saved_count = 0;
+    for (int k = 0; k < 5; k++) {
+        for (int v = 0; v < a.vreg_count; v++) {
+            if (a.start[v] >= 0 && a.location[v] == (int)callee_saved[k]) {
+                saved[saved_count++] = callee_saved[k];
+                break;
+            }
+        }
+    }
+
+    Rewrite rw;
+    rw.location = a.location;
+    rw.saved_count = saved_count;
+    rw.temporaries_used = 0;
+    rw.code = NULL;
+    rw.length = 0;
+    rw.capacity = 0;
+
+    // %rbp is 16-byte aligned after it is pushed, so keeping the frame a
+    // multiple of 16 keeps %rsp aligned
+    long frame_size = 8L * (saved_count + a.spill_count);
+    frame_size = (frame_size + 15) / 16 * 16;
+
+    // prologue
+    put1(&rw, X64_PUSHQ, operand_register(X64_RBP));
+    put2(&rw, X64_MOVQ, operand_register(X64_RSP), operand_register(X64_RBP));
+    if (frame_size > 0) {
+        put2(&rw, X64_SUBQ, operand_immediate(frame_size), operand_register(X64_RSP));
+    }
+    for (int k = 0; k < saved_count; k++) {
+        put2(&rw, X64_MOVQ, operand_register(saved[k]), operand_memory(X64_RBP, -8 * (k + 1)));
+    }
+
+    for (int i = 0; i < a.length; i++) {
+        emit_instr(&rw, &a.code[i]);
+    }
+
+    // epilogue
+    for (int k = saved_count - 1; k >= 0; k--) {
+        put2(&rw, X64_MOVQ, operand_memory(X64_RBP, -8 * (k + 1)), operand_register(saved[k]));
+    }
+    put2(&rw, X64_MOVQ, operand_register(X64_RBP), operand_register(X64_RSP));
+    put1(&rw, X64_POPQ, operand_register(X64_RBP));
+    put0(&rw, X64_RET);
+
+    peephole_optimize(rw.code, &rw.length);
+    for (int i = 0; i < rw.length; i++) {
+        MachineInstr* in = &rw.code[i];
+        if (in->label >= 0) {
+            emit_label(in->label);
+        } else if (in->operand_count == 0) {
+            emit0(in->op);
+        } else if (in->operand_count == 1) {
+            emit1(in->op, in->operands[0]);
+        } else {
+            emit2(in->op, in->operands[0], in->operands[1]);
+        }
+    }
+    free(rw.code);
+
+    for (int k = 0; k < NUM_CALLER_SAVED; k++) {
+        free(a.reserved[k]);
+    }
+    free(a.location);
+    free(a.start);
+    free(a.end);
+    free(a.preds);
+    free(a.pred_start);
+    free(a.block_last);
+    free(a.block_first);
+    free(a.block_of);
+
+    free(f->code);
+    free(f);
+    current_context->function = NULL;
+}
@@ -0,0 +1,66 @@
+#ifndef X64_REGALLOC_H
+#define X64_REGALLOC_H
+
+#include "x64_emit.h"
+
+/*
+Register allocation. Code generation writes the body of a function as a
+list of instructions on virtual registers, of which there is an unlimited
+supply, and function_end maps them onto machine registers with a linear
+scan:
+
+  - liveness is computed per virtual register over the basic blocks of
+    the function, so values that stay live around a loop keep their
+    register for the whole loop;
+  - each virtual register gets one live interval, from the first point it
+    is live to the last;
+  - intervals are handed registers in order of their start. When none is
+    free, the interval that ends last is spilled to a slot in the frame.
+
+rbx, r12-r15 and the caller-saved rcx, rsi, rdi, r8-r10 are allocated.
+A caller-saved register is only given to an interval that does not
+extend across a call, nor across a stretch where the code uses that
+register itself, such as passing arguments. rax and rdx are left to the
+instructions that use them implicitly (IMULQ, IDIVQ, CQO, return values),
+and together with r11 serve as temporaries when an instruction has more
+memory operands than x86 allows.
+
+Vector registers are not allocated. Vectorized loops name xmm and ymm
+registers directly and keep nothing in them from one IR instruction to
+the next.
+
+function_end also writes the prologue and epilogue, which save exactly
+the callee-saved registers that were used and keep the stack 16-byte
+aligned: %rsp is a multiple of 16 everywhere in the body. The finished
+code goes through the peephole optimizer (x64_peephole.h) before it is
+emitted.
+*/
+
+typedef struct MachineFunction MachineFunction;
+
+// starts collecting the body of a function into the current context. the
+// first variable_count virtual registers are set aside for variables,
+// see virtual_register.
+void function_begin(int variable_count);
+
+// the virtual register of variable n of the current function
+Register_t virtual_register(int n);
+
+// a new virtual register
+Register_t vreg_create();
+
+void instr0(Opcode_t op);
+
+void instr1(Opcode_t op, Operand a);
+
+// AT&T operand order: source first
+void instr2(Opcode_t op, Operand source, Operand destination);
+
+// places a label. labels that are placed or jumped to must have been
+// created after function_begin.
+void instr_label(int label);
+
+// allocates registers and emits the function: prologue, body, epilogue
+void function_end();
+
+#endif